@@ -0,0 +1,79 @@
+#include "pafs/arena.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "absl/log/check.h"
+
+namespace pafs {
+
+Arena::Arena(size_t initial_size)
+  : block_size_(initial_size), cur_(nullptr), end_(nullptr) {}
+
+void *Arena::Allocate(size_t size, size_t alignment) {
+  DCHECK_EQ(alignment & (alignment - 1), 0u);
+  size_t pad = -reinterpret_cast<uintptr_t>(cur_) & (alignment - 1);
+  if (cur_ == nullptr || pad + size > static_cast<size_t>(end_ - cur_)) {
+    return AllocateSlow(size, alignment);
+  }
+  void *p = cur_ + pad;
+  cur_ += pad + size;
+  return p;
+}
+
+void *Arena::AllocateSlow(size_t size, size_t alignment) {
+  // Padding for the worst case, since new[] only promises
+  // __STDCPP_DEFAULT_NEW_ALIGNMENT__.
+  size_t needed = size + alignment;
+  std::byte *begin;
+  if (block_ == nullptr) {
+    // Deferred until first use, since most threads that construct an Arena
+    // (to Reset it) never allocate from it.
+    block_size_ = std::max(block_size_, needed);
+    block_ = std::make_unique_for_overwrite<std::byte[]>(block_size_);
+    begin = block_.get();
+    end_ = begin + block_size_;
+  } else {
+    used_before_ = Used();
+    size_t n = std::max(block_size_, needed);
+    overflow_.push_back(std::make_unique_for_overwrite<std::byte[]>(n));
+    overflow_size_ += n;
+    begin = overflow_.back().get();
+    end_ = begin + n;
+  }
+  block_begin_ = begin;
+  cur_ = begin;
+  return Allocate(size, alignment);
+}
+
+void Arena::Reset() {
+  if (!overflow_.empty()) {
+    size_t wanted = block_size_ + overflow_size_;
+    overflow_.clear();
+    overflow_size_ = 0;
+    if (wanted <= kMaxRetainedSize) {
+      block_.reset();
+      block_ = std::make_unique_for_overwrite<std::byte[]>(wanted);
+      block_size_ = wanted;
+    }
+  }
+  used_before_ = 0;
+  if (block_ == nullptr) return;
+  block_begin_ = block_.get();
+  cur_ = block_begin_;
+  end_ = block_begin_ + block_size_;
+}
+
+size_t Arena::Used() const {
+  if (cur_ == nullptr) return 0;
+  return used_before_ + static_cast<size_t>(cur_ - block_begin_);
+}
+
+Arena &RequestArena() {
+  thread_local Arena arena;
+  return arena;
+}
+
+}  // namespace pafs
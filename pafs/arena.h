@@ -0,0 +1,107 @@
+#ifndef PAFS_ARENA_H_
+#define PAFS_ARENA_H_
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+namespace pafs {
+
+// A bump allocator for memory that only lives as long as one request.
+//
+// Allocating bumps a pointer and deallocating does nothing; Reset frees
+// everything at once. The memory itself is kept. When a request outgrows it,
+// the next Reset swaps it for one block big enough for that request, so a
+// warmed-up worker doesn't call malloc.
+//
+// Not thread-safe. Request handlers use their worker's, see RequestArena.
+class Arena {
+ public:
+  static constexpr size_t kDefaultSize = 64 << 10;
+  // Past this, Reset stops growing the block it keeps, so that one huge
+  // request doesn't pin its memory for the life of the thread.
+  static constexpr size_t kMaxRetainedSize = 4 << 20;
+
+  explicit Arena(size_t initial_size = kDefaultSize);
+
+  Arena(Arena &&) = delete;
+  Arena(const Arena &) = delete;
+  Arena &operator=(Arena &&) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // `alignment` must be a power of two.
+  void *Allocate(size_t size, size_t alignment);
+
+  // Uninitialized storage for `n` Ts, e.g. a buffer for a syscall to fill.
+  template <typename T>
+    requires std::is_trivially_default_constructible_v<T>
+  std::span<T> AllocateArray(size_t n) {
+    return {static_cast<T *>(Allocate(n * sizeof(T), alignof(T))), n};
+  }
+
+  // Invalidates everything allocated so far.
+  void Reset();
+
+  // Bytes handed out since the last Reset, including alignment padding.
+  size_t Used() const;
+
+ private:
+  void *AllocateSlow(size_t size, size_t alignment);
+
+  std::unique_ptr<std::byte[]> block_;
+  size_t block_size_;
+  // Blocks added once block_ filled up. Freed by Reset.
+  std::vector<std::unique_ptr<std::byte[]>> overflow_;
+  size_t overflow_size_ = 0;
+
+  // The block being allocated from, and its free part.
+  std::byte *block_begin_ = nullptr;
+  std::byte *cur_;
+  std::byte *end_;
+  // Used() of the blocks before the current one.
+  size_t used_before_ = 0;
+};
+
+// Allocates from an Arena, for standard containers. Never frees.
+//
+// Containers of trivial types lose libstdc++'s memset and memcpy fast paths
+// with a custom allocator, so prefer Arena::AllocateArray for byte buffers.
+template <typename T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+
+  explicit ArenaAllocator(Arena &arena) : arena_(&arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &o) : arena_(o.arena_) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *, size_t) {}
+
+  template <typename U>
+  friend bool operator==(const ArenaAllocator &a, const ArenaAllocator<U> &b) {
+    return a.arena_ == b.arena_;
+  }
+
+ private:
+  template <typename U>
+  friend class ArenaAllocator;
+
+  Arena *arena_;
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// The calling thread's arena for the request it's handling. FuseRequest
+// resets it once the request is done, so nothing allocated from it may
+// outlive the request.
+Arena &RequestArena();
+
+}  // namespace pafs
+
+#endif  // PAFS_ARENA_H_
@@ -0,0 +1,152 @@
+// Counts the heap allocations made by the per-request buffers handlers use,
+// allocated from the heap as they used to be against RequestArena. The
+// "allocs" counter is per iteration, i.e. per request; with the arena it
+// should be 0.
+//
+// bazel run -c opt //pafs:arena_benchmark
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <span>
+#include <stdlib.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "pafs/arena.h"
+#include "pafs/errno.h"
+#include "pafs/inode.h"
+
+namespace {
+
+std::atomic<uint64_t> allocations = 0;
+
+void *CountedAlloc(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size == 0 ? 1 : size)) return p;
+  throw std::bad_alloc();
+}
+
+}  // namespace
+
+void *operator new(size_t size) { return CountedAlloc(size); }
+void *operator new[](size_t size) { return CountedAlloc(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+
+namespace pafs {
+namespace {
+
+// Reports allocations per iteration from the point it's constructed.
+class AllocationCounter {
+ public:
+  explicit AllocationCounter(benchmark::State &state)
+    : state_(state), start_(allocations.load()) {}
+  ~AllocationCounter() {
+    state_.counters["allocs"] = benchmark::Counter(
+        static_cast<double>(allocations.load() - start_),
+        benchmark::Counter::kAvgIterations);
+  }
+
+ private:
+  benchmark::State &state_;
+  uint64_t start_;
+};
+
+// What ~FuseRequest does between requests.
+void EndRequest() { RequestArena().Reset(); }
+
+// The ListXAttr handler's reply buffer.
+template <bool kArena>
+void BM_ListXAttr(benchmark::State &state) {
+  char path[] = "/tmp/pafs-arena-benchmark-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd == -1) {
+    state.SkipWithError("mkstemp failed");
+    return;
+  }
+  close(fd);
+  // May fail, e.g. on tmpfs without user xattrs; the list is then empty.
+  setxattr(path, "user.pafs", "1", 1, 0);
+  ErrnoOr<Inode> inode = Inode::Create(path);
+  unlink(path);
+  if (!inode.ok()) {
+    state.SkipWithError("Inode::Create failed");
+    return;
+  }
+  const size_t size = state.range(0);
+
+  // Warm up, as a long-running worker would be.
+  for (int i = 0; i < 2; i++) {
+    benchmark::DoNotOptimize(
+        inode->ListXAttr(RequestArena().AllocateArray<char>(size)));
+    EndRequest();
+  }
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    if constexpr (kArena) {
+      std::span<char> buf = RequestArena().AllocateArray<char>(size);
+      benchmark::DoNotOptimize(inode->ListXAttr(buf));
+    } else {
+      std::vector<char> buf(size);
+      benchmark::DoNotOptimize(inode->ListXAttr(buf));
+    }
+    EndRequest();
+  }
+}
+BENCHMARK(BM_ListXAttr</*kArena=*/false>)->Arg(4096)->Arg(64 << 10);
+BENCHMARK(BM_ListXAttr</*kArena=*/true>)->Arg(4096)->Arg(64 << 10);
+
+// ReadDirPlus: the dirent buffer, filled an entry at a time as
+// FuseDirsBuilder does, and the references held on listed entries until the
+// reply is sent.
+template <bool kArena>
+void BM_ReadDirBuffers(benchmark::State &state) {
+  const int entries = static_cast<int>(state.range(0));
+  constexpr size_t kEntrySize = 152;  // A fuse_direntplus with a short name.
+  const size_t maxsize = entries * kEntrySize;
+  auto ref = std::make_shared<int>(0);
+
+  auto run = [&]() {
+    if constexpr (kArena) {
+      std::span<char> buf = RequestArena().AllocateArray<char>(maxsize);
+      ArenaVector<std::shared_ptr<int>> refs{
+          ArenaAllocator<std::shared_ptr<int>>(RequestArena())};
+      for (int i = 0; i < entries; i++) {
+        // Standing in for fuse_add_direntry_plus.
+        std::memset(&buf[i * kEntrySize], 'x', kEntrySize);
+        refs.push_back(ref);
+      }
+      benchmark::DoNotOptimize(buf.data());
+      benchmark::DoNotOptimize(refs.data());
+    } else {
+      std::vector<char> buf;
+      std::vector<std::shared_ptr<int>> refs;
+      for (int i = 0; i < entries; i++) {
+        buf.resize(buf.size() + kEntrySize);
+        std::memset(&buf[i * kEntrySize], 'x', kEntrySize);
+        refs.push_back(ref);
+      }
+      benchmark::DoNotOptimize(buf.data());
+      benchmark::DoNotOptimize(refs.data());
+    }
+    EndRequest();
+  };
+
+  run();
+  AllocationCounter counter(state);
+  for (auto _ : state) run();
+}
+BENCHMARK(BM_ReadDirBuffers</*kArena=*/false>)->Arg(8)->Arg(128);
+BENCHMARK(BM_ReadDirBuffers</*kArena=*/true>)->Arg(8)->Arg(128);
+
+}  // namespace
+}  // namespace pafs
@@ -0,0 +1,55 @@
+#include "pafs/benchmark_util.h"
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+
+namespace pafs {
+
+absl::StatusOr<ScratchDir> ScratchDir::Create() {
+  std::error_code ec;
+  std::string parent = std::filesystem::is_directory("/dev/shm", ec)
+    ? "/dev/shm" : std::filesystem::temp_directory_path().string();
+  std::string path = absl::StrCat(parent, "/pafs-benchmark-XXXXXX");
+  if (::mkdtemp(path.data()) == nullptr) {
+    return ErrnoToStatus(errno, absl::StrCat("mkdtemp(", path, ")"));
+  }
+  ErrnoOr<FileDescriptor> fd =
+    syscalls::openat(AT_FDCWD, path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (!fd.ok()) {
+    std::filesystem::remove_all(path, ec);
+    return fd.error().ToStatus();
+  }
+  return ScratchDir(std::move(path), *std::move(fd));
+}
+
+ScratchDir::ScratchDir(std::string path, FileDescriptor fd)
+  : path_(std::move(path)), fd_(std::move(fd)) {}
+
+ScratchDir::~ScratchDir() {
+  if (path_.empty()) return;
+  std::error_code ec;
+  std::filesystem::remove_all(path_, ec);
+  LOG_IF(WARNING, ec) << "Failed to remove " << path_ << ": " << ec.message();
+}
+
+absl::Status ScratchDir::CreateFiles(int count) {
+  for (int i = 0; i < count; i++) {
+    ASSIGN_OR_RETURN(
+        FileDescriptor fd,
+        syscalls::openat(
+          *fd_, std::to_string(i), O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace pafs
@@ -0,0 +1,41 @@
+#ifndef PAFS_BENCHMARK_UTIL_H_
+#define PAFS_BENCHMARK_UTIL_H_
+
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "pafs/cstring_view.h"
+#include "pafs/fd.h"
+
+namespace pafs {
+
+// A directory for a benchmark to work in, removed with everything in it when
+// destroyed. Made on tmpfs (/dev/shm) when there is one, so that results
+// measure our overhead rather than a disk's.
+class ScratchDir {
+ public:
+  static absl::StatusOr<ScratchDir> Create();
+  ~ScratchDir();
+
+  ScratchDir(ScratchDir &&) = default;
+  ScratchDir(const ScratchDir &) = delete;
+  ScratchDir &operator=(ScratchDir &&) = default;
+  ScratchDir &operator=(const ScratchDir &) = delete;
+
+  CStringView Path() const { return path_; }
+  // An O_PATH descriptor of the directory, for *at syscalls.
+  int GetFD() const { return *fd_; }
+
+  // Creates `count` empty files named "0", "1", ... in the directory.
+  absl::Status CreateFiles(int count);
+
+ private:
+  ScratchDir(std::string path, FileDescriptor fd);
+
+  std::string path_;
+  FileDescriptor fd_;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_BENCHMARK_UTIL_H_
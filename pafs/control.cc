@@ -0,0 +1,193 @@
+#include "pafs/control.h"
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <poll.h>
+#include <string>
+#include <string_view>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <utility>
+
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+
+namespace pafs {
+namespace {
+
+// Requests are a short name, so anything longer is a confused client.
+constexpr size_t kMaxRequestSize = 256;
+// How long a client gets to send its request and take the reply, since
+// clients are served one at a time.
+constexpr struct timeval kClientTimeout = {.tv_sec = 1, .tv_usec = 0};
+
+}  // namespace
+
+void ControlRegistry::Register(std::string name, Producer producer) {
+  absl::MutexLock lock(&mu_);
+  for (const std::unique_ptr<File> &file : files_) {
+    CHECK_NE(file->name, name) << "Control file registered twice";
+  }
+  files_.push_back(std::make_unique<File>(
+        File{.name = std::move(name), .producer = std::move(producer)}));
+}
+
+size_t ControlRegistry::Size() const {
+  absl::MutexLock lock(&mu_);
+  return files_.size();
+}
+
+std::optional<size_t> ControlRegistry::Find(std::string_view name) const {
+  absl::MutexLock lock(&mu_);
+  for (size_t i = 0; i < files_.size(); i++) {
+    if (files_[i]->name == name) return i;
+  }
+  return std::nullopt;
+}
+
+const ControlRegistry::File &ControlRegistry::Get(size_t index) const {
+  absl::MutexLock lock(&mu_);
+  CHECK_LT(index, files_.size());
+  return *files_[index];
+}
+
+std::string ControlRegistry::Name(size_t index) const {
+  return Get(index).name;
+}
+
+std::string ControlRegistry::Read(size_t index) const {
+  return Get(index).producer();
+}
+
+absl::StatusOr<FileDescriptor> ControlSocket::Listen(CStringView path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX, .sun_path = {}};
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Control socket path is too long: ", path.c_str()));
+  }
+  std::memcpy(addr.sun_path, path.data(), path.size());
+
+  if (absl::StatusOr<struct stat> st = syscalls::lstat(path.c_str());
+      st.ok() && S_ISSOCK(st->st_mode)) {
+    RETURN_IF_ERROR(syscalls::unlinkat(AT_FDCWD, path));
+  }
+
+  ASSIGN_OR_RETURN(
+      FileDescriptor fd,
+      syscalls::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC));
+  RETURN_IF_ERROR(
+      syscalls::bind(
+        *fd, reinterpret_cast<const struct sockaddr *>(&addr), sizeof(addr)));
+  RETURN_IF_ERROR(syscalls::listen(*fd, /*backlog=*/16));
+  return fd;
+}
+
+absl::StatusOr<std::unique_ptr<ControlSocket>> ControlSocket::Create(
+    FileDescriptor listen_fd, const ControlRegistry &registry) {
+  ASSIGN_OR_RETURN(
+      FileDescriptor wakeup_fd,
+      syscalls::eventfd(/*initval=*/0, EFD_NONBLOCK | EFD_CLOEXEC));
+  auto control = std::unique_ptr<ControlSocket>(
+      new ControlSocket(std::move(listen_fd), std::move(wakeup_fd), registry));
+  control->thread_ = std::thread([c = control.get()]() { c->Run(); });
+  return control;
+}
+
+ControlSocket::ControlSocket(
+    FileDescriptor listen_fd, FileDescriptor wakeup_fd,
+    const ControlRegistry &registry)
+  : listen_fd_(std::move(listen_fd)), wakeup_fd_(std::move(wakeup_fd)),
+    registry_(registry) {}
+
+ControlSocket::~ControlSocket() {
+  uint64_t one = 1;
+  LOG_IF_ERROR(
+      ERROR, syscalls::write(*wakeup_fd_, &one, sizeof(one)).status());
+  if (thread_.joinable()) thread_.join();
+}
+
+void ControlSocket::Run() {
+  while (true) {
+    struct pollfd pfds[] = {
+      {.fd = *listen_fd_, .events = POLLIN, .revents = 0},
+      {.fd = *wakeup_fd_, .events = POLLIN, .revents = 0},
+    };
+    absl::StatusOr<nfds_t> ready =
+      syscalls::poll(pfds, /*timeout=*/absl::InfiniteDuration());
+    if (!ready.ok()) {
+      if (absl::StatusOr<int> err = GetErrnoFromStatus(ready.status());
+          err.ok() && *err == EINTR) {
+        continue;
+      }
+      LOG(ERROR) << "ControlSocket exiting: " << ready.status();
+      return;
+    }
+    if (pfds[1].revents & POLLIN) return;
+    if (!(pfds[0].revents & POLLIN)) continue;
+
+    absl::StatusOr<FileDescriptor> conn =
+      syscalls::accept4(*listen_fd_, SOCK_CLOEXEC);
+    if (!conn.ok()) {
+      LOG(WARNING) << "Failed to accept a control connection: "
+                   << conn.status();
+      continue;
+    }
+    LOG_IF_ERROR(WARNING, Serve(**conn));
+  }
+}
+
+absl::Status ControlSocket::Serve(int conn) {
+  RETURN_IF_ERROR(
+      syscalls::setsockopt(
+        conn, SOL_SOCKET, SO_RCVTIMEO, &kClientTimeout,
+        sizeof(kClientTimeout)));
+  RETURN_IF_ERROR(
+      syscalls::setsockopt(
+        conn, SOL_SOCKET, SO_SNDTIMEO, &kClientTimeout,
+        sizeof(kClientTimeout)));
+
+  std::string request;
+  char buf[kMaxRequestSize];
+  while (request.find('\n') == std::string::npos) {
+    ASSIGN_OR_RETURN(size_t nb, syscalls::recv(conn, buf, sizeof(buf)));
+    if (nb == 0) break;
+    request.append(buf, nb);
+    if (request.size() > kMaxRequestSize) {
+      return absl::InvalidArgumentError("Control request is too long");
+    }
+  }
+  std::string_view name = request;
+  name = name.substr(0, name.find('\n'));
+
+  std::string reply;
+  if (name.empty()) {
+    for (size_t i = 0; i < registry_.Size(); i++) {
+      absl::StrAppend(&reply, registry_.Name(i), "\n");
+    }
+  } else if (std::optional<size_t> index = registry_.Find(name)) {
+    reply = registry_.Read(*index);
+  } else {
+    reply = absl::StrCat("No such control file: ", name, "\n");
+  }
+
+  std::string_view out = reply;
+  while (!out.empty()) {
+    // MSG_NOSIGNAL: a client that hangs up early mustn't SIGPIPE us.
+    ASSIGN_OR_RETURN(
+        size_t nb,
+        syscalls::send(conn, out.data(), out.size(), MSG_NOSIGNAL));
+    out.remove_prefix(nb);
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace pafs
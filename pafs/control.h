@@ -0,0 +1,101 @@
+#ifndef PAFS_CONTROL_H_
+#define PAFS_CONTROL_H_
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/functional/any_invocable.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "pafs/cstring_view.h"
+#include "pafs/fd.h"
+
+namespace pafs {
+
+// Read-only text files describing the running filesystem, e.g. OpStats,
+// produced whenever they're read. ControlDir serves them inside the mount and
+// ControlSocket over a Unix socket.
+//
+// Thread-safe. Files are never removed, so an index stays valid.
+class ControlRegistry {
+ public:
+  using Producer = absl::AnyInvocable<std::string() const>;
+
+  ControlRegistry() = default;
+
+  ControlRegistry(ControlRegistry &&) = delete;
+  ControlRegistry(const ControlRegistry &) = delete;
+  ControlRegistry &operator=(ControlRegistry &&) = delete;
+  ControlRegistry &operator=(const ControlRegistry &) = delete;
+
+  // `name` must be a unique, valid file name. `producer` is called from
+  // request threads, possibly concurrently.
+  void Register(std::string name, Producer producer);
+
+  size_t Size() const;
+  std::optional<size_t> Find(std::string_view name) const;
+  std::string Name(size_t index) const;
+  std::string Read(size_t index) const;
+
+ private:
+  struct File {
+    std::string name;
+    Producer producer;
+  };
+
+  const File &Get(size_t index) const;
+
+  mutable absl::Mutex mu_;
+  // Boxed so that a File can be read without holding mu_.
+  std::vector<std::unique_ptr<File>> files_ ABSL_GUARDED_BY(mu_);
+};
+
+// Serves a ControlRegistry on a Unix stream socket, on a dedicated thread. A
+// client sends a file name and a newline, and gets back the file; an empty
+// line lists the files instead. The connection is then closed.
+//
+//   echo stats | socat - UNIX-CONNECT:/run/pafs.sock
+class ControlSocket {
+ public:
+  // Binds and listens on `path`, replacing any socket left there by an earlier
+  // run. Separate from Create so that it can be called before forking, e.g.
+  // by fuse_daemonize, and a relative `path` is resolved before the chdir.
+  static absl::StatusOr<FileDescriptor> Listen(CStringView path);
+
+  // Starts serving `registry`, which must outlive the ControlSocket, on
+  // `listen_fd` from Listen.
+  static absl::StatusOr<std::unique_ptr<ControlSocket>> Create(
+      FileDescriptor listen_fd, const ControlRegistry &registry);
+
+  // Stops serving. Waits for any connection being served.
+  ~ControlSocket();
+
+  ControlSocket(ControlSocket &&) = delete;
+  ControlSocket(const ControlSocket &) = delete;
+  ControlSocket &operator=(ControlSocket &&) = delete;
+  ControlSocket &operator=(const ControlSocket &) = delete;
+
+ private:
+  ControlSocket(
+      FileDescriptor listen_fd, FileDescriptor wakeup_fd,
+      const ControlRegistry &registry);
+
+  void Run();
+  absl::Status Serve(int conn);
+
+  FileDescriptor listen_fd_;
+  FileDescriptor wakeup_fd_;
+  const ControlRegistry &registry_;
+  std::thread thread_;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_CONTROL_H_
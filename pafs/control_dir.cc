@@ -0,0 +1,159 @@
+#include "pafs/control_dir.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <utility>
+
+#include "absl/log/check.h"
+#include "pafs/fd.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+
+namespace pafs {
+namespace {
+
+// Inodes are pointers, so never this small.
+constexpr fuse_ino_t kMaxIno = 4096;
+
+struct timespec Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts;
+}
+
+}  // namespace
+
+ControlDir::ControlDir(const ControlRegistry &registry)
+  : registry_(registry), uid_(geteuid()), gid_(getegid()), created_(Now()) {}
+
+bool ControlDir::Owns(fuse_ino_t ino) {
+  return ino >= kDirIno && ino < kMaxIno;
+}
+
+struct stat ControlDir::Stat(fuse_ino_t ino) const {
+  struct stat st = {};
+  st.st_ino = ino;
+  st.st_uid = uid_;
+  st.st_gid = gid_;
+  st.st_atim = st.st_mtim = st.st_ctim = created_;
+  if (ino == kDirIno) {
+    st.st_mode = S_IFDIR | 0500;
+    st.st_nlink = 2;
+  } else {
+    st.st_mode = S_IFREG | 0400;
+    st.st_nlink = 1;
+  }
+  return st;
+}
+
+bool ControlDir::Permitted(FuseRequest &req) const {
+  // The mount doesn't use default_permissions, so the kernel won't enforce
+  // the modes above.
+  const fuse_ctx *ctx = fuse_req_ctx(*req);
+  return ctx->uid == uid_ || ctx->uid == 0;
+}
+
+fuse_entry_param ControlDir::EntryParam(fuse_ino_t ino) const {
+  // Zero timeouts, so that files registered later are found.
+  fuse_entry_param param = {};
+  param.ino = ino;
+  param.attr = Stat(ino);
+  return param;
+}
+
+absl::Status ControlDir::LookupSelf(FuseRequest &req) {
+  return req.ReplyEntry(EntryParam(kDirIno));
+}
+
+absl::Status ControlDir::Lookup(FuseRequest &req, CStringView name) {
+  if (!Permitted(req)) return req.ReplyErrno(EACCES);
+  std::optional<size_t> index = registry_.Find(name);
+  if (!index || kFirstFileIno + *index >= kMaxIno) {
+    return req.ReplyErrno(ENOENT);
+  }
+  return req.ReplyEntry(EntryParam(kFirstFileIno + *index));
+}
+
+absl::Status ControlDir::GetAttr(FuseRequest &req, fuse_ino_t ino) {
+  return req.ReplyAttr(Stat(ino), absl::ZeroDuration());
+}
+
+absl::Status ControlDir::Open(
+    FuseRequest &req, fuse_ino_t ino, fuse_file_info &fi) {
+  if (ino == kDirIno) return req.ReplyErrno(EISDIR);
+  if (!Permitted(req)) return req.ReplyErrno(EACCES);
+  if ((fi.flags & O_ACCMODE) != O_RDONLY || (fi.flags & O_TRUNC)) {
+    return req.ReplyErrno(EACCES);
+  }
+  CHECK_LT(ino - kFirstFileIno, registry_.Size());
+  std::string contents = registry_.Read(ino - kFirstFileIno);
+
+  ASSIGN_OR_RETURN(
+      FileDescriptor fd,
+      syscalls::memfd_create(
+        registry_.Name(ino - kFirstFileIno), MFD_CLOEXEC));
+  std::string_view out = contents;
+  while (!out.empty()) {
+    ASSIGN_OR_RETURN(size_t nb, syscalls::write(*fd, out.data(), out.size()));
+    out.remove_prefix(nb);
+  }
+
+  // Read and Release treat fi.fh as a file descriptor, as for any file.
+  fi.fh = *fd;
+  fi.direct_io = 1;
+  fi.keep_cache = 0;
+  fi.noflush = 1;
+  RETURN_IF_ERROR(req.ReplyOpen(fi));
+  std::move(fd).Release();
+  return absl::OkStatus();
+}
+
+absl::Status ControlDir::OpenDir(
+    FuseRequest &req, fuse_ino_t ino, fuse_file_info &fi) {
+  if (ino != kDirIno) return req.ReplyErrno(ENOTDIR);
+  if (!Permitted(req)) return req.ReplyErrno(EACCES);
+  // Nothing to hold: ReadDir lists straight from the registry.
+  fi.fh = 0;
+  return req.ReplyOpen(fi);
+}
+
+absl::Status ControlDir::ReadDir(
+    FuseRequest &req, fuse_ino_t ino, size_t size, off_t off, bool plus) {
+  CHECK_EQ(ino, kDirIno);
+  // Offsets 0 and 1 are "." and "..", then the files in registry order.
+  FuseDirsBuilder dirs(&req, plus, /*maxsize=*/size);
+  const size_t num_files = registry_.Size();
+  for (size_t pos = off; pos < num_files + 2; pos++) {
+    fuse_entry_param param = {};
+    if (pos < 2) {
+      // As in PageAlignFS, the kernel never looks up "." or "..", so their
+      // entries only need the inode number and type.
+      param.attr.st_ino = pos == 0 ? kDirIno : FUSE_ROOT_ID;
+      param.attr.st_mode = S_IFDIR;
+      CStringView name = pos == 0 ? "." : "..";
+      if (!dirs.AddDirEntry(name, std::move(param), pos + 1)) break;
+      continue;
+    }
+    fuse_ino_t file_ino = kFirstFileIno + (pos - 2);
+    if (file_ino >= kMaxIno) break;
+    std::string name = registry_.Name(pos - 2);
+    if (!dirs.AddDirEntry(name, EntryParam(file_ino), pos + 1)) break;
+  }
+  return std::move(dirs).Reply();
+}
+
+absl::Status ControlDir::Access(FuseRequest &req, fuse_ino_t ino, int mask) {
+  if ((mask & W_OK) || (mask != F_OK && !Permitted(req))) {
+    return req.ReplyErrno(EACCES);
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace pafs
@@ -0,0 +1,71 @@
+#ifndef PAFS_CONTROL_DIR_H_
+#define PAFS_CONTROL_DIR_H_
+
+#include <cstddef>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "absl/status/status.h"
+#include "fuse/fuse_lowlevel.h"
+#include "pafs/control.h"
+#include "pafs/cstring_view.h"
+#include "pafs/fuse.h"
+
+namespace pafs {
+
+// Serves a ControlRegistry as a read-only directory in the root of the mount.
+//
+// Its inodes have small fixed numbers, which can't collide with the Inode
+// pointers PageAlignFS uses for everything else. They aren't reference
+// counted, so forgets of them are ignored.
+//
+// Only the daemon's user, and root, may look up, list or open anything in
+// it; its files can hold paths and other details of the source.
+//
+// Each open of a file takes a snapshot of it, which later reads are served
+// from. Files report a size of 0 and are opened with direct_io, so that
+// readers read until EOF rather than trusting the size.
+class ControlDir {
+ public:
+  static constexpr fuse_ino_t kDirIno = FUSE_ROOT_ID + 1;
+
+  // `registry` must outlive the ControlDir.
+  explicit ControlDir(const ControlRegistry &registry);
+
+  ControlDir(ControlDir &&) = delete;
+  ControlDir(const ControlDir &) = delete;
+  ControlDir &operator=(ControlDir &&) = delete;
+  ControlDir &operator=(const ControlDir &) = delete;
+
+  // Whether `ino` is the directory or one of its files.
+  static bool Owns(fuse_ino_t ino);
+
+  // A lookup of the directory itself, in the root.
+  absl::Status LookupSelf(FuseRequest &req);
+  // A lookup of `name` in the directory.
+  absl::Status Lookup(FuseRequest &req, CStringView name);
+
+  absl::Status GetAttr(FuseRequest &req, fuse_ino_t ino);
+  absl::Status Open(FuseRequest &req, fuse_ino_t ino, fuse_file_info &fi);
+  absl::Status OpenDir(FuseRequest &req, fuse_ino_t ino, fuse_file_info &fi);
+  absl::Status ReadDir(
+      FuseRequest &req, fuse_ino_t ino, size_t size, off_t off, bool plus);
+  absl::Status Access(FuseRequest &req, fuse_ino_t ino, int mask);
+
+ private:
+  static constexpr fuse_ino_t kFirstFileIno = kDirIno + 1;
+
+  struct stat Stat(fuse_ino_t ino) const;
+  // Whether the request comes from the daemon's user or root.
+  bool Permitted(FuseRequest &req) const;
+  fuse_entry_param EntryParam(fuse_ino_t ino) const;
+
+  const ControlRegistry &registry_;
+  const uid_t uid_;
+  const gid_t gid_;
+  const struct timespec created_;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_CONTROL_DIR_H_
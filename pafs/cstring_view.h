@@ -0,0 +1,44 @@
+#ifndef PAFS_CSTRING_VIEW_H_
+#define PAFS_CSTRING_VIEW_H_
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace pafs {
+
+// A std::string_view that is known to be NUL-terminated, so that it can be
+// passed to C APIs without copying.
+//
+// Only implicitly constructible from things that guarantee the terminator:
+// C strings (such as the names libfuse hands us) and std::strings. There is
+// deliberately no conversion from std::string_view.
+class CStringView {
+ public:
+  constexpr CStringView() : view_("") {}
+  constexpr CStringView(const char *s) : view_(s) {}
+  CStringView(const std::string &s) : view_(s) {}
+  CStringView(std::nullptr_t) = delete;
+
+  constexpr const char *c_str() const { return view_.data(); }
+  constexpr const char *data() const { return view_.data(); }
+  constexpr size_t size() const { return view_.size(); }
+  constexpr bool empty() const { return view_.empty(); }
+
+  constexpr operator std::string_view() const { return view_; }
+
+  friend constexpr bool operator==(CStringView a, std::string_view b) {
+    return a.view_ == b;
+  }
+  friend std::ostream &operator<<(std::ostream &stream, CStringView s) {
+    return stream << s.view_;
+  }
+
+ private:
+  std::string_view view_;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_CSTRING_VIEW_H_
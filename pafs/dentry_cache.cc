@@ -0,0 +1,163 @@
+#include "pafs/dentry_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/hash/hash.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "pafs/inode.h"
+#include "pafs/numa.h"
+
+namespace pafs {
+
+DentryCache::DentryCache(size_t capacity, size_t numa_nodes)
+  : shard_capacity_(std::max<size_t>(capacity / kNumShards, 1)) {
+  for (size_t i = 0; i < std::max<size_t>(numa_nodes, 1); i++) {
+    copies_.push_back(std::make_unique<Shards>());
+  }
+}
+
+DentryCache::Shard &DentryCache::GetShard(const KeyView &key) {
+  Shards &shards = *copies_[ThreadNumaNode() % copies_.size()];
+  return shards[KeyHash()(key) % kNumShards];
+}
+
+std::optional<DentryCache::Entry> DentryCache::Find(
+    const Inode &parent, std::string_view name) {
+  KeyView key = {&parent, name};
+  Shard &shard = GetShard(key);
+  absl::ReaderMutexLock lock(&shard.mu);
+  auto iter = shard.entries.find(key);
+  if (iter == shard.entries.end()) {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return std::nullopt;
+  }
+  const Value &value = iter->second;
+  if (value.inode->GetAttrEpoch() != value.epoch) {
+    // Left for the next Insert to replace.
+    stale_.fetch_add(1, std::memory_order_relaxed);
+    return std::nullopt;
+  }
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  return Entry{.inode = value.inode, .param = value.param};
+}
+
+void DentryCache::Insert(
+    std::shared_ptr<Inode> parent, std::string_view name,
+    uint64_t parent_epoch, std::shared_ptr<Inode> inode, uint64_t epoch,
+    const fuse_entry_param &param) {
+  KeyView key = {parent.get(), name};
+  Shard &shard = GetShard(key);
+  // Dropping the last reference to an Inode makes syscalls, so anything we
+  // replace or evict is destroyed after the lock is released.
+  std::optional<Value> dropped;
+  std::optional<Value> evicted;
+  {
+    absl::MutexLock lock(&shard.mu);
+    // A namespace op bumps the parent's epoch before invalidating a name, so
+    // checking under the lock means we can't resurrect a name that was just
+    // invalidated.
+    if (parent->GetAttrEpoch() != parent_epoch ||
+        inode->GetAttrEpoch() != epoch) {
+      return;
+    }
+
+    if (auto iter = shard.entries.find(key); iter != shard.entries.end()) {
+      dropped = std::move(iter->second);
+      shard.entries.erase(iter);
+    } else if (shard.entries.size() >= shard_capacity_) {
+      // flat_hash_map iteration order is effectively random.
+      auto victim = shard.entries.begin();
+      evicted = std::move(victim->second);
+      shard.entries.erase(victim);
+      evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const Inode *parent_ptr = parent.get();
+    shard.entries.emplace(
+        Key{.parent = parent_ptr, .name = std::string(name)},
+        Value{
+          .parent = std::move(parent),
+          .inode = std::move(inode),
+          .epoch = epoch,
+          .param = param,
+        });
+  }
+}
+
+void DentryCache::Invalidate(const Inode &parent, std::string_view name) {
+  KeyView key = {&parent, name};
+  const size_t index = KeyHash()(key) % kNumShards;
+  std::optional<Value> dropped;
+  for (const std::unique_ptr<Shards> &shards : copies_) {
+    Shard &shard = (*shards)[index];
+    absl::MutexLock lock(&shard.mu);
+    auto iter = shard.entries.find(key);
+    if (iter == shard.entries.end()) continue;
+    // Every copy caches the same Inode under `key`, so any one will do.
+    dropped = std::move(iter->second);
+    shard.entries.erase(iter);
+  }
+  if (!dropped.has_value()) return;
+  // Other names for the same Inode (i.e. hard links) are cached with the old
+  // epoch.
+  dropped->inode->BumpAttrEpoch();
+}
+
+void DentryCache::InvalidateDirectory(const Inode &parent) {
+  for (const std::unique_ptr<Shards> &shards : copies_) {
+    for (Shard &shard : *shards) {
+      // Declared before the lock, so destroyed after it's released.
+      std::vector<Value> dropped;
+      absl::MutexLock lock(&shard.mu);
+      absl::erase_if(shard.entries, [&](auto &entry) {
+        if (entry.first.parent != &parent) return false;
+        dropped.push_back(std::move(entry.second));
+        return true;
+      });
+    }
+  }
+}
+
+void DentryCache::Clear() {
+  for (const std::unique_ptr<Shards> &shards : copies_) {
+    for (Shard &shard : *shards) {
+      absl::flat_hash_map<Key, Value, KeyHash, KeyEq> dropped;
+      absl::MutexLock lock(&shard.mu);
+      dropped.swap(shard.entries);
+    }
+  }
+}
+
+DentryCache::Stats DentryCache::GetStats() const {
+  return {
+    .hits = hits_.load(std::memory_order_relaxed),
+    .misses = misses_.load(std::memory_order_relaxed),
+    .stale = stale_.load(std::memory_order_relaxed),
+    .evictions = evictions_.load(std::memory_order_relaxed),
+  };
+}
+
+std::string DentryCache::Format() const {
+  const Stats stats = GetStats();
+  const uint64_t lookups = stats.hits + stats.misses + stats.stale;
+  return absl::StrFormat(
+      "hits: %d\n"
+      "misses: %d\n"
+      "stale: %d\n"
+      "evictions: %d\n"
+      "hit rate: %.1f%%\n",
+      stats.hits, stats.misses, stats.stale, stats.evictions,
+      lookups == 0 ? 0.0 : 100.0 * static_cast<double>(stats.hits) /
+        static_cast<double>(lookups));
+}
+
+}  // namespace pafs
@@ -0,0 +1,151 @@
+#ifndef PAFS_DENTRY_CACHE_H_
+#define PAFS_DENTRY_CACHE_H_
+
+#ifndef FUSE_USE_VERSION
+// Needed by fuse/fuse_lowlevel.h
+#define FUSE_USE_VERSION 312
+#elif FUSE_USE_VERSION != 312
+#error this file is written for fuse 3.12
+#endif
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/synchronization/mutex.h"
+#include "fuse/fuse_lowlevel.h"
+#include "pafs/inode.h"
+
+namespace pafs {
+
+// Caches successful lookups, so that looking up the same name again can be
+// answered without any syscalls.
+//
+// Entries hold references to both the parent and the child Inode. An entry is
+// only served while the child's attribute epoch is what it was when the entry
+// was cached. Names are invalidated by our own namespace ops and by inotify
+// events on the parent, so a parent must be watched before anything is
+// cached under it.
+//
+// Thread-safe.
+class DentryCache {
+ public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // Found, but the child's attributes had changed since it was cached.
+    uint64_t stale = 0;
+    uint64_t evictions = 0;
+  };
+
+  struct Entry {
+    std::shared_ptr<Inode> inode;
+    fuse_entry_param param;
+  };
+
+  // Holds at most about `capacity` entries.
+  //
+  // With `numa_nodes` above 1, the threads of each NUMA node, as numbered by
+  // ThreadNumaNode, fill and search a copy of their own, so that hits are
+  // served from memory local to them. Each copy holds up to `capacity`.
+  // Invalidation drops a name from all of them.
+  explicit DentryCache(size_t capacity, size_t numa_nodes = 1);
+
+  DentryCache(DentryCache &&) = delete;
+  DentryCache(const DentryCache &) = delete;
+  DentryCache &operator=(DentryCache &&) = delete;
+  DentryCache &operator=(const DentryCache &) = delete;
+
+  std::optional<Entry> Find(const Inode &parent, std::string_view name);
+
+  // `parent_epoch` and `epoch` are the attribute epochs of `parent` and
+  // `inode`, read before `name` was resolved and `param` was filled in. If
+  // either has changed since, the entry may already be out of date and isn't
+  // cached.
+  void Insert(
+      std::shared_ptr<Inode> parent, std::string_view name,
+      uint64_t parent_epoch, std::shared_ptr<Inode> inode, uint64_t epoch,
+      const fuse_entry_param &param);
+
+  // Drops the entry for `name` in `parent`. The parent's attribute epoch must
+  // already have been bumped.
+  //
+  // Also bumps the child's attribute epoch, since a name changing usually
+  // changes the link count or ctime of what it pointed to.
+  void Invalidate(const Inode &parent, std::string_view name);
+
+  // Drops every entry under `parent`.
+  void InvalidateDirectory(const Inode &parent);
+
+  void Clear();
+
+  Stats GetStats() const;
+
+  // For ControlRegistry.
+  std::string Format() const;
+
+ private:
+  struct Key {
+    const Inode *parent;
+    std::string name;
+  };
+  struct KeyView {
+    const Inode *parent;
+    std::string_view name;
+  };
+  struct KeyHash {
+    using is_transparent = void;
+    size_t operator()(const Key &k) const { return (*this)(View(k)); }
+    size_t operator()(const KeyView &k) const {
+      return absl::HashOf(k.parent, k.name);
+    }
+  };
+  struct KeyEq {
+    using is_transparent = void;
+    bool operator()(const auto &a, const auto &b) const {
+      return View(a).parent == View(b).parent && View(a).name == View(b).name;
+    }
+  };
+  static KeyView View(const Key &k) { return {k.parent, k.name}; }
+  static KeyView View(const KeyView &k) { return k; }
+
+  struct Value {
+    // Keeps `Key::parent` alive.
+    std::shared_ptr<Inode> parent;
+    std::shared_ptr<Inode> inode;
+    uint64_t epoch;
+    fuse_entry_param param;
+  };
+
+  static constexpr size_t kNumShards = 16;
+  struct Shard {
+    absl::Mutex mu;
+    absl::flat_hash_map<Key, Value, KeyHash, KeyEq> entries ABSL_GUARDED_BY(mu);
+  };
+
+  using Shards = std::array<Shard, kNumShards>;
+
+  // In the calling thread's node's copy.
+  Shard &GetShard(const KeyView &key);
+
+  const size_t shard_capacity_;
+  // Indexed by NUMA node.
+  std::vector<std::unique_ptr<Shards>> copies_;
+
+  std::atomic<uint64_t> hits_ = 0;
+  std::atomic<uint64_t> misses_ = 0;
+  std::atomic<uint64_t> stale_ = 0;
+  std::atomic<uint64_t> evictions_ = 0;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_DENTRY_CACHE_H_
@@ -0,0 +1,214 @@
+#include "pafs/dir_watcher.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <utility>
+
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "pafs/fd.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+
+namespace pafs {
+
+DirectoryWatch::DirectoryWatch(DirectoryWatcher *watcher, int wd)
+  : watcher_(watcher), wd_(wd) {}
+
+DirectoryWatch::~DirectoryWatch() {
+  if (watcher_ == nullptr) return;
+  watcher_->Unwatch(wd_);
+}
+
+DirectoryWatch::DirectoryWatch(DirectoryWatch &&o) : DirectoryWatch() {
+  *this = std::move(o);
+}
+
+DirectoryWatch &DirectoryWatch::operator=(DirectoryWatch &&o) {
+  using std::swap;
+  swap(watcher_, o.watcher_);
+  swap(wd_, o.wd_);
+  return *this;
+}
+
+DirectoryWatch::operator bool() const { return watcher_ != nullptr; }
+
+absl::StatusOr<std::unique_ptr<DirectoryWatcher>> DirectoryWatcher::Create(
+    Callback callback) {
+  ASSIGN_OR_RETURN(
+      FileDescriptor inotify_fd,
+      syscalls::inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+  ASSIGN_OR_RETURN(
+      FileDescriptor wakeup_fd,
+      syscalls::eventfd(/*initval=*/0, EFD_NONBLOCK | EFD_CLOEXEC));
+  auto watcher = std::unique_ptr<DirectoryWatcher>(
+      new DirectoryWatcher(
+        std::move(inotify_fd), std::move(wakeup_fd), std::move(callback)));
+  watcher->thread_ = std::thread([w = watcher.get()]() { w->Run(); });
+  return watcher;
+}
+
+DirectoryWatcher::DirectoryWatcher(
+    FileDescriptor inotify_fd, FileDescriptor wakeup_fd, Callback callback)
+  : inotify_fd_(std::move(inotify_fd)), wakeup_fd_(std::move(wakeup_fd)),
+    callback_(std::move(callback)) {}
+
+DirectoryWatcher::~DirectoryWatcher() {
+  Stop();
+  absl::MutexLock lock(&mu_);
+  LOG_IF(WARNING, !watches_.empty())
+    << "DirectoryWatcher destroyed with " << watches_.size()
+    << " live watches";
+}
+
+void DirectoryWatcher::Stop() {
+  {
+    absl::MutexLock lock(&mu_);
+    if (stopping_) return;
+    stopping_ = true;
+  }
+  LOG_IF_ERROR(ERROR, Wakeup());
+  if (thread_.joinable()) thread_.join();
+}
+
+absl::StatusOr<DirectoryWatch> DirectoryWatcher::Watch(
+    int fd, dev_t dev, ino_t ino, uint32_t mask) {
+  // Held across the syscall so a concurrent Unwatch can't remove the wd we're
+  // about to hand out.
+  absl::MutexLock lock(&mu_);
+  // inotify has no fd-based interface, but the procfs magic link resolves to
+  // the directory itself even for O_PATH descriptors.
+  ASSIGN_OR_RETURN(
+      int wd,
+      syscalls::inotify_add_watch(
+        *inotify_fd_, ProcSelfFDPath(fd).Get().c_str(),
+        mask | IN_ONLYDIR | IN_MASK_ADD));
+  auto [iter, inserted] = watches_.try_emplace(
+      wd, WatchState{.dev = dev, .ino = ino, .refcnt = 0});
+  iter->second.refcnt++;
+  return DirectoryWatch(this, wd);
+}
+
+void DirectoryWatcher::Unwatch(int wd) {
+  absl::MutexLock lock(&mu_);
+  auto iter = watches_.find(wd);
+  // The kernel already dropped the watch, e.g. because the directory was
+  // deleted.
+  if (iter == watches_.end()) return;
+  if (--iter->second.refcnt > 0) return;
+  watches_.erase(iter);
+  LOG_IF_ERROR(WARNING, syscalls::inotify_rm_watch(*inotify_fd_, wd));
+}
+
+void DirectoryWatcher::Notify(DirectoryEvent event) {
+  {
+    absl::MutexLock lock(&mu_);
+    if (stopping_) return;
+    pending_.push_back(std::move(event));
+  }
+  LOG_IF_ERROR(ERROR, Wakeup());
+}
+
+absl::Status DirectoryWatcher::Wakeup() {
+  uint64_t one = 1;
+  return syscalls::write(*wakeup_fd_, &one, sizeof(one)).status();
+}
+
+absl::StatusOr<std::vector<DirectoryEvent>>
+DirectoryWatcher::ReadInotifyEvents() {
+  std::vector<DirectoryEvent> events;
+  alignas(struct inotify_event) char buf[16 * 1024];
+  while (true) {
+    absl::StatusOr<size_t> nb = syscalls::read(*inotify_fd_, buf, sizeof(buf));
+    if (!nb.ok()) {
+      if (absl::StatusOr<int> err = GetErrnoFromStatus(nb.status());
+          err.ok() && *err == EAGAIN) {
+        break;
+      }
+      return std::move(nb).status();
+    }
+
+    absl::MutexLock lock(&mu_);
+    for (size_t off = 0; off < *nb;) {
+      const auto *ev = reinterpret_cast<const struct inotify_event *>(buf + off);
+      off += sizeof(*ev) + ev->len;
+
+      if (ev->mask & IN_Q_OVERFLOW) {
+        // We lost events, so every watched directory may have changed.
+        for (const auto &[wd, watch] : watches_) {
+          events.push_back({
+              .dev = watch.dev, .ino = watch.ino, .mask = IN_Q_OVERFLOW});
+        }
+        continue;
+      }
+
+      auto iter = watches_.find(ev->wd);
+      if (iter == watches_.end()) continue;
+      const dev_t dev = iter->second.dev;
+      const ino_t ino = iter->second.ino;
+      if (ev->mask & IN_IGNORED) watches_.erase(iter);
+
+      events.push_back({
+          .dev = dev,
+          .ino = ino,
+          .mask = ev->mask,
+          .name = ev->len > 0 ? std::string(ev->name) : std::string(),
+      });
+    }
+  }
+  return events;
+}
+
+void DirectoryWatcher::Run() {
+  while (true) {
+    struct pollfd pfds[] = {
+      {.fd = *inotify_fd_, .events = POLLIN, .revents = 0},
+      {.fd = *wakeup_fd_, .events = POLLIN, .revents = 0},
+    };
+    absl::StatusOr<nfds_t> ready =
+      syscalls::poll(pfds, /*timeout=*/absl::InfiniteDuration());
+    if (!ready.ok()) {
+      if (absl::StatusOr<int> err = GetErrnoFromStatus(ready.status());
+          err.ok() && *err == EINTR) {
+        continue;
+      }
+      LOG(ERROR) << "DirectoryWatcher exiting: " << ready.status();
+      return;
+    }
+
+    std::vector<DirectoryEvent> events;
+    if (pfds[1].revents & POLLIN) {
+      uint64_t count;
+      LOG_IF_ERROR(
+          WARNING,
+          syscalls::read(*wakeup_fd_, &count, sizeof(count)).status());
+      absl::MutexLock lock(&mu_);
+      if (stopping_) return;
+      events = std::move(pending_);
+      pending_.clear();
+    }
+
+    if (pfds[0].revents & POLLIN) {
+      absl::StatusOr<std::vector<DirectoryEvent>> inotify_events =
+        ReadInotifyEvents();
+      if (!inotify_events.ok()) {
+        LOG(ERROR) << "DirectoryWatcher exiting: " << inotify_events.status();
+        return;
+      }
+      events.insert(
+          events.end(),
+          std::make_move_iterator(inotify_events->begin()),
+          std::make_move_iterator(inotify_events->end()));
+    }
+
+    for (const DirectoryEvent &event : events) callback_(event);
+  }
+}
+
+}  // namespace pafs
@@ -0,0 +1,124 @@
+#ifndef PAFS_DIR_WATCHER_H_
+#define PAFS_DIR_WATCHER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/functional/any_invocable.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "pafs/fd.h"
+
+namespace pafs {
+
+// A change to the contents of a watched source directory.
+struct DirectoryEvent {
+  // Identifies the directory (not the entry) that changed.
+  dev_t dev = 0;
+  ino_t ino = 0;
+  // inotify event mask, e.g. IN_CREATE. Zero for events queued with Notify.
+  uint32_t mask = 0;
+  // Name of the entry within the directory. Empty if the event concerns the
+  // directory as a whole.
+  std::string name;
+};
+
+class DirectoryWatcher;
+
+// An inotify watch on a single directory. Removes the watch when destroyed.
+class DirectoryWatch {
+ public:
+  DirectoryWatch() = default;
+  ~DirectoryWatch();
+
+  DirectoryWatch(DirectoryWatch &&);
+  DirectoryWatch(const DirectoryWatch &) = delete;
+  DirectoryWatch &operator=(DirectoryWatch &&);
+  DirectoryWatch &operator=(const DirectoryWatch &) = delete;
+
+  operator bool() const;
+
+ private:
+  friend class DirectoryWatcher;
+  DirectoryWatch(DirectoryWatcher *watcher, int wd);
+
+  DirectoryWatcher *watcher_ = nullptr;
+  int wd_ = -1;
+};
+
+// Watches source directories with inotify and delivers DirectoryEvents to a
+// callback on a dedicated thread.
+//
+// The callback is never invoked with any lock held, so it is free to create or
+// destroy DirectoryWatches.
+class DirectoryWatcher {
+ public:
+  using Callback = absl::AnyInvocable<void(const DirectoryEvent &)>;
+
+  static absl::StatusOr<std::unique_ptr<DirectoryWatcher>> Create(
+      Callback callback);
+
+  // All DirectoryWatches must be destroyed before the DirectoryWatcher.
+  ~DirectoryWatcher();
+
+  DirectoryWatcher(DirectoryWatcher &&) = delete;
+  DirectoryWatcher(const DirectoryWatcher &) = delete;
+  DirectoryWatcher &operator=(DirectoryWatcher &&) = delete;
+  DirectoryWatcher &operator=(const DirectoryWatcher &) = delete;
+
+  // Starts watching the directory referred to by `fd`, which may be an O_PATH
+  // descriptor. `dev` and `ino` identify the directory in delivered events.
+  absl::StatusOr<DirectoryWatch> Watch(
+      int fd, dev_t dev, ino_t ino, uint32_t mask);
+
+  // Queues an event for delivery on the watcher thread, as if it had come from
+  // inotify. Used for changes we make ourselves, so that they are handled in
+  // the same place and never from within a request handler.
+  void Notify(DirectoryEvent event);
+
+  // Stops the watcher thread. No callbacks are running once this returns.
+  // Idempotent.
+  void Stop();
+
+ private:
+  DirectoryWatcher(
+      FileDescriptor inotify_fd, FileDescriptor wakeup_fd, Callback callback);
+
+  friend class DirectoryWatch;
+  void Unwatch(int wd);
+
+  void Run();
+  absl::Status Wakeup();
+  absl::StatusOr<std::vector<DirectoryEvent>> ReadInotifyEvents();
+
+  FileDescriptor inotify_fd_;
+  FileDescriptor wakeup_fd_;
+  Callback callback_;
+
+  // inotify returns the same wd for every watch on the same directory, so
+  // watches are refcounted and only removed from inotify with the last one.
+  struct WatchState {
+    dev_t dev;
+    ino_t ino;
+    uint64_t refcnt;
+  };
+
+  absl::Mutex mu_;
+  absl::flat_hash_map</*wd=*/int, WatchState> watches_ ABSL_GUARDED_BY(mu_);
+  std::vector<DirectoryEvent> pending_ ABSL_GUARDED_BY(mu_);
+  bool stopping_ ABSL_GUARDED_BY(mu_) = false;
+
+  std::thread thread_;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_DIR_WATCHER_H_
@@ -1,3 +1,7 @@
+#include "pafs/errno.h"
+
+#include <ostream>
+
 #include "pafs/status.h"
 
 #include "absl/strings/str_format.h"
@@ -8,6 +12,16 @@
 
 namespace pafs {
 
+absl::Status Errno::ToStatus() const {
+  if (ok()) return absl::OkStatus();
+  return ErrnoToStatus(value_, call_);
+}
+
+std::ostream &operator<<(std::ostream &stream, const Errno &e) {
+  if (e.ok()) return stream << "OK";
+  return stream << e.call() << ": " << ErrnoToErrorName(e.value());
+}
+
 std::string ErrnoToErrorName(int error_number) {
   if (error_number == 0) return "OK";
   const char *n = strerrorname_np(error_number);
@@ -0,0 +1,94 @@
+#ifndef PAFS_ERRNO_H_
+#define PAFS_ERRNO_H_
+
+#include <cerrno>
+#include <concepts>
+#include <optional>
+#include <ostream>
+#include <utility>
+
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+namespace pafs {
+
+// The result of a syscall that can fail: an errno value and the name of the
+// call that produced it.
+//
+// Unlike the absl::Status from ErrnoToStatus, an Errno never allocates, so
+// it's what the syscalls layer returns from calls whose failures (ENOENT,
+// EEXIST, ...) are routine answers rather than problems. It converts to an
+// absl::Status for callers that want one, e.g. to log it.
+class Errno {
+ public:
+  // Success.
+  constexpr Errno() = default;
+  // `call` must outlive the Errno; it's meant to be a string literal.
+  constexpr Errno(int value, const char *call) : value_(value), call_(call) {}
+
+  // The current value of errno.
+  static Errno Last(const char *call) { return Errno(errno, call); }
+
+  constexpr bool ok() const { return value_ == 0; }
+  constexpr int value() const { return value_; }
+  constexpr const char *call() const { return call_; }
+
+  // Allocates. Returns an OkStatus if ok().
+  absl::Status ToStatus() const;
+  operator absl::Status() const { return ToStatus(); }
+
+  friend bool operator==(const Errno &a, const Errno &b) {
+    return a.value_ == b.value_;
+  }
+  friend std::ostream &operator<<(std::ostream &stream, const Errno &e);
+
+ private:
+  int value_ = 0;
+  const char *call_ = "";
+};
+
+// Either a T or a failed Errno. The allocation-free counterpart to
+// absl::StatusOr<T>, which it converts to.
+//
+// Has ok() and status(), so works with RETURN_IF_ERROR and ASSIGN_OR_RETURN in
+// functions returning absl::Status or absl::StatusOr.
+template <typename T>
+class ErrnoOr {
+ public:
+  ErrnoOr(T value) : value_(std::move(value)) {}
+  ErrnoOr(Errno error) : error_(error) { DCHECK(!error.ok()); }
+
+  bool ok() const { return value_.has_value(); }
+  // Success if ok().
+  Errno error() const { return error_; }
+  // Allocates on failure.
+  absl::Status status() const { return error_.ToStatus(); }
+
+  T &operator*() & { return *value_; }
+  const T &operator*() const & { return *value_; }
+  T &&operator*() && { return *std::move(value_); }
+  T *operator->() { return &*value_; }
+  const T *operator->() const { return &*value_; }
+
+  template <typename U>
+    requires std::constructible_from<U, T &&>
+  operator absl::StatusOr<U>() && {
+    if (!ok()) return status();
+    return U(*std::move(value_));
+  }
+  template <typename U>
+    requires std::constructible_from<U, const T &>
+  operator absl::StatusOr<U>() const & {
+    if (!ok()) return status();
+    return U(*value_);
+  }
+
+ private:
+  std::optional<T> value_;
+  Errno error_;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_ERRNO_H_
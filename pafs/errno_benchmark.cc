@@ -0,0 +1,81 @@
+// Compares reporting a routine syscall failure (ENOENT) through absl::Status,
+// as the syscalls layer used to for every failure, against Errno.
+//
+// bazel run -c opt //pafs:errno_benchmark
+
+#include <cerrno>
+#include <fcntl.h>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+#include "pafs/errno.h"
+#include "pafs/fd.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+
+namespace pafs {
+namespace {
+
+constexpr char kMissing[] = "/nonexistent-pafs-errno-benchmark";
+
+// What a failed lookup used to cost on top of the syscall: building the
+// Status in the wrapper, then recovering the errno from it to reply with.
+void BM_StatusRoundTrip(benchmark::State &state) {
+  for (auto _ : state) {
+    absl::Status st = ErrnoToStatus(
+        ENOENT, absl::StrCat("openat(", AT_FDCWD, ", '", kMissing, "')"));
+    absl::StatusOr<int> err = GetErrnoFromStatus(st);
+    benchmark::DoNotOptimize(err);
+  }
+}
+BENCHMARK(BM_StatusRoundTrip);
+
+// The two halves of the round trip.
+void BM_ErrnoToStatus(benchmark::State &state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ErrnoToStatus(ENOENT, "openat"));
+  }
+}
+BENCHMARK(BM_ErrnoToStatus);
+
+void BM_GetErrnoFromStatus(benchmark::State &state) {
+  const absl::Status st = ErrnoToStatus(ENOENT, "openat");
+  for (auto _ : state) benchmark::DoNotOptimize(GetErrnoFromStatus(st));
+}
+BENCHMARK(BM_GetErrnoFromStatus);
+
+void BM_ErrnoRoundTrip(benchmark::State &state) {
+  for (auto _ : state) {
+    Errno e(ENOENT, "openat");
+    benchmark::DoNotOptimize(e);
+    int err = e.value();
+    benchmark::DoNotOptimize(err);
+  }
+}
+BENCHMARK(BM_ErrnoRoundTrip);
+
+// The same, with a real failing openat for scale.
+void BM_OpenatMissingStatus(benchmark::State &state) {
+  for (auto _ : state) {
+    absl::StatusOr<FileDescriptor> fd =
+      syscalls::openat(AT_FDCWD, kMissing, O_PATH | O_CLOEXEC);
+    absl::StatusOr<int> err = GetErrnoFromStatus(fd.status());
+    benchmark::DoNotOptimize(err);
+  }
+}
+BENCHMARK(BM_OpenatMissingStatus);
+
+void BM_OpenatMissingErrno(benchmark::State &state) {
+  for (auto _ : state) {
+    ErrnoOr<FileDescriptor> fd =
+      syscalls::openat(AT_FDCWD, kMissing, O_PATH | O_CLOEXEC);
+    int err = fd.error().value();
+    benchmark::DoNotOptimize(err);
+  }
+}
+BENCHMARK(BM_OpenatMissingErrno);
+
+}  // namespace
+}  // namespace pafs
@@ -1,5 +1,8 @@
 #include "pafs/fd.h"
 
+#include <charconv>
+#include <cstring>
+
 #include "pafs/syscalls.h"
 #include "absl/log/log.h"
 
@@ -36,4 +39,12 @@ FileDescriptor &FileDescriptor::operator=(FileDescriptor &&o) {
   return *this;
 }
 
+ProcSelfFDPath::ProcSelfFDPath(int fd) {
+  static constexpr char kPrefix[] = "/proc/self/fd/";
+  std::memcpy(buf_, kPrefix, sizeof(kPrefix) - 1);
+  char *end = buf_ + sizeof(buf_) - 1;
+  // Any int fits, so this can't fail.
+  *std::to_chars(buf_ + sizeof(kPrefix) - 1, end, fd).ptr = '\0';
+}
+
 }  // namespace pafs
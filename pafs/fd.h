@@ -2,6 +2,7 @@
 #define PAFS_FD_H_
 
 #include "absl/status/status.h"
+#include "pafs/cstring_view.h"
 
 namespace pafs {
 
@@ -23,6 +24,19 @@ class FileDescriptor {
   int fd_ = -1;
 };
 
+// "/proc/self/fd/<fd>", formatted without allocating. The magic link reopens
+// or names whatever `fd` refers to, including through O_PATH descriptors.
+class ProcSelfFDPath {
+ public:
+  explicit ProcSelfFDPath(int fd);
+
+  CStringView Get() const { return CStringView(buf_); }
+  operator CStringView() const { return Get(); }
+
+ private:
+  char buf_[32];
+};
+
 }  // namespace pafs
 
 #endif  // PAFS_FD_H_
@@ -7,11 +7,20 @@
 #include <cstdint>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 
+#include "absl/cleanup/cleanup.h"
 #include "absl/log/die_if_null.h"
 #include "absl/base/macros.h"
+#include "pafs/arena.h"
+#include "pafs/probes.h"
+#include "pafs/spans.h"
+#include "pafs/stats.h"
+#include "pafs/syscall_stats.h"
 #include "pafs/syscalls.h"
 #include "pafs/status.h"
+#include "pafs/util.h"
+#include "pafs/worker_stats.h"
 #include "absl/status/status.h"
 #include "absl/log/check.h"
 #include "absl/log/log.h"
@@ -65,48 +74,102 @@ int StatusCodeToErrno(absl::StatusCode sc) {
 
 }  // namespace
 
-FuseDirsBuilder::FuseDirsBuilder(FuseRequest *req, bool plus, size_t maxsize)
-  : req_(*ABSL_DIE_IF_NULL(req)), plus_(plus), maxsize_(maxsize) {}
+FuseDirsBuilder::FuseDirsBuilder(
+    FuseRequest *req, bool plus, size_t maxsize, Arena &arena)
+  : req_(*ABSL_DIE_IF_NULL(req)), plus_(plus), maxsize_(maxsize),
+    buf_(arena.AllocateArray<char>(maxsize)) {}
 
 bool FuseDirsBuilder::AddDirEntry(
-    std::string_view name,
+    CStringView name,
     fuse_entry_param param,
     off_t offset) {
-  // TODO make a GarbageBin for this
-  std::string name_str(name);
-
   const auto add_direntry =
-    [this, name = name_str.c_str(), &param, offset](
-        std::span<char> buf) -> size_t {
+    [this, name, &param, offset](std::span<char> buf) -> size_t {
       if (plus_) {
         return fuse_add_direntry_plus(
-            req_.Get(), buf.data(), buf.size(), name, &param, offset);
+            req_.Get(), buf.data(), buf.size(), name.c_str(), &param, offset);
       }
       return fuse_add_direntry(
-          req_.Get(), buf.data(), buf.size(), name, &param.attr, offset);
+          req_.Get(), buf.data(), buf.size(), name.c_str(), &param.attr,
+          offset);
     };
 
   size_t next_entry_size = add_direntry({});
-  size_t oldsize = buf_.size();
-  if (next_entry_size + oldsize > maxsize_) return false;
-  buf_.resize(buf_.size() + next_entry_size);
+  if (next_entry_size + size_ > maxsize_) return false;
 
-  size_t added = add_direntry({buf_.data() + oldsize, next_entry_size});
+  size_t added = add_direntry(buf_.subspan(size_, next_entry_size));
   CHECK_EQ(added, next_entry_size);
+  size_ += added;
 
   return true;
 }
 
 absl::Status FuseDirsBuilder::Reply() && {
-  CHECK_LE(buf_.size(), maxsize_);
-  return req_.ReplyBuf(buf_);
+  CHECK_LE(size_, maxsize_);
+  return req_.ReplyBuf(buf_.first(size_));
+}
+
+FuseRequest::FuseRequest(fuse_req_t req, const OpInfo &info)
+  : req_(std::move(req)), trace_(TraceBegin(info)), op_(info.op),
+    start_ns_(
+        OpStats::Enabled() || PAFS_PROBE_ENABLED(op__exit)
+          ? MonotonicNanos() : 0),
+    resets_arena_(true) {
+  PAFS_PROBE(
+      op__entry, static_cast<int>(info.op), OpName(info.op).data(), info.ino);
+  WorkerStats::BeginRequest();
+  SpanRecorder::BeginRequest(info.op);
+  SyscallStats::BeginRequest(info.op);
 }
 
-FuseRequest::FuseRequest(fuse_req_t req) : req_(std::move(req)) {}
+void FuseRequest::Finish(int error) {
+  req_ = std::nullopt;
+  uint64_t latency_ns = 0;
+  if (start_ns_ != 0) {
+    latency_ns = MonotonicNanos() - start_ns_;
+    OpStats::Record(op_, error, latency_ns);
+    if (heat_ != nullptr) {
+      heat_->ops.fetch_add(1, std::memory_order_relaxed);
+      heat_->latency_ns.fetch_add(latency_ns, std::memory_order_relaxed);
+    }
+    start_ns_ = 0;
+  }
+  heat_ = nullptr;
+  PAFS_PROBE(
+      op__exit, static_cast<int>(op_), OpName(op_).data(), error, latency_ns);
+  if (!trace_) return;
+  TraceEnd(*trace_, error);
+  trace_ = std::nullopt;
+}
 
 fuse_req_t &FuseRequest::operator*() { return *req_; }
 fuse_req_t &FuseRequest::Get() { return *req_; }
 
+fuse_req_t FuseRequest::Release() && {
+  fuse_req_t req = *req_;
+  req_ = std::nullopt;
+  trace_ = std::nullopt;
+  start_ns_ = 0;
+  heat_ = nullptr;
+  return req;
+}
+
+FuseRequest FuseRequest::Offload() && {
+  using std::swap;
+  FuseRequest offloaded;
+  swap(req_, offloaded.req_);
+  swap(trace_, offloaded.trace_);
+  swap(op_, offloaded.op_);
+  swap(start_ns_, offloaded.start_ns_);
+  swap(heat_, offloaded.heat_);
+  return offloaded;
+}
+
+void FuseRequest::SetHeat(HeatCounters *heat) {
+  heat_ = heat;
+  if (heat_ != nullptr && start_ns_ == 0) start_ns_ = MonotonicNanos();
+}
+
 FuseRequest::FuseRequest(FuseRequest &&o)
     : FuseRequest() {
   *this = std::move(o);
@@ -115,10 +178,23 @@ FuseRequest::FuseRequest(FuseRequest &&o)
 FuseRequest &FuseRequest::operator=(FuseRequest &&o) {
   using std::swap;
   swap(req_, o.req_);
+  swap(trace_, o.trace_);
+  swap(op_, o.op_);
+  swap(start_ns_, o.start_ns_);
+  swap(heat_, o.heat_);
+  swap(resets_arena_, o.resets_arena_);
   return *this;
 }
 
 FuseRequest::~FuseRequest() {
+  // The handler's locals are gone by now, so nothing still points into it.
+  absl::Cleanup reset_arena = [this]() {
+    if (!resets_arena_) return;
+    RequestArena().Reset();
+    WorkerStats::EndRequest();
+    SpanRecorder::EndRequest();
+    SyscallStats::EndRequest();
+  };
   if (!req_) return;
   // TODO imporve this warning
   LOG(WARNING) << "Replying to FuseRequest in destructor";
@@ -129,39 +205,49 @@ FuseRequest::~FuseRequest() {
 absl::Status FuseRequest::ReplyAttr(
     const struct stat &attr, absl::Duration attr_timeout) {
   if (!req_) return absl::OkStatus();
+  ScopedSpan span("reply", "fuse_reply_attr");
   absl::Status st = ErrnoToStatus(
       -fuse_reply_attr(*req_, &attr, absl::ToDoubleSeconds(attr_timeout)),
       "fuse_reply_attr");
-  req_ = std::nullopt;
+  Finish(0);
   return st;
 }
 
 absl::Status FuseRequest::ReplyOpen(const fuse_file_info &fi) {
   if (!req_) return absl::OkStatus();
+  ScopedSpan span("reply", "fuse_reply_open");
+  if (trace_) trace_->fh = fi.fh;
   absl::Status st =
     ErrnoToStatus(-fuse_reply_open(*req_, &fi), "fuse_reply_open");
-  req_ = std::nullopt;
+  Finish(0);
   return st;
 }
 
 absl::Status FuseRequest::ReplyCreate(
     const fuse_entry_param &entry, const fuse_file_info &fi) {
   if (!req_) return absl::OkStatus();
+  ScopedSpan span("reply", "fuse_reply_create");
+  if (trace_) {
+    trace_->entry_ino = entry.ino;
+    trace_->fh = fi.fh;
+  }
   absl::Status st =
     ErrnoToStatus(-fuse_reply_create(*req_, &entry, &fi), "fuse_reply_create");
-  req_ = std::nullopt;
+  Finish(0);
   return st;
 }
 
 absl::Status FuseRequest::ReplyErrno(int errnum) {
   if (!req_) return absl::OkStatus();
+  ScopedSpan span("reply", "fuse_reply_err");
   absl::Status st =
     ErrnoToStatus(-fuse_reply_err(*req_, errnum), "fuse_reply_err");
-  req_ = std::nullopt;
+  Finish(errnum);
   return st;
 }
 
 void FuseRequest::ReplyAlwaysAndLogIfNotOk(const absl::Status &status) {
+  SpanRecorder::EndHandler();
   LOG_IF(ERROR, !status.ok()) << status;
   absl::Status reply_s;
   if (status.ok()) {
@@ -177,12 +263,11 @@ absl::Status FuseRequest::ReplyFailure(const absl::Status &status) {
   if (!req_) return absl::OkStatus();
   absl::StatusOr<int> errno_ret = GetErrnoFromStatus(status);
   if (!errno_ret.ok()) errno_ret = StatusCodeToErrno(status.code());
-  absl::Status st = ReplyErrno(*errno_ret);
-  req_ = std::nullopt;
-  return st;
+  return ReplyErrno(*errno_ret);
 }
 
 void FuseRequest::ReplyFailureAndLogIfNotOk(const absl::Status &status) {
+  SpanRecorder::EndHandler();
   if (status.ok()) return;
   LOG(ERROR) << status;
   absl::Status reply_s = ReplyFailure(status);
@@ -191,98 +276,128 @@ void FuseRequest::ReplyFailureAndLogIfNotOk(const absl::Status &status) {
 
 absl::Status FuseRequest::ReplyBuf(std::span<char> buf) {
   if (!req_) return absl::OkStatus();
+  ScopedSpan span("reply", "fuse_reply_buf");
   absl::Status st =
     ErrnoToStatus(
         -fuse_reply_buf(*req_, buf.data(), buf.size()),
         "fuse_reply_buf");
-  req_ = std::nullopt;
+  Finish(0);
   return st;
 }
 
 absl::Status FuseRequest::ReplyEntry(const fuse_entry_param &param) {
   if (!req_) return absl::OkStatus();
+  ScopedSpan span("reply", "fuse_reply_entry");
+  if (trace_) trace_->entry_ino = param.ino;
   absl::Status st =
     ErrnoToStatus(
         -fuse_reply_entry(*req_, &param),
         "fuse_reply_entry");
-  req_ = std::nullopt;
+  Finish(0);
   return st;
 }
 
-absl::Status FuseRequest::ReplyReadLink(std::string_view link) {
+absl::Status FuseRequest::ReplyReadLink(CStringView link) {
   if (!req_) return absl::OkStatus();
+  ScopedSpan span("reply", "fuse_reply_readlink");
   absl::Status st =
     ErrnoToStatus(
-        -fuse_reply_readlink(*req_, std::string(link).c_str()),
+        -fuse_reply_readlink(*req_, link.c_str()),
         "fuse_reply_readlink");
-  req_ = std::nullopt;
+  Finish(0);
   return st;
 }
 
 void FuseRequest::ReplyNone() {
   if (!req_) return;
+  ScopedSpan span("reply", "fuse_reply_none");
   fuse_reply_none(*req_);
-  req_ = std::nullopt;
+  Finish(0);
 }
 
 absl::Status FuseRequest::ReplyData(
     fuse_bufvec bufv, fuse_buf_copy_flags flags) {
   if (!req_) return absl::OkStatus();
+  ScopedSpan span("reply", "fuse_reply_data");
+  if (heat_ != nullptr) {
+    heat_->bytes_read.fetch_add(
+        fuse_buf_size(&bufv), std::memory_order_relaxed);
+  }
   absl::Status st =
     ErrnoToStatus(
         -fuse_reply_data(*req_, &bufv, flags),
         "fuse_reply_data");
-  req_ = std::nullopt;
+  Finish(0);
   return st;
 }
 
 absl::Status FuseRequest::ReplyWrite(size_t bytes_written) {
   if (!req_) return absl::OkStatus();
+  ScopedSpan span("reply", "fuse_reply_write");
+  if (heat_ != nullptr) {
+    heat_->bytes_written.fetch_add(
+        bytes_written, std::memory_order_relaxed);
+  }
   absl::Status st =
     ErrnoToStatus(
         -fuse_reply_write(*req_, bytes_written),
         "fuse_reply_write");
-  req_ = std::nullopt;
+  Finish(0);
   return st;
 }
 
 absl::Status FuseRequest::ReplyStatFS(const struct statvfs &stbuf) {
   if (!req_) return absl::OkStatus();
+  ScopedSpan span("reply", "fuse_reply_statfs");
   absl::Status st =
     ErrnoToStatus(
         -fuse_reply_statfs(*req_, &stbuf),
         "fuse_reply_statfs");
-  req_ = std::nullopt;
+  Finish(0);
   return st;
 }
 
 absl::Status FuseRequest::ReplyLock(const struct flock &lock) {
   if (!req_) return absl::OkStatus();
+  ScopedSpan span("reply", "fuse_reply_lock");
   absl::Status st =
     ErrnoToStatus(
         -fuse_reply_lock(*req_, &lock),
         "fuse_reply_lock");
-  req_ = std::nullopt;
+  Finish(0);
   return st;
 }
 
 absl::Status FuseRequest::ReplyLSeek(off_t off) {
   if (!req_) return absl::OkStatus();
+  ScopedSpan span("reply", "fuse_reply_lseek");
   absl::Status st =
     ErrnoToStatus(
         -fuse_reply_lseek(*req_, off),
         "fuse_reply_lseek");
-  req_ = std::nullopt;
+  Finish(0);
   return st;
 }
 
 absl::Status FuseRequest::ReplyPoll(unsigned revents) {
   if (!req_) return absl::OkStatus();
+  ScopedSpan span("reply", "fuse_reply_poll");
   absl::Status st =
     ErrnoToStatus(
         -fuse_reply_poll(*req_, revents),
         "fuse_reply_poll");
-  req_ = std::nullopt;
+  Finish(0);
+  return st;
+}
+
+absl::Status FuseRequest::ReplyXAttr(size_t count) {
+  if (!req_) return absl::OkStatus();
+  ScopedSpan span("reply", "fuse_reply_xattr");
+  absl::Status st =
+    ErrnoToStatus(
+        -fuse_reply_xattr(*req_, count),
+        "fuse_reply_xattr");
+  Finish(0);
   return st;
 }
 
@@ -293,6 +408,13 @@ absl::StatusOr<size_t> FuseBufCopy(
   return static_cast<size_t>(nb);
 }
 
+absl::Status FuseNotifyInvalInode(
+    fuse_session &se, fuse_ino_t ino, off_t off, off_t len) {
+  int rc = fuse_lowlevel_notify_inval_inode(&se, ino, off, len);
+  if (rc == -ENOENT) return absl::OkStatus();
+  return ErrnoToStatus(-rc, "fuse_lowlevel_notify_inval_inode");
+}
+
 FusePollHandle::FusePollHandle(fuse_pollhandle *handle) : handle_(handle) {}
 
 FusePollHandle::~FusePollHandle() {
@@ -22,9 +22,31 @@
 #include "absl/log/log.h"
 #include "absl/status/statusor.h"
 #include "fuse/fuse_lowlevel.h"
+#include "pafs/arena.h"
+#include "pafs/cstring_view.h"
+#include "pafs/errno.h"
 #include "pafs/fd.h"
 #include "pafs/mount.h"
+#include "pafs/op.h"
+#include "pafs/stats.h"
 #include "pafs/status.h"
+#include "pafs/trace.h"
+
+// For ops that pass a syscall's failure straight back to the kernel. If
+// `expr` (an Errno) failed, replies to the FuseRequest `req` with it as a
+// successful failure (see FuseRequest::ReplyErrno), without building an
+// absl::Status.
+#define REPLY_IF_ERRNO(req, expr) \
+  if (::pafs::Errno e = (expr); !e.ok()) return (req).ReplyErrno(e.value())
+
+// Like ASSIGN_OR_RETURN, but for an ErrnoOr whose failure is replied to `req`
+// as with REPLY_IF_ERRNO.
+#define ASSIGN_OR_REPLY_ERRNO(var, req, expr) \
+  var = ({ \
+    auto v = (expr); \
+    if (!v.ok()) return (req).ReplyErrno(v.error().value()); \
+    *std::move(v); \
+  })
 
 namespace pafs {
 
@@ -32,14 +54,25 @@ absl::StatusOr<size_t> FuseBufCopy(
     fuse_bufvec &dst, fuse_bufvec &src,
     fuse_buf_copy_flags flags = static_cast<fuse_buf_copy_flags>(0));
 
+// Invalidates the kernel's cached attributes and data for `ino`. For
+// directories this also drops any cached readdir results.
+//
+// ENOENT (the kernel doesn't know about `ino`) is not an error.
+absl::Status FuseNotifyInvalInode(
+    fuse_session &se, fuse_ino_t ino, off_t off = 0, off_t len = 0);
+
 // A FuseRequest is a wrapper around fuse_req_t that RAII owns replying to the
 // request.
 class FuseRequest {
  public:
   FuseRequest() = default;
 
-  // Transfers responsibility to this FuseRequest for replying.
-  FuseRequest(fuse_req_t req);
+  // Transfers responsibility to this FuseRequest for replying. `info`
+  // describes the request for tracing; its name need not outlive the
+  // constructor.
+  FuseRequest(fuse_req_t req, const OpInfo &info = {});
+  // Also resets this thread's RequestArena, and tells WorkerStats that the
+  // thread is done with the request.
   ~FuseRequest();
 
   FuseRequest(FuseRequest &&);
@@ -50,6 +83,22 @@ class FuseRequest {
   fuse_req_t &operator*();
   fuse_req_t &Get();
 
+  // Gives up responsibility for replying, returning the request unreplied.
+  // Nothing is traced or recorded for it.
+  fuse_req_t Release() &&;
+
+  // Hands the request to another thread to reply to, e.g. an
+  // OffloadExecutor's. This FuseRequest is left with nothing to reply to,
+  // but its destructor still ends the calling thread's work on the request;
+  // the returned one's doesn't, on whichever thread it runs.
+  FuseRequest Offload() &&;
+
+  Op GetOp() const { return op_; }
+
+  // Charges this request to `heat`, which may be nullptr, once it's replied
+  // to. `heat` must outlive the reply.
+  void SetHeat(HeatCounters *heat);
+
   absl::Status ReplyAttr(
     const struct stat &attr, absl::Duration attr_timeout);
 
@@ -66,7 +115,7 @@ class FuseRequest {
 
   absl::Status ReplyEntry(const fuse_entry_param &param);
 
-  absl::Status ReplyReadLink(std::string_view link);
+  absl::Status ReplyReadLink(CStringView link);
 
   absl::Status ReplyWrite(size_t bytes_written);
 
@@ -78,6 +127,10 @@ class FuseRequest {
 
   absl::Status ReplyPoll(unsigned revents);
 
+  // The reply to a GetXAttr or ListXAttr of size 0: the size of the buffer
+  // needed.
+  absl::Status ReplyXAttr(size_t count);
+
   // A "successful failure" response, e.g. ENOENT, where we succeeded in
   // performing an operation that correctly produces an error code.
   //
@@ -97,12 +150,24 @@ class FuseRequest {
   // Does not need to be called (is called by e.g. GetFuseForgetOp).
   void ReplyNone();
 
-  // Implementation detail -- helpers for the OpFns below
+  // Implementation detail -- helpers for the OpFns below. Called with the
+  // handler's result, so they also end its span.
   void ReplyFailureAndLogIfNotOk(const absl::Status &status);
   void ReplyAlwaysAndLogIfNotOk(const absl::Status &status);
  private:
+  // Called once the request has been replied to.
+  void Finish(int error);
 
   std::optional<fuse_req_t> req_;
+  std::optional<TraceRecord> trace_;
+  Op op_ = Op::kUnknown;
+  // CLOCK_MONOTONIC, or 0 if nothing (OpStats, `heat_` or the op__exit
+  // probe) needs the latency.
+  uint64_t start_ns_ = 0;
+  HeatCounters *heat_ = nullptr;
+  // Whether destroying this ends the request's use of RequestArena, and the
+  // handling thread's work on it, for WorkerStats.
+  bool resets_arena_ = false;
 };
 
 class FusePollHandle {
@@ -132,7 +197,10 @@ bool operator==(nullptr_t, const FusePollHandle &ph);
 
 class FuseDirsBuilder {
  public:
-  FuseDirsBuilder(FuseRequest *req, bool plus, size_t maxsize);
+  // Entries are buffered in `arena`.
+  FuseDirsBuilder(
+      FuseRequest *req, bool plus, size_t maxsize,
+      Arena &arena = RequestArena());
 
   // Adds a directory entry to this builder, unless maxsize is reached.
   //
@@ -140,7 +208,7 @@ class FuseDirsBuilder {
   //
   // If called from a Readdir context, only param.attr is used.
   bool AddDirEntry(
-   std::string_view name,
+   CStringView name,
    fuse_entry_param param,
    off_t offset);
 
@@ -150,7 +218,8 @@ class FuseDirsBuilder {
   FuseRequest &req_;
   bool plus_;
   size_t maxsize_;
-  std::vector<char> buf_;
+  std::span<char> buf_;
+  size_t size_ = 0;
 };
 
 }  // namespace pafs
@@ -0,0 +1,52 @@
+// FuseDirsBuilder filling a ReadDir or ReadDirPlus reply.
+//
+// There's no session here to reply on, so Reply itself isn't measured; the
+// request is released unreplied instead.
+//
+// bazel run -c opt //pafs:fuse_benchmark
+
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "fuse/fuse_lowlevel.h"
+#include "pafs/fuse.h"
+
+namespace pafs {
+namespace {
+
+// range(0) entries into a reply buffer with room for all of them.
+template <bool kPlus>
+void BM_FuseDirsBuilderAddDirEntry(benchmark::State &state) {
+  const int entries = static_cast<int>(state.range(0));
+  std::vector<std::string> names;
+  for (int i = 0; i < entries; i++) {
+    names.push_back("entry-" + std::to_string(i));
+  }
+  // Larger than a fuse_direntplus with any of the names.
+  const size_t maxsize = entries * 256;
+
+  for (auto _ : state) {
+    // libfuse's dirent encoders don't use the request.
+    FuseRequest req(/*req=*/nullptr);
+    {
+      FuseDirsBuilder dirs(&req, kPlus, maxsize);
+      for (int i = 0; i < entries; i++) {
+        fuse_entry_param param = {};
+        param.ino = i + 1;
+        param.attr.st_ino = i + 1;
+        param.attr.st_mode = S_IFREG | 0644;
+        benchmark::DoNotOptimize(dirs.AddDirEntry(names[i], param, i + 1));
+      }
+    }
+    // ~FuseRequest still resets RequestArena, which holds the buffer.
+    std::move(req).Release();
+  }
+  state.SetItemsProcessed(state.iterations() * entries);
+}
+BENCHMARK(BM_FuseDirsBuilderAddDirEntry</*kPlus=*/false>)->Arg(8)->Arg(512);
+BENCHMARK(BM_FuseDirsBuilderAddDirEntry</*kPlus=*/true>)->Arg(8)->Arg(512);
+
+}  // namespace
+}  // namespace pafs
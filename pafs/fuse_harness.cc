@@ -0,0 +1,417 @@
+#include "pafs/fuse_harness.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unistd.h>
+#include <utility>
+
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+
+namespace pafs {
+namespace {
+
+// What the kernel lets an unprivileged process grow a pipe to by default.
+constexpr int kPipeSize = 1 << 20;
+
+template <typename T>
+std::span<const char> Bytes(const T &t) {
+  return {reinterpret_cast<const char *>(&t), sizeof(T)};
+}
+
+// A name as the kernel sends it, with its NUL.
+std::span<const char> WithNul(const std::string &s) {
+  return {s.c_str(), s.size() + 1};
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<FuseHarness>> FuseHarness::Create(
+    const fuse_lowlevel_ops &ops, void *userdata) {
+  ASSIGN_OR_RETURN(auto pipe, syscalls::pipe2(O_CLOEXEC));
+  auto &[read_end, write_end] = pipe;
+  // A reply that didn't fit would block the session forever, since replies
+  // are only read once the request has been handled.
+  RETURN_IF_ERROR(
+      syscalls::fcntl(*write_end, F_SETPIPE_SZ, kPipeSize).status());
+  // So that a missing reply is an error rather than a hang.
+  RETURN_IF_ERROR(
+      syscalls::fcntl(*read_end, F_SETFL, O_NONBLOCK).status());
+
+  char arg0[] = "pafs-harness";
+  char *argv[] = {arg0, nullptr};
+  struct fuse_args args = FUSE_ARGS_INIT(1, argv);
+  fuse_session *se = fuse_session_new(&args, &ops, sizeof(ops), userdata);
+  fuse_opt_free_args(&args);
+  if (se == nullptr) return absl::InternalError("fuse_session_new failed");
+
+  // libfuse takes a /dev/fd/<n> "mountpoint" as an already-open /dev/fuse,
+  // and doesn't mount anything.
+  std::string mountpoint = absl::StrCat("/dev/fd/", *write_end);
+  if (fuse_session_mount(se, mountpoint.c_str()) != 0) {
+    fuse_session_destroy(se);
+    return absl::InternalError("fuse_session_mount failed");
+  }
+  // Closed by fuse_session_destroy.
+  std::move(write_end).Release();
+
+  return std::unique_ptr<FuseHarness>(
+      new FuseHarness(se, std::move(read_end)));
+}
+
+FuseHarness::FuseHarness(fuse_session *se, FileDescriptor replies)
+  : se_(se), replies_(std::move(replies)) {}
+
+FuseHarness::~FuseHarness() { fuse_session_destroy(se_); }
+
+absl::StatusOr<fuse_init_out> FuseHarness::Init(uint32_t flags) {
+  fuse_init_in in = {};
+  in.major = FUSE_KERNEL_VERSION;
+  in.minor = FUSE_KERNEL_MINOR_VERSION;
+  in.max_readahead = 128 << 10;
+  in.flags = flags;
+  ASSIGN_OR_RETURN(Reply reply, Call(FUSE_INIT, /*nodeid=*/0, {Bytes(in)}));
+  if (reply.error != 0) return ErrnoToStatus(reply.error, "FUSE_INIT");
+  // Shorter from an older libfuse.
+  fuse_init_out out = {};
+  std::memcpy(
+      &out, reply.data.data(), std::min(sizeof(out), reply.data.size()));
+  return out;
+}
+
+uint64_t FuseHarness::Process(
+    uint32_t opcode, uint64_t nodeid,
+    std::initializer_list<std::span<const char>> args) {
+  size_t len = sizeof(fuse_in_header);
+  for (std::span<const char> arg : args) len += arg.size();
+  // Reused between requests. Of uint64_t for the alignment libfuse expects
+  // of a request.
+  thread_local std::vector<uint64_t> request;
+  request.resize((len + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+  char *buf = reinterpret_cast<char *>(request.data());
+
+  fuse_in_header in = {};
+  in.len = len;
+  in.opcode = opcode;
+  in.unique = next_unique_.fetch_add(1, std::memory_order_relaxed);
+  in.nodeid = nodeid;
+  in.uid = getuid();
+  in.gid = getgid();
+  in.pid = getpid();
+  std::memcpy(buf, &in, sizeof(in));
+  size_t off = sizeof(in);
+  for (std::span<const char> arg : args) {
+    std::memcpy(buf + off, arg.data(), arg.size());
+    off += arg.size();
+  }
+
+  fuse_buf fbuf = {};
+  fbuf.size = len;
+  fbuf.mem = buf;
+  fbuf.fd = -1;
+  fuse_session_process_buf(se_, &fbuf);
+  return in.unique;
+}
+
+absl::StatusOr<std::optional<std::pair<uint64_t, FuseHarness::Reply>>>
+FuseHarness::ReadNextReply() {
+  fuse_out_header out;
+  absl::StatusOr<size_t> nb = syscalls::read(*replies_, &out, sizeof(out));
+  if (!nb.ok()) {
+    if (absl::StatusOr<int> err = GetErrnoFromStatus(nb.status());
+        err.ok() && *err == EAGAIN) {
+      return std::nullopt;
+    }
+    return nb.status();
+  }
+  // Replies are written whole, so a partial one is a bug.
+  CHECK_EQ(*nb, sizeof(out));
+  CHECK_GE(out.len, sizeof(out));
+
+  Reply reply = {.error = -out.error};
+  reply.data.resize(out.len - sizeof(out));
+  size_t read = 0;
+  while (read < reply.data.size()) {
+    ASSIGN_OR_RETURN(
+        size_t n,
+        syscalls::read(
+          *replies_, reply.data.data() + read, reply.data.size() - read));
+    CHECK_GT(n, 0);
+    read += n;
+  }
+  return std::make_pair(out.unique, std::move(reply));
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::ReadReply(uint64_t unique) {
+  absl::MutexLock lock(&mu_);
+  // The session replied before Process returned, so the reply is either in
+  // the pipe or was read by another thread looking for its own.
+  while (true) {
+    if (auto it = read_ahead_.find(unique); it != read_ahead_.end()) {
+      Reply reply = std::move(it->second);
+      read_ahead_.erase(it);
+      return reply;
+    }
+    ASSIGN_OR_RETURN(auto next, ReadNextReply());
+    if (!next.has_value()) {
+      return absl::FailedPreconditionError(
+          absl::StrCat("No reply to request ", unique));
+    }
+    auto &[next_unique, reply] = *next;
+    if (next_unique == unique) return std::move(reply);
+    read_ahead_.emplace(next_unique, std::move(reply));
+  }
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Call(
+    uint32_t opcode, uint64_t nodeid,
+    std::initializer_list<std::span<const char>> args) {
+  return ReadReply(Process(opcode, nodeid, args));
+}
+
+absl::Status FuseHarness::Send(
+    uint32_t opcode, uint64_t nodeid,
+    std::initializer_list<std::span<const char>> args) {
+  uint64_t unique = Process(opcode, nodeid, args);
+  absl::MutexLock lock(&mu_);
+  // Any reply would have been written by now.
+  while (true) {
+    ASSIGN_OR_RETURN(auto next, ReadNextReply());
+    if (!next.has_value()) break;
+    read_ahead_.emplace(next->first, std::move(next->second));
+  }
+  if (read_ahead_.contains(unique)) {
+    return absl::InternalError(
+        absl::StrCat("Unexpected reply to request ", unique));
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Lookup(
+    uint64_t parent, std::string_view name) {
+  std::string n(name);
+  return Call(FUSE_LOOKUP, parent, {WithNul(n)});
+}
+
+absl::Status FuseHarness::Forget(uint64_t nodeid, uint64_t nlookup) {
+  fuse_forget_in in = {};
+  in.nlookup = nlookup;
+  return Send(FUSE_FORGET, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::GetAttr(uint64_t nodeid) {
+  fuse_getattr_in in = {};
+  return Call(FUSE_GETATTR, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::SetAttr(
+    uint64_t nodeid, const fuse_setattr_in &in) {
+  return Call(FUSE_SETATTR, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::ReadLink(uint64_t nodeid) {
+  return Call(FUSE_READLINK, nodeid);
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Mknod(
+    uint64_t parent, std::string_view name, uint32_t mode, uint32_t rdev) {
+  fuse_mknod_in in = {};
+  in.mode = mode;
+  in.rdev = rdev;
+  std::string n(name);
+  return Call(FUSE_MKNOD, parent, {Bytes(in), WithNul(n)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Mkdir(
+    uint64_t parent, std::string_view name, uint32_t mode) {
+  fuse_mkdir_in in = {};
+  in.mode = mode;
+  std::string n(name);
+  return Call(FUSE_MKDIR, parent, {Bytes(in), WithNul(n)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Unlink(
+    uint64_t parent, std::string_view name) {
+  std::string n(name);
+  return Call(FUSE_UNLINK, parent, {WithNul(n)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Rmdir(
+    uint64_t parent, std::string_view name) {
+  std::string n(name);
+  return Call(FUSE_RMDIR, parent, {WithNul(n)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Symlink(
+    uint64_t parent, std::string_view name, std::string_view target) {
+  std::string n(name);
+  std::string t(target);
+  return Call(FUSE_SYMLINK, parent, {WithNul(n), WithNul(t)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Rename(
+    uint64_t parent, std::string_view name, uint64_t newparent,
+    std::string_view newname, uint32_t flags) {
+  fuse_rename2_in in = {};
+  in.newdir = newparent;
+  in.flags = flags;
+  std::string n(name);
+  std::string nn(newname);
+  return Call(FUSE_RENAME2, parent, {Bytes(in), WithNul(n), WithNul(nn)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Link(
+    uint64_t nodeid, uint64_t newparent, std::string_view newname) {
+  fuse_link_in in = {};
+  in.oldnodeid = nodeid;
+  std::string n(newname);
+  return Call(FUSE_LINK, newparent, {Bytes(in), WithNul(n)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::CreateFile(
+    uint64_t parent, std::string_view name, uint32_t flags, uint32_t mode) {
+  fuse_create_in in = {};
+  in.flags = flags;
+  in.mode = mode;
+  std::string n(name);
+  return Call(FUSE_CREATE, parent, {Bytes(in), WithNul(n)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Open(
+    uint64_t nodeid, uint32_t flags) {
+  fuse_open_in in = {};
+  in.flags = flags;
+  return Call(FUSE_OPEN, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Read(
+    uint64_t nodeid, uint64_t fh, uint64_t offset, uint32_t size) {
+  fuse_read_in in = {};
+  in.fh = fh;
+  in.offset = offset;
+  in.size = size;
+  return Call(FUSE_READ, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Write(
+    uint64_t nodeid, uint64_t fh, uint64_t offset,
+    std::span<const char> data) {
+  fuse_write_in in = {};
+  in.fh = fh;
+  in.offset = offset;
+  in.size = data.size();
+  return Call(FUSE_WRITE, nodeid, {Bytes(in), data});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Flush(
+    uint64_t nodeid, uint64_t fh) {
+  fuse_flush_in in = {};
+  in.fh = fh;
+  return Call(FUSE_FLUSH, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Release(
+    uint64_t nodeid, uint64_t fh) {
+  fuse_release_in in = {};
+  in.fh = fh;
+  return Call(FUSE_RELEASE, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::FSync(
+    uint64_t nodeid, uint64_t fh, bool datasync) {
+  fuse_fsync_in in = {};
+  in.fh = fh;
+  in.fsync_flags = datasync ? 1 : 0;
+  return Call(FUSE_FSYNC, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::OpenDir(uint64_t nodeid) {
+  fuse_open_in in = {};
+  in.flags = O_RDONLY | O_DIRECTORY;
+  return Call(FUSE_OPENDIR, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::ReadDir(
+    uint64_t nodeid, uint64_t fh, uint64_t offset, uint32_t size, bool plus) {
+  fuse_read_in in = {};
+  in.fh = fh;
+  in.offset = offset;
+  in.size = size;
+  return Call(plus ? FUSE_READDIRPLUS : FUSE_READDIR, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::ReleaseDir(
+    uint64_t nodeid, uint64_t fh) {
+  fuse_release_in in = {};
+  in.fh = fh;
+  return Call(FUSE_RELEASEDIR, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::FSyncDir(
+    uint64_t nodeid, uint64_t fh, bool datasync) {
+  fuse_fsync_in in = {};
+  in.fh = fh;
+  in.fsync_flags = datasync ? 1 : 0;
+  return Call(FUSE_FSYNCDIR, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::StatFS(uint64_t nodeid) {
+  return Call(FUSE_STATFS, nodeid);
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::GetXAttr(
+    uint64_t nodeid, std::string_view name, uint32_t size) {
+  fuse_getxattr_in in = {};
+  in.size = size;
+  std::string n(name);
+  return Call(FUSE_GETXATTR, nodeid, {Bytes(in), WithNul(n)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::ListXAttr(
+    uint64_t nodeid, uint32_t size) {
+  fuse_getxattr_in in = {};
+  in.size = size;
+  return Call(FUSE_LISTXATTR, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::Access(
+    uint64_t nodeid, uint32_t mask) {
+  fuse_access_in in = {};
+  in.mask = mask;
+  return Call(FUSE_ACCESS, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::FAllocate(
+    uint64_t nodeid, uint64_t fh, uint64_t offset, uint64_t length,
+    uint32_t mode) {
+  fuse_fallocate_in in = {};
+  in.fh = fh;
+  in.offset = offset;
+  in.length = length;
+  in.mode = mode;
+  return Call(FUSE_FALLOCATE, nodeid, {Bytes(in)});
+}
+
+absl::StatusOr<FuseHarness::Reply> FuseHarness::CopyFileRange(
+    uint64_t nodeid_in, uint64_t fh_in, uint64_t off_in,
+    uint64_t nodeid_out, uint64_t fh_out, uint64_t off_out, uint64_t len) {
+  fuse_copy_file_range_in in = {};
+  in.fh_in = fh_in;
+  in.off_in = off_in;
+  in.nodeid_out = nodeid_out;
+  in.fh_out = fh_out;
+  in.off_out = off_out;
+  in.len = len;
+  return Call(FUSE_COPY_FILE_RANGE, nodeid_in, {Bytes(in)});
+}
+
+}  // namespace pafs
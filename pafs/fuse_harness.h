@@ -0,0 +1,174 @@
+#ifndef PAFS_FUSE_HARNESS_H_
+#define PAFS_FUSE_HARNESS_H_
+
+#ifndef FUSE_USE_VERSION
+// Needed by fuse/fuse_lowlevel.h
+#define FUSE_USE_VERSION 312
+#elif FUSE_USE_VERSION != 312
+#error this file is written for fuse 3.12
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "fuse/fuse_kernel.h"
+#include "fuse/fuse_lowlevel.h"
+#include "pafs/fd.h"
+
+namespace pafs {
+
+// Drives a fuse_session in-process, standing in for the kernel.
+//
+// Requests are built in the FUSE wire format and handed to the session, which
+// handles them on the calling thread. The session writes replies to a pipe,
+// as it would to /dev/fuse, and the harness reads them back. Runs are
+// deterministic and need neither root, fusermount nor a mount.
+//
+// Replies must fit in the pipe, about 1MiB, so reads should be no larger.
+//
+// Thread-safe, so that several threads can drive one session as the kernel
+// would. Replies to concurrent requests must be at most PIPE_BUF bytes, since
+// only writes that small reach the pipe whole.
+class FuseHarness {
+ public:
+  struct Reply {
+    // A positive errno, or 0.
+    int error = 0;
+    // What followed the fuse_out_header.
+    std::string data;
+
+    // The T at `offset` in `data`, e.g. a fuse_entry_out, or nullopt if
+    // `data` is too short.
+    template <typename T>
+    std::optional<T> As(size_t offset = 0) const {
+      if (data.size() < offset || data.size() - offset < sizeof(T)) {
+        return std::nullopt;
+      }
+      T t;
+      std::memcpy(&t, data.data() + offset, sizeof(T));
+      return t;
+    }
+  };
+
+  // `ops` and `userdata` are as for fuse_session_new. `userdata` must outlive
+  // the FuseHarness.
+  static absl::StatusOr<std::unique_ptr<FuseHarness>> Create(
+      const fuse_lowlevel_ops &ops, void *userdata);
+  // Destroys the session, calling the destroy op if Init was called.
+  ~FuseHarness();
+
+  FuseHarness(FuseHarness &&) = delete;
+  FuseHarness(const FuseHarness &) = delete;
+  FuseHarness &operator=(FuseHarness &&) = delete;
+  FuseHarness &operator=(const FuseHarness &) = delete;
+
+  // E.g. for PageAlignFS::SetSession, which must be called before Init.
+  fuse_session *GetSession() const { return se_; }
+
+  // What the kernel offers in FUSE_INIT by default.
+  static constexpr uint32_t kDefaultInitFlags =
+    FUSE_ASYNC_READ | FUSE_POSIX_LOCKS | FUSE_ATOMIC_O_TRUNC |
+    FUSE_BIG_WRITES | FUSE_DONT_MASK | FUSE_FLOCK_LOCKS |
+    FUSE_DO_READDIRPLUS | FUSE_READDIRPLUS_AUTO | FUSE_PARALLEL_DIROPS |
+    FUSE_CACHE_SYMLINKS;
+
+  // Must be the first request, as from the kernel. `flags` are the FUSE_*
+  // capabilities offered.
+  absl::StatusOr<fuse_init_out> Init(uint32_t flags = kDefaultInitFlags);
+
+  // Sends a request whose body is `args`, concatenated, and returns its
+  // reply.
+  absl::StatusOr<Reply> Call(
+      uint32_t opcode, uint64_t nodeid,
+      std::initializer_list<std::span<const char>> args = {});
+  // For requests that aren't replied to, e.g. FUSE_FORGET.
+  absl::Status Send(
+      uint32_t opcode, uint64_t nodeid,
+      std::initializer_list<std::span<const char>> args = {});
+
+  // Common requests, as the kernel sends them.
+  absl::StatusOr<Reply> Lookup(uint64_t parent, std::string_view name);
+  absl::Status Forget(uint64_t nodeid, uint64_t nlookup);
+  absl::StatusOr<Reply> GetAttr(uint64_t nodeid);
+  absl::StatusOr<Reply> SetAttr(uint64_t nodeid, const fuse_setattr_in &in);
+  absl::StatusOr<Reply> ReadLink(uint64_t nodeid);
+  absl::StatusOr<Reply> Mknod(
+      uint64_t parent, std::string_view name, uint32_t mode, uint32_t rdev);
+  absl::StatusOr<Reply> Mkdir(
+      uint64_t parent, std::string_view name, uint32_t mode);
+  absl::StatusOr<Reply> Unlink(uint64_t parent, std::string_view name);
+  absl::StatusOr<Reply> Rmdir(uint64_t parent, std::string_view name);
+  absl::StatusOr<Reply> Symlink(
+      uint64_t parent, std::string_view name, std::string_view target);
+  absl::StatusOr<Reply> Rename(
+      uint64_t parent, std::string_view name, uint64_t newparent,
+      std::string_view newname, uint32_t flags = 0);
+  absl::StatusOr<Reply> Link(
+      uint64_t nodeid, uint64_t newparent, std::string_view newname);
+  absl::StatusOr<Reply> CreateFile(
+      uint64_t parent, std::string_view name, uint32_t flags, uint32_t mode);
+  absl::StatusOr<Reply> Open(uint64_t nodeid, uint32_t flags);
+  absl::StatusOr<Reply> Read(
+      uint64_t nodeid, uint64_t fh, uint64_t offset, uint32_t size);
+  absl::StatusOr<Reply> Write(
+      uint64_t nodeid, uint64_t fh, uint64_t offset,
+      std::span<const char> data);
+  absl::StatusOr<Reply> Flush(uint64_t nodeid, uint64_t fh);
+  absl::StatusOr<Reply> Release(uint64_t nodeid, uint64_t fh);
+  absl::StatusOr<Reply> FSync(uint64_t nodeid, uint64_t fh, bool datasync);
+  absl::StatusOr<Reply> OpenDir(uint64_t nodeid);
+  absl::StatusOr<Reply> ReadDir(
+      uint64_t nodeid, uint64_t fh, uint64_t offset, uint32_t size,
+      bool plus = false);
+  absl::StatusOr<Reply> ReleaseDir(uint64_t nodeid, uint64_t fh);
+  absl::StatusOr<Reply> FSyncDir(uint64_t nodeid, uint64_t fh, bool datasync);
+  absl::StatusOr<Reply> StatFS(uint64_t nodeid);
+  absl::StatusOr<Reply> GetXAttr(
+      uint64_t nodeid, std::string_view name, uint32_t size);
+  absl::StatusOr<Reply> ListXAttr(uint64_t nodeid, uint32_t size);
+  absl::StatusOr<Reply> Access(uint64_t nodeid, uint32_t mask);
+  absl::StatusOr<Reply> FAllocate(
+      uint64_t nodeid, uint64_t fh, uint64_t offset, uint64_t length,
+      uint32_t mode = 0);
+  absl::StatusOr<Reply> CopyFileRange(
+      uint64_t nodeid_in, uint64_t fh_in, uint64_t off_in,
+      uint64_t nodeid_out, uint64_t fh_out, uint64_t off_out, uint64_t len);
+
+ private:
+  FuseHarness(fuse_session *se, FileDescriptor replies);
+
+  // Hands a request to the session. Returns its unique.
+  uint64_t Process(
+      uint32_t opcode, uint64_t nodeid,
+      std::initializer_list<std::span<const char>> args);
+  absl::StatusOr<Reply> ReadReply(uint64_t unique);
+  // Reads the next reply in the pipe, or nullopt if there is none.
+  absl::StatusOr<std::optional<std::pair<uint64_t, Reply>>> ReadNextReply()
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  fuse_session *se_;
+  std::atomic<uint64_t> next_unique_ = 1;
+
+  absl::Mutex mu_;
+  // The read end of the pipe the session replies into.
+  FileDescriptor replies_ ABSL_GUARDED_BY(mu_);
+  // Replies read by a thread waiting for another, by unique.
+  absl::flat_hash_map<uint64_t, Reply> read_ahead_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_FUSE_HARNESS_H_
@@ -22,9 +22,13 @@
 #include "absl/log/log.h"
 #include "absl/status/statusor.h"
 #include "fuse/fuse_lowlevel.h"
+#include "pafs/cstring_view.h"
 #include "pafs/fd.h"
 #include "pafs/fuse_ops.h"
 #include "pafs/mount.h"
+#include "pafs/op.h"
+#include "pafs/spans.h"
+#include "pafs/stats.h"
 #include "pafs/status.h"
 
 namespace pafs {
@@ -51,7 +55,7 @@ concept FuseLookupOp = requires(T t) {
     t.Lookup(
         std::declval<std::add_lvalue_reference_t<FuseRequest>>(),
         fuse_ino_t{},
-        std::declval<std::string_view>())
+        std::declval<CStringView>())
   } -> std::same_as<absl::Status>;
 };
 template <typename T>
@@ -88,7 +92,7 @@ concept FuseMknodOp = requires(T t) {
     t.Mknod(
         std::declval<std::add_lvalue_reference_t<FuseRequest>>(),
         fuse_ino_t{},
-        std::declval<std::string_view>(),
+        std::declval<CStringView>(),
         mode_t{},
         dev_t{})
   } -> std::same_as<absl::Status>;
@@ -99,7 +103,7 @@ concept FuseMkdirOp = requires(T t) {
     t.Mkdir(
         std::declval<std::add_lvalue_reference_t<FuseRequest>>(),
         fuse_ino_t{},
-        std::declval<std::string_view>(),
+        std::declval<CStringView>(),
         mode_t{})
   } -> std::same_as<absl::Status>;
 };
@@ -109,7 +113,7 @@ concept FuseUnlinkOp = requires(T t) {
     t.Unlink(
         std::declval<std::add_lvalue_reference_t<FuseRequest>>(),
         fuse_ino_t{},
-        std::declval<std::string_view>())
+        std::declval<CStringView>())
   } -> std::same_as<absl::Status>;
 };
 template <typename T>
@@ -118,7 +122,7 @@ concept FuseRmdirOp = requires(T t) {
     t.Rmdir(
         std::declval<std::add_lvalue_reference_t<FuseRequest>>(),
         fuse_ino_t{},
-        std::declval<std::string_view>())
+        std::declval<CStringView>())
   } -> std::same_as<absl::Status>;
 };
 template <typename T>
@@ -126,9 +130,9 @@ concept FuseSymlinkOp = requires(T t) {
   {
     t.Symlink(
         std::declval<std::add_lvalue_reference_t<FuseRequest>>(),
-        std::declval<std::string_view>(),
+        std::declval<CStringView>(),
         fuse_ino_t{},
-        std::declval<std::string_view>())
+        std::declval<CStringView>())
   } -> std::same_as<absl::Status>;
 };
 template <typename T>
@@ -137,9 +141,9 @@ concept FuseRenameOp = requires(T t) {
     t.Rename(
         std::declval<std::add_lvalue_reference_t<FuseRequest>>(),
         fuse_ino_t{},
-        std::declval<std::string_view>(),
+        std::declval<CStringView>(),
         fuse_ino_t{},
-        std::declval<std::string_view>(),
+        std::declval<CStringView>(),
         std::declval<unsigned int>())
   } -> std::same_as<absl::Status>;
 };
@@ -150,7 +154,7 @@ concept FuseLinkOp = requires(T t) {
         std::declval<std::add_lvalue_reference_t<FuseRequest>>(),
         fuse_ino_t{},
         fuse_ino_t{},
-        std::declval<std::string_view>())
+        std::declval<CStringView>())
   } -> std::same_as<absl::Status>;
 };
 template <typename T>
@@ -303,7 +307,7 @@ concept FuseSetXAttrOp = requires(T t) {
     t.SetXAttr(
         std::declval<std::add_lvalue_reference_t<FuseRequest>>(),
         fuse_ino_t{},
-        std::declval<std::string_view>(),
+        std::declval<CStringView>(),
         std::span<const char>(),
         int{})
   } -> std::same_as<absl::Status>;
@@ -314,7 +318,7 @@ concept FuseGetXAttrOp = requires(T t) {
     t.GetXAttr(
         std::declval<std::add_lvalue_reference_t<FuseRequest>>(),
         fuse_ino_t{},
-        std::declval<std::string_view>(),
+        std::declval<CStringView>(),
         size_t{})
   } -> std::same_as<absl::Status>;
 };
@@ -333,7 +337,7 @@ concept FuseRemoveXAttrOp = requires(T t) {
     t.RemoveXAttr(
         std::declval<std::add_lvalue_reference_t<FuseRequest>>(),
         fuse_ino_t{},
-        std::declval<std::string_view>())
+        std::declval<CStringView>())
   } -> std::same_as<absl::Status>;
 };
 template <typename T>
@@ -351,7 +355,7 @@ concept FuseCreateOp = requires(T t) {
     t.Create(
         std::declval<std::add_lvalue_reference_t<FuseRequest>>(),
         fuse_ino_t{},
-        std::declval<std::string_view>(),
+        std::declval<CStringView>(),
         mode_t{},
         std::declval<std::add_lvalue_reference_t<fuse_file_info>>())
   } -> std::same_as<absl::Status>;
@@ -471,8 +475,30 @@ concept FuseLSeekOp = requires(T t) {
   } -> std::same_as<absl::Status>;
 };
 
+// Optional: counters for FuseRequest to charge requests on `ino` to, or
+// nullptr.
+template <typename T>
+concept FuseHeatSource = requires(T t) {
+  { t.GetHeat(fuse_ino_t{}) } -> std::same_as<HeatCounters *>;
+};
+
+// Optional: told of each request on `ino` as its handler starts, once however
+// many times the handler looks `ino` up.
+template <typename T>
+concept FuseAccessRecorder = requires(T t) {
+  { t.RecordAccess(fuse_ino_t{}) } -> std::same_as<void>;
+};
+
 // implementation details below
 
+// Called by each wrapper just before its handler.
+template <typename T>
+void BeginHandler(T &t, FuseRequest &fr, fuse_ino_t ino) {
+  if constexpr (FuseHeatSource<T>) fr.SetHeat(t.GetHeat(ino));
+  if constexpr (FuseAccessRecorder<T>) t.RecordAccess(ino);
+  SpanRecorder::BeginHandler();
+}
+
 template <FuseInitOp T>
 auto GetFuseInitOp() {
   return [](void *userdata, struct fuse_conn_info *conn) {
@@ -501,7 +527,8 @@ auto GetFuseLookupOp() {
   return [](fuse_req_t req, fuse_ino_t parent, const char *name) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {.op = Op::kLookup, .ino = parent, .name = name});
+    BeginHandler(*t, fr, parent);
     fr.ReplyFailureAndLogIfNotOk(t->Lookup(fr, parent, name));
   };
 }
@@ -513,7 +540,7 @@ auto GetFuseForgetOp() {
   return [](fuse_req_t req, fuse_ino_t ino, uint64_t nlookup) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {.op = Op::kForget, .ino = ino, .arg0 = nlookup});
     LOG_IF_ERROR(ERROR, t->Forget(fr, ino, nlookup));
     fr.ReplyNone();
   };
@@ -526,7 +553,8 @@ auto GetFuseGetAttrOp() {
   return [](fuse_req_t req, fuse_ino_t ino, fuse_file_info *) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {.op = Op::kGetAttr, .ino = ino});
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(t->GetAttr(fr, ino));
   };
 }
@@ -540,7 +568,14 @@ auto GetFuseSetAttrOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kSetAttr,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(to_set),
+      .arg1 = static_cast<uint64_t>(attr->st_size),
+      .fh = fi->fh,
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(t->SetAttr(fr, ino, *attr, to_set, *fi));
   };
 }
@@ -552,7 +587,8 @@ auto GetFuseReadLinkOp() {
   return [](fuse_req_t req, fuse_ino_t ino) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {.op = Op::kReadLink, .ino = ino});
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(t->ReadLink(fr, ino));
   };
 }
@@ -565,7 +601,14 @@ auto GetFuseMknodOp() {
             dev_t rdev) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kMknod,
+      .ino = parent,
+      .name = name,
+      .arg0 = mode,
+      .arg1 = rdev,
+    });
+    BeginHandler(*t, fr, parent);
     fr.ReplyFailureAndLogIfNotOk(t->Mknod(fr, parent, name, mode, rdev));
   };
 }
@@ -577,7 +620,9 @@ auto GetFuseMkdirOp() {
   return [](fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(
+        req, {.op = Op::kMkdir, .ino = parent, .name = name, .arg0 = mode});
+    BeginHandler(*t, fr, parent);
     fr.ReplyFailureAndLogIfNotOk(t->Mkdir(fr, parent, name, mode));
   };
 }
@@ -589,7 +634,8 @@ auto GetFuseUnlinkOp() {
   return [](fuse_req_t req, fuse_ino_t parent, const char *name) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {.op = Op::kUnlink, .ino = parent, .name = name});
+    BeginHandler(*t, fr, parent);
     fr.ReplyAlwaysAndLogIfNotOk(t->Unlink(fr, parent, name));
   };
 }
@@ -601,7 +647,8 @@ auto GetFuseRmdirOp() {
   return [](fuse_req_t req, fuse_ino_t parent, const char *name) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {.op = Op::kRmdir, .ino = parent, .name = name});
+    BeginHandler(*t, fr, parent);
     fr.ReplyAlwaysAndLogIfNotOk(t->Rmdir(fr, parent, name));
   };
 }
@@ -614,7 +661,13 @@ auto GetFuseSymlinkOp() {
             const char *name) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kSymlink,
+      .ino = parent,
+      .name = name,
+      .name2 = link,
+    });
+    BeginHandler(*t, fr, parent);
     fr.ReplyFailureAndLogIfNotOk(t->Symlink(fr, link, parent, name));
   };
 }
@@ -627,7 +680,15 @@ auto GetFuseRenameOp() {
             fuse_ino_t newparent, const char *newname, unsigned int flags) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kRename,
+      .ino = parent,
+      .name = name,
+      .name2 = newname,
+      .arg0 = newparent,
+      .arg1 = flags,
+    });
+    BeginHandler(*t, fr, parent);
     fr.ReplyAlwaysAndLogIfNotOk(
         t->Rename(fr, parent, name, newparent, newname, flags));
   };
@@ -641,7 +702,9 @@ auto GetFuseLinkOp() {
             const char *newname) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(
+        req, {.op = Op::kLink, .ino = ino, .name = newname, .arg0 = parent});
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(t->Link(fr, ino, parent, newname));
   };
 }
@@ -654,7 +717,12 @@ auto GetFuseOpenOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kOpen,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(fi->flags),
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(t->Open(fr, ino, *fi));
   };
 }
@@ -668,7 +736,14 @@ auto GetFuseReadOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kRead,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(off),
+      .arg1 = size,
+      .fh = fi->fh,
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyAlwaysAndLogIfNotOk(t->Read(fr, ino, size, off, *fi));
   };
 }
@@ -682,7 +757,14 @@ auto GetFuseWriteOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kWrite,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(off),
+      .arg1 = size,
+      .fh = fi->fh,
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyAlwaysAndLogIfNotOk(t->Write(fr, ino, {buf, size}, off, *fi));
   };
 }
@@ -695,7 +777,9 @@ auto GetFuseFlushOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(
+        req, {.op = Op::kFlush, .ino = ino, .fh = fi->fh});
+    BeginHandler(*t, fr, ino);
     fr.ReplyAlwaysAndLogIfNotOk(t->Flush(fr, ino, *fi));
   };
 }
@@ -708,7 +792,9 @@ auto GetFuseReleaseOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(
+        req, {.op = Op::kRelease, .ino = ino, .fh = fi->fh});
+    BeginHandler(*t, fr, ino);
     fr.ReplyAlwaysAndLogIfNotOk(t->Release(fr, ino, *fi));
   };
 }
@@ -722,7 +808,13 @@ auto GetFuseFSyncOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kFSync,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(datasync),
+      .fh = fi->fh,
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyAlwaysAndLogIfNotOk(t->FSync(fr, ino, datasync, *fi));
   };
 }
@@ -735,7 +827,8 @@ auto GetFuseOpenDirOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {.op = Op::kOpenDir, .ino = ino});
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(t->OpenDir(fr, ino, *fi));
   };
 }
@@ -749,7 +842,14 @@ auto GetFuseReadDirOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kReadDir,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(off),
+      .arg1 = size,
+      .fh = fi->fh,
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyAlwaysAndLogIfNotOk(t->ReadDir(fr, ino, size, off, *fi));
   };
 }
@@ -762,7 +862,9 @@ auto GetFuseReleaseDirOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(
+        req, {.op = Op::kReleaseDir, .ino = ino, .fh = fi->fh});
+    BeginHandler(*t, fr, ino);
     fr.ReplyAlwaysAndLogIfNotOk(t->ReleaseDir(fr, ino, *fi));
   };
 }
@@ -775,7 +877,13 @@ auto GetFuseFSyncDirOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kFSyncDir,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(datasync),
+      .fh = fi->fh,
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyAlwaysAndLogIfNotOk(t->FSyncDir(fr, ino, datasync, *fi));
   };
 }
@@ -787,7 +895,8 @@ auto GetFuseStatFSOp() {
   return [](fuse_req_t req, fuse_ino_t ino) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {.op = Op::kStatFS, .ino = ino});
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(t->StatFS(fr, ino));
   };
 }
@@ -799,7 +908,14 @@ auto GetFuseSetXAttrOp() {
   return [](fuse_req_t req, fuse_ino_t ino, const char *name, const char *value, size_t size, int flags) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kSetXAttr,
+      .ino = ino,
+      .name = name,
+      .arg0 = size,
+      .arg1 = static_cast<uint64_t>(flags),
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyAlwaysAndLogIfNotOk(t->SetXAttr(fr, ino, name, {value, size}, flags));
   };
 }
@@ -811,7 +927,9 @@ auto GetFuseGetXAttrOp() {
   return [](fuse_req_t req, fuse_ino_t ino, const char *name, size_t size) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(
+        req, {.op = Op::kGetXAttr, .ino = ino, .name = name, .arg0 = size});
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(t->GetXAttr(fr, ino, name, size));
   };
 }
@@ -823,7 +941,8 @@ auto GetFuseListXAttrOp() {
   return [](fuse_req_t req, fuse_ino_t ino, size_t size) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {.op = Op::kListXAttr, .ino = ino, .arg0 = size});
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(t->ListXAttr(fr, ino, size));
   };
 }
@@ -835,7 +954,8 @@ auto GetFuseRemoveXAttrOp() {
   return [](fuse_req_t req, fuse_ino_t ino, const char *name) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {.op = Op::kRemoveXAttr, .ino = ino, .name = name});
+    BeginHandler(*t, fr, ino);
     fr.ReplyAlwaysAndLogIfNotOk(t->RemoveXAttr(fr, ino, name));
   };
 }
@@ -847,7 +967,12 @@ auto GetFuseAccessOp() {
   return [](fuse_req_t req, fuse_ino_t ino, int mask) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kAccess,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(mask),
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyAlwaysAndLogIfNotOk(t->Access(fr, ino, mask));
   };
 }
@@ -861,7 +986,14 @@ auto GetFuseCreateOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kCreate,
+      .ino = ino,
+      .name = name,
+      .arg0 = mode,
+      .arg1 = static_cast<uint64_t>(fi->flags),
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(t->Create(fr, ino, name, mode, *fi));
   };
 }
@@ -874,7 +1006,9 @@ auto GetFuseGetLkOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(
+        req, {.op = Op::kGetLk, .ino = ino, .fh = fi->fh});
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(t->GetLk(fr, ino, *fi, *lock));
   };
 }
@@ -888,7 +1022,13 @@ auto GetFuseSetLkOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kSetLk,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(sleep),
+      .fh = fi->fh,
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(t->SetLk(fr, ino, *fi, *lock, sleep));
   };
 }
@@ -900,7 +1040,9 @@ auto GetFuseBMapOp() {
   return [](fuse_req_t req, fuse_ino_t ino, size_t blocksize, uint64_t idx) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(
+        req, {.op = Op::kBMap, .ino = ino, .arg0 = idx, .arg1 = blocksize});
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(t->BMap(fr, ino, blocksize, idx));
   };
 }
@@ -916,7 +1058,13 @@ auto GetFuseIOCtlOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kIOCtl,
+      .ino = ino,
+      .arg0 = cmd,
+      .fh = fi->fh,
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(
         t->IOCtl(
           fr, ino, cmd, arg, *fi, flags,
@@ -933,7 +1081,9 @@ auto GetFusePollOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(
+        req, {.op = Op::kPoll, .ino = ino, .fh = fi->fh});
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(
         t->Poll(fr, ino, *fi, FusePollHandle(ph)));
   };
@@ -946,7 +1096,14 @@ auto GetFuseWriteBufOp() {
   return [](fuse_req_t req, fuse_ino_t ino, fuse_bufvec *in_buf, off_t off, fuse_file_info *fi) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kWriteBuf,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(off),
+      .arg1 = fuse_buf_size(in_buf),
+      .fh = fi->fh,
+    });
+    BeginHandler(*t, fr, ino);
     LOG_IF_ERROR(ERROR, t->WriteBuf(fr, ino, *in_buf, off, *fi));
     fr.ReplyNone();
   };
@@ -960,7 +1117,11 @@ auto GetFuseRetrieveReplyOp() {
       fuse_req_t req, void *cookie, fuse_ino_t ino, off_t offset, fuse_bufvec *bufv) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kRetrieveReply,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(offset),
+    });
     LOG_IF_ERROR(ERROR, t->RetrieveReply(fr, cookie, ino, offset, *bufv));
     fr.ReplyNone();
   };
@@ -973,7 +1134,7 @@ auto GetFuseForgetMultiOp() {
   return [](fuse_req_t req, size_t count, fuse_forget_data *forgets) {
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {.op = Op::kForgetMulti, .arg0 = count});
     LOG_IF_ERROR(ERROR, t->ForgetMulti(fr, {forgets, count}));
     fr.ReplyNone();
   };
@@ -987,7 +1148,13 @@ auto GetFuseFLockOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kFLock,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(op),
+      .fh = fi->fh,
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyAlwaysAndLogIfNotOk(t->FLock(fr, ino, *fi, op));
   };
 }
@@ -1001,7 +1168,14 @@ auto GetFuseFAllocateOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kFAllocate,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(offset),
+      .arg1 = static_cast<uint64_t>(length),
+      .fh = fi->fh,
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyAlwaysAndLogIfNotOk(
         t->FAllocate(fr, ino, mode, offset, length, *fi));
   };
@@ -1016,7 +1190,14 @@ auto GetFuseReadDirPlusOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kReadDirPlus,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(off),
+      .arg1 = size,
+      .fh = fi->fh,
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyAlwaysAndLogIfNotOk(t->ReadDirPlus(fr, ino, size, off, *fi));
   };
 }
@@ -1033,7 +1214,15 @@ auto GetFuseCopyFileRangeOp() {
     CHECK_NE(fi_out, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kCopyFileRange,
+      .ino = ino_in,
+      .arg0 = ino_out,
+      .arg1 = len,
+      .fh = fi_in->fh,
+    });
+    // A write to `ino_out`, which ReplyWrite charges the bytes copied to.
+    BeginHandler(*t, fr, ino_out);
     fr.ReplyFailureAndLogIfNotOk(
         t->CopyFileRange(
           fr, ino_in, off_in, *fi_in, ino_out, off_out, *fi_out, len, flags));
@@ -1049,7 +1238,14 @@ auto GetFuseLSeekOp() {
     CHECK_NE(fi, nullptr);
     auto *t = static_cast<T*>(fuse_req_userdata(req));
     CHECK_NE(t, nullptr);
-    FuseRequest fr(req);
+    FuseRequest fr(req, {
+      .op = Op::kLSeek,
+      .ino = ino,
+      .arg0 = static_cast<uint64_t>(off),
+      .arg1 = static_cast<uint64_t>(whence),
+      .fh = fi->fh,
+    });
+    BeginHandler(*t, fr, ino);
     fr.ReplyFailureAndLogIfNotOk(t->LSeek(fr, ino, off, whence, *fi));
   };
 }
@@ -0,0 +1,92 @@
+#include "pafs/hot_inodes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <sys/types.h>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+
+namespace pafs {
+namespace {
+
+struct Heat {
+  dev_t dev = 0;
+  ino_t ino = 0;
+  bool is_root = false;
+  uint64_t ops = 0;
+  uint64_t bytes_read = 0;
+  uint64_t bytes_written = 0;
+  uint64_t latency_ns = 0;
+  std::string path;
+};
+
+Heat Load(const Inode &inode, bool is_root) {
+  const HeatCounters &heat = inode.GetHeat();
+  return Heat{
+    .dev = inode.GetSourceDevice(),
+    .ino = inode.GetNumber(),
+    .is_root = is_root,
+    .ops = heat.ops.load(std::memory_order_relaxed),
+    .bytes_read = heat.bytes_read.load(std::memory_order_relaxed),
+    .bytes_written = heat.bytes_written.load(std::memory_order_relaxed),
+    .latency_ns = heat.latency_ns.load(std::memory_order_relaxed),
+  };
+}
+
+// Resolved while the Inode is in hand, rather than found again in the cache
+// afterwards, which would take a reference and could evict it when dropped.
+void ResolvePath(const Inode &inode, Heat &heat) {
+  absl::StatusOr<std::string> path = inode.GetPath();
+  heat.path = path.ok()
+    ? *std::move(path)
+    : absl::StrCat("(", path.status().message(), ")");
+}
+
+}  // namespace
+
+std::string FormatHotInodes(InodeCache &cache, const Inode &root, size_t n) {
+  // Copied out first, so that no shard stays locked while we sort.
+  std::vector<Heat> heats = {Load(root, /*is_root=*/true)};
+  ResolvePath(root, heats.front());
+  cache.ForEach([&heats](const Inode &inode) {
+    Heat heat = Load(inode, /*is_root=*/false);
+    if (heat.ops == 0) return;
+    ResolvePath(inode, heat);
+    heats.push_back(std::move(heat));
+  });
+
+  std::string out;
+  const auto table = [&](const char *title, auto key) {
+    size_t count = std::min(n, heats.size());
+    std::partial_sort(
+        heats.begin(), heats.begin() + count, heats.end(),
+        [&key](const Heat &a, const Heat &b) { return key(a) > key(b); });
+    absl::StrAppendFormat(
+        &out, "%s%s:\n%12s %14s %14s %14s  %s\n", out.empty() ? "" : "\n",
+        title, "ops", "bytes_read", "bytes_written", "total_us",
+        "dev:ino  path");
+    for (size_t i = 0; i < count; i++) {
+      const Heat &heat = heats[i];
+      if (key(heat) == 0) break;
+      absl::StrAppendFormat(
+          &out, "%12d %14d %14d %14.1f  %d:%d  %s%s\n", heat.ops,
+          heat.bytes_read, heat.bytes_written,
+          static_cast<double>(heat.latency_ns) / 1000, heat.dev, heat.ino,
+          heat.path, heat.is_root ? " (root)" : "");
+    }
+  };
+  table("by ops", [](const Heat &heat) { return heat.ops; });
+  table("by bytes", [](const Heat &heat) {
+    return heat.bytes_read + heat.bytes_written;
+  });
+  table("by latency", [](const Heat &heat) { return heat.latency_ns; });
+  return out;
+}
+
+}  // namespace pafs
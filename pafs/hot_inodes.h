@@ -0,0 +1,22 @@
+#ifndef PAFS_HOT_INODES_H_
+#define PAFS_HOT_INODES_H_
+
+#include <cstddef>
+#include <string>
+
+#include "pafs/inode.h"
+
+namespace pafs {
+
+// The `n` Inodes that have seen the most requests, the most bytes read and
+// written, and the most total request latency, as three tables, by source
+// device, inode number and current path. `root` is counted alongside
+// everything in `cache`.
+//
+// Only cached Inodes are ranked, so a file drops out once the kernel forgets
+// it.
+std::string FormatHotInodes(InodeCache &cache, const Inode &root, size_t n);
+
+}  // namespace pafs
+
+#endif  // PAFS_HOT_INODES_H_
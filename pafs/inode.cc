@@ -1,6 +1,10 @@
 #include "pafs/inode.h"
 
+#include <atomic>
+#include <cerrno>
+#include <climits>
 #include <memory>
+#include <span>
 #include <string_view>
 #include <utility>
 #include <sys/types.h>
@@ -18,6 +22,8 @@
 #include "pafs/status.h"
 #include "absl/functional/any_invocable.h"
 #include "absl/utility/utility.h"
+#include "absl/hash/hash.h"
+#include "absl/synchronization/mutex.h"
 #include "pafs/fd.h"
 #include "pafs/dir.h"
 #include "absl/cleanup/cleanup.h"
@@ -31,49 +37,102 @@
 namespace pafs {
 namespace {
 
-absl::StatusOr<uint64_t> GetFileVersionFromPathFD(int fd) {
-  ASSIGN_OR_RETURN(
-      FileDescriptor myfd,
-      syscalls::open(
-        absl::StrCat("/proc/self/fd/", fd).c_str(), O_RDONLY | O_CLOEXEC));
-
+absl::StatusOr<uint64_t> GetFileVersion(int fd) {
   uint64_t version = 0;
-  RETURN_IF_ERROR(syscalls::ioctl(*myfd, FS_IOC_GETVERSION, &version).status());
+  RETURN_IF_ERROR(syscalls::ioctl(fd, FS_IOC_GETVERSION, &version).status());
   return version;
 }
 
-absl::StatusOr<struct stat> StatFD(int fd) {
+// Set once the kernel turns down a call, so that we don't keep asking.
+std::atomic<bool> xattrat_unsupported = false;
+std::atomic<bool> faccessat2_unsupported = false;
+
+Errno ErrorOf(const Errno &e) { return e; }
+template <typename T>
+Errno ErrorOf(const ErrnoOr<T> &e) { return e.error(); }
+
+// Runs the first of `at` (a *xattrat call on the O_PATH fd), `f` (an f*xattr
+// call on the readable fd) and `path` (a path-based call on the procfs magic
+// link) that this kernel and file allow.
+template <typename At, typename F, typename Path>
+auto XAttrCall(const Inode &inode, At at, F f, Path path) {
+  if (!xattrat_unsupported.load(std::memory_order_relaxed)) {
+    auto ret = at(inode.GetFD());
+    // ENOSYS predates the calls; EBADF means they don't take O_PATH fds.
+    if (int e = ErrorOf(ret).value(); e != ENOSYS && e != EBADF) return ret;
+    xattrat_unsupported.store(true, std::memory_order_relaxed);
+  }
+  if (ErrnoOr<int> fd = inode.GetReadableFD(); fd.ok()) return f(*fd);
+  return path(ProcSelfFDPath(inode.GetFD()));
+}
+
+ErrnoOr<struct stat> StatFD(int fd) {
   return syscalls::fstatat(
       fd, /*path=*/"", AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW);
 }
 
 }  // namespace
 
-absl::StatusOr<std::shared_ptr<Inode>>
-InodeCache::Insert(Inode inode) {
+InodeCache::Shard &InodeCache::GetShard(const Key &key) {
+  return shards_[absl::HashOf(key) % kNumShards];
+}
+
+std::shared_ptr<Inode> InodeCache::MakeRef(Inode &inode) {
+  return std::shared_ptr<Inode>(&inode, [this](Inode *i) {
+    if (i == nullptr) return;
+    LOG_IF_ERROR(WARNING, Unref(*i));
+  });
+}
+
+std::shared_ptr<Inode> InodeCache::Insert(Inode inode) {
   auto key = std::make_pair(inode.GetSourceDevice(), inode.GetNumber());
-  auto iter = inodes_.find(key);
-  if (iter == inodes_.end()) {
-    auto value =
-      std::make_unique<std::pair<uint64_t, Inode>>(
-        /*refcnt=*/UINT64_C(0), std::move(inode));
-    iter = inodes_.emplace_hint(iter, key, std::move(value));
+  Shard &shard = GetShard(key);
+  Inode *ino;
+  {
+    absl::MutexLock lock(&shard.mu);
+    auto iter = shard.inodes.find(key);
+    if (iter == shard.inodes.end()) {
+      auto value =
+        std::make_unique<Entry>(/*refcnt=*/UINT64_C(0), std::move(inode));
+      iter = shard.inodes.emplace_hint(iter, key, std::move(value));
+    }
+
+    uint64_t &refcnt = iter->second->first;
+    ino = &iter->second->second;
+
+    refcnt++;
   }
+  // If we lost a race to insert, `inode` is closed here, outside the lock.
 
-  uint64_t &refcnt = iter->second->first;
-  Inode &ino = iter->second->second;
+  return MakeRef(*ino);
+}
+
+std::shared_ptr<Inode> InodeCache::Find(dev_t dev, ino_t ino) {
+  Key key = {dev, ino};
+  Shard &shard = GetShard(key);
+  absl::MutexLock lock(&shard.mu);
+  auto iter = shard.inodes.find(key);
+  if (iter == shard.inodes.end()) return nullptr;
 
+  uint64_t &refcnt = iter->second->first;
   refcnt++;
 
-  return std::shared_ptr<Inode>(&ino, [this](Inode *i) {
-    if (i == nullptr) return;
-    LOG_IF_ERROR(WARNING, Unref(*i));
-  });
+  return MakeRef(iter->second->second);
+}
+
+void InodeCache::ForEach(absl::FunctionRef<void(const Inode &)> fn) {
+  for (Shard &shard : shards_) {
+    absl::MutexLock lock(&shard.mu);
+    for (const auto &[key, entry] : shard.inodes) fn(entry->second);
+  }
 }
 
 absl::Status InodeCache::Ref(const Inode &inode, uint64_t ntimes) {
-  auto iter = inodes_.find({inode.GetSourceDevice(), inode.GetNumber()});
-  if (iter == inodes_.end()) {
+  Key key = {inode.GetSourceDevice(), inode.GetNumber()};
+  Shard &shard = GetShard(key);
+  absl::MutexLock lock(&shard.mu);
+  auto iter = shard.inodes.find(key);
+  if (iter == shard.inodes.end()) {
     return absl::InternalError(
         absl::StrCat(
           "Was asked to ref inode ", inode.GetNumber(),
@@ -88,68 +147,232 @@ absl::Status InodeCache::Ref(const Inode &inode, uint64_t ntimes) {
 }
 
 absl::Status InodeCache::Unref(const Inode &inode, uint64_t ntimes) {
-  auto iter = inodes_.find({inode.GetSourceDevice(), inode.GetNumber()});
-  if (iter == inodes_.end()) {
-    return absl::InternalError(
-        absl::StrCat(
-          "Was asked to unref inode ", inode.GetNumber(),
-          " tracking src device ", inode.GetSourceDevice(),
-          " which we don't have an entry for"));
-  }
+  Key key = {inode.GetSourceDevice(), inode.GetNumber()};
+  Shard &shard = GetShard(key);
+  // Destroyed after the lock is released, since destroying an Inode makes
+  // syscalls.
+  std::unique_ptr<Entry> evicted;
+  {
+    absl::MutexLock lock(&shard.mu);
+    auto iter = shard.inodes.find(key);
+    if (iter == shard.inodes.end()) {
+      return absl::InternalError(
+          absl::StrCat(
+            "Was asked to unref inode ", inode.GetNumber(),
+            " tracking src device ", inode.GetSourceDevice(),
+            " which we don't have an entry for"));
+    }
 
-  uint64_t &refcnt = iter->second->first;
-  CHECK_GE(refcnt, ntimes) << inode;
-  refcnt -= ntimes;
-  if (refcnt == 0) inodes_.erase(iter);
+    uint64_t &refcnt = iter->second->first;
+    CHECK_GE(refcnt, ntimes) << inode;
+    refcnt -= ntimes;
+    if (refcnt == 0) {
+      evicted = std::move(iter->second);
+      shard.inodes.erase(iter);
+    }
+  }
 
   return absl::OkStatus();
 }
 
-absl::StatusOr<struct stat> Inode::Stat() const {
+ErrnoOr<struct stat> Inode::Stat() const {
   return StatFD(GetFD());
 }
 
-absl::StatusOr<Inode> Inode::Create(
-    std::string_view path, int parent_fd) {
-  ASSIGN_OR_RETURN(
-      FileDescriptor fd,
-      syscalls::openat(
-        parent_fd, std::string(path).c_str(), O_PATH | O_NOFOLLOW | O_CLOEXEC));
+ErrnoOr<Inode> Inode::Create(CStringView path, int parent_fd) {
+  ErrnoOr<FileDescriptor> fd =
+    syscalls::openat(parent_fd, path, O_PATH | O_NOFOLLOW | O_CLOEXEC);
+  if (!fd.ok()) return fd.error();
 
-  ASSIGN_OR_RETURN(struct stat st, StatFD(*fd));
+  ErrnoOr<struct stat> st = StatFD(**fd);
+  if (!st.ok()) return st.error();
 
-  return Inode(std::move(fd), st.st_ino, st.st_dev);
+  Inode inode(*std::move(fd), st->st_ino, st->st_dev, st->st_mode & S_IFMT);
+  if (S_ISDIR(st->st_mode)) {
+    inode.readdirplus_policy_ = std::make_shared<ReadDirPlusPolicy>();
+    inode.name_filter_ = std::make_unique<NameFilter>();
+  }
+  return inode;
 }
 
-Inode::Inode(FileDescriptor fd, ino_t num, dev_t src_dev_num)
-  : fd_(std::move(fd)), num_(num), src_dev_num_(src_dev_num) {}
+Inode::Inode(FileDescriptor fd, ino_t num, dev_t src_dev_num, mode_t type)
+  : fd_(std::move(fd)), num_(num), src_dev_num_(src_dev_num), type_(type),
+    home_node_(ThreadNumaNode()), state_(std::make_unique<MutableState>()) {}
 
 absl::StatusOr<uint64_t> Inode::GetGeneration() const {
-  if (!generation_) generation_ = GetFileVersionFromPathFD(GetFD());
-  return *generation_;
+  absl::MutexLock lock(&state_->mu);
+  if (state_->generation) return *state_->generation;
+  // Only needed once, so not worth keeping a readable fd open for.
+  if (state_->readable_fd) {
+    state_->generation = GetFileVersion(**state_->readable_fd);
+  } else if (ErrnoOr<FileDescriptor> fd = Reopen(O_RDONLY | O_CLOEXEC);
+             fd.ok()) {
+    state_->generation = GetFileVersion(**fd);
+  } else {
+    state_->generation = fd.status();
+  }
+  return *state_->generation;
 }
 
 int Inode::GetFD() const { return *fd_; }
 ino_t Inode::GetNumber() const { return num_; }
 dev_t Inode::GetSourceDevice() const { return src_dev_num_; }
+mode_t Inode::GetType() const { return type_; }
+
+ErrnoOr<FileDescriptor> Inode::Reopen(int flags) const {
+  return syscalls::openat(AT_FDCWD, ProcSelfFDPath(GetFD()), flags);
+}
+
+ErrnoOr<int> Inode::GetReadableFD() const {
+  int flags = O_RDONLY | O_CLOEXEC | O_NOCTTY;
+  if (S_ISDIR(type_)) {
+    flags |= O_DIRECTORY;
+  } else if (!S_ISREG(type_)) {
+    return Errno(EBADF, "GetReadableFD");
+  }
+
+  {
+    absl::MutexLock lock(&state_->mu);
+    if (state_->readable_fd) return **state_->readable_fd;
+  }
+  // Opened outside the lock. Failures aren't cached: they may be down to
+  // permissions that later change.
+  ErrnoOr<FileDescriptor> fd = Reopen(flags);
+  if (!fd.ok()) return fd.error();
+  absl::MutexLock lock(&state_->mu);
+  // If another thread won the race, ours is closed on return.
+  if (!state_->readable_fd) state_->readable_fd = *std::move(fd);
+  return **state_->readable_fd;
+}
+
+Errno Inode::SetXAttr(
+    CStringView name, std::span<const char> value, int flags) const {
+  return XAttrCall(
+      *this,
+      [&](int fd) {
+        return syscalls::setxattrat(fd, "", AT_EMPTY_PATH, name, value, flags);
+      },
+      [&](int fd) { return syscalls::fsetxattr(fd, name, value, flags); },
+      [&](CStringView path) {
+        return syscalls::setxattr(path, name, value, flags);
+      });
+}
+
+ErrnoOr<size_t> Inode::GetXAttr(
+    CStringView name, std::span<char> value) const {
+  return XAttrCall(
+      *this,
+      [&](int fd) {
+        return syscalls::getxattrat(fd, "", AT_EMPTY_PATH, name, value);
+      },
+      [&](int fd) { return syscalls::fgetxattr(fd, name, value); },
+      [&](CStringView path) { return syscalls::getxattr(path, name, value); });
+}
+
+ErrnoOr<size_t> Inode::ListXAttr(std::span<char> list) const {
+  return XAttrCall(
+      *this,
+      [&](int fd) {
+        return syscalls::listxattrat(fd, "", AT_EMPTY_PATH, list);
+      },
+      [&](int fd) { return syscalls::flistxattr(fd, list); },
+      [&](CStringView path) { return syscalls::listxattr(path, list); });
+}
+
+Errno Inode::RemoveXAttr(CStringView name) const {
+  return XAttrCall(
+      *this,
+      [&](int fd) {
+        return syscalls::removexattrat(fd, "", AT_EMPTY_PATH, name);
+      },
+      [&](int fd) { return syscalls::fremovexattr(fd, name); },
+      [&](CStringView path) { return syscalls::removexattr(path, name); });
+}
+
+Errno Inode::Access(int mode) const {
+  if (!faccessat2_unsupported.load(std::memory_order_relaxed)) {
+    Errno e = syscalls::faccessat(GetFD(), "", mode, AT_EMPTY_PATH);
+    // Without the faccessat2 syscall (Linux 5.8), glibc rejects the flag.
+    if (e.value() != ENOSYS && e.value() != EINVAL) return e;
+    faccessat2_unsupported.store(true, std::memory_order_relaxed);
+  }
+  return syscalls::access(ProcSelfFDPath(GetFD()), mode);
+}
+
+uint64_t Inode::GetAttrEpoch() const {
+  return state_->attr_epoch.load(std::memory_order_acquire);
+}
+
+void Inode::BumpAttrEpoch() const {
+  state_->attr_epoch.fetch_add(1, std::memory_order_acq_rel);
+}
+
+HeatCounters &Inode::GetHeat() const { return state_->heat; }
+
+absl::StatusOr<std::string> Inode::GetPath() const {
+  char buf[PATH_MAX + 1];
+  ASSIGN_OR_RETURN(
+      ssize_t nb,
+      syscalls::readlinkat(AT_FDCWD, ProcSelfFDPath(GetFD()), buf));
+  if (nb == sizeof(buf)) return ErrnoToStatus(ENAMETOOLONG, "Path too long");
+  return std::string(buf, nb);
+}
 
 void Inode::AddPollHandle(FusePollHandle handle) {
   if (!handle) return;
-  poll_handle_ = std::move(handle);
+  absl::MutexLock lock(&state_->mu);
+  state_->poll_handle = std::move(handle);
 }
 
 absl::Status Inode::NotifyPollEvent() const {
-  if (!poll_handle_) return absl::OkStatus();
-  return poll_handle_.Notify();
+  absl::MutexLock lock(&state_->mu);
+  if (!state_->poll_handle) return absl::OkStatus();
+  return state_->poll_handle.Notify();
+}
+
+ReadDirPlusPolicy *Inode::GetReadDirPlusPolicy() const {
+  return readdirplus_policy_.get();
+}
+
+NameFilter *Inode::GetNameFilter() const { return name_filter_.get(); }
+
+void Inode::SetListedBy(const Inode &dir) {
+  absl::MutexLock lock(&state_->mu);
+  state_->listed_by = dir.readdirplus_policy_;
+  state_->listed.store(true, std::memory_order_relaxed);
+}
+
+std::shared_ptr<ReadDirPlusPolicy> Inode::TakeListedBy() const {
+  if (!state_->listed.load(std::memory_order_relaxed)) return nullptr;
+  absl::MutexLock lock(&state_->mu);
+  state_->listed.store(false, std::memory_order_relaxed);
+  return std::move(state_->listed_by);
+}
+
+bool Inode::HasDirectoryWatch() const {
+  absl::MutexLock lock(&state_->mu);
+  return state_->watch;
+}
+
+absl::Status Inode::EnsureDirectoryWatch(
+    absl::FunctionRef<absl::StatusOr<DirectoryWatch>(const Inode &)> watch)
+  const {
+  absl::MutexLock lock(&state_->mu);
+  if (state_->watch) return absl::OkStatus();
+  ASSIGN_OR_RETURN(state_->watch, watch(*this));
+  return absl::OkStatus();
 }
 
 std::ostream &operator<<(std::ostream &stream, const Inode &inode) {
   std::string generation = "unknown";
-  if (inode.generation_) {
-    if (inode.generation_->ok()) {
-      generation = absl::StrCat(*(*inode.generation_));
-    } else {
-      generation = inode.generation_->status().ToString();
+  if (inode.state_ != nullptr) {
+    absl::MutexLock lock(&inode.state_->mu);
+    if (inode.state_->generation) {
+      if (inode.state_->generation->ok()) {
+        generation = absl::StrCat(*(*inode.state_->generation));
+      } else {
+        generation = inode.state_->generation->status().ToString();
+      }
     }
   }
   return stream
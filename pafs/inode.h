@@ -6,6 +6,7 @@
 #include <fcntl.h>
 #include <iostream>
 #include <memory>
+#include <string>
 #include <string_view>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -13,8 +14,12 @@
 #include <utility>
 #include <optional>
 #include <ostream>
+#include <span>
+#include <array>
+#include <atomic>
 
 #include "absl/functional/any_invocable.h"
+#include "absl/functional/function_ref.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/cleanup/cleanup.h"
 #include "absl/log/check.h"
@@ -22,40 +27,129 @@
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/time/time.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "pafs/cstring_view.h"
+#include "pafs/dir_watcher.h"
+#include "pafs/errno.h"
 #include "pafs/fd.h"
 #include "pafs/inode.h"
+#include "pafs/name_filter.h"
+#include "pafs/numa.h"
+#include "pafs/readdirplus_policy.h"
+#include "pafs/stats.h"
 #include "pafs/syscalls.h"
 #include "pafs/fuse.h"
 
 namespace pafs {
 
+// Thread-safe.
 class Inode {
  public:
-  static absl::StatusOr<Inode> Create(
-      std::string_view path, int parent_fd = AT_FDCWD);
+  static ErrnoOr<Inode> Create(
+      CStringView path, int parent_fd = AT_FDCWD);
 
-  absl::StatusOr<struct stat> Stat() const;
+  ErrnoOr<struct stat> Stat() const;
 
   ino_t GetNumber() const;
   dev_t GetSourceDevice() const;
+  // The S_IFMT bits of the file's mode, which can't change.
+  mode_t GetType() const;
+  // An O_PATH descriptor.
   int GetFD() const;
   absl::StatusOr<uint64_t> GetGeneration() const;
 
+  // Opens the file anew through procfs, e.g. to get a descriptor that can do
+  // I/O.
+  ErrnoOr<FileDescriptor> Reopen(int flags) const;
+
+  // A read-only descriptor, for calls that reject O_PATH ones. Opened on first
+  // use and kept until this Inode is destroyed. Only regular files and
+  // directories have one, since opening anything else can block or have side
+  // effects; for the rest this fails with EBADF.
+  ErrnoOr<int> GetReadableFD() const;
+
+  // Extended attributes of, and permission checks on, the file itself. Prefer
+  // syscalls relative to GetFD, then GetReadableFD, and only fall back to a
+  // procfs path when the kernel or file type allows neither.
+  Errno SetXAttr(
+      CStringView name, std::span<const char> value, int flags) const;
+  ErrnoOr<size_t> GetXAttr(CStringView name, std::span<char> value) const;
+  ErrnoOr<size_t> ListXAttr(std::span<char> list) const;
+  Errno RemoveXAttr(CStringView name) const;
+  Errno Access(int mode) const;
+
+  // Changes whenever we change this Inode's attributes, or learn that someone
+  // else did. Read it before a stat to tell whether the result is still
+  // current.
+  uint64_t GetAttrEpoch() const;
+  void BumpAttrEpoch() const;
+
   void AddPollHandle(FusePollHandle handle);
   absl::Status NotifyPollEvent() const;
 
+  // What requests on this Inode have cost. Lost once it's forgotten.
+  HeatCounters &GetHeat() const;
+
+  // Where the file is now, as procfs reports it. For diagnostics only, since
+  // it's stale as soon as it's returned.
+  absl::StatusOr<std::string> GetPath() const;
+
+  // The NUMA node of the thread that created this Inode, whose memory its
+  // state was allocated from. See PlaceThreadOnNode.
+  int GetHomeNode() const { return home_node_; }
+
+  // nullptr unless this is a directory.
+  ReadDirPlusPolicy *GetReadDirPlusPolicy() const;
+  NameFilter *GetNameFilter() const;
+
+  // Records that `dir`'s ReadDirPlus returned this Inode with attributes.
+  void SetListedBy(const Inode &dir);
+  // The policy of the directory that last listed this Inode with attributes,
+  // if it hasn't been taken since.
+  std::shared_ptr<ReadDirPlusPolicy> TakeListedBy() const;
+
+  // Only directories are watched. The watch lives as long as this Inode.
+  bool HasDirectoryWatch() const;
+  // Calls `watch` to create this Inode's DirectoryWatch, unless it already has
+  // one.
+  absl::Status EnsureDirectoryWatch(
+      absl::FunctionRef<absl::StatusOr<DirectoryWatch>(const Inode &)> watch)
+    const;
+
   friend std::ostream &operator<<(std::ostream &stream, const Inode &inode);
 
  private:
-  Inode(FileDescriptor fd, ino_t num, dev_t src_dev_num);
+  Inode(FileDescriptor fd, ino_t num, dev_t src_dev_num, mode_t type);
+
+  // Everything that can change after creation. Lives on the heap so that
+  // Inode stays movable.
+  struct MutableState {
+    absl::Mutex mu;
+    std::optional<absl::StatusOr<uint64_t>> generation ABSL_GUARDED_BY(mu);
+    std::optional<FileDescriptor> readable_fd ABSL_GUARDED_BY(mu);
+    FusePollHandle poll_handle ABSL_GUARDED_BY(mu);
+    DirectoryWatch watch ABSL_GUARDED_BY(mu);
+    std::atomic<uint64_t> attr_epoch = 0;
+    HeatCounters heat;
+    // Checked before taking mu, since almost every GetAttr asks.
+    std::atomic<bool> listed = false;
+    std::shared_ptr<ReadDirPlusPolicy> listed_by ABSL_GUARDED_BY(mu);
+  };
 
   FileDescriptor fd_;
   ino_t num_ = 0;
   dev_t src_dev_num_ = 0;
-  mutable std::optional<absl::StatusOr<uint64_t>> generation_;
-  FusePollHandle poll_handle_;
+  mode_t type_ = 0;
+  int home_node_ = 0;
+  // Shared with the entries it listed. See SetListedBy.
+  std::shared_ptr<ReadDirPlusPolicy> readdirplus_policy_;
+  std::unique_ptr<NameFilter> name_filter_;
+  // Declared last so the watch is removed before anything else is torn down.
+  std::unique_ptr<MutableState> state_;
 };
 
+// Thread-safe.
 class InodeCache {
  public:
   InodeCache() = default;
@@ -73,7 +167,7 @@ class InodeCache {
   //
   // All shared_ptrs returned by this method must be destroyed before destroying
   // this InodeCache.
-  absl::StatusOr<std::shared_ptr<Inode>> Insert(Inode inode);
+  std::shared_ptr<Inode> Insert(Inode inode);
 
   // Increment the reference count of a cached inode ntimes.
   //
@@ -84,10 +178,29 @@ class InodeCache {
   // No need to call this if using a shared_ptr returned by Insert above.
   absl::Status Unref(const Inode &inode, uint64_t ntimes = 1);
 
+  // Returns the cached Inode for a source device and inode number, or nullptr
+  // if there isn't one. Like Insert, the returned pointer holds a reference.
+  std::shared_ptr<Inode> Find(dev_t dev, ino_t ino);
+
+  // Calls `fn` on every cached Inode, holding its shard's lock, so `fn` must
+  // not call back into the cache.
+  void ForEach(absl::FunctionRef<void(const Inode &)> fn);
+
  private:
-  absl::flat_hash_map<
-    std::pair<dev_t, ino_t>,
-    std::unique_ptr<std::pair</*refcnt=*/uint64_t, Inode>>> inodes_;
+  using Key = std::pair<dev_t, ino_t>;
+  using Entry = std::pair</*refcnt=*/uint64_t, Inode>;
+
+  // Sharded to keep lookups in unrelated directories from contending.
+  static constexpr size_t kNumShards = 16;
+  struct Shard {
+    absl::Mutex mu;
+    absl::flat_hash_map<Key, std::unique_ptr<Entry>> inodes ABSL_GUARDED_BY(mu);
+  };
+
+  Shard &GetShard(const Key &key);
+  std::shared_ptr<Inode> MakeRef(Inode &inode);
+
+  std::array<Shard, kNumShards> shards_;
 };
 
 }  // namespace pafs
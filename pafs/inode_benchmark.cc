@@ -0,0 +1,130 @@
+// Inode and InodeCache, against files on tmpfs.
+//
+// bazel run -c opt //pafs:inode_benchmark
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "pafs/benchmark_util.h"
+#include "pafs/errno.h"
+#include "pafs/inode.h"
+
+namespace pafs {
+namespace {
+
+// Shared by every thread of a multithreaded benchmark, so set up by thread 0.
+// Threads start the loop together, so the others see it.
+std::unique_ptr<ScratchDir> scratch;
+std::unique_ptr<InodeCache> cache;
+std::vector<std::shared_ptr<Inode>> cached;
+
+bool SetUpScratch(benchmark::State &state, int files) {
+  absl::StatusOr<ScratchDir> dir = ScratchDir::Create();
+  if (!dir.ok()) {
+    state.SkipWithError("ScratchDir::Create failed");
+    return false;
+  }
+  scratch = std::make_unique<ScratchDir>(*std::move(dir));
+  if (!scratch->CreateFiles(files).ok()) {
+    state.SkipWithError("CreateFiles failed");
+    return false;
+  }
+  return true;
+}
+
+void BM_InodeCreate(benchmark::State &state) {
+  if (!SetUpScratch(state, /*files=*/1)) return;
+  for (auto _ : state) {
+    ErrnoOr<Inode> inode = Inode::Create("0", scratch->GetFD());
+    benchmark::DoNotOptimize(inode);
+  }
+  scratch.reset();
+}
+BENCHMARK(BM_InodeCreate);
+
+void BM_InodeStat(benchmark::State &state) {
+  if (!SetUpScratch(state, /*files=*/1)) return;
+  ErrnoOr<Inode> inode = Inode::Create("0", scratch->GetFD());
+  if (!inode.ok()) {
+    state.SkipWithError("Inode::Create failed");
+    return;
+  }
+  for (auto _ : state) benchmark::DoNotOptimize(inode->Stat());
+  scratch.reset();
+}
+BENCHMARK(BM_InodeStat);
+
+// Inserting range(0) new inodes into an empty cache, then dropping them,
+// which evicts them. Creating the Inodes isn't timed.
+void BM_InodeCacheInsert(benchmark::State &state) {
+  const int n = static_cast<int>(state.range(0));
+  if (!SetUpScratch(state, n)) return;
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::vector<Inode> inodes;
+    inodes.reserve(n);
+    for (int i = 0; i < n; i++) {
+      ErrnoOr<Inode> inode =
+        Inode::Create(std::to_string(i), scratch->GetFD());
+      if (!inode.ok()) {
+        state.SkipWithError("Inode::Create failed");
+        return;
+      }
+      inodes.push_back(*std::move(inode));
+    }
+    InodeCache cache;
+    std::vector<std::shared_ptr<Inode>> refs;
+    refs.reserve(n);
+    state.ResumeTiming();
+
+    for (Inode &inode : inodes) refs.push_back(cache.Insert(std::move(inode)));
+    refs.clear();
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+  scratch.reset();
+}
+BENCHMARK(BM_InodeCacheInsert)->Arg(16)->Arg(1024);
+
+// The kernel's lookup count going up and down, as Lookup and Forget do.
+// range(0) is 1 if every thread uses its own inode, 0 if they share one.
+void BM_InodeCacheRefUnref(benchmark::State &state) {
+  const bool own_inode = state.range(0) != 0;
+  if (state.thread_index() == 0) {
+    if (!SetUpScratch(state, state.threads())) return;
+    cache = std::make_unique<InodeCache>();
+    for (int i = 0; i < state.threads(); i++) {
+      ErrnoOr<Inode> inode =
+        Inode::Create(std::to_string(i), scratch->GetFD());
+      if (!inode.ok()) {
+        state.SkipWithError("Inode::Create failed");
+        return;
+      }
+      cached.push_back(cache->Insert(*std::move(inode)));
+    }
+  }
+
+  const size_t index = own_inode ? state.thread_index() : 0;
+  for (auto _ : state) {
+    if (index >= cached.size()) {
+      state.SkipWithError("Set up failed");
+      break;
+    }
+    const Inode &inode = *cached[index];
+    benchmark::DoNotOptimize(cache->Ref(inode));
+    benchmark::DoNotOptimize(cache->Unref(inode));
+  }
+
+  if (state.thread_index() == 0) {
+    cached.clear();
+    cache.reset();
+    scratch.reset();
+  }
+}
+BENCHMARK(BM_InodeCacheRefUnref)
+  ->ArgName("own_inode")->Arg(0)->Arg(1)
+  ->Threads(1)->Threads(4)->ThreadPerCpu()->UseRealTime();
+
+}  // namespace
+}  // namespace pafs
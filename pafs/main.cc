@@ -5,13 +5,19 @@
 #error this file is written for fuse 3.12
 #endif
 
+#include <csignal>
 #include <cstdint>
 #include <cstdlib>
+#include <fcntl.h>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <utility>
+#include <vector>
 
 #include "absl/cleanup/cleanup.h"
 #include "absl/flags/flag.h"
@@ -23,13 +29,47 @@
 #include "absl/status/status.h"
 #include "absl/time/time.h"
 #include "fuse/fuse_lowlevel.h"
+#include "pafs/control.h"
 #include "pafs/fuse.h"
 #include "pafs/fuse_ops.h"
+#include "pafs/numa.h"
 #include "pafs/syscalls.h"
 #include "pafs/page_align_fs.h"
+#include "pafs/request_scheduler.h"
+#include "pafs/spans.h"
+#include "pafs/stats.h"
+#include "pafs/syscall_stats.h"
+#include "pafs/tenant_throttle.h"
+#include "pafs/trace.h"
+#include "pafs/worker_loop.h"
+#include "pafs/worker_stats.h"
 
 ABSL_FLAG(absl::Duration, kernel_attribute_timeout, absl::ZeroDuration(), "How long the kernel can cache inode attributes.");
 ABSL_FLAG(absl::Duration, kernel_entry_timeout, absl::ZeroDuration(), "How long the kernel can cache fs entries (files and directories).");
+ABSL_FLAG(bool, adaptive_readdirplus, true, "Only return attributes from READDIRPLUS for directories whose entries are then looked up.");
+ABSL_FLAG(bool, parallel_dirops, true, "Let the kernel send concurrent lookups and creates within one directory.");
+ABSL_FLAG(bool, negative_lookup_filter, false, "Answer lookups of nonexistent names from a per-directory Bloom filter. Changes made directly to the source directory are seen once inotify reports them.");
+ABSL_FLAG(uint64_t, dentry_cache_entries, 0, "Cache up to this many successful lookups, answering repeats without syscalls. Its hit rate is readable as the \"dentries\" control file. 0 disables the cache.");
+ABSL_FLAG(bool, kernel_readdir_cache, false, "Let the kernel cache directory listings, invalidating them when the source directory changes.");
+ABSL_FLAG(std::string, trace_file, "", "Write a binary trace of requests to this file. Decode it with trace_decode. SIGUSR1 switches tracing off and back on.");
+ABSL_FLAG(pafs::TraceLevel, trace_level, pafs::TraceLevel::kAll, "Which requests to trace: off, failures or all.");
+ABSL_FLAG(uint32_t, trace_sample_every, 1, "Trace only every Nth successful request on each thread. Failures are always traced.");
+ABSL_FLAG(absl::Duration, trace_flush_interval, absl::Milliseconds(100), "How often traced requests are written out.");
+ABSL_FLAG(bool, op_stats, true, "Keep per-op request counts, error counts and latency histograms, readable as the \"stats\" control file.");
+ABSL_FLAG(bool, syscall_stats, false, "Count the syscalls each op makes and the time spent in them, readable as the \"syscalls\" control file.");
+ABSL_FLAG(uint32_t, span_sample_every, 0, "Record a timeline of every Nth request on each thread, with its handler, syscalls and reply, readable in Chrome trace format as the \"spans.json\" control file. Reading it clears it. 0 disables it.");
+ABSL_FLAG(uint32_t, worker_threads, 0, "Serve requests on this many threads, started up front and kept, instead of libfuse's, which come and go with load. 0 uses libfuse's.");
+ABSL_FLAG(std::string, worker_cpus, "", "With --worker_threads, pin each thread to one of these CPUs, in turn, e.g. \"0-3,8\".");
+ABSL_FLAG(bool, worker_numa, false, "With --worker_threads, spread threads across NUMA nodes, each pinned to its node's CPUs (of --worker_cpus, if set) and allocating from its memory, and keep a copy of the dentry cache for each node. How often threads use files created on other nodes is readable as the \"numa\" control file.");
+ABSL_FLAG(uint32_t, worker_data_threads, 0, "With --worker_threads, handle reads, writes, fsyncs and other data requests on at most this many threads at once, queueing the rest, so that the others are kept for lookups, getattrs and other metadata requests. Readable as the \"scheduler\" control file. 0 disables it.");
+ABSL_FLAG(std::string, tenant_limits, "", "Limit the data requests and bytes a second of each uid and gid, and share the source between them by weight, as configured by this file; see TenantThrottle. Needs --worker_threads. SIGUSR2 rereads it. Usage is readable as the \"tenants\" control file.");
+ABSL_FLAG(uint32_t, offload_threads, 0, "Run big fsyncs, fallocates, copy_file_ranges, truncates and unlinks on this many threads of their own, so that they don't hold up the threads serving requests. Readable as the \"offload\" control file. 0 runs them inline.");
+ABSL_FLAG(uint64_t, offload_min_bytes, 64 << 20, "With --offload_threads, only offload truncates and unlinks that free at least this many allocated bytes, fsyncs of files with that many allocated, and fallocates and copy_file_ranges of ranges at least that long. Directory fsyncs are always offloaded.");
+ABSL_FLAG(bool, worker_stats, true, "Count busy, idle, started and exited worker threads and sample the kernel's queue of waiting requests, readable as the \"workers\" control file.");
+ABSL_FLAG(absl::Duration, worker_stats_interval, absl::Seconds(1), "How often worker threads and the kernel's queue are sampled.");
+ABSL_FLAG(std::string, control_dir, "", "Serve control files from a read-only directory of this name, e.g. \".pafs\", in the root of the mount, readable only by the daemon's user. The source directory must not already have an entry of that name. Empty disables it.");
+ABSL_FLAG(uint64_t, hot_inodes, 0, "Serve the top this many files, with their paths, by requests, bytes and latency as the \"hot_inodes\" control file. 0 disables it.");
+ABSL_FLAG(std::string, control_socket, "", "Also serve control files on a Unix socket at this path. Send a file's name and a newline to read it.");
 
 namespace pafs {
 
@@ -71,11 +111,102 @@ absl::StatusOr<int> Main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
+  // Opened now since fuse_daemonize changes directory.
+  std::optional<FileDescriptor> trace_fd;
+  if (std::string trace_file = absl::GetFlag(FLAGS_trace_file);
+      !trace_file.empty()) {
+    ASSIGN_OR_RETURN(
+        trace_fd,
+        syscalls::open(
+          trace_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+  }
+
+  // Also bound now, for the same reason.
+  std::optional<FileDescriptor> control_fd;
+  if (std::string control_socket = absl::GetFlag(FLAGS_control_socket);
+      !control_socket.empty()) {
+    ASSIGN_OR_RETURN(
+        control_fd, ControlSocket::Listen(control_socket.c_str()));
+  }
+
+  ASSIGN_OR_RETURN(
+      std::vector<int> worker_cpus,
+      ParseCpuList(absl::GetFlag(FLAGS_worker_cpus)));
+
+  ControlRegistry control_registry;
+  std::unique_ptr<OpStats> op_stats;
+  if (absl::GetFlag(FLAGS_op_stats)) {
+    op_stats = OpStats::Create();
+    control_registry.Register(
+        "stats", [stats = op_stats.get()]() { return stats->Format(); });
+  }
+
+  std::unique_ptr<SyscallStats> syscall_stats;
+  if (absl::GetFlag(FLAGS_syscall_stats)) {
+    syscall_stats = SyscallStats::Create();
+    control_registry.Register("syscalls", [stats = syscall_stats.get()]() {
+      return stats->Format();
+    });
+  }
+  size_t numa_nodes = 1;
+  std::unique_ptr<NumaStats> numa_stats;
+  const bool numa =
+    absl::GetFlag(FLAGS_worker_numa) && absl::GetFlag(FLAGS_worker_threads) > 0;
+  if (numa) {
+    ASSIGN_OR_RETURN(std::vector<NumaNode> nodes, ReadNumaTopology());
+    if (!nodes.empty()) numa_nodes = nodes.back().id + 1;
+    ASSIGN_OR_RETURN(numa_stats, NumaStats::Create());
+    control_registry.Register(
+        "numa", [stats = numa_stats.get()]() { return stats->Format(); });
+  }
+  std::unique_ptr<TenantThrottle> throttle;
+  if (std::string limits = absl::GetFlag(FLAGS_tenant_limits);
+      !limits.empty()) {
+    if (absl::GetFlag(FLAGS_worker_threads) == 0) {
+      return absl::InvalidArgumentError(
+          "--tenant_limits needs --worker_threads");
+    }
+    ASSIGN_OR_RETURN(throttle, TenantThrottle::Create(std::move(limits)));
+    RETURN_IF_ERROR(TenantThrottle::ReloadOnSignal(SIGUSR2));
+    control_registry.Register(
+        "tenants", [t = throttle.get()]() { return t->Format(); });
+  }
+  std::unique_ptr<RequestScheduler> scheduler;
+  if (uint32_t data_threads = absl::GetFlag(FLAGS_worker_data_threads);
+      data_threads > 0) {
+    if (data_threads >= absl::GetFlag(FLAGS_worker_threads)) {
+      return absl::InvalidArgumentError(
+          "--worker_data_threads must leave some of --worker_threads for "
+          "metadata");
+    }
+    scheduler = std::make_unique<RequestScheduler>(
+        RequestScheduler::Options{.data_threads = data_threads});
+    control_registry.Register(
+        "scheduler", [s = scheduler.get()]() { return s->Format(); });
+  }
+  std::unique_ptr<SpanRecorder> spans;
+  if (uint32_t every = absl::GetFlag(FLAGS_span_sample_every); every > 0) {
+    spans = SpanRecorder::Create({.sample_every = every});
+    control_registry.Register(
+        "spans.json", [spans = spans.get()]() { return spans->Flush(); });
+  }
+
   absl::StatusOr<PageAlignFS> pafs = PageAlignFS::Create(
       fuse_opts.mountpoint,
       {
         .kernel_entry_timeout = absl::GetFlag(FLAGS_kernel_entry_timeout),
         .kernel_attribute_timeout = absl::GetFlag(FLAGS_kernel_attribute_timeout),
+        .kernel_readdir_cache = absl::GetFlag(FLAGS_kernel_readdir_cache),
+        .adaptive_readdirplus = absl::GetFlag(FLAGS_adaptive_readdirplus),
+        .parallel_dirops = absl::GetFlag(FLAGS_parallel_dirops),
+        .negative_lookup_filter = absl::GetFlag(FLAGS_negative_lookup_filter),
+        .dentry_cache_entries = absl::GetFlag(FLAGS_dentry_cache_entries),
+        .numa_nodes = numa_nodes,
+        .control_registry = &control_registry,
+        .control_dir_name = absl::GetFlag(FLAGS_control_dir),
+        .hot_inodes = absl::GetFlag(FLAGS_hot_inodes),
+        .offload_threads = absl::GetFlag(FLAGS_offload_threads),
+        .offload_min_bytes = absl::GetFlag(FLAGS_offload_min_bytes),
       });
   RETURN_IF_ERROR(pafs.status());
 
@@ -86,6 +217,7 @@ absl::StatusOr<int> Main(int argc, char *argv[]) {
   absl::Cleanup cleanup_fuse_session = [fuse_session]() {
     fuse_session_destroy(fuse_session);
   };
+  pafs->SetSession(fuse_session);
 
   if (fuse_set_signal_handlers(fuse_session) != 0) return EXIT_FAILURE;
   absl::Cleanup cleanup_fuse_signal_handlers = [fuse_session]() {
@@ -101,10 +233,61 @@ absl::StatusOr<int> Main(int argc, char *argv[]) {
 
   fuse_daemonize(fuse_opts.foreground);
 
+  // Started after fuse_daemonize, whose fork would leave its thread behind.
+  std::unique_ptr<Tracer> tracer;
+  if (trace_fd.has_value()) {
+    ASSIGN_OR_RETURN(
+        tracer,
+        Tracer::Create(
+          *std::move(trace_fd),
+          {
+            .level = absl::GetFlag(FLAGS_trace_level),
+            .sample_every = absl::GetFlag(FLAGS_trace_sample_every),
+            .flush_interval = absl::GetFlag(FLAGS_trace_flush_interval),
+          }));
+    RETURN_IF_ERROR(Tracer::ToggleOnSignal(SIGUSR1));
+  }
+  std::unique_ptr<WorkerStats> worker_stats;
+  if (absl::GetFlag(FLAGS_worker_stats)) {
+    absl::StatusOr<std::string> waiting =
+      WorkerStats::FindWaitingFile(fuse_opts.mountpoint);
+    LOG_IF(WARNING, !waiting.ok())
+      << "Not sampling the kernel's queue: " << waiting.status();
+    worker_stats = WorkerStats::Create({
+      .waiting_file =
+        waiting.ok() ? std::optional(*std::move(waiting)) : std::nullopt,
+      .sample_interval = absl::GetFlag(FLAGS_worker_stats_interval),
+    });
+    control_registry.Register(
+        "workers", [stats = worker_stats.get()]() { return stats->Format(); });
+  }
+  std::unique_ptr<ControlSocket> control_socket;
+  if (control_fd.has_value()) {
+    ASSIGN_OR_RETURN(
+        control_socket,
+        ControlSocket::Create(*std::move(control_fd), control_registry));
+  }
+
   if (fuse_opts.singlethread) {
     return fuse_session_loop(fuse_session);
   }
 
+  if (uint32_t threads = absl::GetFlag(FLAGS_worker_threads); threads > 0) {
+    LOG_IF(WARNING, fuse_opts.clone_fd)
+      << "clone_fd is ignored with --worker_threads";
+    RETURN_IF_ERROR(
+        RunWorkerLoop(
+          fuse_session,
+          {
+            .threads = threads,
+            .cpus = std::move(worker_cpus),
+            .numa = numa,
+            .scheduler = scheduler.get(),
+            .throttle = throttle.get(),
+          }));
+    return EXIT_SUCCESS;
+  }
+
   struct fuse_loop_config *loop_config = fuse_loop_cfg_create();
   CHECK_NE(loop_config, nullptr);
   absl::Cleanup cleanup_loop_config = [loop_config]() {
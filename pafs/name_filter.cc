@@ -0,0 +1,252 @@
+#include "pafs/name_filter.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "pafs/fd.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+
+namespace pafs {
+namespace {
+
+// Four 64-bit lanes. GCC lowers this to AVX2 where available and to pairs of
+// SSE2 registers otherwise.
+typedef uint64_t U64x4 __attribute__((vector_size(32)));
+
+constexpr uint64_t kSeed = UINT64_C(0x9e3779b97f4a7c15);
+constexpr uint64_t kMul = UINT64_C(0xff51afd7ed558ccd);
+constexpr uint64_t kFinalMul = UINT64_C(0xc4ceb9fe1a85ec53);
+
+// Written once for both uint64_t and U64x4 so that the vector and scalar
+// hashes can't drift apart.
+template <typename T>
+T HashStart(T len) { return len * kMul ^ kSeed; }
+
+template <typename T>
+T HashMix(T h, T word) {
+  h ^= word;
+  h *= kMul;
+  return h ^ (h >> 29);
+}
+
+template <typename T>
+T HashFinish(T h) {
+  h ^= h >> 32;
+  h *= kFinalMul;
+  return h ^ (h >> 29);
+}
+
+size_t NumWords(std::string_view name) { return (name.size() + 7) / 8; }
+
+// The i-th 8 bytes of `name`, zero-padded.
+uint64_t LoadWord(std::string_view name, size_t i) {
+  uint64_t word = 0;
+  size_t off = i * 8;
+  std::memcpy(&word, name.data() + off, std::min<size_t>(8, name.size() - off));
+  return word;
+}
+
+}  // namespace
+
+uint64_t HashName(std::string_view name) {
+  uint64_t h = HashStart<uint64_t>(name.size());
+  for (size_t i = 0; i < NumWords(name); i++) {
+    h = HashMix(h, LoadWord(name, i));
+  }
+  return HashFinish(h);
+}
+
+void HashNames(
+    std::span<const std::string_view, 4> names, std::span<uint64_t, 4> out) {
+  U64x4 lens, nwords;
+  size_t max_words = 0;
+  for (int l = 0; l < 4; l++) {
+    lens[l] = names[l].size();
+    nwords[l] = NumWords(names[l]);
+    max_words = std::max<size_t>(max_words, nwords[l]);
+  }
+
+  U64x4 h = HashStart(lens);
+  for (size_t i = 0; i < max_words; i++) {
+    U64x4 words;
+    for (int l = 0; l < 4; l++) {
+      words[l] = i < nwords[l] ? LoadWord(names[l], i) : 0;
+    }
+    // Lanes whose name has run out keep their hash as is.
+    U64x4 live = reinterpret_cast<U64x4>(U64x4{i, i, i, i} < nwords);
+    h = (HashMix(h, words) & live) | (h & ~live);
+  }
+  h = HashFinish(h);
+
+  for (int l = 0; l < 4; l++) out[l] = h[l];
+}
+
+class NameFilter::Bits {
+ public:
+  // ~16 bits per name with 4 probes is a false positive rate of about 0.25%.
+  static constexpr uint64_t kBitsPerName = 16;
+  static constexpr int kProbes = 4;
+
+  explicit Bits(uint64_t nnames)
+    : nbits_(std::bit_ceil(std::max<uint64_t>(nnames, 64) * kBitsPerName)),
+      words_(nbits_ / 64) {}
+
+  void Add(uint64_t hash) {
+    for (uint64_t bit : Probes(hash)) {
+      words_[bit / 64] |= UINT64_C(1) << (bit % 64);
+    }
+    added_++;
+  }
+
+  bool MayContain(uint64_t hash) const {
+    for (uint64_t bit : Probes(hash)) {
+      if (!(words_[bit / 64] & (UINT64_C(1) << (bit % 64)))) return false;
+    }
+    return true;
+  }
+
+  // Past twice the size it was built for, the false positive rate is bad
+  // enough that a rebuild is worthwhile.
+  bool Saturated() const { return added_ * kBitsPerName > nbits_ * 2; }
+
+ private:
+  std::array<uint64_t, kProbes> Probes(uint64_t hash) const {
+    // Double hashing (Kirsch-Mitzenmacher).
+    uint64_t h1 = hash;
+    uint64_t h2 = (hash >> 32) | 1;
+    std::array<uint64_t, kProbes> bits;
+    for (int i = 0; i < kProbes; i++) bits[i] = (h1 + i * h2) & (nbits_ - 1);
+    return bits;
+  }
+
+  const uint64_t nbits_;
+  std::vector<uint64_t> words_;
+  uint64_t added_ = 0;
+};
+
+NameFilter::NameFilter() = default;
+NameFilter::~NameFilter() = default;
+
+bool NameFilter::MayContain(std::string_view name) const {
+  uint64_t hash = HashName(name);
+  absl::ReaderMutexLock lock(&mu_);
+  if (bits_ == nullptr) return true;
+  return bits_->MayContain(hash);
+}
+
+void NameFilter::Add(std::string_view name) {
+  uint64_t hash = HashName(name);
+  absl::MutexLock lock(&mu_);
+  if (bits_ != nullptr) {
+    bits_->Add(hash);
+    if (bits_->Saturated()) {
+      bits_ = nullptr;
+      lookups_.store(0, std::memory_order_relaxed);
+    }
+  } else if (building_) {
+    pending_.push_back(hash);
+  }
+  // Otherwise any Build starts after `name` was created, so finds it.
+}
+
+void NameFilter::Reset() {
+  absl::MutexLock lock(&mu_);
+  bits_ = nullptr;
+  lookups_.store(0, std::memory_order_relaxed);
+  if (building_) build_invalidated_ = true;
+}
+
+bool NameFilter::IsBuilt() const {
+  absl::ReaderMutexLock lock(&mu_);
+  return bits_ != nullptr;
+}
+
+bool NameFilter::ShouldBuild() {
+  if (IsBuilt()) return false;
+  return lookups_.fetch_add(1, std::memory_order_relaxed) + 1
+    == kBuildAfterLookups;
+}
+
+void NameFilter::BuildFailed() {
+  lookups_.store(0, std::memory_order_relaxed);
+}
+
+absl::Status NameFilter::Build(int dirfd) {
+  {
+    absl::MutexLock lock(&mu_);
+    if (bits_ != nullptr || building_) return absl::OkStatus();
+    building_ = true;
+    build_invalidated_ = false;
+  }
+
+  std::vector<uint64_t> hashes;
+  absl::Status scan = [&]() -> absl::Status {
+    ASSIGN_OR_RETURN(
+        FileDescriptor fd,
+        syscalls::openat(
+          dirfd, ".", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+
+    alignas(struct dirent64) char buf[64 * 1024];
+    while (true) {
+      ASSIGN_OR_RETURN(size_t nb, syscalls::getdents64(*fd, buf));
+      if (nb == 0) break;
+
+      // "." and ".." are kept, since the kernel may look up ".." in an
+      // exported filesystem.
+      std::array<std::string_view, 4> batch;
+      size_t nbatch = 0;
+      for (size_t off = 0; off < nb;) {
+        const auto *ent = reinterpret_cast<const struct dirent64 *>(buf + off);
+        off += ent->d_reclen;
+        batch[nbatch++] = ent->d_name;
+        if (nbatch < batch.size()) continue;
+
+        std::array<uint64_t, 4> out;
+        HashNames(batch, out);
+        hashes.insert(hashes.end(), out.begin(), out.end());
+        nbatch = 0;
+      }
+      // The names point into `buf`, so finish the batch before refilling it.
+      for (size_t i = 0; i < nbatch; i++) {
+        hashes.push_back(HashName(batch[i]));
+      }
+    }
+    return absl::OkStatus();
+  }();
+
+  std::unique_ptr<Bits> bits;
+  if (scan.ok()) bits = std::make_unique<Bits>(hashes.size());
+  if (bits != nullptr) {
+    for (uint64_t hash : hashes) bits->Add(hash);
+  }
+
+  absl::MutexLock lock(&mu_);
+  building_ = false;
+  std::vector<uint64_t> pending = std::move(pending_);
+  pending_.clear();
+  if (!scan.ok()) {
+    // Let a later lookup try again.
+    lookups_.store(0, std::memory_order_relaxed);
+    return scan;
+  }
+  if (build_invalidated_) return absl::OkStatus();
+
+  for (uint64_t hash : pending) bits->Add(hash);
+  bits_ = std::move(bits);
+  return absl::OkStatus();
+}
+
+}  // namespace pafs
@@ -0,0 +1,95 @@
+#ifndef PAFS_NAME_FILTER_H_
+#define PAFS_NAME_FILTER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+
+namespace pafs {
+
+// Hashes a directory entry name for NameFilter.
+uint64_t HashName(std::string_view name);
+
+// Hashes four names at once. out[i] == HashName(names[i]).
+void HashNames(
+    std::span<const std::string_view, 4> names, std::span<uint64_t, 4> out);
+
+// A Bloom filter over the names in one source directory, so that lookups of
+// names that don't exist can be answered without an openat in the source
+// filesystem.
+//
+// The filter is only correct while the directory is watched: every name that
+// appears after the scan in Build starts must be passed to Add, either by us
+// once we've created it or by the DirectoryWatcher once inotify reports it.
+// Removed names are never taken out, they just become false positives until
+// the filter is rebuilt.
+//
+// Thread-safe.
+class NameFilter {
+ public:
+  NameFilter();
+  ~NameFilter();
+
+  NameFilter(NameFilter &&) = delete;
+  NameFilter(const NameFilter &) = delete;
+  NameFilter &operator=(NameFilter &&) = delete;
+  NameFilter &operator=(const NameFilter &) = delete;
+
+  // Whether `name` may be in the directory. Always true while the filter is
+  // unbuilt.
+  bool MayContain(std::string_view name) const;
+
+  // Records that `name` is in the directory. Must be called after it's
+  // created, so that a Build scanning meanwhile either finds it or is told of
+  // it here.
+  void Add(std::string_view name);
+
+  // Throws the filter away, e.g. because inotify dropped events.
+  void Reset();
+
+  bool IsBuilt() const;
+
+  // Called on each lookup in the directory. Returns true once the directory
+  // has been looked up in enough to be worth building a filter for.
+  bool ShouldBuild();
+
+  // Builds the filter by scanning the directory `dirfd` refers to, which may
+  // be an O_PATH descriptor. The directory must already be watched. Does
+  // nothing if the filter is built or being built by another thread.
+  absl::Status Build(int dirfd);
+
+  // Called when a Build that ShouldBuild asked for couldn't start, e.g.
+  // because the directory couldn't be watched, so that a later lookup tries
+  // again.
+  void BuildFailed();
+
+ private:
+  class Bits;
+
+  // Unbuilt filters start building after this many lookups.
+  static constexpr uint64_t kBuildAfterLookups = 32;
+
+  std::atomic<uint64_t> lookups_ = 0;
+
+  // Lookups only read bits_, so they share the lock. Replaced Bits are freed
+  // under the writer lock, once no lookup can be using them.
+  mutable absl::Mutex mu_;
+  // Null while unbuilt.
+  std::unique_ptr<Bits> bits_ ABSL_GUARDED_BY(mu_);
+  bool building_ ABSL_GUARDED_BY(mu_) = false;
+  // Hashes Added while a Build is scanning.
+  std::vector<uint64_t> pending_ ABSL_GUARDED_BY(mu_);
+  // Set by Reset during a Build, whose result is then discarded.
+  bool build_invalidated_ ABSL_GUARDED_BY(mu_) = false;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_NAME_FILTER_H_
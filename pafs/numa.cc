@@ -0,0 +1,141 @@
+#include "pafs/numa.h"
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <linux/mempolicy.h>
+#include <memory>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+#include "pafs/util.h"
+
+namespace pafs {
+namespace {
+
+std::atomic<NumaStats *> current = nullptr;
+
+thread_local int thread_node = 0;
+
+absl::StatusOr<std::vector<int>> ReadList(const std::string &path) {
+  ASSIGN_OR_RETURN(std::string contents, ReadFile(path));
+  return ParseCpuList(absl::StripAsciiWhitespace(contents));
+}
+
+}  // namespace
+
+absl::StatusOr<std::vector<NumaNode>> ReadNumaTopology() {
+  constexpr std::string_view kNodeDir = "/sys/devices/system/node";
+  absl::StatusOr<std::vector<int>> ids =
+    ReadList(absl::StrCat(kNodeDir, "/online"));
+  if (absl::IsNotFound(ids.status())) return std::vector<NumaNode>(1);
+  RETURN_IF_ERROR(ids.status());
+
+  std::vector<NumaNode> nodes;
+  for (int id : *ids) {
+    ASSIGN_OR_RETURN(
+        std::vector<int> cpus,
+        ReadList(absl::StrCat(kNodeDir, "/node", id, "/cpulist")));
+    nodes.push_back({.id = id, .cpus = std::move(cpus)});
+  }
+  return nodes;
+}
+
+absl::StatusOr<std::vector<int>> ParseCpuList(std::string_view list) {
+  std::vector<int> cpus;
+  for (std::string_view range : absl::StrSplit(list, ',', absl::SkipEmpty())) {
+    std::pair<std::string_view, std::string_view> bounds =
+      absl::StrSplit(range, absl::MaxSplits('-', 1));
+    const bool is_range = range.find('-') != std::string_view::npos;
+    int first, last;
+    if (!absl::SimpleAtoi(bounds.first, &first) ||
+        !absl::SimpleAtoi(is_range ? bounds.second : bounds.first, &last) ||
+        first < 0 || last < first || last >= CPU_SETSIZE) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Bad CPU range \"", range, "\""));
+    }
+    for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+absl::Status PlaceThreadOnNode(const NumaNode &node) {
+  if (!node.cpus.empty()) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : node.cpus) CPU_SET(cpu, &cpus);
+    RETURN_IF_ERROR(syscalls::pthread_setaffinity_np(pthread_self(), cpus));
+  }
+
+  constexpr int kBits = sizeof(unsigned long) * CHAR_BIT;
+  std::vector<unsigned long> mask(node.id / kBits + 1);
+  mask[node.id / kBits] = 1UL << (node.id % kBits);
+  // Preferred rather than bound, so that a full node spills over instead of
+  // failing allocations.
+  RETURN_IF_ERROR(
+      syscalls::set_mempolicy(
+        MPOL_PREFERRED, mask.data(), mask.size() * kBits));
+  thread_node = node.id;
+  return absl::OkStatus();
+}
+
+int ThreadNumaNode() { return thread_node; }
+
+absl::StatusOr<std::unique_ptr<NumaStats>> NumaStats::Create() {
+  ASSIGN_OR_RETURN(std::vector<NumaNode> nodes, ReadNumaTopology());
+  auto stats = std::unique_ptr<NumaStats>(new NumaStats(std::move(nodes)));
+  NumaStats *expected = nullptr;
+  CHECK(current.compare_exchange_strong(expected, stats.get()))
+    << "Only one NumaStats may exist";
+  return stats;
+}
+
+NumaStats::NumaStats(std::vector<NumaNode> nodes)
+  : nodes_(std::move(nodes)),
+    num_counters_(nodes_.empty() ? 1 : nodes_.back().id + 1),
+    counters_(std::make_unique<Counters[]>(num_counters_)) {}
+
+NumaStats::~NumaStats() { current.store(nullptr); }
+
+void NumaStats::RecordInodeAccess(int home_node) {
+  NumaStats *stats = current.load(std::memory_order_acquire);
+  if (stats == nullptr) return;
+  size_t node = static_cast<size_t>(thread_node);
+  if (node >= stats->num_counters_) return;
+  Counters &counters = stats->counters_[node];
+  (home_node == thread_node ? counters.local : counters.remote)
+    .fetch_add(1, std::memory_order_relaxed);
+}
+
+std::string NumaStats::Format() const {
+  std::string out = absl::StrFormat(
+      "%-6s %6s %14s %14s %8s\n", "node", "cpus", "inode local",
+      "inode remote", "remote");
+  for (const NumaNode &node : nodes_) {
+    const Counters &counters = counters_[node.id];
+    uint64_t local = counters.local.load(std::memory_order_relaxed);
+    uint64_t remote = counters.remote.load(std::memory_order_relaxed);
+    double share = local + remote == 0
+      ? 0 : 100.0 * static_cast<double>(remote) / (local + remote);
+    absl::StrAppendFormat(
+        &out, "%-6d %6d %14d %14d %7.1f%%\n", node.id, node.cpus.size(), local,
+        remote, share);
+  }
+  return out;
+}
+
+}  // namespace pafs
@@ -0,0 +1,76 @@
+#ifndef PAFS_NUMA_H_
+#define PAFS_NUMA_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+namespace pafs {
+
+struct NumaNode {
+  int id = 0;
+  // Online CPUs, ascending.
+  std::vector<int> cpus;
+};
+
+// The online NUMA nodes, from sysfs. A kernel without NUMA support has no
+// nodes there, and is reported as a single node 0 with no CPUs listed.
+absl::StatusOr<std::vector<NumaNode>> ReadNumaTopology();
+
+// Parses a list of CPUs like "0-3,8,10-11", as in cpuset(7).
+absl::StatusOr<std::vector<int>> ParseCpuList(std::string_view list);
+
+// Pins the calling thread to `node`'s CPUs, if any are listed, and has the
+// kernel prefer `node`'s memory for the thread's allocations from then on,
+// so that e.g. its RequestArena and receive buffer are local to it.
+absl::Status PlaceThreadOnNode(const NumaNode &node);
+
+// The node the calling thread was placed on, or 0 if it wasn't.
+int ThreadNumaNode();
+
+// Counts, for each NUMA node, how often its threads used an Inode that was
+// created on another node, and so whose state likely lives in that node's
+// memory.
+//
+// Only one NumaStats may exist at a time.
+class NumaStats {
+ public:
+  static absl::StatusOr<std::unique_ptr<NumaStats>> Create();
+  ~NumaStats();
+
+  NumaStats(NumaStats &&) = delete;
+  NumaStats(const NumaStats &) = delete;
+  NumaStats &operator=(NumaStats &&) = delete;
+  NumaStats &operator=(const NumaStats &) = delete;
+
+  // Called as the calling thread uses an Inode created on `home_node`. Does
+  // nothing unless a NumaStats exists.
+  static void RecordInodeAccess(int home_node);
+
+  // For ControlRegistry.
+  std::string Format() const;
+
+ private:
+  // Each node's threads write only their own, on its own cache line.
+  struct alignas(64) Counters {
+    std::atomic<uint64_t> local = 0;
+    std::atomic<uint64_t> remote = 0;
+  };
+
+  explicit NumaStats(std::vector<NumaNode> nodes);
+
+  const std::vector<NumaNode> nodes_;
+  // Indexed by node ID.
+  const size_t num_counters_;
+  std::unique_ptr<Counters[]> counters_;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_NUMA_H_
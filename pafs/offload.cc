@@ -0,0 +1,130 @@
+#include "pafs/offload.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "pafs/arena.h"
+#include "pafs/fuse.h"
+#include "pafs/op.h"
+#include "pafs/syscall_stats.h"
+#include "pafs/util.h"
+
+namespace pafs {
+void OffloadExecutor::Latency::Add(uint64_t ns) {
+  total_ns.fetch_add(ns, std::memory_order_relaxed);
+  uint64_t max = max_ns.load(std::memory_order_relaxed);
+  while (ns > max &&
+         !max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+}
+
+OffloadExecutor::OffloadExecutor(size_t threads) {
+  CHECK_GT(threads, 0u);
+  for (size_t i = 0; i < threads; i++) {
+    threads_.emplace_back([this]() { Run(); });
+  }
+}
+
+OffloadExecutor::~OffloadExecutor() {
+  {
+    absl::MutexLock lock(&mu_);
+    stopping_ = true;
+  }
+  for (std::thread &thread : threads_) thread.join();
+}
+
+void OffloadExecutor::Submit(FuseRequest req, Task task) {
+  by_op_[static_cast<size_t>(req.GetOp())].fetch_add(
+      1, std::memory_order_relaxed);
+  absl::MutexLock lock(&mu_);
+  jobs_.push_back({
+    .req = std::move(req),
+    .task = std::move(task),
+    .queued_ns = MonotonicNanos(),
+  });
+  outstanding_++;
+  peak_outstanding_ = std::max(peak_outstanding_, outstanding_);
+}
+
+void OffloadExecutor::Drain() {
+  absl::MutexLock lock(&mu_);
+  mu_.Await(absl::Condition(
+      +[](size_t *outstanding) { return *outstanding == 0; }, &outstanding_));
+}
+
+void OffloadExecutor::Run() {
+  while (true) {
+    std::optional<Job> job;
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.Await(absl::Condition(
+          +[](OffloadExecutor *e) ABSL_EXCLUSIVE_LOCKS_REQUIRED(e->mu_) {
+            return !e->jobs_.empty() || e->stopping_;
+          },
+          this));
+      if (jobs_.empty()) return;
+      job.emplace(std::move(jobs_.front()));
+      jobs_.pop_front();
+    }
+
+    const uint64_t start_ns = MonotonicNanos();
+    wait_.Add(start_ns - job->queued_ns);
+    SyscallStats::ResumeRequest(job->req.GetOp());
+    absl::Status status = job->task(job->req);
+    job->req.ReplyAlwaysAndLogIfNotOk(status);
+    SyscallStats::EndRequest();
+    RequestArena().Reset();
+    run_.Add(MonotonicNanos() - start_ns);
+    completed_.fetch_add(1, std::memory_order_relaxed);
+
+    absl::MutexLock lock(&mu_);
+    outstanding_--;
+  }
+}
+
+std::string OffloadExecutor::Format() const {
+  const uint64_t completed = completed_.load(std::memory_order_relaxed);
+  const auto mean_us = [completed](const Latency &l) {
+    return completed == 0
+      ? 0
+      : static_cast<double>(l.total_ns.load(std::memory_order_relaxed)) /
+        1000 / static_cast<double>(completed);
+  };
+  const auto max_us = [](const Latency &l) {
+    return static_cast<double>(l.max_ns.load(std::memory_order_relaxed)) /
+      1000;
+  };
+
+  std::string out;
+  {
+    absl::MutexLock lock(&mu_);
+    absl::StrAppendFormat(
+        &out,
+        "threads: %d\n"
+        "requests: %d completed\n"
+        "queue: %d now, %d outstanding, %d peak outstanding\n",
+        threads_.size(), completed, jobs_.size(), outstanding_,
+        peak_outstanding_);
+  }
+  absl::StrAppendFormat(
+      &out,
+      "queued: %.1f us mean, %.1f us max\n"
+      "run: %.1f us mean, %.1f us max\n",
+      mean_us(wait_), max_us(wait_), mean_us(run_), max_us(run_));
+  for (size_t i = 0; i < kNumOps; i++) {
+    if (uint64_t n = by_op_[i].load(std::memory_order_relaxed); n != 0) {
+      absl::StrAppendFormat(&out, "%s: %d\n", OpName(static_cast<Op>(i)), n);
+    }
+  }
+  return out;
+}
+
+}  // namespace pafs
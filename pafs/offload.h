@@ -0,0 +1,83 @@
+#ifndef PAFS_OFFLOAD_H_
+#define PAFS_OFFLOAD_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/functional/any_invocable.h"
+#include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
+#include "pafs/fuse.h"
+#include "pafs/op.h"
+
+namespace pafs {
+
+// Runs slow requests, e.g. fsyncs, on threads of its own, so that they don't
+// hold up the session loop's. A simple pool: the threads take requests from
+// one queue, oldest first.
+//
+// Thread-safe.
+class OffloadExecutor {
+ public:
+  // Handles the request, as an op handler would. Runs after the handler that
+  // submitted it has returned, so must own everything it uses.
+  using Task = absl::AnyInvocable<absl::Status(FuseRequest &)>;
+
+  explicit OffloadExecutor(size_t threads);
+  // Runs everything queued, then stops the threads.
+  ~OffloadExecutor();
+
+  OffloadExecutor(OffloadExecutor &&) = delete;
+  OffloadExecutor(const OffloadExecutor &) = delete;
+  OffloadExecutor &operator=(OffloadExecutor &&) = delete;
+  OffloadExecutor &operator=(const OffloadExecutor &) = delete;
+
+  // Runs `task` on `req`, from FuseRequest::Offload, on one of the
+  // executor's threads, then replies as ReplyAlwaysAndLogIfNotOk does.
+  void Submit(FuseRequest req, Task task);
+
+  // Waits until everything submitted so far has been replied to.
+  void Drain();
+
+  // For ControlRegistry.
+  std::string Format() const;
+
+ private:
+  struct Job {
+    FuseRequest req;
+    Task task;
+    uint64_t queued_ns;
+  };
+  struct Latency {
+    std::atomic<uint64_t> total_ns = 0;
+    std::atomic<uint64_t> max_ns = 0;
+
+    void Add(uint64_t ns);
+  };
+
+  void Run();
+
+  mutable absl::Mutex mu_;
+  std::deque<Job> jobs_ ABSL_GUARDED_BY(mu_);
+  // Submitted and not yet replied to.
+  size_t outstanding_ ABSL_GUARDED_BY(mu_) = 0;
+  size_t peak_outstanding_ ABSL_GUARDED_BY(mu_) = 0;
+  bool stopping_ ABSL_GUARDED_BY(mu_) = false;
+
+  std::atomic<uint64_t> completed_ = 0;
+  std::atomic<uint64_t> by_op_[kNumOps] = {};
+  Latency wait_;
+  Latency run_;
+
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_OFFLOAD_H_
@@ -0,0 +1,63 @@
+#include "pafs/op.h"
+
+#include <array>
+#include <string_view>
+
+namespace pafs {
+namespace {
+
+constexpr std::array<std::string_view, kNumOps> kOpNames = {
+  "Unknown",
+  "Lookup",
+  "Forget",
+  "GetAttr",
+  "SetAttr",
+  "ReadLink",
+  "Mknod",
+  "Mkdir",
+  "Unlink",
+  "Rmdir",
+  "Symlink",
+  "Rename",
+  "Link",
+  "Open",
+  "Read",
+  "Write",
+  "Flush",
+  "Release",
+  "FSync",
+  "OpenDir",
+  "ReadDir",
+  "ReleaseDir",
+  "FSyncDir",
+  "StatFS",
+  "SetXAttr",
+  "GetXAttr",
+  "ListXAttr",
+  "RemoveXAttr",
+  "Access",
+  "Create",
+  "GetLk",
+  "SetLk",
+  "BMap",
+  "IOCtl",
+  "Poll",
+  "WriteBuf",
+  "RetrieveReply",
+  "ForgetMulti",
+  "FLock",
+  "FAllocate",
+  "ReadDirPlus",
+  "CopyFileRange",
+  "LSeek",
+};
+
+}  // namespace
+
+std::string_view OpName(Op op) {
+  size_t i = static_cast<size_t>(op);
+  if (i >= kOpNames.size()) return kOpNames[0];
+  return kOpNames[i];
+}
+
+}  // namespace pafs
@@ -0,0 +1,86 @@
+#ifndef PAFS_OP_H_
+#define PAFS_OP_H_
+
+#ifndef FUSE_USE_VERSION
+// Needed by fuse/fuse_lowlevel.h
+#define FUSE_USE_VERSION 312
+#elif FUSE_USE_VERSION != 312
+#error this file is written for fuse 3.12
+#endif
+
+#include <cstdint>
+#include <string_view>
+
+#include "fuse/fuse_lowlevel.h"
+
+namespace pafs {
+
+// The fuse_lowlevel_ops a request is for. The values are written to trace
+// files, so only append.
+enum class Op : uint8_t {
+  kUnknown = 0,
+  kLookup,
+  kForget,
+  kGetAttr,
+  kSetAttr,
+  kReadLink,
+  kMknod,
+  kMkdir,
+  kUnlink,
+  kRmdir,
+  kSymlink,
+  kRename,
+  kLink,
+  kOpen,
+  kRead,
+  kWrite,
+  kFlush,
+  kRelease,
+  kFSync,
+  kOpenDir,
+  kReadDir,
+  kReleaseDir,
+  kFSyncDir,
+  kStatFS,
+  kSetXAttr,
+  kGetXAttr,
+  kListXAttr,
+  kRemoveXAttr,
+  kAccess,
+  kCreate,
+  kGetLk,
+  kSetLk,
+  kBMap,
+  kIOCtl,
+  kPoll,
+  kWriteBuf,
+  kRetrieveReply,
+  kForgetMulti,
+  kFLock,
+  kFAllocate,
+  kReadDirPlus,
+  kCopyFileRange,
+  kLSeek,
+};
+inline constexpr size_t kNumOps = static_cast<size_t>(Op::kLSeek) + 1;
+
+// e.g. "Lookup". "Unknown" for values out of range.
+std::string_view OpName(Op op);
+
+// What a request is for, as known before it's handled. The meaning of `arg0`
+// and `arg1` depends on the op; see GetFuse*Op in fuse_ops.h.
+struct OpInfo {
+  Op op = Op::kUnknown;
+  fuse_ino_t ino = 0;
+  std::string_view name;
+  // Rename's new name, or Symlink's target.
+  std::string_view name2;
+  uint64_t arg0 = 0;
+  uint64_t arg1 = 0;
+  // The file handle of a request on an open file or directory.
+  uint64_t fh = 0;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_OP_H_
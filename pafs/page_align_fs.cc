@@ -7,7 +7,10 @@
 
 #include "pafs/page_align_fs.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <memory>
+#include <optional>
 #include <poll.h>
 #include <cstdlib>
 #include <iostream>
@@ -15,20 +18,29 @@
 #include <sys/statvfs.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <string>
 #include <utility>
 #include <linux/fs.h>
+#include <sys/inotify.h>
 
+#include "pafs/arena.h"
 #include "pafs/inode.h"
 #include "absl/functional/any_invocable.h"
 #include "absl/cleanup/cleanup.h"
 #include "absl/utility/utility.h"
 #include "pafs/fd.h"
 #include "pafs/dir.h"
+#include "pafs/dir_watcher.h"
+#include "pafs/hot_inodes.h"
+#include "pafs/name_filter.h"
+#include "pafs/numa.h"
+#include "pafs/offload.h"
 #include "absl/cleanup/cleanup.h"
 #include "absl/log/check.h"
 #include "absl/log/log.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
 #include "absl/time/time.h"
 #include "fuse/fuse_lowlevel.h"
 #include "pafs/fuse.h"
@@ -36,6 +48,22 @@
 
 
 namespace pafs {
+namespace {
+
+// inotify events that change which names are in a directory.
+constexpr uint32_t kDirectoryEntryEvents =
+  IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+// Whether shrinking `st`'s file to `size` frees at least `bytes` of its
+// allocation, which is what makes truncates and unlinks slow. With `size` 0,
+// whether it has that much allocated, which bounds what an fsync writes back.
+bool FreesAtLeast(const struct stat &st, off_t size, uint64_t bytes) {
+  const uint64_t allocated = static_cast<uint64_t>(st.st_blocks) * 512;
+  const auto kept = static_cast<uint64_t>(std::max<off_t>(size, 0));
+  return allocated > kept && allocated - kept >= bytes;
+}
+
+}  // namespace
 
 absl::Status PageAlignFS::Init(struct fuse_conn_info &conn) {
   LOG(INFO)
@@ -48,50 +76,163 @@ absl::Status PageAlignFS::Init(struct fuse_conn_info &conn) {
   LOG(INFO) << "Maximum background requests is " << conn.max_background;
   LOG(INFO) << "Congestion threshold is " << conn.congestion_threshold;
   // TODO set FUSE_CAP_EXPORT_SUPPORT
+
+  // Lookups and creates in the same directory may run concurrently. Our
+  // InodeCache and Inodes are thread-safe, and each handler only touches the
+  // source directory through *at syscalls, which the source filesystem
+  // serializes as needed.
+  if (opts_.parallel_dirops && (conn.capable & FUSE_CAP_PARALLEL_DIROPS)) {
+    conn.want |= FUSE_CAP_PARALLEL_DIROPS;
+  } else {
+    conn.want &= ~FUSE_CAP_PARALLEL_DIROPS;
+  }
+  LOG(INFO)
+    << "PARALLEL_DIROPS is "
+    << ((conn.want & FUSE_CAP_PARALLEL_DIROPS) ? "on" : "off");
+
+  // Ask for READDIRPLUS explicitly rather than relying on libfuse's defaults.
+  // With READDIRPLUS_AUTO the kernel only sends READDIRPLUS for directories
+  // whose entries are being looked up, and ReadDirPlusPolicy then decides
+  // whether we fill in attributes.
+  if (conn.capable & FUSE_CAP_READDIRPLUS) {
+    conn.want |= FUSE_CAP_READDIRPLUS;
+    if (conn.capable & FUSE_CAP_READDIRPLUS_AUTO) {
+      conn.want |= FUSE_CAP_READDIRPLUS_AUTO;
+    }
+  }
+  LOG(INFO)
+    << "READDIRPLUS is " << ((conn.want & FUSE_CAP_READDIRPLUS) ? "on" : "off")
+    << ", READDIRPLUS_AUTO is "
+    << ((conn.want & FUSE_CAP_READDIRPLUS_AUTO) ? "on" : "off");
+
+  if (opts_.kernel_readdir_cache && session_ == nullptr) {
+    return absl::FailedPreconditionError(
+        "kernel_readdir_cache requires SetSession; not caching listings");
+  }
+  if (opts_.kernel_readdir_cache || opts_.negative_lookup_filter ||
+      dentries_ != nullptr) {
+    ASSIGN_OR_RETURN(
+        watcher_,
+        DirectoryWatcher::Create([this](const DirectoryEvent &event) {
+          OnDirectoryEvent(event);
+        }));
+  }
+  // Started here rather than on construction, since main daemonizes in
+  // between, and threads don't survive the fork.
+  if (dentries_ != nullptr && opts_.control_registry != nullptr) {
+    opts_.control_registry->Register(
+        "dentries", [dentries = dentries_.get()]() {
+          return dentries->Format();
+        });
+  }
+  if (opts_.offload_threads > 0) {
+    offload_ = std::make_unique<OffloadExecutor>(opts_.offload_threads);
+    if (opts_.control_registry != nullptr) {
+      opts_.control_registry->Register(
+          "offload", [offload = offload_.get()]() {
+            return offload->Format();
+          });
+    }
+  }
   return absl::OkStatus();
 }
 
-// TODO remove this method?
 absl::Status PageAlignFS::Destroy() {
   LOG(INFO) << "Destroy()";
+  if (dentries_ != nullptr) {
+    DentryCache::Stats stats = dentries_->GetStats();
+    LOG(INFO)
+      << "Dentry cache hits:" << stats.hits << ", misses:" << stats.misses
+      << ", stale:" << stats.stale << ", evictions:" << stats.evictions;
+  }
+  // Offloaded requests must be replied to while the session is still up.
+  if (offload_ != nullptr) offload_->Drain();
+  if (watcher_ != nullptr) watcher_->Stop();
   return absl::OkStatus();
 }
 
 absl::Status PageAlignFS::Forget(
     FuseRequest &req, fuse_ino_t ino, uint64_t nlookup) {
+  if (IsControl(ino)) return absl::OkStatus();
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "Forget() ino:" << inode << ", nlookup:" << nlookup;
   return inodes_.Unref(inode, nlookup);
 }
 
 absl::Status PageAlignFS::Lookup(
-    FuseRequest &req, fuse_ino_t parent, std::string_view name) {
+    FuseRequest &req, fuse_ino_t parent, CStringView name) {
+  if (IsControl(parent)) return control_->Lookup(req, name);
+  if (IsControl(parent, name)) return control_->LookupSelf(req);
   Inode &parent_ino = GetInode(parent);
-  LOG(INFO) << "Lookup() parent:" << parent_ino << ", name:" << name;
-  return ReplyWithLookup(req, parent_ino, name);
+  ReadDirPlusPolicy *policy = parent_ino.GetReadDirPlusPolicy();
+  if (dentries_ != nullptr) {
+    if (std::optional<DentryCache::Entry> entry =
+          dentries_->Find(parent_ino, name)) {
+      RETURN_IF_ERROR(ReplyWithEntryParam(req, *entry->inode, entry->param));
+      if (policy != nullptr) policy->OnEntryUsed();
+      return absl::OkStatus();
+    }
+  }
+  if (NameFilter *filter = parent_ino.GetNameFilter();
+      filter != nullptr && opts_.negative_lookup_filter) {
+    if (filter->ShouldBuild()) {
+      LOG_IF_ERROR(WARNING, BuildNameFilter(parent_ino));
+    }
+    if (!filter->MayContain(name)) return req.ReplyErrno(ENOENT);
+  }
+  RETURN_IF_ERROR(ReplyWithLookup(req, parent_ino, name));
+  if (policy != nullptr) policy->OnEntryUsed();
+  return absl::OkStatus();
 }
 
 absl::Status PageAlignFS::GetAttr(FuseRequest &req, fuse_ino_t ino) {
+  if (IsControl(ino)) return control_->GetAttr(req, ino);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "GetAttr() ino:" << inode;
-  return ReplyWithAttrs(req, inode);
+  RETURN_IF_ERROR(ReplyWithAttrs(req, inode));
+  // Fetching attributes ReadDirPlus gave out means they were used.
+  if (std::shared_ptr<ReadDirPlusPolicy> policy = inode.TakeListedBy()) {
+    policy->OnEntryUsed();
+  }
+  return absl::OkStatus();
 }
 
 absl::Status PageAlignFS::SetAttr(
     FuseRequest &req, fuse_ino_t ino, struct stat &attr, int to_set,
     struct fuse_file_info &fi) {
+  if (IsControl(ino)) return req.ReplyErrno(EPERM);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "SetAttr() ino:" << inode;
+  if (offload_ != nullptr && (to_set & FUSE_SET_ATTR_SIZE)) {
+    if (ErrnoOr<struct stat> st = inode.Stat();
+        st.ok() && FreesAtLeast(*st, attr.st_size, opts_.offload_min_bytes)) {
+      return Offload(
+          req,
+          [this, inode = &inode, attr, to_set, fi](FuseRequest &req) {
+            return SetAttrInternal(req, *inode, attr, to_set, fi);
+          });
+    }
+  }
+  return SetAttrInternal(req, inode, attr, to_set, fi);
+}
 
+absl::Status PageAlignFS::SetAttrInternal(
+    FuseRequest &req, Inode &inode, const struct stat &attr, int to_set,
+    const fuse_file_info &fi) {
+  // After the changes, even partial ones, so that a concurrent lookup can't
+  // cache attributes from before them.
+  absl::Cleanup bump_epoch = [&inode]() { inode.BumpAttrEpoch(); };
+
+  // Ownership can be changed through the O_PATH fd; everything else needs a
+  // real one.
   std::optional<FileDescriptor> myfd;
   int fd = fi.fh;
-  if (fd == 0) {
-    ASSIGN_OR_RETURN(
-        myfd,
-        syscalls::open(
-          absl::StrCat("/proc/self/fd/", inode.GetFD()).c_str(),
-          O_RDONLY | O_CLOEXEC));
-    fd = *(*myfd);
+  if (fd == 0 &&
+      (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_SIZE | FUSE_SET_ATTR_ATIME |
+                 FUSE_SET_ATTR_MTIME))) {
+    if (ErrnoOr<int> readable = inode.GetReadableFD(); readable.ok()) {
+      fd = *readable;
+    } else {
+      ASSIGN_OR_RETURN(myfd, inode.Reopen(O_RDONLY | O_CLOEXEC));
+      fd = *(*myfd);
+    }
   }
 
   if (to_set & FUSE_SET_ATTR_MODE) {
@@ -106,7 +247,8 @@ absl::Status PageAlignFS::SetAttr(
 
     RETURN_IF_ERROR(
         syscalls::fchownat(
-          fd, /*path=*/"", uid, gid, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW));
+          inode.GetFD(), /*path=*/"", uid, gid,
+          AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW));
   }
 
   if (to_set & FUSE_SET_ATTR_SIZE) {
@@ -140,8 +282,8 @@ absl::Status PageAlignFS::SetAttr(
 }
 
 absl::Status PageAlignFS::ReadLink(FuseRequest &req, fuse_ino_t ino) {
+  if (IsControl(ino)) return req.ReplyErrno(EINVAL);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "ReadLink() ino:" << inode;
 
   // TODO make this a dynamically growing buffer
   char buf[PATH_MAX + 1];
@@ -149,19 +291,33 @@ absl::Status PageAlignFS::ReadLink(FuseRequest &req, fuse_ino_t ino) {
       ssize_t nb,
       syscalls::readlinkat(inode.GetFD(), /*pathname=*/"", {buf, sizeof(buf)}));
   if (nb == sizeof(buf)) return ErrnoToStatus(ENAMETOOLONG, "Path too long");
+  buf[nb] = '\0';
 
-  return req.ReplyReadLink({buf, static_cast<size_t>(nb)});
+  return req.ReplyReadLink(buf);
 }
 
 absl::Status PageAlignFS::OpenDir(
     FuseRequest &req, fuse_ino_t ino, fuse_file_info &fi) {
+  if (IsControl(ino)) return control_->OpenDir(req, ino, fi);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "OpenDir() ino:" << inode;
   ASSIGN_OR_RETURN(
       FileDescriptor dirfd,
       syscalls::openat(
         inode.GetFD(), /*path=*/".", O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
   ASSIGN_OR_RETURN(auto d, Directory::Create(std::move(dirfd)));
+
+  LOG_IF_ERROR(WARNING, BuildNameFilter(inode));
+
+  if (opts_.kernel_readdir_cache) {
+    // Only let the kernel cache the listing if we'll hear about changes to it.
+    if (absl::Status st = WatchDirectory(inode); st.ok()) {
+      fi.cache_readdir = 1;
+      fi.keep_cache = 1;
+    } else {
+      LOG(WARNING) << "Not caching listing of " << inode << ": " << st;
+    }
+  }
+
   auto *dir = new Directory(std::move(d));
   static_assert(sizeof(fi.fh) >= sizeof(dir));
   fi.fh = reinterpret_cast<decltype(fi.fh)>(dir);
@@ -170,8 +326,7 @@ absl::Status PageAlignFS::OpenDir(
 
 absl::Status PageAlignFS::ReleaseDir(
     FuseRequest &req, fuse_ino_t ino, fuse_file_info &fi) {
-  Inode &inode = GetInode(ino);
-  LOG(INFO) << "ReleaseDir() ino:" << inode;
+  if (IsControl(ino)) return absl::OkStatus();
   delete reinterpret_cast<Directory *>(fi.fh);
   return absl::OkStatus();
 }
@@ -179,127 +334,181 @@ absl::Status PageAlignFS::ReleaseDir(
 absl::Status PageAlignFS::ReadDir(
     FuseRequest &req, fuse_ino_t ino, size_t size, off_t off,
     fuse_file_info &fi) {
+  if (IsControl(ino)) {
+    return control_->ReadDir(req, ino, size, off, /*plus=*/false);
+  }
   Inode &inode = GetInode(ino);
-  LOG(INFO)
-    << "ReadDir() ino:" << inode << ", off:" << off << ", size:" << size;
   return ReadDirInternal(req, inode, size, off, fi, /*plus=*/false);
 }
 
 absl::Status PageAlignFS::ReadDirPlus(
     FuseRequest &req, fuse_ino_t ino, size_t size, off_t off,
     fuse_file_info &fi) {
+  if (IsControl(ino)) {
+    return control_->ReadDir(req, ino, size, off, /*plus=*/true);
+  }
   Inode &inode = GetInode(ino);
-  LOG(INFO)
-    << "ReadDirPlus() ino:" << inode << ", off:" << off << ", size:" << size;
   return ReadDirInternal(req, inode, size, off, fi, /*plus=*/true);
 }
 
 absl::Status PageAlignFS::ForgetMulti(
     FuseRequest &req, std::span<fuse_forget_data> forgets) {
-  LOG(INFO) << "ForgetMulti() forgets:" << forgets.size();
   // TODO implement this as a batch call into inodes_
   for (const fuse_forget_data &forget : forgets) {
+    if (IsControl(forget.ino)) continue;
     RETURN_IF_ERROR(inodes_.Unref(GetInode(forget.ino), forget.nlookup));
   }
   return absl::OkStatus();
 }
 
 absl::Status PageAlignFS::Mknod(
-    FuseRequest &req, fuse_ino_t parent, std::string_view name, mode_t mode,
+    FuseRequest &req, fuse_ino_t parent, CStringView name, mode_t mode,
     dev_t rdev) {
+  if (IsControl(parent) || IsControl(parent, name)) {
+    return req.ReplyErrno(EPERM);
+  }
   Inode &parent_ino = GetInode(parent);
-  LOG(INFO)
-    << "Mknod() parent:" << parent_ino << ", name:" << name << ", mode:" << mode
-    << ", rdev:" << rdev;
-  RETURN_IF_ERROR(
-      syscalls::mknodat(
-        parent_ino.GetFD(), std::string(name).c_str(), mode, rdev));
+  REPLY_IF_ERRNO(
+      req, syscalls::mknodat(parent_ino.GetFD(), name, mode, rdev));
+  AddToNameFilter(parent_ino, name);
+  InvalidateEntry(parent_ino, name);
   return ReplyWithLookup(req, parent_ino, name);
 }
 
 absl::Status PageAlignFS::Mkdir(
-    FuseRequest &req, fuse_ino_t parent, std::string_view name, mode_t mode) {
+    FuseRequest &req, fuse_ino_t parent, CStringView name, mode_t mode) {
+  if (IsControl(parent) || IsControl(parent, name)) {
+    return req.ReplyErrno(EPERM);
+  }
   Inode &parent_ino = GetInode(parent);
-  LOG(INFO)
-    << "Mkdir() parent:" << parent_ino << ", name:" << name << ", mode:"
-    << mode;
-  RETURN_IF_ERROR(
-      syscalls::mkdirat(
-        parent_ino.GetFD(), std::string(name).c_str(), mode));
+  REPLY_IF_ERRNO(req, syscalls::mkdirat(parent_ino.GetFD(), name, mode));
+  AddToNameFilter(parent_ino, name);
+  InvalidateEntry(parent_ino, name);
   return ReplyWithLookup(req, parent_ino, name);
 }
 
 absl::Status PageAlignFS::Unlink(
-    FuseRequest &req, fuse_ino_t ino, std::string_view name) {
+    FuseRequest &req, fuse_ino_t ino, CStringView name) {
+  if (IsControl(ino) || IsControl(ino, name)) return req.ReplyErrno(EPERM);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "Unlink() ino:" << inode << ", name:" << name;
-  return syscalls::unlinkat(inode.GetFD(), std::string(name).c_str());
+  // One stat serves both finding the child and deciding whether to offload.
+  std::optional<struct stat> st;
+  if (dentries_ != nullptr || offload_ != nullptr) {
+    if (ErrnoOr<struct stat> child_st = syscalls::fstatat(
+          inode.GetFD(), name.c_str(), AT_SYMLINK_NOFOLLOW);
+        child_st.ok()) {
+      st = *child_st;
+    }
+  }
+  std::shared_ptr<Inode> child = st.has_value() ? FindChild(*st) : nullptr;
+  // Unlinking the last link to a file frees its blocks.
+  if (offload_ != nullptr) {
+    if (st.has_value() && S_ISREG(st->st_mode) && st->st_nlink == 1 &&
+        FreesAtLeast(*st, 0, opts_.offload_min_bytes)) {
+      return Offload(
+          req,
+          [this, inode = &inode, name = std::string(name),
+           child = std::move(child)](FuseRequest &req) {
+            REPLY_IF_ERRNO(req, syscalls::unlinkat(inode->GetFD(), name));
+            InvalidateEntry(*inode, name);
+            if (child != nullptr) child->BumpAttrEpoch();
+            return absl::OkStatus();
+          });
+    }
+  }
+  REPLY_IF_ERRNO(req, syscalls::unlinkat(inode.GetFD(), name));
+  InvalidateEntry(inode, name);
+  // Its link count changed.
+  if (child != nullptr) child->BumpAttrEpoch();
+  return absl::OkStatus();
 }
 
 absl::Status PageAlignFS::Rmdir(
-    FuseRequest &req, fuse_ino_t ino, std::string_view name) {
+    FuseRequest &req, fuse_ino_t ino, CStringView name) {
+  if (IsControl(ino) || IsControl(ino, name)) return req.ReplyErrno(EPERM);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "Rmdir() ino:" << inode << ", name:" << name;
-  return syscalls::unlinkat(
-        inode.GetFD(), std::string(name).c_str(), AT_REMOVEDIR);
+  std::shared_ptr<Inode> child = FindChild(inode, name);
+  REPLY_IF_ERRNO(
+      req, syscalls::unlinkat(inode.GetFD(), name, AT_REMOVEDIR));
+  InvalidateEntry(inode, name);
+  if (child != nullptr) child->BumpAttrEpoch();
+  return absl::OkStatus();
 }
 
 absl::Status PageAlignFS::Symlink(
-    FuseRequest &req, std::string_view link, fuse_ino_t parent,
-    std::string_view name) {
+    FuseRequest &req, CStringView link, fuse_ino_t parent,
+    CStringView name) {
+  if (IsControl(parent) || IsControl(parent, name)) {
+    return req.ReplyErrno(EPERM);
+  }
   Inode &parent_ino = GetInode(parent);
-  LOG(INFO)
-    << "Symlink() link:" << link << ", parent:" << parent_ino << ", name:"
-    << name;
-  RETURN_IF_ERROR(
-      syscalls::symlinkat(
-        std::string(link).c_str(), parent_ino.GetFD(),
-        std::string(name).c_str()));
+  REPLY_IF_ERRNO(
+      req, syscalls::symlinkat(link, parent_ino.GetFD(), name));
+  AddToNameFilter(parent_ino, name);
+  InvalidateEntry(parent_ino, name);
   return ReplyWithLookup(req, parent_ino, name);
 }
 
 absl::Status PageAlignFS::Rename(
-    FuseRequest &req, fuse_ino_t parent, std::string_view name,
-    fuse_ino_t newparent, std::string_view newname, unsigned int flags) {
+    FuseRequest &req, fuse_ino_t parent, CStringView name,
+    fuse_ino_t newparent, CStringView newname, unsigned int flags) {
+  if (IsControl(parent) || IsControl(parent, name) || IsControl(newparent) ||
+      IsControl(newparent, newname)) {
+    return req.ReplyErrno(EPERM);
+  }
   Inode &parent_ino = GetInode(parent);
   Inode &newparent_ino = GetInode(newparent);
-  LOG(INFO)
-    << "Rename() parent:" << parent_ino << ", name:" << name << ", newparent:"
-    << newparent_ino << ", newname:" << newname << ", flags:" << flags;
-
-  return syscalls::renameat2(
-      parent_ino.GetFD(), name,
-      newparent_ino.GetFD(), newname,
-      flags);
+  // The renamed file's ctime changes, and a replaced one loses a link.
+  std::shared_ptr<Inode> moved = FindChild(parent_ino, name);
+  std::shared_ptr<Inode> replaced = FindChild(newparent_ino, newname);
+
+  REPLY_IF_ERRNO(
+      req,
+      syscalls::renameat2(
+        parent_ino.GetFD(), name,
+        newparent_ino.GetFD(), newname,
+        flags));
+  AddToNameFilter(newparent_ino, newname);
+  InvalidateEntry(parent_ino, name);
+  InvalidateEntry(newparent_ino, newname);
+  if (moved != nullptr) moved->BumpAttrEpoch();
+  if (replaced != nullptr) replaced->BumpAttrEpoch();
+  return absl::OkStatus();
 }
 
 absl::Status PageAlignFS::Link(
     FuseRequest &req, fuse_ino_t ino,
-    fuse_ino_t newparent, std::string_view newname) {
+    fuse_ino_t newparent, CStringView newname) {
+  if (IsControl(ino) || IsControl(newparent) ||
+      IsControl(newparent, newname)) {
+    return req.ReplyErrno(EPERM);
+  }
   Inode &inode = GetInode(ino);
   Inode &newparent_ino = GetInode(newparent);
-  LOG(INFO)
-    << "Link() ino:" << inode << ", newparent:" << newparent_ino << ", newname:"
-    << newname;
 
-  RETURN_IF_ERROR(syscalls::linkat(
-      inode.GetFD(), /*oldpath=*/"",
-      newparent_ino.GetFD(), newname,
-      AT_EMPTY_PATH));
+  REPLY_IF_ERRNO(
+      req,
+      syscalls::linkat(
+        inode.GetFD(), /*oldpath=*/"",
+        newparent_ino.GetFD(), newname,
+        AT_EMPTY_PATH));
+  AddToNameFilter(newparent_ino, newname);
+  InvalidateEntry(newparent_ino, newname);
+  // Its link count changed.
+  inode.BumpAttrEpoch();
 
   return ReplyWithLookup(req, newparent_ino, newname);
 }
 
 absl::Status PageAlignFS::Open(
     FuseRequest &req, fuse_ino_t ino, fuse_file_info &fi) {
+  if (IsControl(ino)) return control_->Open(req, ino, fi);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "Open() ino:" << inode;
 
-  ASSIGN_OR_RETURN(
+  ASSIGN_OR_REPLY_ERRNO(
       FileDescriptor fd,
-      syscalls::open(
-        absl::StrCat("/proc/self/fd/", inode.GetFD()).c_str(),
-        (fi.flags | O_CLOEXEC) & ~O_NOFOLLOW));
+      req,
+      inode.Reopen((fi.flags | O_CLOEXEC) & ~O_NOFOLLOW));
 
   fi.noflush = (fi.flags & O_ACCMODE) == O_RDONLY;
   fi.parallel_direct_writes = 1;
@@ -312,16 +521,12 @@ absl::Status PageAlignFS::Open(
 
 absl::Status PageAlignFS::Release(
     FuseRequest &, fuse_ino_t ino, fuse_file_info &fi) {
-  Inode &inode = GetInode(ino);
-  LOG(INFO) << "Release() ino:" << inode;
   return syscalls::close(FileDescriptor(fi.fh));
 }
 
 absl::Status PageAlignFS::Read(
     FuseRequest &req, fuse_ino_t ino, size_t size, off_t off,
     fuse_file_info &fi) {
-  Inode &inode = GetInode(ino);
-  LOG(INFO) << "Read() ino:" << inode;
   fuse_bufvec bufv = FUSE_BUFVEC_INIT(size);
   bufv.buf[0].flags = static_cast<fuse_buf_flags>(
       FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
@@ -333,9 +538,9 @@ absl::Status PageAlignFS::Read(
 absl::Status PageAlignFS::WriteBuf(
     FuseRequest &req, fuse_ino_t ino, fuse_bufvec &in_buf, off_t off,
     fuse_file_info &fi) {
+  if (IsControl(ino)) return req.ReplyErrno(EBADF);
   Inode &inode = GetInode(ino);
   size_t bufsiz = fuse_buf_size(&in_buf);
-  LOG(INFO) << "WriteBuf() ino:" << inode << ", bufsiz:" << bufsiz;
 
   fuse_bufvec out_buf = FUSE_BUFVEC_INIT(bufsiz);
   out_buf.buf[0].flags = static_cast<fuse_buf_flags>(
@@ -344,6 +549,7 @@ absl::Status PageAlignFS::WriteBuf(
   out_buf.buf[0].pos = off;
 
   ASSIGN_OR_RETURN(size_t nb, FuseBufCopy(out_buf, in_buf));
+  inode.BumpAttrEpoch();
   absl::Status ret = req.ReplyWrite(nb);
   LOG_IF_ERROR(WARNING, inode.NotifyPollEvent());
   return ret;
@@ -351,9 +557,6 @@ absl::Status PageAlignFS::WriteBuf(
 
 absl::Status PageAlignFS::Flush(
     FuseRequest &req, fuse_ino_t ino, fuse_file_info &fi) {
-  Inode &inode = GetInode(ino);
-  LOG(INFO) << "Flush() ino:" << inode;
-
   // Duplicate then close the fd to provide some attempt at providing close-time
   // errors.
   ASSIGN_OR_RETURN(FileDescriptor fd, syscalls::dup(fi.fh));
@@ -362,102 +565,111 @@ absl::Status PageAlignFS::Flush(
 
 absl::Status PageAlignFS::FSync(
     FuseRequest &req, fuse_ino_t ino, bool datasync, fuse_file_info &fi) {
-  Inode &inode = GetInode(ino);
-  LOG(INFO) << "FSync() ino:" << inode << ", datasync:" << datasync;
-
-  if (datasync) {
-    return syscalls::fdatasync(fi.fh);
-  } else {
-    return syscalls::fsync(fi.fh);
+  auto sync = [fd = fi.fh, datasync](FuseRequest &) {
+    if (datasync) {
+      return syscalls::fdatasync(fd);
+    } else {
+      return syscalls::fsync(fd);
+    }
+  };
+  if (IsControl(ino) || !IsBigEnoughToOffload(GetInode(ino))) {
+    return sync(req);
   }
+  return Offload(req, std::move(sync));
 }
 
 absl::Status PageAlignFS::FSyncDir(
     FuseRequest &req, fuse_ino_t ino, bool datasync, fuse_file_info &fi) {
-  Inode &inode = GetInode(ino);
-  LOG(INFO) << "FSyncDir() ino:" << inode << ", datasync:" << datasync;
-
+  if (IsControl(ino)) return absl::OkStatus();
   auto &dir = *reinterpret_cast<Directory *>(fi.fh);
   ASSIGN_OR_RETURN(int dfd, syscalls::dirfd(*dir));
 
-  if (datasync) {
-    return syscalls::fdatasync(dfd);
-  } else {
-    return syscalls::fsync(dfd);
-  }
+  auto sync = [dfd, datasync](FuseRequest &) {
+    if (datasync) {
+      return syscalls::fdatasync(dfd);
+    } else {
+      return syscalls::fsync(dfd);
+    }
+  };
+  // A directory's size says nothing about how long syncing it takes, which is
+  // mostly waiting on the journal, so it's always offloaded.
+  return Offload(req, std::move(sync));
 }
 
 absl::Status PageAlignFS::StatFS(FuseRequest &req, fuse_ino_t ino) {
-  Inode &inode = GetInode(ino);
-  LOG(INFO) << "StatFS() ino:" << inode;
+  Inode &inode = GetInode(IsControl(ino) ? FUSE_ROOT_ID : ino);
   ASSIGN_OR_RETURN(struct statvfs stbuf, syscalls::fstatvfs(inode.GetFD()));
   return req.ReplyStatFS(std::move(stbuf));
 }
 
 absl::Status PageAlignFS::SetXAttr(
-    FuseRequest &req, fuse_ino_t ino, std::string_view name,
+    FuseRequest &req, fuse_ino_t ino, CStringView name,
     std::span<const char> value, int flags) {
+  if (IsControl(ino)) return req.ReplyErrno(EPERM);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "SetXAttr() ino:" << inode << ", name:" << name;
-  return syscalls::setxattr(
-      absl::StrCat("/proc/self/fd/", inode.GetFD()),
-      name, value, flags);
+  REPLY_IF_ERRNO(req, inode.SetXAttr(name, value, flags));
+  inode.BumpAttrEpoch();
+  return absl::OkStatus();
 }
 
-// TODO: Test that size=0 case works
 absl::Status PageAlignFS::GetXAttr(
-    FuseRequest &req, fuse_ino_t ino, std::string_view name, size_t size) {
+    FuseRequest &req, fuse_ino_t ino, CStringView name, size_t size) {
+  if (IsControl(ino)) return req.ReplyErrno(ENODATA);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "GetXAttr() ino:" << inode << ", name:" << name;
-  ASSIGN_OR_RETURN(
-      std::vector<char> buf,
-      syscalls::getxattr(
-        absl::StrCat("/proc/self/fd/", inode.GetFD()), name, /*maxsize=*/size));
-  CHECK_LE(buf.size(), size);
-  return req.ReplyBuf(buf);
+  std::span<char> buf = RequestArena().AllocateArray<char>(size);
+  ASSIGN_OR_REPLY_ERRNO(size_t nb, req, inode.GetXAttr(name, buf));
+  // A size of 0 asks how big the value is.
+  if (size == 0) return req.ReplyXAttr(nb);
+  CHECK_LE(nb, size);
+  return req.ReplyBuf(buf.first(nb));
 }
 
-// TODO: Test that size=0 case works
 absl::Status PageAlignFS::ListXAttr(
     FuseRequest &req, fuse_ino_t ino, size_t size) {
+  // Not ENOTSUP, which the kernel takes to mean that no file has xattrs. A
+  // size of 0 asks for the length; otherwise the kernel wants the list.
+  if (IsControl(ino)) {
+    return size == 0 ? req.ReplyXAttr(0) : req.ReplyBuf({});
+  }
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "ListXAttr() ino:" << inode << ", size:" << size;
-  std::vector<char> buf(size);
-  ASSIGN_OR_RETURN(
-      size_t nb,
-      syscalls::listxattr(
-        absl::StrCat("/proc/self/fd/", inode.GetFD()), buf));
-  CHECK_LE(buf.size(), size);
-  buf.resize(nb);
-  return req.ReplyBuf(buf);
+  std::span<char> buf = RequestArena().AllocateArray<char>(size);
+  ASSIGN_OR_REPLY_ERRNO(size_t nb, req, inode.ListXAttr(buf));
+  // A size of 0 asks how big the list is.
+  if (size == 0) return req.ReplyXAttr(nb);
+  CHECK_LE(nb, size);
+  return req.ReplyBuf(buf.first(nb));
 }
 
 absl::Status PageAlignFS::RemoveXAttr(
-    FuseRequest &req, fuse_ino_t ino, std::string_view name) {
+    FuseRequest &req, fuse_ino_t ino, CStringView name) {
+  if (IsControl(ino)) return req.ReplyErrno(EPERM);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "RemoveXAttr() ino:" << inode << ", name:" << name;
-  return syscalls::removexattr(
-      absl::StrCat("/proc/self/fd/", inode.GetFD()), name);
+  REPLY_IF_ERRNO(req, inode.RemoveXAttr(name));
+  inode.BumpAttrEpoch();
+  return absl::OkStatus();
 }
 
 absl::Status PageAlignFS::Access(FuseRequest &req, fuse_ino_t ino, int mask) {
+  if (IsControl(ino)) return control_->Access(req, ino, mask);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "Access() ino:" << inode;
-  // faccessat doesn't support AT_EMPTY_PATH yet
-  return syscalls::access(absl::StrCat("/proc/self/fd/", inode.GetFD()), mask);
+  REPLY_IF_ERRNO(req, inode.Access(mask));
+  return absl::OkStatus();
 }
 
 absl::Status PageAlignFS::Create(
-    FuseRequest &req, fuse_ino_t ino, std::string_view name, mode_t mode,
+    FuseRequest &req, fuse_ino_t ino, CStringView name, mode_t mode,
     fuse_file_info &fi) {
+  if (IsControl(ino) || IsControl(ino, name)) return req.ReplyErrno(EPERM);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "Create() ino:" << inode;
 
-  ASSIGN_OR_RETURN(
+  ASSIGN_OR_REPLY_ERRNO(
       FileDescriptor fd,
+      req,
       syscalls::openat(
-        inode.GetFD(), std::string(name).c_str(),
+        inode.GetFD(), name,
         (fi.flags | O_CLOEXEC | O_CREAT) & ~O_NOFOLLOW, mode));
+  AddToNameFilter(inode, name);
+  InvalidateEntry(inode, name);
 
   fi.noflush = (fi.flags & O_ACCMODE) == O_RDONLY;
   fi.parallel_direct_writes = 1;
@@ -470,8 +682,8 @@ absl::Status PageAlignFS::Create(
 
 absl::Status PageAlignFS::GetLk(
     FuseRequest &req, fuse_ino_t ino, fuse_file_info &fi, flock &lock) {
+  if (IsControl(ino)) return req.ReplyErrno(EBADF);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "GetLk() ino:" << inode;
 
   RETURN_IF_ERROR(syscalls::fcntl(inode.GetFD(), F_GETLK, &lock).status());
   return req.ReplyLock(lock);
@@ -480,8 +692,8 @@ absl::Status PageAlignFS::GetLk(
 absl::Status PageAlignFS::SetLk(
     FuseRequest &req, fuse_ino_t ino, fuse_file_info &fi, flock &lock,
     bool sleep) {
+  if (IsControl(ino)) return req.ReplyErrno(EBADF);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "SetLk() ino:" << inode;
 
   int cmd = sleep ? F_SETLKW : F_SETLK;
   // TODO: This will set the lock owner to our pid/uid, meaning a GetLk call
@@ -493,17 +705,29 @@ absl::Status PageAlignFS::SetLk(
 
 absl::Status PageAlignFS::FLock(
     FuseRequest &req, fuse_ino_t ino, fuse_file_info &fi, int op) {
+  if (IsControl(ino)) return req.ReplyErrno(EBADF);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "FLock() ino:" << inode;
   return syscalls::flock(inode.GetFD(), op);
 }
 
 absl::Status PageAlignFS::FAllocate(
     FuseRequest &req, fuse_ino_t ino, int mode, off_t offset, off_t length,
-    fuse_file_info &) {
+    fuse_file_info &fi) {
+  if (IsControl(ino)) return req.ReplyErrno(EBADF);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "FAllocate() ino:" << inode;
-  return syscalls::fallocate(inode.GetFD(), mode, offset, length);
+  // The Inode's own fd is O_PATH, so use the one the file was opened with.
+  auto allocate =
+    [inode = &inode, fd = fi.fh, mode, offset, length](
+        FuseRequest &) -> absl::Status {
+      RETURN_IF_ERROR(syscalls::fallocate(fd, mode, offset, length));
+      inode->BumpAttrEpoch();
+      return absl::OkStatus();
+    };
+  // Its cost grows with the range allocated or punched.
+  if (static_cast<uint64_t>(length) < opts_.offload_min_bytes) {
+    return allocate(req);
+  }
+  return Offload(req, std::move(allocate));
 }
 
 absl::Status PageAlignFS::CopyFileRange(
@@ -511,30 +735,35 @@ absl::Status PageAlignFS::CopyFileRange(
     fuse_ino_t ino_in, off_t off_in, fuse_file_info &fi_in,
     fuse_ino_t ino_out, off_t off_out, fuse_file_info &fi_out,
     size_t len, int flags) {
-  Inode &inode_in = GetInode(ino_in);
+  if (IsControl(ino_in) || IsControl(ino_out)) return req.ReplyErrno(EBADF);
   Inode &inode_out = GetInode(ino_out);
-  LOG(INFO)
-    << "CopyFileRange() ino_in:" << inode_in << ", ino_out:" << inode_out;
-  ASSIGN_OR_RETURN(
-      size_t nb,
-      syscalls::copy_file_range(
-        inode_in.GetFD(), &off_in, inode_out.GetFD(), &off_out, len, flags));
-  return req.ReplyWrite(nb);
+  auto copy =
+    [fd_in = fi_in.fh, off_in, out = &inode_out, fd_out = fi_out.fh, off_out,
+     len, flags](FuseRequest &req) mutable -> absl::Status {
+      ASSIGN_OR_RETURN(
+          size_t nb,
+          syscalls::copy_file_range(
+            fd_in, &off_in, fd_out, &off_out, len, flags));
+      out->BumpAttrEpoch();
+      return req.ReplyWrite(nb);
+    };
+  if (len < opts_.offload_min_bytes) return copy(req);
+  return Offload(req, std::move(copy));
 }
 
 absl::Status PageAlignFS::LSeek(
     FuseRequest &req, fuse_ino_t ino, off_t off, int whence,
     fuse_file_info &fi) {
+  if (IsControl(ino)) return req.ReplyErrno(EBADF);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "LSeek() ino:" << inode;
   ASSIGN_OR_RETURN(off_t next_off, syscalls::lseek(inode.GetFD(), off, whence));
   return req.ReplyLSeek(next_off);
 }
 
 absl::Status PageAlignFS::Poll(
     FuseRequest &req, fuse_ino_t ino, fuse_file_info &fi, FusePollHandle ph) {
+  if (IsControl(ino)) return req.ReplyErrno(EBADF);
   Inode &inode = GetInode(ino);
-  LOG(INFO) << "Poll() ino:" << inode;
   inode.AddPollHandle(std::move(ph));
   struct pollfd pfd {
     .fd = inode.GetFD(),
@@ -577,8 +806,61 @@ absl::Status DoStuff(std::string mountpoint) {
 #endif
 
 PageAlignFS::PageAlignFS(Inode root, Options opts)
-  : root_(std::move(root)), opts_(std::move(opts))
-{}
+  : root_(std::move(root)), opts_(std::move(opts)) {
+  if (opts_.dentry_cache_entries > 0) {
+    dentries_ = std::make_unique<DentryCache>(
+        opts_.dentry_cache_entries, opts_.numa_nodes);
+  }
+  if (opts_.control_registry != nullptr && !opts_.control_dir_name.empty()) {
+    control_ = std::make_unique<ControlDir>(*opts_.control_registry);
+  }
+  if (opts_.control_registry != nullptr && opts_.hot_inodes > 0) {
+    // PageAlignFS can't be moved, so `this` stays valid.
+    opts_.control_registry->Register("hot_inodes", [this]() {
+      return FormatHotInodes(inodes_, root_, opts_.hot_inodes);
+    });
+  }
+}
+
+PageAlignFS::~PageAlignFS() {
+  // The watcher thread calls back into us, so stop it before any members are
+  // destroyed.
+  if (watcher_ != nullptr) watcher_->Stop();
+}
+
+void PageAlignFS::SetSession(fuse_session *session) { session_ = session; }
+
+absl::Status PageAlignFS::Offload(
+    FuseRequest &req, OffloadExecutor::Task task) {
+  if (offload_ == nullptr) return task(req);
+  offload_->Submit(std::move(req).Offload(), std::move(task));
+  return absl::OkStatus();
+}
+
+bool PageAlignFS::IsBigEnoughToOffload(const Inode &inode) const {
+  if (offload_ == nullptr) return false;
+  ErrnoOr<struct stat> st = inode.Stat();
+  return st.ok() && FreesAtLeast(*st, 0, opts_.offload_min_bytes);
+}
+
+HeatCounters *PageAlignFS::GetHeat(fuse_ino_t ino) {
+  if (opts_.hot_inodes == 0 || IsControl(ino)) return nullptr;
+  return &GetInode(ino).GetHeat();
+}
+
+void PageAlignFS::RecordAccess(fuse_ino_t ino) {
+  if (IsControl(ino)) return;
+  NumaStats::RecordInodeAccess(GetInode(ino).GetHomeNode());
+}
+
+bool PageAlignFS::IsControl(fuse_ino_t ino) const {
+  return control_ != nullptr && ControlDir::Owns(ino);
+}
+
+bool PageAlignFS::IsControl(fuse_ino_t parent, std::string_view name) const {
+  return control_ != nullptr && parent == FUSE_ROOT_ID &&
+    name == opts_.control_dir_name;
+}
 
 absl::Status PageAlignFS::ReadDirInternal(
     FuseRequest &req, const Inode &dir_inode, size_t size, off_t off,
@@ -589,7 +871,14 @@ absl::Status PageAlignFS::ReadDirInternal(
 
   RETURN_IF_ERROR(syscalls::seekdir(*dir, off));
 
-  std::vector<std::shared_ptr<Inode>> inodes;
+  ReadDirPlusPolicy *policy = dir_inode.GetReadDirPlusPolicy();
+  if (policy != nullptr && off == 0) policy->StartListing();
+  bool with_attrs =
+    plus && (!opts_.adaptive_readdirplus || policy == nullptr
+             || policy->WantAttributes());
+
+  ArenaVector<std::shared_ptr<Inode>> inodes{
+      ArenaAllocator<std::shared_ptr<Inode>>(RequestArena())};
   absl::Cleanup unref_inodes([this, &inodes]() {
     for (const std::shared_ptr<Inode> &inode : inodes) {
       LOG_IF_ERROR(WARNING, inodes_.Unref(*inode));
@@ -597,53 +886,82 @@ absl::Status PageAlignFS::ReadDirInternal(
   });
 
   FuseDirsBuilder dirs(&req, plus, /*maxsize=*/size);
+  uint64_t listed = 0;
   while (true) {
     ASSIGN_OR_RETURN(struct dirent *entry, syscalls::readdir(*dir));
     if (entry == nullptr) break;
 
+    CStringView name = entry->d_name;
+    // Shadowed by the control directory.
+    if (&dir_inode == &root_ && IsControl(FUSE_ROOT_ID, name)) continue;
+    // The kernel never looks up "." or "..", even from ReadDirPlus.
+    bool is_dots = name == "." || name == "..";
+
+    if (!with_attrs || is_dots) {
+      // Without attributes only the inode number and type are used, and the
+      // dirent already has those. For ReadDirPlus, a zero param.ino tells the
+      // kernel we didn't fill in the entry.
+      fuse_entry_param param = {};
+      param.attr.st_ino = entry->d_ino;
+      param.attr.st_mode = DTTOIF(entry->d_type);
+      if (!dirs.AddDirEntry(name, std::move(param), entry->d_off)) break;
+      if (!is_dots) listed++;
+      continue;
+    }
+
     ASSIGN_OR_RETURN(
         std::shared_ptr<Inode> inode,
-        FindOrCreateInode(dir_inode, entry->d_name));
+        FindOrCreateInode(dir_inode, name));
 
     ASSIGN_OR_RETURN(
         fuse_entry_param param,
-        CreateFuseEntryParam(inode.get(), /*with_generation=*/plus));
-    if (!dirs.AddDirEntry(entry->d_name, std::move(param), entry->d_off)) {
+        CreateFuseEntryParam(inode.get(), /*with_generation=*/true));
+    if (!dirs.AddDirEntry(name, std::move(param), entry->d_off)) {
       break;
     }
+    listed++;
+    if (policy != nullptr) inode->SetListedBy(dir_inode);
 
-    if (plus) {
-      // ReadDirPlus is supposed to increment the refcnt, whereas ReadDir does
-      // not.
-      RETURN_IF_ERROR(inodes_.Ref(*inode));
-      inodes.push_back(inode);
-    }
+    // Entries returned with attributes count as a lookup by the kernel.
+    RETURN_IF_ERROR(inodes_.Ref(*inode));
+    inodes.push_back(inode);
   }
 
   RETURN_IF_ERROR(std::move(dirs).Reply());
   std::move(unref_inodes).Cancel();
+  if (policy != nullptr) policy->OnEntriesListed(listed);
   return absl::OkStatus();
 }
 
 absl::StatusOr<PageAlignFS> PageAlignFS::Create(
-    std::string_view srcdir, Options opts) {
+    CStringView srcdir, Options opts) {
   ASSIGN_OR_RETURN(auto root, Inode::Create(srcdir));
   ASSIGN_OR_RETURN(struct stat st, root.Stat());
   if (!S_ISDIR(st.st_mode)) {
     return absl::FailedPreconditionError("Mountpoint is not a directory");
   }
+  if (opts.control_registry != nullptr && !opts.control_dir_name.empty() &&
+      syscalls::fstatat(
+        root.GetFD(), opts.control_dir_name.c_str(), AT_SYMLINK_NOFOLLOW)
+        .ok()) {
+    // It would be hidden behind the control directory.
+    return absl::FailedPreconditionError(
+        absl::StrCat(
+          "Source directory already has an entry named ",
+          opts.control_dir_name));
+  }
   return absl::StatusOr<PageAlignFS>(absl::in_place_t{}, std::move(root), opts);
 }
 
 Inode &PageAlignFS::GetInode(fuse_ino_t ino) {
-  if (ino == FUSE_ROOT_ID) return root_;
-  return *reinterpret_cast<Inode *>(ino);
+  return ino == FUSE_ROOT_ID ? root_ : *reinterpret_cast<Inode *>(ino);
 }
 
-absl::StatusOr<std::shared_ptr<Inode>>
-PageAlignFS::FindOrCreateInode(const Inode &parent, std::string_view path) {
-  ASSIGN_OR_RETURN(auto inode, Inode::Create(path, parent.GetFD()));
-  return inodes_.Insert(std::move(inode));
+ErrnoOr<std::shared_ptr<Inode>>
+PageAlignFS::FindOrCreateInode(const Inode &parent, CStringView path) {
+  ErrnoOr<Inode> inode = Inode::Create(path, parent.GetFD());
+  if (!inode.ok()) return inode.error();
+  return inodes_.Insert(*std::move(inode));
 }
 
 absl::StatusOr<fuse_entry_param> PageAlignFS::CreateFuseEntryParam(
@@ -661,10 +979,11 @@ absl::StatusOr<fuse_entry_param> PageAlignFS::CreateFuseEntryParam(
 }
 
 absl::Status PageAlignFS::ReplyWithCreate(
-    FuseRequest &req, const Inode &parent, std::string_view name,
+    FuseRequest &req, const Inode &parent, CStringView name,
     const fuse_file_info &fi) {
-  ASSIGN_OR_RETURN(
-      std::shared_ptr<Inode> inode, FindOrCreateInode(parent, name));
+  uint64_t parent_epoch = parent.GetAttrEpoch();
+  ASSIGN_OR_REPLY_ERRNO(
+      std::shared_ptr<Inode> inode, req, FindOrCreateInode(parent, name));
 
   if (parent.GetSourceDevice() != inode->GetSourceDevice()) {
     // TODO can we do this after all?
@@ -672,6 +991,7 @@ absl::Status PageAlignFS::ReplyWithCreate(
         "PageAlignFS cannot span multiple source mounts");
   }
 
+  uint64_t epoch = inode->GetAttrEpoch();
   ASSIGN_OR_RETURN(
       fuse_entry_param param,
       CreateFuseEntryParam(inode.get(), /*with_generation=*/true));
@@ -686,13 +1006,15 @@ absl::Status PageAlignFS::ReplyWithCreate(
   RETURN_IF_ERROR(req.ReplyCreate(param, fi));
   // We replied successfully, don't decrement
   std::move(unref_inode).Cancel();
+  CacheDentry(parent, name, parent_epoch, std::move(inode), epoch, param);
   return absl::OkStatus();
 }
 
 absl::Status PageAlignFS::ReplyWithLookup(
-    FuseRequest &req, const Inode &parent, std::string_view name) {
-  ASSIGN_OR_RETURN(
-      std::shared_ptr<Inode> inode, FindOrCreateInode(parent, name));
+    FuseRequest &req, const Inode &parent, CStringView name) {
+  uint64_t parent_epoch = parent.GetAttrEpoch();
+  ASSIGN_OR_REPLY_ERRNO(
+      std::shared_ptr<Inode> inode, req, FindOrCreateInode(parent, name));
 
   if (parent.GetSourceDevice() != inode->GetSourceDevice()) {
     // TODO can we do this after all?
@@ -700,14 +1022,22 @@ absl::Status PageAlignFS::ReplyWithLookup(
         "PageAlignFS cannot span multiple source mounts");
   }
 
+  uint64_t epoch = inode->GetAttrEpoch();
   ASSIGN_OR_RETURN(
       fuse_entry_param param,
       CreateFuseEntryParam(inode.get(), /*with_generation=*/true));
 
+  RETURN_IF_ERROR(ReplyWithEntryParam(req, *inode, param));
+  CacheDentry(parent, name, parent_epoch, std::move(inode), epoch, param);
+  return absl::OkStatus();
+}
+
+absl::Status PageAlignFS::ReplyWithEntryParam(
+    FuseRequest &req, const Inode &inode, const fuse_entry_param &param) {
   // Increment the refcnt on behalf of the kernel.
-  RETURN_IF_ERROR(inodes_.Ref(*inode));
+  RETURN_IF_ERROR(inodes_.Ref(inode));
   // ... but decrement it if we fail to reply
-  absl::Cleanup unref_inode([this, &inode = *inode]() {
+  absl::Cleanup unref_inode([this, &inode]() {
     LOG_IF_ERROR(WARNING, inodes_.Unref(inode));
   });
 
@@ -722,4 +1052,130 @@ absl::Status PageAlignFS::ReplyWithAttrs(FuseRequest &req, const Inode &inode) {
   return req.ReplyAttr(attrs, opts_.kernel_entry_timeout);
 }
 
+fuse_ino_t PageAlignFS::GetFuseIno(const Inode &inode) const {
+  if (&inode == &root_) return FUSE_ROOT_ID;
+  return reinterpret_cast<fuse_ino_t>(&inode);
+}
+
+std::shared_ptr<Inode> PageAlignFS::FindInode(dev_t dev, ino_t ino) {
+  if (dev == root_.GetSourceDevice() && ino == root_.GetNumber()) {
+    // The root is never evicted, so there's no reference to hold.
+    return std::shared_ptr<Inode>(&root_, [](Inode *) {});
+  }
+  return inodes_.Find(dev, ino);
+}
+
+absl::Status PageAlignFS::WatchDirectory(const Inode &dir) {
+  CHECK_NE(watcher_, nullptr);
+  uint32_t mask = kDirectoryEntryEvents | IN_EXCL_UNLINK;
+  // Cached dentries carry their entry's attributes.
+  if (dentries_ != nullptr) mask |= IN_ATTRIB | IN_MODIFY;
+  return dir.EnsureDirectoryWatch([this, mask](const Inode &dir) {
+    return watcher_->Watch(
+        dir.GetFD(), dir.GetSourceDevice(), dir.GetNumber(), mask);
+  });
+}
+
+std::shared_ptr<Inode> PageAlignFS::FindChild(
+    const Inode &dir, CStringView name) {
+  // Without the cache, nothing serves attributes without asking the source.
+  if (dentries_ == nullptr) return nullptr;
+  ErrnoOr<struct stat> st =
+    syscalls::fstatat(dir.GetFD(), name.c_str(), AT_SYMLINK_NOFOLLOW);
+  if (!st.ok()) return nullptr;
+  return FindChild(*st);
+}
+
+std::shared_ptr<Inode> PageAlignFS::FindChild(const struct stat &st) {
+  if (dentries_ == nullptr) return nullptr;
+  return FindInode(st.st_dev, st.st_ino);
+}
+
+void PageAlignFS::InvalidateEntry(const Inode &dir, std::string_view name) {
+  // Its mtime changed. Bumped first, see DentryCache::Insert.
+  dir.BumpAttrEpoch();
+  if (dentries_ != nullptr) dentries_->Invalidate(dir, name);
+
+  // Nothing can be cached about a directory we aren't watching.
+  if (!opts_.kernel_readdir_cache || !dir.HasDirectoryWatch()) return;
+  // Notifying the kernel from within a request handler can deadlock, so hand
+  // this off to the watcher thread.
+  watcher_->Notify({.dev = dir.GetSourceDevice(), .ino = dir.GetNumber()});
+}
+
+void PageAlignFS::CacheDentry(
+    const Inode &parent, std::string_view name, uint64_t parent_epoch,
+    std::shared_ptr<Inode> inode, uint64_t epoch,
+    const fuse_entry_param &param) {
+  if (dentries_ == nullptr) return;
+  if (absl::Status st = WatchDirectory(parent); !st.ok()) {
+    LOG(WARNING) << "Not caching entries of " << parent << ": " << st;
+    return;
+  }
+  std::shared_ptr<Inode> parent_ref =
+    FindInode(parent.GetSourceDevice(), parent.GetNumber());
+  if (parent_ref == nullptr) return;
+  dentries_->Insert(
+      std::move(parent_ref), name, parent_epoch, std::move(inode), epoch,
+      param);
+}
+
+absl::Status PageAlignFS::BuildNameFilter(Inode &dir) {
+  NameFilter *filter = dir.GetNameFilter();
+  if (!opts_.negative_lookup_filter || filter == nullptr || filter->IsBuilt()) {
+    return absl::OkStatus();
+  }
+  // The watch has to be in place before the scan, or names created between
+  // the two would be missed.
+  if (absl::Status st = WatchDirectory(dir); !st.ok()) {
+    filter->BuildFailed();
+    return st;
+  }
+  return filter->Build(dir.GetFD());
+}
+
+void PageAlignFS::AddToNameFilter(const Inode &dir, std::string_view name) {
+  if (!opts_.negative_lookup_filter) return;
+  if (NameFilter *filter = dir.GetNameFilter()) filter->Add(name);
+}
+
+void PageAlignFS::OnDirectoryEvent(const DirectoryEvent &event) {
+  std::shared_ptr<Inode> dir = FindInode(event.dev, event.ino);
+  // The kernel forgot the directory, so it has nothing cached for it.
+  if (dir == nullptr) return;
+
+  // A zero mask is our own InvalidateEntry, which has already done this.
+  if (event.mask != 0) {
+    if (event.mask & IN_Q_OVERFLOW) {
+      // We missed events, so anything could have changed.
+      if (dentries_ != nullptr) dentries_->Clear();
+    } else if (event.mask & IN_IGNORED) {
+      // We won't hear about this directory anymore.
+      if (dentries_ != nullptr) dentries_->InvalidateDirectory(*dir);
+    } else {
+      if (event.name.empty() || (event.mask & kDirectoryEntryEvents)) {
+        dir->BumpAttrEpoch();
+      }
+      if (dentries_ != nullptr && !event.name.empty()) {
+        dentries_->Invalidate(*dir, event.name);
+      }
+    }
+  }
+
+  if (NameFilter *filter = dir->GetNameFilter()) {
+    if (event.mask & (IN_Q_OVERFLOW | IN_IGNORED)) {
+      filter->Reset();
+    } else if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+      filter->Add(event.name);
+    }
+  }
+
+  // Changes to an entry's attributes don't change the listing.
+  if (opts_.kernel_readdir_cache &&
+      (event.mask == 0 ||
+       (event.mask & (kDirectoryEntryEvents | IN_Q_OVERFLOW | IN_IGNORED)))) {
+    LOG_IF_ERROR(WARNING, FuseNotifyInvalInode(*session_, GetFuseIno(*dir)));
+  }
+}
+
 }  // namespace pafs
@@ -10,6 +10,8 @@
 #include <unistd.h>
 #include <utility>
 #include <span>
+#include <string>
+#include <string_view>
 
 #include "absl/functional/any_invocable.h"
 #include "absl/container/flat_hash_map.h"
@@ -20,10 +22,16 @@
 #include "absl/status/statusor.h"
 #include "absl/time/time.h"
 #include "fuse/fuse_lowlevel.h"
+#include "pafs/control.h"
+#include "pafs/control_dir.h"
+#include "pafs/cstring_view.h"
+#include "pafs/dir_watcher.h"
 #include "pafs/fuse.h"
 #include "pafs/fuse_ops.h"
 #include "pafs/fd.h"
+#include "pafs/dentry_cache.h"
 #include "pafs/inode.h"
+#include "pafs/offload.h"
 #include "pafs/syscalls.h"
 
 namespace pafs {
@@ -35,10 +43,55 @@ class PageAlignFS {
     absl::Duration kernel_entry_timeout = absl::ZeroDuration();
     // Validity timeout for inode attributes.
     absl::Duration kernel_attribute_timeout = absl::ZeroDuration();
+    // Let the kernel cache directory listings. Cached listings are invalidated
+    // when the source directory changes, as observed with inotify.
+    bool kernel_readdir_cache = false;
+    // Let ReadDirPlusPolicy decide per directory whether ReadDirPlus returns
+    // attributes. Otherwise it always does.
+    bool adaptive_readdirplus = true;
+    // Let the kernel send concurrent lookups and creates within a directory.
+    bool parallel_dirops = true;
+    // Answer lookups of names that aren't in the source directory from a
+    // per-directory NameFilter. Changes made to the source directory by others
+    // are only seen once inotify reports them.
+    bool negative_lookup_filter = false;
+    // Cache up to this many successful lookups in a DentryCache, answering
+    // repeats of them without syscalls. Its hit rate is the "dentries" control
+    // file. 0 disables the cache.
+    size_t dentry_cache_entries = 0;
+    // Keep a copy of cached lookups for each NUMA node ID below this, see
+    // DentryCache. For when workers are placed on nodes, see
+    // PlaceThreadOnNode.
+    size_t numa_nodes = 1;
+    // Serve these files, e.g. OpStats, from a read-only directory named
+    // control_dir_name in the root, if that's set. The directory isn't
+    // listed, and only the daemon's user can read it. Create fails if the
+    // source directory already has something of that name. Must outlive the
+    // PageAlignFS.
+    ControlRegistry *control_registry = nullptr;
+    std::string control_dir_name;
+    // Count the requests, bytes and latency of each cached Inode, and serve
+    // the top this many as the "hot_inodes" control file. 0 disables it.
+    size_t hot_inodes = 0;
+    // Run ops that may block for long, e.g. fsyncs, on an OffloadExecutor of
+    // this many threads, rather than on the session loop's. Its metrics are
+    // the "offload" control file. 0 runs them inline.
+    size_t offload_threads = 0;
+    // Truncates and unlinks are only offloaded when they free at least this
+    // many allocated bytes, fsyncs when the file has that many allocated, and
+    // fallocates and copy_file_ranges when their range is at least that long.
+    // Directory fsyncs are always offloaded.
+    uint64_t offload_min_bytes = 64 << 20;
   };
 
   static absl::StatusOr<PageAlignFS> Create(
-      std::string_view srcdir, Options opts);
+      CStringView srcdir, Options opts);
+
+  ~PageAlignFS();
+
+  // Must be called before the session is mounted. Used to send notifications
+  // to the kernel.
+  void SetSession(fuse_session *session);
 
   absl::Status Init(struct fuse_conn_info &conn);
   static_assert(FuseInitOp<PageAlignFS>);
@@ -47,7 +100,7 @@ class PageAlignFS {
   static_assert(FuseDestroyOp<PageAlignFS>);
 
   absl::Status Lookup(
-      FuseRequest &req, fuse_ino_t parent, std::string_view name);
+      FuseRequest &req, fuse_ino_t parent, CStringView name);
   static_assert(FuseLookupOp<PageAlignFS>);
 
   absl::Status Forget(FuseRequest &req, fuse_ino_t ino, uint64_t nlookup);
@@ -85,33 +138,33 @@ class PageAlignFS {
   static_assert(FuseForgetMultiOp<PageAlignFS>);
 
   absl::Status Mknod(
-      FuseRequest &req, fuse_ino_t ino, std::string_view name, mode_t mode,
+      FuseRequest &req, fuse_ino_t ino, CStringView name, mode_t mode,
       dev_t rdev);
   static_assert(FuseMknodOp<PageAlignFS>);
 
   absl::Status Mkdir(
-      FuseRequest &req, fuse_ino_t ino, std::string_view name, mode_t mode);
+      FuseRequest &req, fuse_ino_t ino, CStringView name, mode_t mode);
   static_assert(FuseMkdirOp<PageAlignFS>);
 
-  absl::Status Unlink(FuseRequest &req, fuse_ino_t ino, std::string_view name);
+  absl::Status Unlink(FuseRequest &req, fuse_ino_t ino, CStringView name);
   static_assert(FuseUnlinkOp<PageAlignFS>);
 
-  absl::Status Rmdir(FuseRequest &req, fuse_ino_t ino, std::string_view name);
+  absl::Status Rmdir(FuseRequest &req, fuse_ino_t ino, CStringView name);
   static_assert(FuseRmdirOp<PageAlignFS>);
 
   absl::Status Symlink(
-      FuseRequest &req, std::string_view link, fuse_ino_t parent,
-      std::string_view name);
+      FuseRequest &req, CStringView link, fuse_ino_t parent,
+      CStringView name);
   static_assert(FuseSymlinkOp<PageAlignFS>);
 
   absl::Status Rename(
-      FuseRequest &req, fuse_ino_t parent, std::string_view name,
-      fuse_ino_t newparent, std::string_view newname, unsigned int flags);
+      FuseRequest &req, fuse_ino_t parent, CStringView name,
+      fuse_ino_t newparent, CStringView newname, unsigned int flags);
   static_assert(FuseRenameOp<PageAlignFS>);
 
   absl::Status Link(
       FuseRequest &req, fuse_ino_t ino, fuse_ino_t newparent,
-      std::string_view newname);
+      CStringView newname);
   static_assert(FuseLinkOp<PageAlignFS>);
 
   absl::Status Open(
@@ -148,12 +201,12 @@ class PageAlignFS {
   static_assert(FuseStatFSOp<PageAlignFS>);
 
   absl::Status SetXAttr(
-      FuseRequest &req, fuse_ino_t ino, std::string_view name,
+      FuseRequest &req, fuse_ino_t ino, CStringView name,
       std::span<const char> value, int flags);
   static_assert(FuseSetXAttrOp<PageAlignFS>);
 
   absl::Status GetXAttr(
-      FuseRequest &req, fuse_ino_t ino, std::string_view name, size_t size);
+      FuseRequest &req, fuse_ino_t ino, CStringView name, size_t size);
   static_assert(FuseGetXAttrOp<PageAlignFS>);
 
   absl::Status ListXAttr(
@@ -161,14 +214,14 @@ class PageAlignFS {
   static_assert(FuseListXAttrOp<PageAlignFS>);
 
   absl::Status RemoveXAttr(
-      FuseRequest &req, fuse_ino_t ino, std::string_view name);
+      FuseRequest &req, fuse_ino_t ino, CStringView name);
   static_assert(FuseRemoveXAttrOp<PageAlignFS>);
 
   absl::Status Access(FuseRequest &req, fuse_ino_t ino, int mask);
   static_assert(FuseAccessOp<PageAlignFS>);
 
   absl::Status Create(
-      FuseRequest &req, fuse_ino_t ino, std::string_view name, mode_t mode,
+      FuseRequest &req, fuse_ino_t ino, CStringView name, mode_t mode,
       fuse_file_info &fi);
   static_assert(FuseCreateOp<PageAlignFS>);
 
@@ -206,6 +259,14 @@ class PageAlignFS {
       fuse_file_info &fi);
   static_assert(FuseLSeekOp<PageAlignFS>);
 
+  // nullptr unless opts.hot_inodes is set.
+  HeatCounters *GetHeat(fuse_ino_t ino);
+  static_assert(FuseHeatSource<PageAlignFS>);
+
+  // Counts whether `ino` is used on its home NUMA node, for NumaStats.
+  void RecordAccess(fuse_ino_t ino);
+  static_assert(FuseAccessRecorder<PageAlignFS>);
+
 #if 0
   absl::Status DoStuff(std::string mountpoint);
 #endif
@@ -214,8 +275,8 @@ class PageAlignFS {
   // Gets an Inode from a fuse_ino_t.
   Inode &GetInode(fuse_ino_t ino);
 
-  absl::StatusOr<std::shared_ptr<Inode>>
-    FindOrCreateInode(const Inode &parent, std::string_view path);
+  ErrnoOr<std::shared_ptr<Inode>>
+    FindOrCreateInode(const Inode &parent, CStringView path);
 
   // Set `plus` to true if handling ReadDirPlus.
   absl::Status ReadDirInternal(
@@ -228,23 +289,91 @@ class PageAlignFS {
 
   // Any call to ReplyWithLookup increments the reference count of the Inode.
   absl::Status ReplyWithLookup(
-      FuseRequest &req, const Inode &parent, std::string_view name);
+      FuseRequest &req, const Inode &parent, CStringView name);
+
+  // Replies with `param`, which must describe `inode`, and increments the
+  // reference count of the Inode.
+  absl::Status ReplyWithEntryParam(
+      FuseRequest &req, const Inode &inode, const fuse_entry_param &param);
 
   // Any call to ReplyWithCreate increments the reference count of the Inode.
   absl::Status ReplyWithCreate(
-      FuseRequest &req, const Inode &parent, std::string_view name,
+      FuseRequest &req, const Inode &parent, CStringView name,
       const fuse_file_info &fi);
 
   absl::Status ReplyWithAttrs(FuseRequest &req, const Inode &inode);
 
+  // The body of SetAttr, which may run on offload_.
+  absl::Status SetAttrInternal(
+      FuseRequest &req, Inode &inode, const struct stat &attr, int to_set,
+      const fuse_file_info &fi);
+
+  // Runs `task` on `req` on offload_, or now if there isn't one. Either way,
+  // `req` is replied to once `task` returns.
+  absl::Status Offload(FuseRequest &req, OffloadExecutor::Task task);
+  // Whether an op whose cost grows with `inode`'s allocation, e.g. an fsync,
+  // should be offloaded: whether it has at least offload_min_bytes allocated.
+  bool IsBigEnoughToOffload(const Inode &inode) const;
+
+  // The fuse_ino_t that the kernel knows `inode` by.
+  fuse_ino_t GetFuseIno(const Inode &inode) const;
+
+  // Like InodeCache::Find, but also finds the root.
+  std::shared_ptr<Inode> FindInode(dev_t dev, ino_t ino);
+
+  // The cached Inode at `name` in `dir`, if the dentry cache is on. Found
+  // before an op that changes its link count, so that its epoch can be
+  // bumped after: it may be cached under another name too, and that entry
+  // would otherwise serve the old st_nlink and st_ctime. Costs an fstatat,
+  // and nothing with the cache off.
+  std::shared_ptr<Inode> FindChild(const Inode &dir, CStringView name);
+  // Likewise, for a child the caller has already stat'ed.
+  std::shared_ptr<Inode> FindChild(const struct stat &st);
+
+  // Starts watching `dir` for changes to its entries, if it isn't already.
+  absl::Status WatchDirectory(const Inode &dir);
+
+  // Drops anything cached about `name` in `dir`, `dir`'s attributes, and
+  // `dir`'s listing. Used after we change a directory ourselves.
+  void InvalidateEntry(const Inode &dir, std::string_view name);
+
+  // Adds a successful lookup to dentries_, if it's enabled. The epochs are as
+  // for DentryCache::Insert.
+  void CacheDentry(
+      const Inode &parent, std::string_view name, uint64_t parent_epoch,
+      std::shared_ptr<Inode> inode, uint64_t epoch,
+      const fuse_entry_param &param);
+
+  // Builds `dir`'s NameFilter if it's enabled and not yet built.
+  absl::Status BuildNameFilter(Inode &dir);
+
+  // Must be called once `name` has been created in `dir`, see NameFilter::Add.
+  void AddToNameFilter(const Inode &dir, std::string_view name);
+
+  // Runs on the DirectoryWatcher thread.
+  void OnDirectoryEvent(const DirectoryEvent &event);
+
+  // Whether `ino` belongs to control_, and must not be passed to GetInode.
+  bool IsControl(fuse_ino_t ino) const;
+  // Whether `name` in `parent` is control_'s directory.
+  bool IsControl(fuse_ino_t parent, std::string_view name) const;
+
  public:
   // TODO this should be private
   PageAlignFS(Inode root, Options opts);
  private:
 
+  // Must outlive every Inode, since Inodes hold DirectoryWatches.
+  std::unique_ptr<DirectoryWatcher> watcher_;
   Inode root_;
   InodeCache inodes_;
+  // Holds Inode references, so must be destroyed before inodes_.
+  std::unique_ptr<DentryCache> dentries_;
+  std::unique_ptr<ControlDir> control_;
   const Options opts_;
+  fuse_session *session_ = nullptr;
+  // Its tasks use the other members, so it's destroyed, and drained, first.
+  std::unique_ptr<OffloadExecutor> offload_;
 };
 
 }  // namespace pafs
@@ -0,0 +1,214 @@
+// PageAlignFS handling requests from a FuseHarness, over a source directory on
+// tmpfs: the latency of each op from request to reply, without the kernel.
+//
+// bazel run -c opt //pafs:page_align_fs_benchmark
+
+#include <fcntl.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "benchmark/benchmark.h"
+#include "fuse/fuse_kernel.h"
+#include "pafs/benchmark_util.h"
+#include "pafs/fuse.h"
+#include "pafs/fuse_harness.h"
+#include "pafs/fuse_ops.h"
+#include "pafs/page_align_fs.h"
+#include "pafs/status.h"
+
+namespace pafs {
+namespace {
+
+// A PageAlignFS over a ScratchDir of `files` empty files, "0", "1", ...
+struct HarnessedFS {
+  static absl::StatusOr<std::unique_ptr<HarnessedFS>> Create(
+      int files, PageAlignFS::Options opts = {}) {
+    ASSIGN_OR_RETURN(ScratchDir dir, ScratchDir::Create());
+    RETURN_IF_ERROR(dir.CreateFiles(files));
+    std::string path(dir.Path());
+    auto h = std::unique_ptr<HarnessedFS>(new HarnessedFS{
+        .dir = std::move(dir),
+        .fs = PageAlignFS::Create(path, std::move(opts)),
+    });
+    RETURN_IF_ERROR(h->fs.status());
+    ASSIGN_OR_RETURN(
+        h->harness,
+        FuseHarness::Create(AsFuseLowLevelOps<PageAlignFS>(), &*h->fs));
+    h->fs->SetSession(h->harness->GetSession());
+    RETURN_IF_ERROR(h->harness->Init().status());
+    return h;
+  }
+
+  // The nodeid of `name` in the root. The caller owns a lookup of it.
+  absl::StatusOr<uint64_t> Lookup(std::string_view name) {
+    ASSIGN_OR_RETURN(FuseHarness::Reply reply, harness->Lookup(1, name));
+    if (reply.error != 0) return ErrnoToStatus(reply.error, "Lookup");
+    return reply.As<fuse_entry_out>()->nodeid;
+  }
+
+  ScratchDir dir;
+  absl::StatusOr<PageAlignFS> fs;
+  // Destroyed first, since it calls into `fs`.
+  std::unique_ptr<FuseHarness> harness;
+};
+
+// A fuse_dirent without its name, which can't be copied out of a reply.
+struct DirentHeader {
+  uint64_t ino;
+  uint64_t off;
+  uint32_t namelen;
+  uint32_t type;
+};
+static_assert(sizeof(DirentHeader) == FUSE_NAME_OFFSET);
+
+std::unique_ptr<HarnessedFS> SetUp(benchmark::State &state, int files) {
+  absl::StatusOr<std::unique_ptr<HarnessedFS>> h = HarnessedFS::Create(files);
+  if (!h.ok()) {
+    state.SkipWithError(std::string(h.status().message()).c_str());
+    return nullptr;
+  }
+  return *std::move(h);
+}
+
+// A lookup, then the kernel forgetting it.
+void BM_LookupForget(benchmark::State &state) {
+  std::unique_ptr<HarnessedFS> h = SetUp(state, /*files=*/1);
+  if (h == nullptr) return;
+  for (auto _ : state) {
+    absl::StatusOr<uint64_t> nodeid = h->Lookup("0");
+    if (!nodeid.ok()) {
+      state.SkipWithError("Lookup failed");
+      break;
+    }
+    benchmark::DoNotOptimize(h->harness->Forget(*nodeid, 1));
+  }
+}
+BENCHMARK(BM_LookupForget);
+
+void BM_LookupMissing(benchmark::State &state) {
+  std::unique_ptr<HarnessedFS> h = SetUp(state, /*files=*/0);
+  if (h == nullptr) return;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(h->harness->Lookup(1, "missing"));
+  }
+}
+BENCHMARK(BM_LookupMissing);
+
+void BM_GetAttr(benchmark::State &state) {
+  std::unique_ptr<HarnessedFS> h = SetUp(state, /*files=*/1);
+  if (h == nullptr) return;
+  absl::StatusOr<uint64_t> nodeid = h->Lookup("0");
+  if (!nodeid.ok()) {
+    state.SkipWithError("Lookup failed");
+    return;
+  }
+  for (auto _ : state) benchmark::DoNotOptimize(h->harness->GetAttr(*nodeid));
+  benchmark::DoNotOptimize(h->harness->Forget(*nodeid, 1));
+}
+BENCHMARK(BM_GetAttr);
+
+// Opening the root, listing all range(0) files with ReadDir or ReadDirPlus
+// in 64KiB replies, and releasing it, as `ls` does.
+template <bool kPlus>
+void BM_ListDirectory(benchmark::State &state) {
+  const int files = static_cast<int>(state.range(0));
+  std::unique_ptr<HarnessedFS> h = SetUp(state, files);
+  if (h == nullptr) return;
+  FuseHarness &fuse = *h->harness;
+  std::vector<uint64_t> looked_up;
+
+  for (auto _ : state) {
+    absl::StatusOr<FuseHarness::Reply> open = fuse.OpenDir(1);
+    if (!open.ok() || open->error != 0) {
+      state.SkipWithError("OpenDir failed");
+      break;
+    }
+    uint64_t fh = open->As<fuse_open_out>()->fh;
+    uint64_t off = 0;
+    while (true) {
+      absl::StatusOr<FuseHarness::Reply> reply =
+        fuse.ReadDir(1, fh, off, /*size=*/64 << 10, kPlus);
+      if (!reply.ok() || reply->error != 0 || reply->data.empty()) break;
+      // Continue from the last entry's offset.
+      size_t pos = 0;
+      while (pos < reply->data.size()) {
+        if constexpr (kPlus) {
+          uint64_t nodeid = reply->As<fuse_entry_out>(pos)->nodeid;
+          if (nodeid != 0) looked_up.push_back(nodeid);
+          pos += sizeof(fuse_entry_out);
+        }
+        DirentHeader entry = *reply->As<DirentHeader>(pos);
+        off = entry.off;
+        pos += FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + entry.namelen);
+      }
+    }
+    benchmark::DoNotOptimize(fuse.ReleaseDir(1, fh));
+
+    state.PauseTiming();
+    for (uint64_t nodeid : looked_up) {
+      benchmark::DoNotOptimize(fuse.Forget(nodeid, 1));
+    }
+    looked_up.clear();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * files);
+}
+BENCHMARK(BM_ListDirectory</*kPlus=*/false>)->Arg(16)->Arg(1024);
+BENCHMARK(BM_ListDirectory</*kPlus=*/true>)->Arg(16)->Arg(1024);
+
+// range(0)-byte reads of an open file.
+void BM_Read(benchmark::State &state) {
+  const uint32_t size = state.range(0);
+  std::unique_ptr<HarnessedFS> h = SetUp(state, /*files=*/0);
+  if (h == nullptr) return;
+  FuseHarness &fuse = *h->harness;
+  absl::StatusOr<FuseHarness::Reply> created =
+    fuse.CreateFile(1, "data", O_RDWR, 0644);
+  if (!created.ok() || created->error != 0) {
+    state.SkipWithError("Create failed");
+    return;
+  }
+  uint64_t nodeid = created->As<fuse_entry_out>()->nodeid;
+  uint64_t fh = created->As<fuse_open_out>(sizeof(fuse_entry_out))->fh;
+  std::string data(size, 'x');
+  benchmark::DoNotOptimize(fuse.Write(nodeid, fh, 0, data));
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(fuse.Read(nodeid, fh, 0, size));
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+
+  benchmark::DoNotOptimize(fuse.Release(nodeid, fh));
+  benchmark::DoNotOptimize(fuse.Forget(nodeid, 1));
+}
+BENCHMARK(BM_Read)->Arg(4096)->Arg(128 << 10);
+
+// Creating, closing and removing a file.
+void BM_CreateReleaseUnlink(benchmark::State &state) {
+  std::unique_ptr<HarnessedFS> h = SetUp(state, /*files=*/0);
+  if (h == nullptr) return;
+  FuseHarness &fuse = *h->harness;
+  for (auto _ : state) {
+    absl::StatusOr<FuseHarness::Reply> created =
+      fuse.CreateFile(1, "new", O_WRONLY, 0644);
+    if (!created.ok() || created->error != 0) {
+      state.SkipWithError("Create failed");
+      break;
+    }
+    uint64_t nodeid = created->As<fuse_entry_out>()->nodeid;
+    uint64_t fh = created->As<fuse_open_out>(sizeof(fuse_entry_out))->fh;
+    benchmark::DoNotOptimize(fuse.Release(nodeid, fh));
+    benchmark::DoNotOptimize(fuse.Unlink(1, "new"));
+    benchmark::DoNotOptimize(fuse.Forget(nodeid, 1));
+  }
+}
+BENCHMARK(BM_CreateReleaseUnlink);
+
+}  // namespace
+}  // namespace pafs
@@ -0,0 +1,401 @@
+// PageAlignFS handling requests from a FuseHarness, over a ScratchDir: that
+// each reply says what the source directory does.
+//
+// bazel test //pafs:page_align_fs_test
+
+#include <array>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "fuse/fuse_kernel.h"
+#include "gtest/gtest.h"
+#include "pafs/benchmark_util.h"
+#include "pafs/errno.h"
+#include "pafs/fuse.h"
+#include "pafs/fuse_harness.h"
+#include "pafs/fuse_ops.h"
+#include "pafs/page_align_fs.h"
+#include "pafs/syscalls.h"
+
+namespace pafs {
+namespace {
+
+using Reply = FuseHarness::Reply;
+
+constexpr uint64_t kRoot = FUSE_ROOT_ID;
+
+// A fuse_dirent without its name.
+struct DirentHeader {
+  uint64_t ino;
+  uint64_t off;
+  uint32_t namelen;
+  uint32_t type;
+};
+static_assert(sizeof(DirentHeader) == FUSE_NAME_OFFSET);
+
+class PageAlignFSTest : public testing::Test {
+ protected:
+  explicit PageAlignFSTest(PageAlignFS::Options opts = {})
+    : fs_(PageAlignFS::Create(dir_.Path(), std::move(opts))) {}
+
+  void SetUp() override {
+    CHECK_OK(fs_.status());
+    absl::StatusOr<std::unique_ptr<FuseHarness>> harness =
+      FuseHarness::Create(AsFuseLowLevelOps<PageAlignFS>(), &*fs_);
+    CHECK_OK(harness.status());
+    fuse_ = *std::move(harness);
+    fs_->SetSession(fuse_->GetSession());
+    CHECK_OK(fuse_->Init().status());
+  }
+
+  static ScratchDir CreateDir() {
+    absl::StatusOr<ScratchDir> dir = ScratchDir::Create();
+    CHECK_OK(dir.status());
+    return *std::move(dir);
+  }
+
+  // A failure of the harness itself, rather than an error reply, is a bug.
+  static Reply Must(absl::StatusOr<Reply> reply) {
+    CHECK_OK(reply.status());
+    return *std::move(reply);
+  }
+
+  // What the source directory says `name` is.
+  struct stat SourceStat(const std::string &name) {
+    ErrnoOr<struct stat> st =
+      syscalls::fstatat(dir_.GetFD(), name.c_str(), AT_SYMLINK_NOFOLLOW);
+    CHECK_OK(st.status());
+    return *st;
+  }
+
+  bool SourceHas(const std::string &name) {
+    return syscalls::fstatat(
+        dir_.GetFD(), name.c_str(), AT_SYMLINK_NOFOLLOW).ok();
+  }
+
+  ScratchDir dir_ = CreateDir();
+  absl::StatusOr<PageAlignFS> fs_;
+  // Destroyed first, since it calls into `fs_`.
+  std::unique_ptr<FuseHarness> fuse_;
+};
+
+TEST_F(PageAlignFSTest, LookupReturnsTheSourceAttributes) {
+  CHECK_OK(dir_.CreateFiles(1));
+  struct stat st = SourceStat("0");
+
+  Reply reply = Must(fuse_->Lookup(kRoot, "0"));
+  ASSERT_EQ(reply.error, 0);
+  std::optional<fuse_entry_out> entry = reply.As<fuse_entry_out>();
+  ASSERT_TRUE(entry.has_value());
+  EXPECT_NE(entry->nodeid, 0);
+  EXPECT_EQ(entry->attr.ino, st.st_ino);
+  EXPECT_EQ(entry->attr.mode, st.st_mode);
+  EXPECT_EQ(entry->attr.size, 0);
+  EXPECT_EQ(entry->attr.nlink, 1);
+}
+
+TEST_F(PageAlignFSTest, LookupOfAMissingNameIsENOENT) {
+  EXPECT_EQ(Must(fuse_->Lookup(kRoot, "missing")).error, ENOENT);
+}
+
+TEST_F(PageAlignFSTest, ReadReturnsWhatWasWritten) {
+  Reply created = Must(fuse_->CreateFile(kRoot, "data", O_RDWR, 0644));
+  ASSERT_EQ(created.error, 0);
+  uint64_t nodeid = created.As<fuse_entry_out>()->nodeid;
+  uint64_t fh = created.As<fuse_open_out>(sizeof(fuse_entry_out))->fh;
+  EXPECT_TRUE(S_ISREG(SourceStat("data").st_mode));
+
+  const std::string data = "page aligned";
+  Reply written = Must(fuse_->Write(nodeid, fh, 0, data));
+  ASSERT_EQ(written.error, 0);
+  EXPECT_EQ(written.As<fuse_write_out>()->size, data.size());
+
+  Reply read = Must(fuse_->Read(nodeid, fh, 0, 4096));
+  ASSERT_EQ(read.error, 0);
+  EXPECT_EQ(read.data, data);
+  // From an offset, and past the end.
+  EXPECT_EQ(Must(fuse_->Read(nodeid, fh, 5, 7)).data, "aligned");
+  EXPECT_EQ(Must(fuse_->Read(nodeid, fh, data.size(), 4096)).data, "");
+
+  Reply attr = Must(fuse_->GetAttr(nodeid));
+  ASSERT_EQ(attr.error, 0);
+  EXPECT_EQ(attr.As<fuse_attr_out>()->attr.size, data.size());
+  EXPECT_EQ(SourceStat("data").st_size, data.size());
+
+  EXPECT_EQ(Must(fuse_->Release(nodeid, fh)).error, 0);
+  CHECK_OK(fuse_->Forget(nodeid, 1));
+}
+
+TEST_F(PageAlignFSTest, ReadDirListsEveryEntry) {
+  CHECK_OK(dir_.CreateFiles(3));
+  Reply opened = Must(fuse_->OpenDir(kRoot));
+  ASSERT_EQ(opened.error, 0);
+  uint64_t fh = opened.As<fuse_open_out>()->fh;
+
+  std::set<std::string> names;
+  uint64_t off = 0;
+  while (true) {
+    Reply reply = Must(fuse_->ReadDir(kRoot, fh, off, /*size=*/4096));
+    ASSERT_EQ(reply.error, 0);
+    if (reply.data.empty()) break;
+    size_t pos = 0;
+    while (pos < reply.data.size()) {
+      DirentHeader entry = *reply.As<DirentHeader>(pos);
+      names.insert(reply.data.substr(pos + FUSE_NAME_OFFSET, entry.namelen));
+      off = entry.off;
+      pos += FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + entry.namelen);
+    }
+  }
+  EXPECT_EQ(names, (std::set<std::string>{".", "..", "0", "1", "2"}));
+  EXPECT_EQ(Must(fuse_->ReleaseDir(kRoot, fh)).error, 0);
+}
+
+TEST_F(PageAlignFSTest, UnlinkRemovesTheEntry) {
+  CHECK_OK(dir_.CreateFiles(1));
+  Reply looked_up = Must(fuse_->Lookup(kRoot, "0"));
+  ASSERT_EQ(looked_up.error, 0);
+  uint64_t nodeid = looked_up.As<fuse_entry_out>()->nodeid;
+
+  EXPECT_EQ(Must(fuse_->Unlink(kRoot, "0")).error, 0);
+  EXPECT_FALSE(SourceHas("0"));
+  EXPECT_EQ(Must(fuse_->Lookup(kRoot, "0")).error, ENOENT);
+  EXPECT_EQ(Must(fuse_->Unlink(kRoot, "0")).error, ENOENT);
+  // Still open to the kernel, with no links left.
+  Reply attr = Must(fuse_->GetAttr(nodeid));
+  ASSERT_EQ(attr.error, 0);
+  EXPECT_EQ(attr.As<fuse_attr_out>()->attr.nlink, 0);
+  CHECK_OK(fuse_->Forget(nodeid, 1));
+}
+
+TEST_F(PageAlignFSTest, RenameMovesTheEntry) {
+  CHECK_OK(dir_.CreateFiles(1));
+  const ino_t ino = SourceStat("0").st_ino;
+
+  EXPECT_EQ(Must(fuse_->Rename(kRoot, "0", kRoot, "renamed")).error, 0);
+  EXPECT_FALSE(SourceHas("0"));
+  EXPECT_EQ(Must(fuse_->Lookup(kRoot, "0")).error, ENOENT);
+  Reply looked_up = Must(fuse_->Lookup(kRoot, "renamed"));
+  ASSERT_EQ(looked_up.error, 0);
+  EXPECT_EQ(looked_up.As<fuse_entry_out>()->attr.ino, ino);
+  CHECK_OK(fuse_->Forget(looked_up.As<fuse_entry_out>()->nodeid, 1));
+
+  EXPECT_EQ(
+      Must(fuse_->Rename(kRoot, "missing", kRoot, "other")).error, ENOENT);
+}
+
+TEST_F(PageAlignFSTest, MkdirAndRmdir) {
+  Reply made = Must(fuse_->Mkdir(kRoot, "sub", 0755));
+  ASSERT_EQ(made.error, 0);
+  uint64_t nodeid = made.As<fuse_entry_out>()->nodeid;
+  EXPECT_TRUE(S_ISDIR(made.As<fuse_entry_out>()->attr.mode));
+  EXPECT_TRUE(S_ISDIR(SourceStat("sub").st_mode));
+  EXPECT_EQ(Must(fuse_->Mkdir(kRoot, "sub", 0755)).error, EEXIST);
+
+  // Not empty.
+  Reply child = Must(fuse_->Mkdir(nodeid, "child", 0755));
+  ASSERT_EQ(child.error, 0);
+  EXPECT_EQ(Must(fuse_->Rmdir(kRoot, "sub")).error, ENOTEMPTY);
+
+  EXPECT_EQ(Must(fuse_->Rmdir(nodeid, "child")).error, 0);
+  EXPECT_EQ(Must(fuse_->Rmdir(kRoot, "sub")).error, 0);
+  EXPECT_FALSE(SourceHas("sub"));
+  CHECK_OK(fuse_->Forget(child.As<fuse_entry_out>()->nodeid, 1));
+  CHECK_OK(fuse_->Forget(nodeid, 1));
+}
+
+TEST_F(PageAlignFSTest, FAllocateAndCopyFileRangeUseTheOpenFiles) {
+  Reply src = Must(fuse_->CreateFile(kRoot, "src", O_RDWR, 0644));
+  ASSERT_EQ(src.error, 0);
+  uint64_t src_id = src.As<fuse_entry_out>()->nodeid;
+  uint64_t src_fh = src.As<fuse_open_out>(sizeof(fuse_entry_out))->fh;
+  Reply dst = Must(fuse_->CreateFile(kRoot, "dst", O_RDWR, 0644));
+  ASSERT_EQ(dst.error, 0);
+  uint64_t dst_id = dst.As<fuse_entry_out>()->nodeid;
+  uint64_t dst_fh = dst.As<fuse_open_out>(sizeof(fuse_entry_out))->fh;
+
+  EXPECT_EQ(Must(fuse_->FAllocate(src_id, src_fh, 0, 8192)).error, 0);
+  EXPECT_EQ(SourceStat("src").st_size, 8192);
+
+  const std::string data = "page aligned";
+  ASSERT_EQ(Must(fuse_->Write(src_id, src_fh, 0, data)).error, 0);
+  Reply copied = Must(fuse_->CopyFileRange(
+      src_id, src_fh, 0, dst_id, dst_fh, 0, data.size()));
+  ASSERT_EQ(copied.error, 0);
+  EXPECT_EQ(copied.As<fuse_write_out>()->size, data.size());
+  EXPECT_EQ(Must(fuse_->Read(dst_id, dst_fh, 0, 4096)).data, data);
+
+  for (auto [nodeid, fh] : {std::pair(src_id, src_fh),
+                            std::pair(dst_id, dst_fh)}) {
+    EXPECT_EQ(Must(fuse_->Release(nodeid, fh)).error, 0);
+    CHECK_OK(fuse_->Forget(nodeid, 1));
+  }
+}
+
+class XAttrTest : public PageAlignFSTest {
+ protected:
+  void SetUp() override {
+    PageAlignFSTest::SetUp();
+    CHECK_OK(dir_.CreateFiles(1));
+    path_ = absl::StrCat(dir_.Path().c_str(), "/0");
+    if (Errno set = syscalls::setxattr(path_, "user.pafs", kValue);
+        set.value() == ENOTSUP) {
+      GTEST_SKIP() << "The source doesn't support user xattrs";
+    } else {
+      CHECK_OK(set.ToStatus());
+    }
+    Reply looked_up = Must(fuse_->Lookup(kRoot, "0"));
+    CHECK_EQ(looked_up.error, 0);
+    nodeid_ = looked_up.As<fuse_entry_out>()->nodeid;
+  }
+
+  void TearDown() override {
+    if (nodeid_ != 0) CHECK_OK(fuse_->Forget(nodeid_, 1));
+  }
+
+  // How long the source's list of names is, which may include xattrs other
+  // than ours, e.g. security labels.
+  size_t SourceListSize() {
+    ErrnoOr<size_t> size = syscalls::listxattr(path_, {});
+    CHECK_OK(size.status());
+    return *size;
+  }
+
+  static constexpr std::string_view kValue = "page aligned";
+
+  std::string path_;
+  uint64_t nodeid_ = 0;
+};
+
+TEST_F(XAttrTest, SizeZeroAsksForTheLength) {
+  Reply got = Must(fuse_->GetXAttr(nodeid_, "user.pafs", 0));
+  ASSERT_EQ(got.error, 0);
+  EXPECT_EQ(got.As<fuse_getxattr_out>()->size, kValue.size());
+
+  Reply listed = Must(fuse_->ListXAttr(nodeid_, 0));
+  ASSERT_EQ(listed.error, 0);
+  EXPECT_EQ(listed.As<fuse_getxattr_out>()->size, SourceListSize());
+}
+
+TEST_F(XAttrTest, BigEnoughBufferGetsTheData) {
+  Reply got = Must(fuse_->GetXAttr(nodeid_, "user.pafs", 4096));
+  ASSERT_EQ(got.error, 0);
+  EXPECT_EQ(got.data, kValue);
+
+  Reply listed = Must(fuse_->ListXAttr(nodeid_, 4096));
+  ASSERT_EQ(listed.error, 0);
+  EXPECT_EQ(listed.data.size(), SourceListSize());
+  EXPECT_NE(listed.data.find(std::string_view("user.pafs\0", 10)),
+            std::string::npos);
+}
+
+TEST_F(XAttrTest, TooSmallBufferIsERANGE) {
+  EXPECT_EQ(
+      Must(fuse_->GetXAttr(nodeid_, "user.pafs", kValue.size() - 1)).error,
+      ERANGE);
+  EXPECT_EQ(
+      Must(fuse_->ListXAttr(nodeid_, SourceListSize() - 1)).error, ERANGE);
+}
+
+// Many threads creating, unlinking and looking up the same few names in one
+// directory, as the kernel sends them with PARALLEL_DIROPS, with every cache
+// that lookups go through turned on.
+class ParallelDirOpsTest : public PageAlignFSTest {
+ protected:
+  ParallelDirOpsTest()
+    : PageAlignFSTest({
+        .negative_lookup_filter = true,
+        .dentry_cache_entries = 1024,
+      }) {}
+
+  static constexpr int kThreads = 8;
+  static constexpr int kOpsPerThread = 2000;
+  static constexpr int kNames = 32;
+};
+
+TEST_F(ParallelDirOpsTest, RepliesMatchTheSourceDirectory) {
+  // The directory's i_rwsem: the kernel holds it exclusively for creates and
+  // unlinks, and shared for lookups only with PARALLEL_DIROPS. Lookups that
+  // revalidate a dentry don't take it at all.
+  std::shared_mutex dir_lock;
+  std::array<std::vector<uint64_t>, kThreads> looked_up;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([this, t, &dir_lock, &looked_up]() {
+      std::mt19937 rng(t);
+      for (int i = 0; i < kOpsPerThread; i++) {
+        const std::string name = absl::StrCat("f", rng() % kNames);
+        switch (rng() % 4) {
+          case 0: {
+            std::unique_lock lock(dir_lock);
+            Reply created = Must(
+                fuse_->CreateFile(kRoot, name, O_CREAT | O_WRONLY, 0644));
+            ASSERT_EQ(created.error, 0) << name;
+            uint64_t nodeid = created.As<fuse_entry_out>()->nodeid;
+            looked_up[t].push_back(nodeid);
+            ASSERT_EQ(
+                Must(fuse_->Release(
+                    nodeid,
+                    created.As<fuse_open_out>(sizeof(fuse_entry_out))->fh))
+                  .error,
+                0);
+            break;
+          }
+          case 1: {
+            std::unique_lock lock(dir_lock);
+            int error = Must(fuse_->Unlink(kRoot, name)).error;
+            ASSERT_TRUE(error == 0 || error == ENOENT) << name << ": " << error;
+            break;
+          }
+          default: {
+            std::optional<std::shared_lock<std::shared_mutex>> lock;
+            if (rng() % 2 == 0) lock.emplace(dir_lock);
+            Reply reply = Must(fuse_->Lookup(kRoot, name));
+            ASSERT_TRUE(reply.error == 0 || reply.error == ENOENT)
+              << name << ": " << reply.error;
+            if (reply.error == 0) {
+              looked_up[t].push_back(reply.As<fuse_entry_out>()->nodeid);
+            }
+            break;
+          }
+        }
+      }
+    });
+  }
+  for (std::thread &thread : threads) thread.join();
+
+  // Once quiet, every name is what the source says it is.
+  for (int i = 0; i < kNames; i++) {
+    const std::string name = absl::StrCat("f", i);
+    Reply reply = Must(fuse_->Lookup(kRoot, name));
+    if (SourceHas(name)) {
+      ASSERT_EQ(reply.error, 0) << name;
+      EXPECT_EQ(reply.As<fuse_entry_out>()->attr.ino, SourceStat(name).st_ino)
+        << name;
+      looked_up[0].push_back(reply.As<fuse_entry_out>()->nodeid);
+    } else {
+      EXPECT_EQ(reply.error, ENOENT) << name;
+    }
+  }
+
+  for (const std::vector<uint64_t> &nodeids : looked_up) {
+    for (uint64_t nodeid : nodeids) CHECK_OK(fuse_->Forget(nodeid, 1));
+  }
+}
+
+}  // namespace
+}  // namespace pafs
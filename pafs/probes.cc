@@ -0,0 +1,20 @@
+#include "pafs/probes.h"
+
+#ifdef PAFS_HAVE_USDT
+
+// Tracers find these through the probes' notes and increment them while
+// attached.
+#define PAFS_SEMAPHORE(name)                                          \
+  __extension__ volatile unsigned short pafs_##name##_semaphore       \
+    __attribute__((unused)) __attribute__((section(".probes"))) = 0
+
+extern "C" {
+PAFS_SEMAPHORE(op__entry);
+PAFS_SEMAPHORE(op__exit);
+PAFS_SEMAPHORE(syscall__entry);
+PAFS_SEMAPHORE(syscall__exit);
+}
+
+#undef PAFS_SEMAPHORE
+
+#endif  // PAFS_HAVE_USDT
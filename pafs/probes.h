@@ -0,0 +1,53 @@
+#ifndef PAFS_PROBES_H_
+#define PAFS_PROBES_H_
+
+// USDT probes, for attaching bpftrace, perf or SystemTap to a running pafs:
+//
+//   bpftrace -e 'usdt:/path/to/pafs:pafs:op__exit {
+//     @us[str(arg1)] = hist(arg3 / 1000); }'
+//
+// Probes:
+//   op__entry(op, op_name, ino)
+//   op__exit(op, op_name, errno, latency_ns)
+//   syscall__entry(name)
+//   syscall__exit(name, latency_ns)
+//
+// An unattached probe is a nop. Latencies cost clock reads, so they're only
+// measured while a tracer that sets probe semaphores, like bpftrace, is
+// attached to the exit probe, and are 0 otherwise.
+//
+// Without <sys/sdt.h> (systemtap-sdt-dev) the probes compile to nothing.
+
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define PAFS_HAVE_USDT 1
+#endif
+
+#ifdef PAFS_HAVE_USDT
+
+// Defined in probes.cc. Their names are fixed by sys/sdt.h.
+extern "C" {
+extern volatile unsigned short pafs_op__entry_semaphore;
+extern volatile unsigned short pafs_op__exit_semaphore;
+extern volatile unsigned short pafs_syscall__entry_semaphore;
+extern volatile unsigned short pafs_syscall__exit_semaphore;
+}
+
+#define PAFS_PROBE_ENABLED(name) \
+  __builtin_expect(pafs_##name##_semaphore != 0, 0)
+#define PAFS_PROBE(name, ...) STAP_PROBEV(pafs, name, __VA_ARGS__)
+
+#else
+
+namespace pafs {
+// Keeps probe arguments used, for want of a probe to pass them to.
+inline void IgnoreProbeArgs(const auto &...) {}
+}  // namespace pafs
+
+#define PAFS_PROBE_ENABLED(name) false
+#define PAFS_PROBE(name, ...) ::pafs::IgnoreProbeArgs(__VA_ARGS__)
+
+#endif  // PAFS_HAVE_USDT
+
+#endif  // PAFS_PROBES_H_
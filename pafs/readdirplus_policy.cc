@@ -0,0 +1,43 @@
+#include "pafs/readdirplus_policy.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#include "absl/synchronization/mutex.h"
+
+namespace pafs {
+
+void ReadDirPlusPolicy::StartListing() {
+  uint64_t listed = listed_.exchange(0, std::memory_order_relaxed);
+  uint64_t used = used_.exchange(0, std::memory_order_relaxed);
+  if (listed < kMinEntries) return;
+  const bool was_used = used * kUsedFraction >= listed;
+
+  absl::MutexLock lock(&mu_);
+  if (want_attributes_.load(std::memory_order_relaxed)) {
+    if (was_used) {
+      unused_passes_ = 0;
+    } else if (++unused_passes_ >= max_unused_passes_) {
+      unused_passes_ = 0;
+      want_attributes_.store(false, std::memory_order_relaxed);
+    }
+  } else if (was_used) {
+    max_unused_passes_ = std::min(max_unused_passes_ * 2, kMaxUnusedPasses);
+    want_attributes_.store(true, std::memory_order_relaxed);
+  }
+}
+
+bool ReadDirPlusPolicy::WantAttributes() const {
+  return want_attributes_.load(std::memory_order_relaxed);
+}
+
+void ReadDirPlusPolicy::OnEntriesListed(uint64_t n) {
+  listed_.fetch_add(n, std::memory_order_relaxed);
+}
+
+void ReadDirPlusPolicy::OnEntryUsed() {
+  used_.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace pafs
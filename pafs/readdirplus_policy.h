@@ -0,0 +1,68 @@
+#ifndef PAFS_READDIRPLUS_POLICY_H_
+#define PAFS_READDIRPLUS_POLICY_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace pafs {
+
+// Decides, per directory, whether ReadDirPlus is worth serving with
+// attributes.
+//
+// Filling in attributes costs an openat, fstatat and FS_IOC_GETVERSION per
+// entry. That's wasted when the caller only wants names (e.g. `find -name`).
+// We can't see whether the kernel used the attributes we gave it, but we can
+// see whether the caller went on to use the entries: after a listing without
+// attributes it looks them up, and after one with attributes it fetches them
+// again once they expire. So after each full pass over a directory, compare
+// the number of entries used since the previous pass against the number
+// listed, and switch modes when the pattern changes.
+//
+// Attributes the kernel may still cache hide their use, which would make us
+// turn them off, see the lookups, and turn them back on. So each time a pass
+// without attributes shows that turning them off was a mistake, it takes
+// twice as many unused passes before we try again.
+//
+// Thread-safe.
+class ReadDirPlusPolicy {
+ public:
+  // Called when a new pass over the directory starts (i.e. at offset 0).
+  void StartListing();
+
+  // Whether ReadDirPlus should currently return attributes.
+  bool WantAttributes() const;
+
+  // Called with the number of entries (excluding "." and "..") returned by a
+  // ReadDir or ReadDirPlus of this directory.
+  void OnEntriesListed(uint64_t n);
+
+  // Called when a name in this directory is successfully looked up, or the
+  // attributes of an entry the last ReadDirPlus returned are fetched.
+  void OnEntryUsed();
+
+ private:
+  // Passes smaller than this don't tell us enough to change modes.
+  static constexpr uint64_t kMinEntries = 16;
+  // Fraction of listed entries (as 1/n) that must be used before we consider
+  // the attributes used.
+  static constexpr uint64_t kUsedFraction = 8;
+  // Most unused passes we ever wait for before turning attributes off.
+  static constexpr uint64_t kMaxUnusedPasses = 64;
+
+  std::atomic<bool> want_attributes_ = true;
+  std::atomic<uint64_t> listed_ = 0;
+  std::atomic<uint64_t> used_ = 0;
+
+  absl::Mutex mu_;
+  // Consecutive passes with attributes that weren't used.
+  uint64_t unused_passes_ ABSL_GUARDED_BY(mu_) = 0;
+  // How many of those turn attributes off.
+  uint64_t max_unused_passes_ ABSL_GUARDED_BY(mu_) = 1;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_READDIRPLUS_POLICY_H_
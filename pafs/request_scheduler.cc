@@ -0,0 +1,111 @@
+#include "pafs/request_scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "fuse/fuse_kernel.h"
+#include "fuse/fuse_lowlevel.h"
+#include "pafs/util.h"
+
+namespace pafs {
+namespace {
+
+bool IsData(const fuse_buf &buf) {
+  // libfuse leaves a write it spliced from /dev/fuse in a pipe, header and
+  // all. Only writes are spliced.
+  if (buf.flags & FUSE_BUF_IS_FD) return true;
+  if (buf.size < sizeof(fuse_in_header)) return false;
+  switch (static_cast<const fuse_in_header *>(buf.mem)->opcode) {
+    case FUSE_READ:
+    case FUSE_WRITE:
+    case FUSE_FSYNC:
+    case FUSE_FSYNCDIR:
+    case FUSE_FALLOCATE:
+    case FUSE_COPY_FILE_RANGE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+RequestScheduler::RequestScheduler(Options opts) : opts_(opts) {}
+
+RequestScheduler::~RequestScheduler() {
+  absl::MutexLock lock(&mu_);
+  for (Queued &queued : queue_) std::free(queued.buf.mem);
+}
+
+RequestScheduler::Admission RequestScheduler::Admit(fuse_buf &buf) {
+  if (!IsData(buf)) {
+    metadata_.fetch_add(1, std::memory_order_relaxed);
+    return Admission::kMetadata;
+  }
+
+  absl::MutexLock lock(&mu_);
+  data_++;
+  // A spliced write is read from the reading thread's pipe, so it can't be
+  // handed to another thread.
+  const bool can_queue = !(buf.flags & FUSE_BUF_IS_FD);
+  if (busy_ >= opts_.data_threads && can_queue &&
+      queue_.size() < opts_.max_queued) {
+    // Only what was read: most queued requests are reads, of a few dozen
+    // bytes.
+    if (void *mem = std::malloc(buf.size); mem != nullptr) {
+      std::memcpy(mem, buf.mem, buf.size);
+      fuse_buf copy = buf;
+      copy.mem = mem;
+      queue_.push_back({.buf = copy, .queued_ns = MonotonicNanos()});
+      peak_queued_ = std::max(peak_queued_, queue_.size());
+      queued_++;
+      return Admission::kQueued;
+    }
+  }
+  if (busy_ >= opts_.data_threads) over_limit_++;
+  busy_++;
+  return Admission::kData;
+}
+
+std::optional<fuse_buf> RequestScheduler::Next() {
+  absl::MutexLock lock(&mu_);
+  // Over the limit, give up the data thread without taking more.
+  if (queue_.empty() || busy_ > opts_.data_threads) {
+    busy_--;
+    return std::nullopt;
+  }
+  Queued queued = queue_.front();
+  queue_.pop_front();
+  uint64_t wait = MonotonicNanos() - queued.queued_ns;
+  dequeued_++;
+  wait_total_ns_ += wait;
+  wait_max_ns_ = std::max(wait_max_ns_, wait);
+  return queued.buf;
+}
+
+std::string RequestScheduler::Format() const {
+  std::string out = absl::StrFormat(
+      "metadata: %d requests\n",
+      metadata_.load(std::memory_order_relaxed));
+  absl::MutexLock lock(&mu_);
+  absl::StrAppendFormat(
+      &out,
+      "data: %d requests, %d of %d threads busy, %d queued, %d over the "
+      "limit\n"
+      "queue: %d now, %d peak, %.1f us mean wait, %.1f us max wait\n",
+      data_, busy_, opts_.data_threads, queued_, over_limit_, queue_.size(),
+      peak_queued_,
+      dequeued_ == 0
+        ? 0 : static_cast<double>(wait_total_ns_) / 1000 / dequeued_,
+      static_cast<double>(wait_max_ns_) / 1000);
+  return out;
+}
+
+}  // namespace pafs
@@ -0,0 +1,101 @@
+#ifndef PAFS_REQUEST_SCHEDULER_H_
+#define PAFS_REQUEST_SCHEDULER_H_
+
+#ifndef FUSE_USE_VERSION
+// Needed by fuse/fuse_lowlevel.h
+#define FUSE_USE_VERSION 312
+#elif FUSE_USE_VERSION != 312
+#error this file is written for fuse 3.12
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "fuse/fuse_lowlevel.h"
+
+namespace pafs {
+
+// Keeps bulk data requests (reads, writes, fsyncs and the like) from taking
+// every worker thread, so that metadata requests like Lookup and GetAttr
+// don't wait behind them. At most `data_threads` threads handle data requests
+// at once; the rest are kept for metadata. A data request read while those
+// are all busy is queued, and handled by the next thread to finish one
+// before it reads anything more from the kernel.
+//
+// Requests are classified by their opcode as read from /dev/fuse, before
+// libfuse dispatches them, since a request can't be set aside once its
+// handler has started.
+//
+// Thread-safe.
+class RequestScheduler {
+ public:
+  struct Options {
+    size_t data_threads = 1;
+    // Once this many data requests are queued, further ones are handled at
+    // once, over the limit, rather than stop the thread that read them.
+    size_t max_queued = 256;
+  };
+
+  explicit RequestScheduler(Options opts);
+  // Frees any requests still queued, unreplied.
+  ~RequestScheduler();
+
+  RequestScheduler(RequestScheduler &&) = delete;
+  RequestScheduler(const RequestScheduler &) = delete;
+  RequestScheduler &operator=(RequestScheduler &&) = delete;
+  RequestScheduler &operator=(const RequestScheduler &) = delete;
+
+  enum class Admission {
+    // Handle it now.
+    kMetadata,
+    // Handle it now, holding a data thread, then call Next.
+    kData,
+    // A copy has been queued. `buf` is left to be read into again, since
+    // libfuse would otherwise allocate a whole new receive buffer, about
+    // 1MiB, for the next read.
+    kQueued,
+  };
+
+  // Called with a request just read into `buf` by fuse_session_receive_buf.
+  Admission Admit(fuse_buf &buf);
+
+  // Called once the caller has handled a data request. Returns the next
+  // queued one, still holding the data thread, or nullopt once there's none,
+  // giving it up. The caller owns the returned buffer's memory.
+  std::optional<fuse_buf> Next();
+
+  // For ControlRegistry.
+  std::string Format() const;
+
+ private:
+  struct Queued {
+    fuse_buf buf;
+    uint64_t queued_ns;
+  };
+
+  const Options opts_;
+  // Not under mu_, so that metadata requests never wait on it.
+  std::atomic<uint64_t> metadata_ = 0;
+
+  mutable absl::Mutex mu_;
+  size_t busy_ ABSL_GUARDED_BY(mu_) = 0;
+  std::deque<Queued> queue_ ABSL_GUARDED_BY(mu_);
+  size_t peak_queued_ ABSL_GUARDED_BY(mu_) = 0;
+  uint64_t data_ ABSL_GUARDED_BY(mu_) = 0;
+  uint64_t queued_ ABSL_GUARDED_BY(mu_) = 0;
+  uint64_t over_limit_ ABSL_GUARDED_BY(mu_) = 0;
+  // Of those dequeued.
+  uint64_t dequeued_ ABSL_GUARDED_BY(mu_) = 0;
+  uint64_t wait_total_ns_ ABSL_GUARDED_BY(mu_) = 0;
+  uint64_t wait_max_ns_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_REQUEST_SCHEDULER_H_
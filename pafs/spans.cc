@@ -0,0 +1,208 @@
+#include "pafs/spans.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/log/check.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "pafs/util.h"
+
+namespace pafs {
+namespace {
+
+struct Span {
+  const char *category;
+  // nullptr for the request itself, which is named after `op`.
+  const char *name;
+  Op op;
+  uint64_t start_ns;
+  uint64_t end_ns;
+};
+
+struct SpanBuffer {
+  explicit SpanBuffer(uint32_t tid) : tid(tid) {}
+
+  const uint32_t tid;
+  // Set when the owning thread exits. Flush forgets the buffer once it's
+  // empty.
+  std::atomic<bool> retired = false;
+
+  absl::Mutex mu;
+  std::vector<Span> spans ABSL_GUARDED_BY(mu);
+  uint64_t dropped ABSL_GUARDED_BY(mu) = 0;
+};
+
+// Buffers outlive both their thread and any one SpanRecorder.
+ABSL_CONST_INIT absl::Mutex buffers_mu(absl::kConstInit);
+std::vector<std::shared_ptr<SpanBuffer>> &Buffers()
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(buffers_mu) {
+  static auto *buffers = new std::vector<std::shared_ptr<SpanBuffer>>();
+  return *buffers;
+}
+
+std::atomic<uint32_t> sample_every = 0;
+std::atomic<size_t> max_spans = 0;
+
+struct ThreadSpans {
+  ~ThreadSpans() {
+    if (buffer != nullptr) {
+      buffer->retired.store(true, std::memory_order_release);
+    }
+  }
+
+  void Add(const Span &span) {
+    if (buffer == nullptr) {
+      buffer = std::make_shared<SpanBuffer>(static_cast<uint32_t>(gettid()));
+      absl::MutexLock lock(&buffers_mu);
+      Buffers().push_back(buffer);
+    }
+    absl::MutexLock lock(&buffer->mu);
+    if (buffer->spans.size() >= max_spans.load(std::memory_order_relaxed)) {
+      buffer->dropped++;
+      return;
+    }
+    buffer->spans.push_back(span);
+  }
+
+  std::shared_ptr<SpanBuffer> buffer;
+  uint32_t sample_count = 0;
+  // Set while handling a sampled request.
+  bool sampled = false;
+  Op op = Op::kUnknown;
+  uint64_t request_start_ns = 0;
+  uint64_t handler_start_ns = 0;
+};
+thread_local ThreadSpans thread_spans;
+
+}  // namespace
+
+std::unique_ptr<SpanRecorder> SpanRecorder::Create(Options opts) {
+  CHECK_GT(opts.sample_every, 0u);
+  uint32_t expected = 0;
+  CHECK(sample_every.compare_exchange_strong(expected, opts.sample_every))
+    << "Only one SpanRecorder may exist";
+  max_spans.store(opts.max_spans_per_thread);
+  return std::unique_ptr<SpanRecorder>(new SpanRecorder());
+}
+
+SpanRecorder::~SpanRecorder() { sample_every.store(0); }
+
+void SpanRecorder::BeginRequest(Op op) {
+  uint32_t every = sample_every.load(std::memory_order_relaxed);
+  ThreadSpans &t = thread_spans;
+  if (every == 0 || ++t.sample_count < every) return;
+  t.sample_count = 0;
+  t.sampled = true;
+  t.op = op;
+  t.request_start_ns = MonotonicNanos();
+  t.handler_start_ns = 0;
+}
+
+void SpanRecorder::EndRequest() {
+  ThreadSpans &t = thread_spans;
+  if (!t.sampled) return;
+  t.sampled = false;
+  t.Add({
+    .category = "request",
+    .name = nullptr,
+    .op = t.op,
+    .start_ns = t.request_start_ns,
+    .end_ns = MonotonicNanos(),
+  });
+}
+
+void SpanRecorder::BeginHandler() {
+  ThreadSpans &t = thread_spans;
+  if (t.sampled) t.handler_start_ns = MonotonicNanos();
+}
+
+void SpanRecorder::EndHandler() {
+  ThreadSpans &t = thread_spans;
+  if (!t.sampled || t.handler_start_ns == 0) return;
+  t.Add({
+    .category = "handler",
+    .name = "handler",
+    .op = t.op,
+    .start_ns = t.handler_start_ns,
+    .end_ns = MonotonicNanos(),
+  });
+  t.handler_start_ns = 0;
+}
+
+std::string SpanRecorder::Flush() const {
+  std::vector<std::shared_ptr<SpanBuffer>> buffers;
+  {
+    absl::MutexLock lock(&buffers_mu);
+    buffers = Buffers();
+  }
+
+  const int pid = getpid();
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  const auto event = [&](std::string_view json) {
+    absl::StrAppend(&out, first ? "\n" : ",\n", json);
+    first = false;
+  };
+  for (const std::shared_ptr<SpanBuffer> &buffer : buffers) {
+    std::vector<Span> spans;
+    uint64_t dropped;
+    {
+      absl::MutexLock lock(&buffer->mu);
+      spans.swap(buffer->spans);
+      dropped = std::exchange(buffer->dropped, 0);
+    }
+    for (const Span &span : spans) {
+      // Chrome traces count in microseconds.
+      event(absl::StrFormat(
+          "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+          "\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"op\":\"%s\"}}",
+          span.name != nullptr ? span.name : OpName(span.op), span.category,
+          static_cast<double>(span.start_ns) / 1000,
+          static_cast<double>(span.end_ns - span.start_ns) / 1000, pid,
+          buffer->tid, OpName(span.op)));
+    }
+    if (dropped != 0) {
+      event(absl::StrFormat(
+          "{\"name\":\"dropped\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,"
+          "\"tid\":%d,\"args\":{\"spans\":%d}}",
+          static_cast<double>(MonotonicNanos()) / 1000, pid, buffer->tid,
+          dropped));
+    }
+  }
+  absl::StrAppend(&out, "\n]}\n");
+
+  absl::MutexLock lock(&buffers_mu);
+  std::erase_if(Buffers(), [](const std::shared_ptr<SpanBuffer> &buffer) {
+    if (!buffer->retired.load(std::memory_order_acquire)) return false;
+    absl::MutexLock lock(&buffer->mu);
+    return buffer->spans.empty();
+  });
+  return out;
+}
+
+ScopedSpan::ScopedSpan(const char *category, const char *name)
+  : category_(category), name_(name),
+    start_ns_(thread_spans.sampled ? MonotonicNanos() : 0) {}
+
+ScopedSpan::~ScopedSpan() {
+  ThreadSpans &t = thread_spans;
+  if (start_ns_ == 0 || !t.sampled) return;
+  t.Add({
+    .category = category_,
+    .name = name_,
+    .op = t.op,
+    .start_ns = start_ns_,
+    .end_ns = MonotonicNanos(),
+  });
+}
+
+}  // namespace pafs
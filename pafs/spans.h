@@ -0,0 +1,75 @@
+#ifndef PAFS_SPANS_H_
+#define PAFS_SPANS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "pafs/op.h"
+
+namespace pafs {
+
+// Records timelines of sampled requests: a span for the whole request, one
+// for its handler, and one for each syscall and reply made while handling it.
+// Spans are kept in per-thread buffers until Flush turns them into a Chrome
+// trace, which chrome://tracing and ui.perfetto.dev both open.
+//
+// Threads only ever lock their own buffer, except while Flush collects it.
+//
+// Only one SpanRecorder may exist at a time.
+class SpanRecorder {
+ public:
+  struct Options {
+    // Record only every Nth request on each thread.
+    uint32_t sample_every = 100;
+    // Spans past this many on a thread since the last Flush are dropped, and
+    // counted.
+    size_t max_spans_per_thread = 1 << 16;
+  };
+
+  static std::unique_ptr<SpanRecorder> Create(Options opts);
+  ~SpanRecorder();
+
+  SpanRecorder(SpanRecorder &&) = delete;
+  SpanRecorder(const SpanRecorder &) = delete;
+  SpanRecorder &operator=(SpanRecorder &&) = delete;
+  SpanRecorder &operator=(const SpanRecorder &) = delete;
+
+  // Chrome trace event JSON of every span recorded since the last Flush,
+  // which are then forgotten. For ControlRegistry.
+  std::string Flush() const;
+
+  // Called by FuseRequest as the calling thread starts and stops handling a
+  // request, and around the handler. Decide whether the request is sampled.
+  static void BeginRequest(Op op);
+  static void EndRequest();
+  static void BeginHandler();
+  static void EndHandler();
+
+ private:
+  SpanRecorder() = default;
+};
+
+// A span covering this object's lifetime, if the calling thread is handling
+// a sampled request. Otherwise costs a thread-local load. `name` and
+// `category` must be string literals.
+class ScopedSpan {
+ public:
+  ScopedSpan(const char *category, const char *name);
+  ~ScopedSpan();
+
+  ScopedSpan(ScopedSpan &&) = delete;
+  ScopedSpan(const ScopedSpan &) = delete;
+  ScopedSpan &operator=(ScopedSpan &&) = delete;
+  ScopedSpan &operator=(const ScopedSpan &) = delete;
+
+ private:
+  const char *category_;
+  const char *name_;
+  uint64_t start_ns_ = 0;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_SPANS_H_
@@ -0,0 +1,183 @@
+#include "pafs/stats.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <sched.h>
+#include <string>
+#include <sys/sysinfo.h>
+
+#include "absl/log/check.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "pafs/status.h"
+
+namespace pafs {
+namespace {
+
+std::atomic<OpStats *> current = nullptr;
+
+}  // namespace
+
+struct OpStats::Shard {
+  struct alignas(64) PerOp {
+    std::atomic<uint64_t> count = 0;
+    std::atomic<uint64_t> total_ns = 0;
+    std::atomic<uint64_t> max_ns = 0;
+    std::atomic<uint64_t> errors = 0;
+    std::array<std::atomic<uint64_t>, kNumBuckets> buckets = {};
+    std::array<std::atomic<uint64_t>, kMaxErrno + 1> errnos = {};
+  };
+  std::array<PerOp, kNumOps> ops;
+};
+
+std::unique_ptr<OpStats> OpStats::Create() {
+  auto stats = std::unique_ptr<OpStats>(new OpStats());
+  OpStats *expected = nullptr;
+  CHECK(current.compare_exchange_strong(expected, stats.get()))
+    << "Only one OpStats may exist";
+  return stats;
+}
+
+OpStats::OpStats()
+  : num_shards_(std::max(get_nprocs_conf(), 1)),
+    shards_(new std::atomic<Shard *>[num_shards_]()) {}
+
+OpStats::~OpStats() {
+  current.store(nullptr);
+  for (int i = 0; i < num_shards_; i++) delete shards_[i].load();
+}
+
+bool OpStats::Enabled() {
+  return current.load(std::memory_order_relaxed) != nullptr;
+}
+
+void OpStats::Record(Op op, int error, uint64_t latency_ns) {
+  OpStats *stats = current.load(std::memory_order_acquire);
+  if (stats == nullptr) return;
+  stats->Add(op, error, latency_ns);
+}
+
+int OpStats::Bucket(uint64_t ns) {
+  if (ns < kSubBuckets) return static_cast<int>(ns);
+  int exp = std::bit_width(ns) - 1;
+  if (exp > kMaxExponent) return kNumBuckets - 1;
+  // The top kSubBucketBits bits below the leading one.
+  int sub = static_cast<int>(ns >> (exp - kSubBucketBits)) - kSubBuckets;
+  return (exp - kSubBucketBits + 1) * kSubBuckets + sub;
+}
+
+uint64_t OpStats::BucketUpperBound(int bucket) {
+  if (bucket < kSubBuckets) return bucket;
+  int exp = bucket / kSubBuckets + kSubBucketBits - 1;
+  uint64_t sub = bucket % kSubBuckets;
+  uint64_t width = uint64_t{1} << (exp - kSubBucketBits);
+  return (kSubBuckets + sub) * width + width - 1;
+}
+
+uint64_t OpStats::Histogram::Quantile(double q) const {
+  if (count == 0) return 0;
+  auto rank = static_cast<uint64_t>(std::ceil(q * static_cast<double>(count)));
+  rank = std::clamp<uint64_t>(rank, 1, count);
+  uint64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; i++) {
+    seen += buckets[i];
+    if (seen >= rank) return std::min(BucketUpperBound(i), max_ns);
+  }
+  return max_ns;
+}
+
+OpStats::Shard &OpStats::GetShard() {
+  // Falls back to shard 0 if the CPU is unknown. Being migrated between here
+  // and the update is harmless: the counters are atomic, just usually
+  // uncontended.
+  int cpu = std::max(sched_getcpu(), 0) % num_shards_;
+  std::atomic<Shard *> &slot = shards_[cpu];
+  if (Shard *shard = slot.load(std::memory_order_acquire)) return *shard;
+  auto shard = std::make_unique<Shard>();
+  Shard *expected = nullptr;
+  if (slot.compare_exchange_strong(
+        expected, shard.get(), std::memory_order_acq_rel)) {
+    return *shard.release();
+  }
+  return *expected;
+}
+
+void OpStats::Add(Op op, int error, uint64_t latency_ns) {
+  Shard::PerOp &s = GetShard().ops[static_cast<size_t>(op)];
+  s.count.fetch_add(1, std::memory_order_relaxed);
+  s.total_ns.fetch_add(latency_ns, std::memory_order_relaxed);
+  s.buckets[Bucket(latency_ns)].fetch_add(1, std::memory_order_relaxed);
+  uint64_t max = s.max_ns.load(std::memory_order_relaxed);
+  while (latency_ns > max &&
+         !s.max_ns.compare_exchange_weak(
+           max, latency_ns, std::memory_order_relaxed)) {}
+  if (error != 0) {
+    s.errors.fetch_add(1, std::memory_order_relaxed);
+    s.errnos[std::clamp(error, 0, kMaxErrno)].fetch_add(
+        1, std::memory_order_relaxed);
+  }
+}
+
+std::unique_ptr<std::array<OpStats::OpSnapshot, kNumOps>>
+OpStats::Snapshot() const {
+  auto snapshot = std::make_unique<std::array<OpSnapshot, kNumOps>>();
+  for (int i = 0; i < num_shards_; i++) {
+    const Shard *shard = shards_[i].load(std::memory_order_acquire);
+    if (shard == nullptr) continue;
+    for (size_t op = 0; op < kNumOps; op++) {
+      const Shard::PerOp &s = shard->ops[op];
+      OpSnapshot &out = (*snapshot)[op];
+      out.latency.count += s.count.load(std::memory_order_relaxed);
+      out.latency.total_ns += s.total_ns.load(std::memory_order_relaxed);
+      out.latency.max_ns = std::max(
+          out.latency.max_ns, s.max_ns.load(std::memory_order_relaxed));
+      for (int b = 0; b < kNumBuckets; b++) {
+        out.latency.buckets[b] += s.buckets[b].load(std::memory_order_relaxed);
+      }
+      out.errors += s.errors.load(std::memory_order_relaxed);
+      for (int e = 0; e <= kMaxErrno; e++) {
+        out.errnos[e] += s.errnos[e].load(std::memory_order_relaxed);
+      }
+    }
+  }
+  return snapshot;
+}
+
+std::string OpStats::Format() const {
+  std::unique_ptr<std::array<OpSnapshot, kNumOps>> snapshot = Snapshot();
+  const auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000; };
+
+  std::string out = absl::StrFormat(
+      "%-16s %12s %10s %10s %10s %10s %10s %10s %10s\n", "op", "count",
+      "errors", "mean_us", "p50_us", "p90_us", "p99_us", "p999_us", "max_us");
+  for (size_t op = 0; op < kNumOps; op++) {
+    const OpSnapshot &s = (*snapshot)[op];
+    if (s.latency.count == 0) continue;
+    absl::StrAppendFormat(
+        &out, "%-16s %12d %10d %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+        OpName(static_cast<Op>(op)), s.latency.count, s.errors,
+        us(s.latency.total_ns) / static_cast<double>(s.latency.count),
+        us(s.latency.Quantile(0.5)), us(s.latency.Quantile(0.9)),
+        us(s.latency.Quantile(0.99)), us(s.latency.Quantile(0.999)),
+        us(s.latency.max_ns));
+  }
+
+  absl::StrAppend(&out, "\nerrors:\n");
+  for (size_t op = 0; op < kNumOps; op++) {
+    const OpSnapshot &s = (*snapshot)[op];
+    for (int e = 1; e <= kMaxErrno; e++) {
+      if (s.errnos[e] == 0) continue;
+      absl::StrAppendFormat(
+          &out, "%-16s %-16s %12d\n", OpName(static_cast<Op>(op)),
+          e == kMaxErrno ? "other" : ErrnoToErrorName(e), s.errnos[e]);
+    }
+  }
+  return out;
+}
+
+}  // namespace pafs
@@ -0,0 +1,103 @@
+#ifndef PAFS_STATS_H_
+#define PAFS_STATS_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "pafs/op.h"
+
+namespace pafs {
+
+// What requests on one file have cost, for finding the hottest files. Charged
+// by FuseRequest as it replies; see FuseHeatSource in fuse_ops.h.
+struct HeatCounters {
+  std::atomic<uint64_t> ops = 0;
+  // As replied with. Reads replied to from a file descriptor count what was
+  // asked for, which is more than was read at the end of the file.
+  std::atomic<uint64_t> bytes_read = 0;
+  std::atomic<uint64_t> bytes_written = 0;
+  std::atomic<uint64_t> latency_ns = 0;
+};
+
+// Per-op request counts, error counts by errno and latency histograms, fed by
+// FuseRequest as it replies to each request.
+//
+// Counters live in per-CPU shards so that recording a request only touches
+// cache lines of the CPU it ran on. They're summed when read.
+//
+// Only one OpStats may exist at a time, and it must outlive the session loop.
+class OpStats {
+ public:
+  // Latencies are bucketed log-linearly, as in HdrHistogram: each power of two
+  // is split into kSubBuckets buckets, so a bucket's bounds are within
+  // 1/kSubBuckets of each other.
+  static constexpr int kSubBucketBits = 3;
+  static constexpr int kSubBuckets = 1 << kSubBucketBits;
+  // Latencies of 2^(kMaxExponent+1)ns (about 2 minutes) or more share the
+  // last bucket.
+  static constexpr int kMaxExponent = 36;
+  static constexpr int kNumBuckets =
+    (kMaxExponent - kSubBucketBits + 2) * kSubBuckets;
+  // Linux's errnos end at 133 (EHWPOISON). Anything larger is counted as
+  // kMaxErrno.
+  static constexpr int kMaxErrno = 134;
+
+  static std::unique_ptr<OpStats> Create();
+  ~OpStats();
+
+  OpStats(OpStats &&) = delete;
+  OpStats(const OpStats &) = delete;
+  OpStats &operator=(OpStats &&) = delete;
+  OpStats &operator=(const OpStats &) = delete;
+
+  // Whether an OpStats exists, i.e. whether requests need timing.
+  static bool Enabled();
+  // Records a finished request. Does nothing unless Enabled().
+  static void Record(Op op, int error, uint64_t latency_ns);
+
+  struct Histogram {
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    std::array<uint64_t, kNumBuckets> buckets = {};
+
+    // An upper bound on the `q` quantile, 0 <= q <= 1.
+    uint64_t Quantile(double q) const;
+  };
+
+  struct OpSnapshot {
+    Histogram latency;
+    uint64_t errors = 0;
+    std::array<uint64_t, kMaxErrno + 1> errnos = {};
+  };
+
+  // Sums the shards. Requests recorded concurrently may be partly counted.
+  std::unique_ptr<std::array<OpSnapshot, kNumOps>> Snapshot() const;
+
+  // A table of every op that has seen a request, then the errors they
+  // replied with. For ControlRegistry.
+  std::string Format() const;
+
+  static int Bucket(uint64_t ns);
+  // The largest latency in `bucket`.
+  static uint64_t BucketUpperBound(int bucket);
+
+ private:
+  struct Shard;
+
+  OpStats();
+
+  Shard &GetShard();
+  void Add(Op op, int error, uint64_t latency_ns);
+
+  const int num_shards_;
+  // Allocated by the first request to run on each CPU.
+  std::unique_ptr<std::atomic<Shard *>[]> shards_;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_STATS_H_
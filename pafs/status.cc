@@ -31,6 +31,9 @@ absl::Status Append(absl::Status st, std::string_view message, std::string_view
 }
 
 absl::Status ErrnoToStatus(int error_number, absl::string_view message) {
+  // Every successful fuse reply passes through here, so don't build a payload
+  // just to have it dropped.
+  if (error_number == 0) return absl::OkStatus();
   absl::Status status = absl::ErrnoToStatus(error_number, message);
   status.SetPayload(kErrnoTypeUrl, absl::Cord(ErrnoToErrorName(error_number)));
   return status;
@@ -0,0 +1,244 @@
+#include "pafs/syscall_stats.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <sched.h>
+#include <string>
+#include <string_view>
+#include <sys/sysinfo.h>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+
+namespace pafs {
+namespace {
+
+constexpr std::array<std::string_view, kNumSyscalls> kSyscallNames = {
+  "close",
+  "open",
+  "openat",
+  "read",
+  "write",
+  "pread",
+  "pwrite",
+  "mount",
+  "stat",
+  "lstat",
+  "fstatat",
+  "umount",
+  "sigaction",
+  "signalfd",
+  "sigprocmask",
+  "pthread_sigmask",
+  "pthread_setschedparam",
+  "pthread_setaffinity_np",
+  "pthread_kill",
+  "set_mempolicy",
+  "fdopendir",
+  "closedir",
+  "readdir",
+  "getdents64",
+  "fchmod",
+  "fchownat",
+  "ftruncate",
+  "futimens",
+  "readlinkat",
+  "mknodat",
+  "mkdirat",
+  "unlinkat",
+  "symlinkat",
+  "renameat2",
+  "linkat",
+  "dup",
+  "fsync",
+  "fdatasync",
+  "fstatvfs",
+  "fsetxattr",
+  "setxattr",
+  "getxattr",
+  "fgetxattr",
+  "listxattr",
+  "flistxattr",
+  "removexattr",
+  "fremovexattr",
+  "setxattrat",
+  "getxattrat",
+  "listxattrat",
+  "removexattrat",
+  "access",
+  "faccessat",
+  "flock",
+  "fallocate",
+  "copy_file_range",
+  "lseek",
+  "inotify_init1",
+  "inotify_add_watch",
+  "inotify_rm_watch",
+  "eventfd",
+  "poll",
+  "memfd_create",
+  "pipe2",
+  "socket",
+  "bind",
+  "listen",
+  "accept4",
+  "setsockopt",
+  "recv",
+  "send",
+  "ioctl",
+};
+
+std::atomic<SyscallStats *> current = nullptr;
+
+// The op of the request the thread is handling.
+thread_local Op current_op = Op::kUnknown;
+
+}  // namespace
+
+std::string_view SyscallName(Syscall syscall) {
+  return kSyscallNames[static_cast<size_t>(syscall)];
+}
+
+struct SyscallStats::Shard {
+  struct Counter {
+    std::atomic<uint64_t> count = 0;
+    std::atomic<uint64_t> total_ns = 0;
+  };
+  struct alignas(64) PerOp {
+    std::atomic<uint64_t> requests = 0;
+    std::array<Counter, kNumSyscalls> syscalls;
+  };
+  std::array<PerOp, kNumOps> ops;
+};
+
+std::unique_ptr<SyscallStats> SyscallStats::Create() {
+  auto stats = std::unique_ptr<SyscallStats>(new SyscallStats());
+  SyscallStats *expected = nullptr;
+  CHECK(current.compare_exchange_strong(expected, stats.get()))
+    << "Only one SyscallStats may exist";
+  return stats;
+}
+
+SyscallStats::SyscallStats()
+  : num_shards_(std::max(get_nprocs_conf(), 1)),
+    shards_(new std::atomic<Shard *>[num_shards_]()) {}
+
+SyscallStats::~SyscallStats() {
+  current.store(nullptr);
+  for (int i = 0; i < num_shards_; i++) delete shards_[i].load();
+}
+
+bool SyscallStats::Enabled() {
+  return current.load(std::memory_order_relaxed) != nullptr;
+}
+
+void SyscallStats::BeginRequest(Op op) {
+  current_op = op;
+  SyscallStats *stats = current.load(std::memory_order_acquire);
+  if (stats == nullptr) return;
+  stats->GetShard().ops[static_cast<size_t>(op)].requests.fetch_add(
+      1, std::memory_order_relaxed);
+}
+
+void SyscallStats::EndRequest() { current_op = Op::kUnknown; }
+
+void SyscallStats::ResumeRequest(Op op) { current_op = op; }
+
+void SyscallStats::Record(Syscall syscall, uint64_t latency_ns) {
+  SyscallStats *stats = current.load(std::memory_order_acquire);
+  if (stats == nullptr) return;
+  Shard::Counter &c = stats->GetShard()
+    .ops[static_cast<size_t>(current_op)]
+    .syscalls[static_cast<size_t>(syscall)];
+  c.count.fetch_add(1, std::memory_order_relaxed);
+  c.total_ns.fetch_add(latency_ns, std::memory_order_relaxed);
+}
+
+SyscallStats::Shard &SyscallStats::GetShard() {
+  int cpu = std::max(sched_getcpu(), 0) % num_shards_;
+  std::atomic<Shard *> &slot = shards_[cpu];
+  if (Shard *shard = slot.load(std::memory_order_acquire)) return *shard;
+  auto shard = std::make_unique<Shard>();
+  Shard *expected = nullptr;
+  if (slot.compare_exchange_strong(
+        expected, shard.get(), std::memory_order_acq_rel)) {
+    return *shard.release();
+  }
+  return *expected;
+}
+
+std::string SyscallStats::Format() const {
+  struct Sum {
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+  };
+  struct OpSum {
+    uint64_t requests = 0;
+    std::array<Sum, kNumSyscalls> syscalls = {};
+  };
+  auto sums = std::make_unique<std::array<OpSum, kNumOps>>();
+  for (int i = 0; i < num_shards_; i++) {
+    const Shard *shard = shards_[i].load(std::memory_order_acquire);
+    if (shard == nullptr) continue;
+    for (size_t op = 0; op < kNumOps; op++) {
+      const Shard::PerOp &in = shard->ops[op];
+      OpSum &out = (*sums)[op];
+      out.requests += in.requests.load(std::memory_order_relaxed);
+      for (size_t s = 0; s < kNumSyscalls; s++) {
+        out.syscalls[s].count +=
+          in.syscalls[s].count.load(std::memory_order_relaxed);
+        out.syscalls[s].total_ns +=
+          in.syscalls[s].total_ns.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Per request, except for Op::kUnknown, which has no requests and is shown
+  // in totals.
+  std::string out = absl::StrFormat(
+      "%-20s %12s %12s %12s\n", "op / syscall", "requests", "calls/req",
+      "us/req");
+  for (size_t op = 0; op < kNumOps; op++) {
+    const OpSum &sum = (*sums)[op];
+    std::vector<size_t> used;
+    Sum total;
+    for (size_t s = 0; s < kNumSyscalls; s++) {
+      if (sum.syscalls[s].count == 0) continue;
+      used.push_back(s);
+      if (!IsSyscall(static_cast<Syscall>(s))) continue;
+      total.count += sum.syscalls[s].count;
+      total.total_ns += sum.syscalls[s].total_ns;
+    }
+    if (sum.requests == 0 && used.empty()) continue;
+    const double per =
+      sum.requests == 0 ? 1 : static_cast<double>(sum.requests);
+    const auto row = [&](std::string_view name, const Sum &s) {
+      absl::StrAppendFormat(
+          &out, "%-20s %12s %12.2f %12.1f\n", name, "",
+          static_cast<double>(s.count) / per,
+          static_cast<double>(s.total_ns) / 1000 / per);
+    };
+    absl::StrAppendFormat(
+        &out, "%-20s %12d %12.2f %12.1f\n", OpName(static_cast<Op>(op)),
+        sum.requests, static_cast<double>(total.count) / per,
+        static_cast<double>(total.total_ns) / 1000 / per);
+    // Most called first.
+    std::sort(used.begin(), used.end(), [&sum](size_t a, size_t b) {
+      return sum.syscalls[a].count > sum.syscalls[b].count;
+    });
+    for (size_t s : used) {
+      const auto syscall = static_cast<Syscall>(s);
+      row(absl::StrCat(
+            "  ", SyscallName(syscall), IsSyscall(syscall) ? "" : " (libc)"),
+          sum.syscalls[s]);
+    }
+  }
+  return out;
+}
+
+}  // namespace pafs
@@ -0,0 +1,154 @@
+#ifndef PAFS_SYSCALL_STATS_H_
+#define PAFS_SYSCALL_STATS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "pafs/op.h"
+
+namespace pafs {
+
+// The wrappers in pafs::syscalls that enter the kernel. kReaddir is readdir(3),
+// which only does when its buffer runs out, so it's counted apart from the
+// rest: see IsSyscall.
+enum class Syscall : uint8_t {
+  kClose,
+  kOpen,
+  kOpenat,
+  kRead,
+  kWrite,
+  kPread,
+  kPwrite,
+  kMount,
+  kStat,
+  kLstat,
+  kFstatat,
+  kUmount,
+  kSigaction,
+  kSignalfd,
+  kSigprocmask,
+  kPthreadSigmask,
+  kPthreadSetschedparam,
+  kPthreadSetaffinityNp,
+  kPthreadKill,
+  kSetMempolicy,
+  kFdopendir,
+  kClosedir,
+  kReaddir,
+  kGetdents64,
+  kFchmod,
+  kFchownat,
+  kFtruncate,
+  kFutimens,
+  kReadlinkat,
+  kMknodat,
+  kMkdirat,
+  kUnlinkat,
+  kSymlinkat,
+  kRenameat2,
+  kLinkat,
+  kDup,
+  kFsync,
+  kFdatasync,
+  kFstatvfs,
+  kFsetxattr,
+  kSetxattr,
+  kGetxattr,
+  kFgetxattr,
+  kListxattr,
+  kFlistxattr,
+  kRemovexattr,
+  kFremovexattr,
+  kSetxattrat,
+  kGetxattrat,
+  kListxattrat,
+  kRemovexattrat,
+  kAccess,
+  kFaccessat,
+  kFlock,
+  kFallocate,
+  kCopyFileRange,
+  kLseek,
+  kInotifyInit1,
+  kInotifyAddWatch,
+  kInotifyRmWatch,
+  kEventfd,
+  kPoll,
+  kMemfdCreate,
+  kPipe2,
+  kSocket,
+  kBind,
+  kListen,
+  kAccept4,
+  kSetsockopt,
+  kRecv,
+  kSend,
+  kIoctl,
+};
+inline constexpr size_t kNumSyscalls =
+  static_cast<size_t>(Syscall::kIoctl) + 1;
+
+// e.g. "openat".
+std::string_view SyscallName(Syscall syscall);
+
+// Whether every call enters the kernel. Those that don't are left out of the
+// per-request totals.
+constexpr bool IsSyscall(Syscall syscall) {
+  return syscall != Syscall::kReaddir;
+}
+
+// Counts the calls made through pafs::syscalls and the time spent in them,
+// by the op of the request the calling thread was handling, so that e.g. the
+// syscalls a Lookup costs can be counted. Calls made outside of any request,
+// e.g. by the inotify thread, are counted against Op::kUnknown.
+//
+// Like OpStats, counters live in per-CPU shards.
+//
+// Only one SyscallStats may exist at a time, and it must outlive the session
+// loop.
+class SyscallStats {
+ public:
+  static std::unique_ptr<SyscallStats> Create();
+  ~SyscallStats();
+
+  SyscallStats(SyscallStats &&) = delete;
+  SyscallStats(const SyscallStats &) = delete;
+  SyscallStats &operator=(SyscallStats &&) = delete;
+  SyscallStats &operator=(const SyscallStats &) = delete;
+
+  // Whether a SyscallStats exists, i.e. whether syscalls need timing.
+  static bool Enabled();
+
+  // Called by FuseRequest as the calling thread starts and stops handling a
+  // request.
+  static void BeginRequest(Op op);
+  static void EndRequest();
+  // Like BeginRequest, for a thread taking over a request that another began,
+  // e.g. in an OffloadExecutor. The request isn't counted again.
+  static void ResumeRequest(Op op);
+  // Records a finished syscall against the calling thread's current op. Does
+  // nothing unless Enabled().
+  static void Record(Syscall syscall, uint64_t latency_ns);
+
+  // For each op that has seen a request: the syscalls made per request, in
+  // total and by syscall, and the time spent in them. For ControlRegistry.
+  std::string Format() const;
+
+ private:
+  struct Shard;
+
+  SyscallStats();
+
+  Shard &GetShard();
+
+  const int num_shards_;
+  // Allocated by the first syscall or request on each CPU.
+  std::unique_ptr<std::atomic<Shard *>[]> shards_;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_SYSCALL_STATS_H_
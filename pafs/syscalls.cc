@@ -11,16 +11,61 @@
 #include <dirent.h>
 #include <sys/mount.h>
 #include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <cstdint>
+#include <ctime>
 
 #include "absl/time/time.h"
+#include "pafs/probes.h"
 #include "pafs/status.h"
+#include "pafs/util.h"
 #include "absl/log/log.h"
 #include "absl/log/check.h"
 
 namespace pafs {
 namespace syscalls {
+namespace {
+
+// Newer than our kernel headers. Like every syscall since 424, numbered the
+// same on all architectures.
+constexpr long kSetXattrAtNr = 463;
+constexpr long kGetXattrAtNr = 464;
+constexpr long kListXattrAtNr = 465;
+constexpr long kRemoveXattrAtNr = 466;
+
+// struct xattr_args from <linux/xattr.h>.
+struct XattrArgs {
+  alignas(8) uint64_t value;
+  uint32_t size;
+  uint32_t flags;
+};
+
+}  // namespace
+
+namespace internal {
+
+CallScope::CallScope(Syscall syscall)
+  : span_("syscall", SyscallName(syscall).data()), syscall_(syscall),
+    start_ns_(
+        SyscallStats::Enabled() || PAFS_PROBE_ENABLED(syscall__exit)
+          ? MonotonicNanos() : 0) {
+  PAFS_PROBE(syscall__entry, SyscallName(syscall).data());
+}
+
+CallScope::~CallScope() {
+  uint64_t latency_ns = start_ns_ == 0 ? 0 : MonotonicNanos() - start_ns_;
+  SyscallStats::Record(syscall_, latency_ns);
+  PAFS_PROBE(syscall__exit, SyscallName(syscall_).data(), latency_ns);
+}
+
+}  // namespace internal
 
 absl::Status close(pafs::FileDescriptor fd) {
+  internal::CallScope scope(Syscall::kClose);
   // Failure of close is not recoverable... we must leak the fd.
   int fd_i = std::move(fd).Release();
   errno = 0;
@@ -29,24 +74,25 @@ absl::Status close(pafs::FileDescriptor fd) {
 }
 
 absl::StatusOr<pafs::FileDescriptor> open(
-    const char *pathname, int flags, mode_t mode) {
-  int fd = ::open(pathname, flags, mode);
+    CStringView pathname, int flags, mode_t mode) {
+  internal::CallScope scope(Syscall::kOpen);
+  int fd = ::open(pathname.c_str(), flags, mode);
   if (fd == -1) {
-    return ErrnoToStatus(errno, absl::StrCat("open('", pathname, "')"));
+    return ErrnoToStatus(errno, absl::StrCat("open('", pathname.c_str(), "')"));
   }
   return pafs::FileDescriptor(fd);
 }
 
-absl::StatusOr<pafs::FileDescriptor> openat(
-    int dirfd, const char *pathname, int flags, mode_t mode) {
-  int fd = ::openat(dirfd, pathname, flags, mode);
-  if (fd == -1) {
-    return ErrnoToStatus(errno, absl::StrCat("openat(", dirfd, ", '", pathname, "')"));
-  }
+ErrnoOr<pafs::FileDescriptor> openat(
+    int dirfd, CStringView pathname, int flags, mode_t mode) {
+  internal::CallScope scope(Syscall::kOpenat);
+  int fd = ::openat(dirfd, pathname.c_str(), flags, mode);
+  if (fd == -1) return Errno::Last("openat");
   return pafs::FileDescriptor(fd);
 }
 
 absl::StatusOr<size_t> read(int fd, void *buf, size_t count) {
+  internal::CallScope scope(Syscall::kRead);
   ssize_t nb = ::read(fd, buf, count);
   if (nb == -1) {
     return ErrnoToStatus(errno, absl::StrCat("read(", fd, ")"));
@@ -54,9 +100,38 @@ absl::StatusOr<size_t> read(int fd, void *buf, size_t count) {
   return nb;
 }
 
+absl::StatusOr<size_t> write(int fd, const void *buf, size_t count) {
+  internal::CallScope scope(Syscall::kWrite);
+  ssize_t nb = ::write(fd, buf, count);
+  if (nb == -1) {
+    return ErrnoToStatus(errno, absl::StrCat("write(", fd, ")"));
+  }
+  return nb;
+}
+
+absl::StatusOr<size_t> pread(int fd, void *buf, size_t count, off_t offset) {
+  internal::CallScope scope(Syscall::kPread);
+  ssize_t nb = ::pread(fd, buf, count, offset);
+  if (nb == -1) {
+    return ErrnoToStatus(errno, absl::StrCat("pread(", fd, ")"));
+  }
+  return nb;
+}
+
+absl::StatusOr<size_t> pwrite(
+    int fd, const void *buf, size_t count, off_t offset) {
+  internal::CallScope scope(Syscall::kPwrite);
+  ssize_t nb = ::pwrite(fd, buf, count, offset);
+  if (nb == -1) {
+    return ErrnoToStatus(errno, absl::StrCat("pwrite(", fd, ")"));
+  }
+  return nb;
+}
+
 absl::StatusOr<pafs::Mount> mount(
     const char *source, std::string target, const char *filesystemtype,
     unsigned long mountflags, const void *data) {
+  internal::CallScope scope(Syscall::kMount);
   if (::mount(source, target.c_str(), filesystemtype, mountflags, data) == -1) {
     return ErrnoToStatus(errno, "mount");
   }
@@ -64,6 +139,7 @@ absl::StatusOr<pafs::Mount> mount(
 }
 
 absl::StatusOr<struct stat> stat(const char *pathname) {
+  internal::CallScope scope(Syscall::kStat);
   struct stat statbuf;
   if (::stat(pathname, &statbuf) == -1) {
     return ErrnoToStatus(errno, absl::StrCat("stat(", pathname, ")"));
@@ -72,6 +148,7 @@ absl::StatusOr<struct stat> stat(const char *pathname) {
 }
 
 absl::StatusOr<struct stat> lstat(const char *pathname) {
+  internal::CallScope scope(Syscall::kLstat);
   struct stat statbuf;
   if (::lstat(pathname, &statbuf) == -1) {
     return ErrnoToStatus(errno, absl::StrCat("lstat(", pathname, ")"));
@@ -79,15 +156,17 @@ absl::StatusOr<struct stat> lstat(const char *pathname) {
   return statbuf;
 }
 
-absl::StatusOr<struct stat> fstatat(int fd, const char *path, int flag) {
+ErrnoOr<struct stat> fstatat(int fd, const char *path, int flag) {
+  internal::CallScope scope(Syscall::kFstatat);
   struct stat statbuf;
   if (::fstatat(fd, path, &statbuf, flag) == -1) {
-    return ErrnoToStatus(errno, absl::StrCat("fstatat(", fd, ", ", path, ")"));
+    return Errno::Last("fstatat");
   }
   return statbuf;
 }
 
 absl::Status umount(pafs::Mount mount, int flags) {
+  internal::CallScope scope(Syscall::kUmount);
   if (const std::string &target = mount.GetTarget();
       ::umount2(target.c_str(), flags) == -1) {
     return ErrnoToStatus(errno, absl::StrCat("umount2(", target, ")"));
@@ -98,6 +177,7 @@ absl::Status umount(pafs::Mount mount, int flags) {
 
 absl::Status sigaction(
     int signum, const struct sigaction *act, struct sigaction *oldact) {
+  internal::CallScope scope(Syscall::kSigaction);
   if (int rc = ::sigaction(signum, act, oldact); rc != 0) {
     return ErrnoToStatus(errno, "sigaction");
   }
@@ -105,47 +185,76 @@ absl::Status sigaction(
 }
 
 absl::StatusOr<pafs::FileDescriptor> signalfd(const sigset_t &mask, int flags) {
+  internal::CallScope scope(Syscall::kSignalfd);
   int fd = ::signalfd(/*fd=*/-1, &mask, flags);
   if (fd == -1) return ErrnoToStatus(errno, "signalfd");
   return pafs::FileDescriptor(fd);
 }
 
 absl::Status signalfd(int fd, const sigset_t &mask, int flags) {
+  internal::CallScope scope(Syscall::kSignalfd);
   errno = 0;
   ::signalfd(fd, &mask, flags);
   return ErrnoToStatus(errno, "signalfd");
 }
 
 absl::Status sigprocmask(int how, const sigset_t *set, sigset_t *oldset) {
+  internal::CallScope scope(Syscall::kSigprocmask);
   errno = 0;
   ::sigprocmask(how, set, oldset);
   return ErrnoToStatus(errno, "sigprocmask");
 }
 
 absl::Status pthread_sigmask(int how, const sigset_t *set, sigset_t *oldset) {
+  internal::CallScope scope(Syscall::kPthreadSigmask);
   return ErrnoToStatus(
       ::pthread_sigmask(how, set, oldset), "pthread_sigmask");
 }
 
 absl::Status pthread_setschedparam(
     pthread_t thread, int policy, const struct sched_param &param) {
+  internal::CallScope scope(Syscall::kPthreadSetschedparam);
   return ErrnoToStatus(
       ::pthread_setschedparam(thread, policy, &param), "pthread_setschedparam");
 }
 
+absl::Status pthread_setaffinity_np(pthread_t thread, const cpu_set_t &cpus) {
+  internal::CallScope scope(Syscall::kPthreadSetaffinityNp);
+  return ErrnoToStatus(
+      ::pthread_setaffinity_np(thread, sizeof(cpus), &cpus),
+      "pthread_setaffinity_np");
+}
+
+absl::Status pthread_kill(pthread_t thread, int sig) {
+  internal::CallScope scope(Syscall::kPthreadKill);
+  return ErrnoToStatus(::pthread_kill(thread, sig), "pthread_kill");
+}
+
+absl::Status set_mempolicy(
+    int mode, const unsigned long *nodemask, unsigned long maxnode) {
+  internal::CallScope scope(Syscall::kSetMempolicy);
+  // glibc has no wrapper; libnuma's would be a new dependency.
+  long rc = ::syscall(SYS_set_mempolicy, mode, nodemask, maxnode);
+  if (rc == -1) return ErrnoToStatus(errno, "set_mempolicy");
+  return absl::OkStatus();
+}
+
 absl::StatusOr<std::reference_wrapper<DIR>> fdopendir(FileDescriptor fd) {
+  internal::CallScope scope(Syscall::kFdopendir);
   DIR *ret = ::fdopendir(std::move(fd).Release());
   if (ret == nullptr) return ErrnoToStatus(errno, "fdopendir");
   return *ret;
 }
 
 absl::Status closedir(DIR &dir) {
+  internal::CallScope scope(Syscall::kClosedir);
   errno = 0;
   ::closedir(&dir);
   return ErrnoToStatus(errno, "closedir");
 }
 
 absl::StatusOr<struct dirent *> readdir(DIR &dir) {
+  internal::CallScope scope(Syscall::kReaddir);
   errno = 0;
   struct dirent *ent = ::readdir(&dir);
   if (ent == nullptr && errno != 0) return ErrnoToStatus(errno, "readdir");
@@ -163,106 +272,128 @@ absl::Status seekdir(DIR &dir, long loc) {
   return absl::OkStatus();
 }
 
+absl::StatusOr<size_t> getdents64(int fd, std::span<char> buf) {
+  internal::CallScope scope(Syscall::kGetdents64);
+  ssize_t nb = ::getdents64(fd, buf.data(), buf.size());
+  if (nb == -1) {
+    return ErrnoToStatus(errno, absl::StrCat("getdents64(", fd, ")"));
+  }
+  return nb;
+}
+
 absl::Status fchmod(int fd, mode_t mode) {
+  internal::CallScope scope(Syscall::kFchmod);
   if (::fchmod(fd, mode) == -1) {
     return ErrnoToStatus(errno, "fchmod");
   }
   return absl::OkStatus();
 }
 
-absl::Status fchownat(int fd, std::string_view path, uid_t owner, gid_t group, int flag) {
-  int rc = ::fchownat(fd, std::string(path).c_str(), owner, group, flag);
+absl::Status fchownat(int fd, CStringView path, uid_t owner, gid_t group, int flag) {
+  internal::CallScope scope(Syscall::kFchownat);
+  int rc = ::fchownat(fd, path.c_str(), owner, group, flag);
   if (rc == -1) return ErrnoToStatus(errno, "fchownat");
   return absl::OkStatus();
 }
 
 absl::Status ftruncate(int fd, off_t length) {
+  internal::CallScope scope(Syscall::kFtruncate);
   int rc = ::ftruncate(fd, length);
   if (rc == -1) return ErrnoToStatus(errno, "ftruncate");
   return absl::OkStatus();
 }
 
 absl::Status futimens(int fd, const struct timespec times[2]) {
+  internal::CallScope scope(Syscall::kFutimens);
   int rc = ::futimens(fd, times);
   if (rc == -1) return ErrnoToStatus(errno, "futimens");
   return absl::OkStatus();
 }
 
-absl::StatusOr<ssize_t> readlinkat(int dirfd, std::string_view pathname, std::span<char> buf) {
-  ssize_t rc = ::readlinkat(dirfd, std::string(pathname).c_str(), buf.data(), buf.size());
+absl::StatusOr<ssize_t> readlinkat(int dirfd, CStringView pathname, std::span<char> buf) {
+  internal::CallScope scope(Syscall::kReadlinkat);
+  ssize_t rc = ::readlinkat(dirfd, pathname.c_str(), buf.data(), buf.size());
   if (rc == -1) return ErrnoToStatus(errno, "readlinkat");
   return rc;
 }
 
-absl::Status mknodat(int dirfd, std::string_view pathname, mode_t mode, dev_t dev) {
-  int rc = ::mknodat(dirfd, std::string(pathname).c_str(), mode, dev);
-  if (rc == -1) return ErrnoToStatus(errno, "mknodat");
-  return absl::OkStatus();
+Errno mknodat(int dirfd, CStringView pathname, mode_t mode, dev_t dev) {
+  internal::CallScope scope(Syscall::kMknodat);
+  int rc = ::mknodat(dirfd, pathname.c_str(), mode, dev);
+  if (rc == -1) return Errno::Last("mknodat");
+  return Errno();
 }
 
-absl::Status mkdirat(int dirfd, std::string_view pathname, mode_t mode) {
-  int rc = ::mkdirat(dirfd, std::string(pathname).c_str(), mode);
-  if (rc == -1) return ErrnoToStatus(errno, "mkdirat");
-  return absl::OkStatus();
+Errno mkdirat(int dirfd, CStringView pathname, mode_t mode) {
+  internal::CallScope scope(Syscall::kMkdirat);
+  int rc = ::mkdirat(dirfd, pathname.c_str(), mode);
+  if (rc == -1) return Errno::Last("mkdirat");
+  return Errno();
 }
 
-absl::Status unlinkat(int dirfd, std::string_view pathname, int flags) {
-  int rc = ::unlinkat(dirfd, std::string(pathname).c_str(), flags);
-  if (rc == -1) return ErrnoToStatus(errno, "unlinkat");
-  return absl::OkStatus();
+Errno unlinkat(int dirfd, CStringView pathname, int flags) {
+  internal::CallScope scope(Syscall::kUnlinkat);
+  int rc = ::unlinkat(dirfd, pathname.c_str(), flags);
+  if (rc == -1) return Errno::Last("unlinkat");
+  return Errno();
 }
 
-absl::Status symlinkat(
-    std::string_view target, int newdirfd, std::string_view linkpath) {
-  int rc = ::symlinkat(
-      std::string(target).c_str(), newdirfd, std::string(linkpath).c_str());
-  if (rc == -1) return ErrnoToStatus(errno, "symlinkat");
-  return absl::OkStatus();
+Errno symlinkat(
+    CStringView target, int newdirfd, CStringView linkpath) {
+  internal::CallScope scope(Syscall::kSymlinkat);
+  int rc = ::symlinkat(target.c_str(), newdirfd, linkpath.c_str());
+  if (rc == -1) return Errno::Last("symlinkat");
+  return Errno();
 }
 
-absl::Status renameat(
-    int olddirfd, std::string_view oldpath,
-    int newdirfd, std::string_view newpath) {
+Errno renameat(
+    int olddirfd, CStringView oldpath,
+    int newdirfd, CStringView newpath) {
   return renameat2(olddirfd, oldpath, newdirfd, newpath, /*flags=*/0);
 }
 
-absl::Status renameat2(
-    int olddirfd, std::string_view oldpath,
-    int newdirfd, std::string_view newpath,
+Errno renameat2(
+    int olddirfd, CStringView oldpath,
+    int newdirfd, CStringView newpath,
     unsigned int flags) {
+  internal::CallScope scope(Syscall::kRenameat2);
   int rc = ::renameat2(
-      olddirfd, std::string(oldpath).c_str(),
-      newdirfd, std::string(newpath).c_str(),
+      olddirfd, oldpath.c_str(),
+      newdirfd, newpath.c_str(),
       flags);
-  if (rc == -1) return ErrnoToStatus(errno, "renameat2");
-  return absl::OkStatus();
+  if (rc == -1) return Errno::Last("renameat2");
+  return Errno();
 }
 
-absl::Status linkat(
-    int olddirfd, std::string_view oldpath,
-    int newdirfd, std::string_view newpath,
+Errno linkat(
+    int olddirfd, CStringView oldpath,
+    int newdirfd, CStringView newpath,
     int flags) {
+  internal::CallScope scope(Syscall::kLinkat);
   int rc = ::linkat(
-      olddirfd, std::string(oldpath).c_str(),
-      newdirfd, std::string(newpath).c_str(),
+      olddirfd, oldpath.c_str(),
+      newdirfd, newpath.c_str(),
       flags);
-  if (rc == -1) return ErrnoToStatus(errno, "linkat");
-  return absl::OkStatus();
+  if (rc == -1) return Errno::Last("linkat");
+  return Errno();
 }
 
 absl::StatusOr<FileDescriptor> dup(int oldfd) {
+  internal::CallScope scope(Syscall::kDup);
   int fd = ::dup(oldfd);
   if (fd == -1) return ErrnoToStatus(errno, "dup");
   return FileDescriptor(fd);
 }
 
 absl::Status fsync(int fd) {
+  internal::CallScope scope(Syscall::kFsync);
   int rc = ::fsync(fd);
   if (rc == -1) return ErrnoToStatus(errno, "fsync");
   return absl::OkStatus();
 }
 
 absl::Status fdatasync(int fd) {
+  internal::CallScope scope(Syscall::kFdatasync);
   int rc = ::fdatasync(fd);
   if (rc == -1) return ErrnoToStatus(errno, "fdatasync");
   return absl::OkStatus();
@@ -275,81 +406,163 @@ absl::StatusOr<int> dirfd(DIR &dirp) {
 }
 
 absl::StatusOr<struct statvfs> fstatvfs(int fd) {
+  internal::CallScope scope(Syscall::kFstatvfs);
   struct statvfs buf;
   int rc = ::fstatvfs(fd, &buf);
   if (rc == -1) return ErrnoToStatus(errno, "fstatvfs");
   return std::move(buf);
 }
 
-absl::Status fsetxattr(
-    int fd, std::string_view name, std::span<const char> value, int flags) {
+Errno fsetxattr(
+    int fd, CStringView name, std::span<const char> value, int flags) {
+  internal::CallScope scope(Syscall::kFsetxattr);
   int rc = ::fsetxattr(
-      fd, std::string(name).c_str(), value.data(), value.size(), flags);
-  if (rc == -1) return ErrnoToStatus(errno, "fsetxattr");
-  return absl::OkStatus();
+      fd, name.c_str(), value.data(), value.size(), flags);
+  if (rc == -1) return Errno::Last("fsetxattr");
+  return Errno();
 }
 
-absl::Status setxattr(
-    std::string_view path, std::string_view name, std::span<const char> value,
+Errno setxattr(
+    CStringView path, CStringView name, std::span<const char> value,
     int flags) {
+  internal::CallScope scope(Syscall::kSetxattr);
   int rc = ::setxattr(
-      std::string(path).c_str(), std::string(name).c_str(), value.data(),
+      path.c_str(), name.c_str(), value.data(),
       value.size(), flags);
-  if (rc == -1) return ErrnoToStatus(errno, "setxattr");
-  return absl::OkStatus();
+  if (rc == -1) return Errno::Last("setxattr");
+  return Errno();
 }
 
-absl::StatusOr<size_t> getxattr(
-    std::string_view path, std::string_view name, std::span<char> value) {
+ErrnoOr<size_t> getxattr(
+    CStringView path, CStringView name, std::span<char> value) {
+  internal::CallScope scope(Syscall::kGetxattr);
   ssize_t nb = ::getxattr(
-      std::string(path).c_str(), std::string(name).c_str(), value.data(),
+      path.c_str(), name.c_str(), value.data(),
       value.size());
-  if (nb == -1) return ErrnoToStatus(errno, "getxattr");
+  if (nb == -1) return Errno::Last("getxattr");
   return static_cast<size_t>(nb);
 }
 
-absl::StatusOr<std::vector<char>> getxattr(
-    std::string_view path, std::string_view name, size_t maxsize) {
+ErrnoOr<std::vector<char>> getxattr(
+    CStringView path, CStringView name, size_t maxsize) {
   std::vector<char> val(maxsize);
-  ASSIGN_OR_RETURN(size_t nb, getxattr(path, name, val));
-  CHECK_LE(nb, maxsize);
-  val.resize(nb);
+  ErrnoOr<size_t> nb = getxattr(path, name, val);
+  if (!nb.ok()) return nb.error();
+  CHECK_LE(*nb, maxsize);
+  val.resize(*nb);
   return val;
 }
 
-absl::StatusOr<size_t> listxattr(std::string_view path, std::span<char> list) {
+ErrnoOr<size_t> fgetxattr(int fd, CStringView name, std::span<char> value) {
+  internal::CallScope scope(Syscall::kFgetxattr);
+  ssize_t nb = ::fgetxattr(fd, name.c_str(), value.data(), value.size());
+  if (nb == -1) return Errno::Last("fgetxattr");
+  return static_cast<size_t>(nb);
+}
+
+ErrnoOr<size_t> listxattr(CStringView path, std::span<char> list) {
+  internal::CallScope scope(Syscall::kListxattr);
   ssize_t nb = ::listxattr(
-      std::string(path).c_str(), list.data(), list.size());
-  if (nb == -1) return ErrnoToStatus(errno, "listxattr");
+      path.c_str(), list.data(), list.size());
+  if (nb == -1) return Errno::Last("listxattr");
   return static_cast<size_t>(nb);
 }
 
-absl::Status removexattr(std::string_view path, std::string_view name) {
-  int rc = ::removexattr(std::string(path).c_str(), std::string(name).c_str());
-  if (rc == -1) return ErrnoToStatus(errno, "removexattr");
-  return absl::OkStatus();
+ErrnoOr<size_t> flistxattr(int fd, std::span<char> list) {
+  internal::CallScope scope(Syscall::kFlistxattr);
+  ssize_t nb = ::flistxattr(fd, list.data(), list.size());
+  if (nb == -1) return Errno::Last("flistxattr");
+  return static_cast<size_t>(nb);
 }
 
-absl::Status access(std::string_view pathname, int mode) {
-  int rc = ::access(std::string(pathname).c_str(), mode);
-  if (rc == -1) return ErrnoToStatus(errno, "access");
-  return absl::OkStatus();
+Errno removexattr(CStringView path, CStringView name) {
+  internal::CallScope scope(Syscall::kRemovexattr);
+  int rc = ::removexattr(path.c_str(), name.c_str());
+  if (rc == -1) return Errno::Last("removexattr");
+  return Errno();
+}
+
+Errno fremovexattr(int fd, CStringView name) {
+  internal::CallScope scope(Syscall::kFremovexattr);
+  int rc = ::fremovexattr(fd, name.c_str());
+  if (rc == -1) return Errno::Last("fremovexattr");
+  return Errno();
+}
+
+Errno setxattrat(
+    int dirfd, CStringView path, int at_flags, CStringView name,
+    std::span<const char> value, int flags) {
+  internal::CallScope scope(Syscall::kSetxattrat);
+  XattrArgs args = {
+    .value = reinterpret_cast<uintptr_t>(value.data()),
+    .size = static_cast<uint32_t>(value.size()),
+    .flags = static_cast<uint32_t>(flags),
+  };
+  long rc = ::syscall(
+      kSetXattrAtNr, dirfd, path.c_str(), at_flags, name.c_str(), &args,
+      sizeof(args));
+  if (rc == -1) return Errno::Last("setxattrat");
+  return Errno();
+}
+
+ErrnoOr<size_t> getxattrat(
+    int dirfd, CStringView path, int at_flags, CStringView name,
+    std::span<char> value) {
+  internal::CallScope scope(Syscall::kGetxattrat);
+  XattrArgs args = {
+    .value = reinterpret_cast<uintptr_t>(value.data()),
+    .size = static_cast<uint32_t>(value.size()),
+    .flags = 0,
+  };
+  long nb = ::syscall(
+      kGetXattrAtNr, dirfd, path.c_str(), at_flags, name.c_str(), &args,
+      sizeof(args));
+  if (nb == -1) return Errno::Last("getxattrat");
+  return static_cast<size_t>(nb);
 }
 
-absl::Status faccessat(
-    int dirfd, std::string_view pathname, int mode, int flags) {
-  int rc = ::faccessat(dirfd, std::string(pathname).c_str(), mode, flags);
-  if (rc == -1) return ErrnoToStatus(errno, "faccessat");
-  return absl::OkStatus();
+ErrnoOr<size_t> listxattrat(
+    int dirfd, CStringView path, int at_flags, std::span<char> list) {
+  internal::CallScope scope(Syscall::kListxattrat);
+  long nb = ::syscall(
+      kListXattrAtNr, dirfd, path.c_str(), at_flags, list.data(), list.size());
+  if (nb == -1) return Errno::Last("listxattrat");
+  return static_cast<size_t>(nb);
+}
+
+Errno removexattrat(
+    int dirfd, CStringView path, int at_flags, CStringView name) {
+  internal::CallScope scope(Syscall::kRemovexattrat);
+  long rc = ::syscall(
+      kRemoveXattrAtNr, dirfd, path.c_str(), at_flags, name.c_str());
+  if (rc == -1) return Errno::Last("removexattrat");
+  return Errno();
+}
+
+Errno access(CStringView pathname, int mode) {
+  internal::CallScope scope(Syscall::kAccess);
+  int rc = ::access(pathname.c_str(), mode);
+  if (rc == -1) return Errno::Last("access");
+  return Errno();
+}
+
+Errno faccessat(
+    int dirfd, CStringView pathname, int mode, int flags) {
+  internal::CallScope scope(Syscall::kFaccessat);
+  int rc = ::faccessat(dirfd, pathname.c_str(), mode, flags);
+  if (rc == -1) return Errno::Last("faccessat");
+  return Errno();
 }
 
 absl::Status flock(int fd, int operation) {
+  internal::CallScope scope(Syscall::kFlock);
   int rc = ::flock(fd, operation);
   if (rc == -1) return ErrnoToStatus(errno, "flock");
   return absl::OkStatus();
 }
 
 absl::Status fallocate(int fd, int mode, off_t offset, off_t len) {
+  internal::CallScope scope(Syscall::kFallocate);
   int rc = ::fallocate(fd, mode, offset, len);
   if (rc == -1) return ErrnoToStatus(errno, "fallocate");
   return absl::OkStatus();
@@ -359,21 +572,57 @@ absl::StatusOr<size_t> copy_file_range(
     int fd_in, off_t *off_in,
     int fd_out, off_t *off_out,
     size_t len, unsigned int flags) {
+  internal::CallScope scope(Syscall::kCopyFileRange);
   ssize_t nb = ::copy_file_range(fd_in, off_in, fd_out, off_out, len, flags);
   if (nb == -1) return ErrnoToStatus(errno, "copy_file_range");
   return static_cast<size_t>(nb);
 }
 
 absl::StatusOr<off_t> lseek(int fd, off_t offset, int whence) {
+  internal::CallScope scope(Syscall::kLseek);
   off_t rc = ::lseek(fd, offset, whence);
   if (rc == static_cast<off_t>(-1)) return ErrnoToStatus(errno, "lseek");
   return rc;
 }
 
+absl::StatusOr<pafs::FileDescriptor> inotify_init1(int flags) {
+  internal::CallScope scope(Syscall::kInotifyInit1);
+  int fd = ::inotify_init1(flags);
+  if (fd == -1) return ErrnoToStatus(errno, "inotify_init1");
+  return pafs::FileDescriptor(fd);
+}
+
+absl::StatusOr<int> inotify_add_watch(
+    int fd, const char *pathname, uint32_t mask) {
+  internal::CallScope scope(Syscall::kInotifyAddWatch);
+  int wd = ::inotify_add_watch(fd, pathname, mask);
+  if (wd == -1) {
+    return ErrnoToStatus(
+        errno, absl::StrCat("inotify_add_watch(", fd, ", ", pathname, ")"));
+  }
+  return wd;
+}
+
+absl::Status inotify_rm_watch(int fd, int wd) {
+  internal::CallScope scope(Syscall::kInotifyRmWatch);
+  int rc = ::inotify_rm_watch(fd, wd);
+  if (rc == -1) return ErrnoToStatus(errno, "inotify_rm_watch");
+  return absl::OkStatus();
+}
+
+absl::StatusOr<pafs::FileDescriptor> eventfd(unsigned int initval, int flags) {
+  internal::CallScope scope(Syscall::kEventfd);
+  int fd = ::eventfd(initval, flags);
+  if (fd == -1) return ErrnoToStatus(errno, "eventfd");
+  return pafs::FileDescriptor(fd);
+}
+
 absl::StatusOr<nfds_t> poll(std::span<pollfd> fds, absl::Duration timeout) {
+  internal::CallScope scope(Syscall::kPoll);
   // TODO convert this to use ppoll instead.
 
-  int64_t timeout_ms64 = absl::ToInt64Milliseconds(timeout);
+  int64_t timeout_ms64 = timeout == absl::InfiniteDuration()
+    ? -1 : absl::ToInt64Milliseconds(timeout);
   if (timeout_ms64 > INT_MAX || timeout_ms64 < INT_MIN
       || (timeout_ms64 == 0 && timeout != absl::ZeroDuration())) {
     return ErrnoToStatus(
@@ -388,5 +637,75 @@ absl::StatusOr<nfds_t> poll(std::span<pollfd> fds, absl::Duration timeout) {
   return static_cast<nfds_t>(nelems);
 }
 
+absl::StatusOr<pafs::FileDescriptor> memfd_create(
+    CStringView name, unsigned int flags) {
+  internal::CallScope scope(Syscall::kMemfdCreate);
+  int fd = ::memfd_create(name.c_str(), flags);
+  if (fd == -1) return ErrnoToStatus(errno, "memfd_create");
+  return pafs::FileDescriptor(fd);
+}
+
+absl::StatusOr<std::pair<pafs::FileDescriptor, pafs::FileDescriptor>> pipe2(
+    int flags) {
+  internal::CallScope scope(Syscall::kPipe2);
+  int fds[2];
+  if (::pipe2(fds, flags) == -1) return ErrnoToStatus(errno, "pipe2");
+  return std::make_pair(
+      pafs::FileDescriptor(fds[0]), pafs::FileDescriptor(fds[1]));
+}
+
+absl::StatusOr<pafs::FileDescriptor> socket(
+    int domain, int type, int protocol) {
+  internal::CallScope scope(Syscall::kSocket);
+  int fd = ::socket(domain, type, protocol);
+  if (fd == -1) return ErrnoToStatus(errno, "socket");
+  return pafs::FileDescriptor(fd);
+}
+
+absl::Status bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
+  internal::CallScope scope(Syscall::kBind);
+  int rc = ::bind(sockfd, addr, addrlen);
+  if (rc == -1) return ErrnoToStatus(errno, "bind");
+  return absl::OkStatus();
+}
+
+absl::Status listen(int sockfd, int backlog) {
+  internal::CallScope scope(Syscall::kListen);
+  int rc = ::listen(sockfd, backlog);
+  if (rc == -1) return ErrnoToStatus(errno, "listen");
+  return absl::OkStatus();
+}
+
+absl::StatusOr<pafs::FileDescriptor> accept4(int sockfd, int flags) {
+  internal::CallScope scope(Syscall::kAccept4);
+  int fd = ::accept4(sockfd, /*addr=*/nullptr, /*addrlen=*/nullptr, flags);
+  if (fd == -1) return ErrnoToStatus(errno, "accept4");
+  return pafs::FileDescriptor(fd);
+}
+
+absl::Status setsockopt(
+    int sockfd, int level, int optname, const void *optval,
+    socklen_t optlen) {
+  internal::CallScope scope(Syscall::kSetsockopt);
+  int rc = ::setsockopt(sockfd, level, optname, optval, optlen);
+  if (rc == -1) return ErrnoToStatus(errno, "setsockopt");
+  return absl::OkStatus();
+}
+
+absl::StatusOr<size_t> recv(int sockfd, void *buf, size_t len, int flags) {
+  internal::CallScope scope(Syscall::kRecv);
+  ssize_t nb = ::recv(sockfd, buf, len, flags);
+  if (nb == -1) return ErrnoToStatus(errno, "recv");
+  return static_cast<size_t>(nb);
+}
+
+absl::StatusOr<size_t> send(
+    int sockfd, const void *buf, size_t len, int flags) {
+  internal::CallScope scope(Syscall::kSend);
+  ssize_t nb = ::send(sockfd, buf, len, flags);
+  if (nb == -1) return ErrnoToStatus(errno, "send");
+  return static_cast<size_t>(nb);
+}
+
 }  // namespace syscalls
 }  // namespace pafs
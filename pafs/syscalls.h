@@ -12,8 +12,12 @@
 #include <sys/statvfs.h>
 #include <sys/signalfd.h>
 #include <sys/xattr.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <signal.h>
 #include <sched.h>
+#include <cstdint>
 #include <span>
 #include <pthread.h>
 #include <fcntl.h>
@@ -21,21 +25,55 @@
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/time/time.h"
+#include "pafs/cstring_view.h"
+#include "pafs/errno.h"
 #include "pafs/fd.h"
 #include "pafs/mount.h"
+#include "pafs/spans.h"
 #include "pafs/status.h"
+#include "pafs/syscall_stats.h"
 
 namespace pafs {
 namespace syscalls {
+namespace internal {
+
+// Brackets each call into the kernel: a span for SpanRecorder, the
+// syscall__entry and syscall__exit probes, and SyscallStats.
+class CallScope {
+ public:
+  explicit CallScope(Syscall syscall);
+  ~CallScope();
+
+  CallScope(CallScope &&) = delete;
+  CallScope(const CallScope &) = delete;
+  CallScope &operator=(CallScope &&) = delete;
+  CallScope &operator=(const CallScope &) = delete;
+
+ private:
+  ScopedSpan span_;
+  const Syscall syscall_;
+  // 0 unless SyscallStats or the exit probe needs the latency.
+  uint64_t start_ns_ = 0;
+};
+
+}  // namespace internal
+
+// Calls whose failures are routine answers to the caller (ENOENT, EEXIST,
+// EACCES, ENODATA, ...) return Errno or ErrnoOr, so that failing doesn't
+// allocate. Everything else returns absl::Status.
 
 absl::Status close(pafs::FileDescriptor fd);
 
 absl::StatusOr<pafs::FileDescriptor> open(
-    const char *pathname, int flags, mode_t mode = 0);
-absl::StatusOr<pafs::FileDescriptor> openat(
-    int dirfd, const char *pathname, int flags, mode_t mode = 0);
+    CStringView pathname, int flags, mode_t mode = 0);
+ErrnoOr<pafs::FileDescriptor> openat(
+    int dirfd, CStringView pathname, int flags, mode_t mode = 0);
 
 absl::StatusOr<size_t> read(int fd, void *buf, size_t count);
+absl::StatusOr<size_t> write(int fd, const void *buf, size_t count);
+absl::StatusOr<size_t> pread(int fd, void *buf, size_t count, off_t offset);
+absl::StatusOr<size_t> pwrite(
+    int fd, const void *buf, size_t count, off_t offset);
 
 absl::StatusOr<pafs::Mount> mount(
     const char *source, std::string target, const char *filesystemtype,
@@ -46,7 +84,7 @@ absl::Status umount(pafs::Mount mount, int flags = 0);
 absl::StatusOr<struct stat> stat(const char *pathname);
 absl::StatusOr<struct stat> lstat(const char *pathname);
 
-absl::StatusOr<struct stat> fstatat(int fd, const char *path, int flag = 0);
+ErrnoOr<struct stat> fstatat(int fd, const char *path, int flag = 0);
 
 absl::Status sigaction(
     int signum,
@@ -65,8 +103,14 @@ absl::Status pthread_sigmask(
 
 absl::Status pthread_setschedparam(
     pthread_t thread, int policy, const struct sched_param &param);
+absl::Status pthread_setaffinity_np(pthread_t thread, const cpu_set_t &cpus);
+absl::Status pthread_kill(pthread_t thread, int sig);
+// The calling thread's NUMA memory policy. See set_mempolicy(2).
+absl::Status set_mempolicy(
+    int mode, const unsigned long *nodemask, unsigned long maxnode);
 
 absl::StatusOr<int> ioctl(int fd, unsigned long request, auto... args) {
+  internal::CallScope scope(Syscall::kIoctl);
   errno = 0;
   int ret = ::ioctl(fd, request, std::forward<decltype(args)>(args)...);
   if (errno != 0) {
@@ -81,31 +125,34 @@ absl::Status closedir(DIR &dir);
 absl::StatusOr<struct dirent *> readdir(DIR &dir);
 absl::StatusOr<long> telldir(DIR &dir);
 absl::Status seekdir(DIR &dir, long loc);
+// Returns the number of bytes of linux_dirent64 records read into `buf`, or 0
+// at the end of the directory.
+absl::StatusOr<size_t> getdents64(int fd, std::span<char> buf);
 
 absl::Status fchmod(int fd, mode_t mode);
-absl::Status fchownat(int fd, std::string_view path, uid_t owner, gid_t group, int flag = 0);
+absl::Status fchownat(int fd, CStringView path, uid_t owner, gid_t group, int flag = 0);
 absl::Status ftruncate(int fd, off_t length);
 absl::Status futimens(int fd, const struct timespec times[2]);
 
-absl::StatusOr<ssize_t> readlinkat(int dirfd, std::string_view pathname, std::span<char> buf);
+absl::StatusOr<ssize_t> readlinkat(int dirfd, CStringView pathname, std::span<char> buf);
 
-absl::Status mknodat(int dirfd, std::string_view pathname, mode_t mode, dev_t dev);
-absl::Status mkdirat(int dirfd, std::string_view pathname, mode_t mode);
-absl::Status unlinkat(int dirfd, std::string_view pathname, int flags = 0);
-absl::Status symlinkat(
-    std::string_view target, int newdirfd, std::string_view linkpath);
+Errno mknodat(int dirfd, CStringView pathname, mode_t mode, dev_t dev);
+Errno mkdirat(int dirfd, CStringView pathname, mode_t mode);
+Errno unlinkat(int dirfd, CStringView pathname, int flags = 0);
+Errno symlinkat(
+    CStringView target, int newdirfd, CStringView linkpath);
 
-absl::Status renameat(
-    int olddirfd, std::string_view oldpath,
-    int newdirfd, std::string_view newpath);
-absl::Status renameat2(
-    int olddirfd, std::string_view oldpath,
-    int newdirfd, std::string_view newpath,
+Errno renameat(
+    int olddirfd, CStringView oldpath,
+    int newdirfd, CStringView newpath);
+Errno renameat2(
+    int olddirfd, CStringView oldpath,
+    int newdirfd, CStringView newpath,
     unsigned int flags);
 
-absl::Status linkat(
-    int olddirfd, std::string_view oldpath,
-    int newdirfd, std::string_view newpath,
+Errno linkat(
+    int olddirfd, CStringView oldpath,
+    int newdirfd, CStringView newpath,
     int flags = 0);
 
 absl::StatusOr<FileDescriptor> dup(int oldfd);
@@ -117,24 +164,41 @@ absl::StatusOr<int> dirfd(DIR &dirp);
 
 absl::StatusOr<struct statvfs> fstatvfs(int fd);
 
-absl::Status setxattr(
-    std::string_view path, std::string_view name, std::span<const char> value,
+Errno setxattr(
+    CStringView path, CStringView name, std::span<const char> value,
     int flags = 0);
-absl::Status fsetxattr(
-    int fd, std::string_view name, std::span<const char> value, int flags = 0);
-
-absl::StatusOr<size_t> getxattr(
-    std::string_view path, std::string_view name, std::span<char> value);
-absl::StatusOr<std::vector<char>> getxattr(
-    std::string_view path, std::string_view name, size_t maxsize);
-
-absl::StatusOr<size_t> listxattr(std::string_view path, std::span<char> list);
-
-absl::Status removexattr(std::string_view path, std::string_view name);
-
-absl::Status access(std::string_view pathname, int mode);
-absl::Status faccessat(
-    int dirfd, std::string_view pathname, int mode, int flags = 0);
+Errno fsetxattr(
+    int fd, CStringView name, std::span<const char> value, int flags = 0);
+
+ErrnoOr<size_t> getxattr(
+    CStringView path, CStringView name, std::span<char> value);
+ErrnoOr<std::vector<char>> getxattr(
+    CStringView path, CStringView name, size_t maxsize);
+ErrnoOr<size_t> fgetxattr(int fd, CStringView name, std::span<char> value);
+
+ErrnoOr<size_t> listxattr(CStringView path, std::span<char> list);
+ErrnoOr<size_t> flistxattr(int fd, std::span<char> list);
+
+Errno removexattr(CStringView path, CStringView name);
+Errno fremovexattr(int fd, CStringView name);
+
+// The *xattrat family (Linux 6.13), which unlike the f*xattr calls can name
+// an O_PATH descriptor's file with AT_EMPTY_PATH and an empty `path`. Fail
+// with ENOSYS on older kernels.
+Errno setxattrat(
+    int dirfd, CStringView path, int at_flags, CStringView name,
+    std::span<const char> value, int flags = 0);
+ErrnoOr<size_t> getxattrat(
+    int dirfd, CStringView path, int at_flags, CStringView name,
+    std::span<char> value);
+ErrnoOr<size_t> listxattrat(
+    int dirfd, CStringView path, int at_flags, std::span<char> list);
+Errno removexattrat(
+    int dirfd, CStringView path, int at_flags, CStringView name);
+
+Errno access(CStringView pathname, int mode);
+Errno faccessat(
+    int dirfd, CStringView pathname, int mode, int flags = 0);
 
 absl::Status flock(int fd, int operation);
 absl::Status fallocate(int fd, int mode, off_t offset, off_t len);
@@ -146,8 +210,35 @@ absl::StatusOr<size_t> copy_file_range(
 
 absl::StatusOr<off_t> lseek(int fd, off_t offset, int whence);
 
+absl::StatusOr<pafs::FileDescriptor> inotify_init1(int flags = 0);
+absl::StatusOr<int> inotify_add_watch(
+    int fd, const char *pathname, uint32_t mask);
+absl::Status inotify_rm_watch(int fd, int wd);
+
+absl::StatusOr<pafs::FileDescriptor> eventfd(
+    unsigned int initval = 0, int flags = 0);
+
 absl::StatusOr<nfds_t> poll(std::span<pollfd> fds, absl::Duration timeout);
 
+absl::StatusOr<pafs::FileDescriptor> memfd_create(
+    CStringView name, unsigned int flags = 0);
+
+// The read end, then the write end.
+absl::StatusOr<std::pair<pafs::FileDescriptor, pafs::FileDescriptor>> pipe2(
+    int flags = 0);
+
+absl::StatusOr<pafs::FileDescriptor> socket(
+    int domain, int type, int protocol = 0);
+absl::Status bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
+absl::Status listen(int sockfd, int backlog);
+absl::StatusOr<pafs::FileDescriptor> accept4(int sockfd, int flags = 0);
+absl::Status setsockopt(
+    int sockfd, int level, int optname, const void *optval,
+    socklen_t optlen);
+absl::StatusOr<size_t> recv(int sockfd, void *buf, size_t len, int flags = 0);
+absl::StatusOr<size_t> send(
+    int sockfd, const void *buf, size_t len, int flags = 0);
+
 template <typename... Arg>
 absl::StatusOr<int> fcntl(int fd, int cmd, Arg... args) {
   int rc = ::fcntl(fd, cmd, std::forward<Arg>(args)...);
@@ -0,0 +1,154 @@
+// The syscalls:: wrappers against the raw calls they wrap, on tmpfs, to show
+// what the wrappers cost on top of the syscall.
+//
+// bazel run -c opt //pafs:syscalls_benchmark
+
+#include <cerrno>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "pafs/benchmark_util.h"
+#include "pafs/dir.h"
+#include "pafs/errno.h"
+#include "pafs/fd.h"
+#include "pafs/syscalls.h"
+
+namespace pafs {
+namespace {
+
+template <bool kRaw>
+void BM_OpenatClose(benchmark::State &state) {
+  absl::StatusOr<ScratchDir> dir = ScratchDir::Create();
+  if (!dir.ok() || !dir->CreateFiles(1).ok()) {
+    state.SkipWithError("ScratchDir set up failed");
+    return;
+  }
+  for (auto _ : state) {
+    if constexpr (kRaw) {
+      int fd = ::openat(dir->GetFD(), "0", O_RDONLY | O_CLOEXEC);
+      benchmark::DoNotOptimize(fd);
+      ::close(fd);
+    } else {
+      ErrnoOr<FileDescriptor> fd =
+        syscalls::openat(dir->GetFD(), "0", O_RDONLY | O_CLOEXEC);
+      benchmark::DoNotOptimize(syscalls::close(*std::move(fd)));
+    }
+  }
+}
+BENCHMARK(BM_OpenatClose</*kRaw=*/true>);
+BENCHMARK(BM_OpenatClose</*kRaw=*/false>);
+
+// A failing openat, as for a lookup of a missing name.
+template <bool kRaw>
+void BM_OpenatMissing(benchmark::State &state) {
+  absl::StatusOr<ScratchDir> dir = ScratchDir::Create();
+  if (!dir.ok()) {
+    state.SkipWithError("ScratchDir::Create failed");
+    return;
+  }
+  for (auto _ : state) {
+    if constexpr (kRaw) {
+      int fd = ::openat(dir->GetFD(), "missing", O_PATH | O_CLOEXEC);
+      benchmark::DoNotOptimize(fd);
+      benchmark::DoNotOptimize(errno);
+    } else {
+      ErrnoOr<FileDescriptor> fd =
+        syscalls::openat(dir->GetFD(), "missing", O_PATH | O_CLOEXEC);
+      benchmark::DoNotOptimize(fd.error().value());
+    }
+  }
+}
+BENCHMARK(BM_OpenatMissing</*kRaw=*/true>);
+BENCHMARK(BM_OpenatMissing</*kRaw=*/false>);
+
+template <bool kRaw>
+void BM_Fstatat(benchmark::State &state) {
+  absl::StatusOr<ScratchDir> dir = ScratchDir::Create();
+  if (!dir.ok() || !dir->CreateFiles(1).ok()) {
+    state.SkipWithError("ScratchDir set up failed");
+    return;
+  }
+  for (auto _ : state) {
+    if constexpr (kRaw) {
+      struct stat st;
+      benchmark::DoNotOptimize(
+          ::fstatat(dir->GetFD(), "0", &st, AT_SYMLINK_NOFOLLOW));
+      benchmark::DoNotOptimize(st);
+    } else {
+      benchmark::DoNotOptimize(
+          syscalls::fstatat(dir->GetFD(), "0", AT_SYMLINK_NOFOLLOW));
+    }
+  }
+}
+BENCHMARK(BM_Fstatat</*kRaw=*/true>);
+BENCHMARK(BM_Fstatat</*kRaw=*/false>);
+
+// Reads of range(0) bytes from the start of a file.
+template <bool kRaw>
+void BM_Read(benchmark::State &state) {
+  const size_t size = state.range(0);
+  absl::StatusOr<ScratchDir> dir = ScratchDir::Create();
+  if (!dir.ok()) {
+    state.SkipWithError("ScratchDir::Create failed");
+    return;
+  }
+  ErrnoOr<FileDescriptor> fd = syscalls::openat(
+      dir->GetFD(), "data", O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  std::vector<char> buf(size, 'x');
+  if (!fd.ok() || !syscalls::write(**fd, buf.data(), size).ok()) {
+    state.SkipWithError("Writing the file failed");
+    return;
+  }
+  for (auto _ : state) {
+    ::lseek(**fd, 0, SEEK_SET);
+    if constexpr (kRaw) {
+      benchmark::DoNotOptimize(::read(**fd, buf.data(), size));
+    } else {
+      benchmark::DoNotOptimize(syscalls::read(**fd, buf.data(), size));
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_Read</*kRaw=*/true>)->Arg(4096)->Arg(1 << 20);
+BENCHMARK(BM_Read</*kRaw=*/false>)->Arg(4096)->Arg(1 << 20);
+
+// Listing a directory of range(0) files, as ReadDir does.
+void BM_ReadDir(benchmark::State &state) {
+  const int files = static_cast<int>(state.range(0));
+  absl::StatusOr<ScratchDir> dir = ScratchDir::Create();
+  if (!dir.ok() || !dir->CreateFiles(files).ok()) {
+    state.SkipWithError("ScratchDir set up failed");
+    return;
+  }
+  ErrnoOr<FileDescriptor> dirfd = syscalls::openat(
+      dir->GetFD(), ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (!dirfd.ok()) {
+    state.SkipWithError("Opening the directory failed");
+    return;
+  }
+  absl::StatusOr<Directory> d = Directory::Create(*std::move(dirfd));
+  if (!d.ok()) {
+    state.SkipWithError("Directory::Create failed");
+    return;
+  }
+  for (auto _ : state) {
+    if (!syscalls::seekdir(**d, 0).ok()) {
+      state.SkipWithError("seekdir failed");
+      break;
+    }
+    while (true) {
+      absl::StatusOr<struct dirent *> entry = syscalls::readdir(**d);
+      if (!entry.ok() || *entry == nullptr) break;
+      benchmark::DoNotOptimize(*entry);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * (files + 2));
+}
+BENCHMARK(BM_ReadDir)->Arg(16)->Arg(1024);
+
+}  // namespace
+}  // namespace pafs
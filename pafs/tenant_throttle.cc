@@ -0,0 +1,465 @@
+#include "pafs/tenant_throttle.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <signal.h>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "fuse/fuse_kernel.h"
+#include "fuse/fuse_lowlevel.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+#include "pafs/util.h"
+
+namespace pafs {
+namespace {
+
+// Set by ReloadOnSignal's handler, so kept lock-free.
+std::atomic<bool> reload_pending = false;
+
+static_assert(std::atomic<bool>::is_always_lock_free);
+
+constexpr uint64_t kGidKey = uint64_t{1} << 32;
+
+void RequestReload(int) {
+  reload_pending.store(true, std::memory_order_relaxed);
+}
+
+// e.g. "400M".
+bool ParseAmount(std::string_view text, double &out) {
+  double scale = 1;
+  if (absl::ConsumeSuffix(&text, "K")) {
+    scale = 1 << 10;
+  } else if (absl::ConsumeSuffix(&text, "M")) {
+    scale = 1 << 20;
+  } else if (absl::ConsumeSuffix(&text, "G")) {
+    scale = 1 << 30;
+  }
+  if (!absl::SimpleAtod(text, &out) || out < 0) return false;
+  out *= scale;
+  return true;
+}
+
+// "-" for unlimited.
+std::string FormatRate(double rate) {
+  return rate == 0 ? "-" : absl::StrFormat("%.0f", rate);
+}
+
+// The request's uid, gid and bytes, unless it's left unthrottled: metadata,
+// forgets and the like, and writes still in a pipe.
+struct Request {
+  uid_t uid;
+  gid_t gid;
+  uint64_t bytes;
+};
+
+// `field` of the request's fuse_*_in, or 0 if it's short.
+template <typename In, typename Field>
+uint64_t BodyBytes(const fuse_buf &buf, Field In::*field) {
+  if (buf.size < sizeof(fuse_in_header) + sizeof(In)) return 0;
+  In in;
+  std::memcpy(
+      &in, static_cast<const char *>(buf.mem) + sizeof(fuse_in_header),
+      sizeof(in));
+  return in.*field;
+}
+
+std::optional<Request> Classify(const fuse_buf &buf) {
+  if ((buf.flags & FUSE_BUF_IS_FD) || buf.size < sizeof(fuse_in_header)) {
+    return std::nullopt;
+  }
+  fuse_in_header in;
+  std::memcpy(&in, buf.mem, sizeof(in));
+  Request request = {.uid = in.uid, .gid = in.gid, .bytes = 0};
+  // The same requests as RequestScheduler's data requests.
+  switch (in.opcode) {
+    case FUSE_READ:
+      request.bytes = BodyBytes(buf, &fuse_read_in::size);
+      return request;
+    case FUSE_WRITE:
+      request.bytes = BodyBytes(buf, &fuse_write_in::size);
+      return request;
+    case FUSE_COPY_FILE_RANGE:
+      request.bytes = BodyBytes(buf, &fuse_copy_file_range_in::len);
+      return request;
+    case FUSE_FSYNC:
+    case FUSE_FSYNCDIR:
+    case FUSE_FALLOCATE:
+      return request;
+    default:
+      return std::nullopt;
+  }
+}
+
+}  // namespace
+
+void TenantThrottle::TokenBucket::SetRate(double r, uint64_t now_ns) {
+  const bool was_unlimited = rate == 0;
+  Refill(now_ns);
+  rate = r;
+  updated_ns = now_ns;
+  // Starts full.
+  tokens = was_unlimited ? rate : std::min(tokens, rate);
+}
+
+void TenantThrottle::TokenBucket::Refill(uint64_t now_ns) {
+  if (rate == 0 || now_ns <= updated_ns) return;
+  tokens = std::min(
+      rate, tokens + rate * static_cast<double>(now_ns - updated_ns) / 1e9);
+  updated_ns = now_ns;
+}
+
+uint64_t TenantThrottle::TokenBucket::WaitNanos() const {
+  if (Ready()) return 0;
+  return static_cast<uint64_t>(-tokens / rate * 1e9) + 1;
+}
+
+absl::StatusOr<TenantThrottle::Config> TenantThrottle::ParseConfig(
+    std::string_view text) {
+  Config config;
+  int line_number = 0;
+  for (std::string_view line : absl::StrSplit(text, '\n')) {
+    line_number++;
+    line = line.substr(0, line.find('#'));
+    std::vector<std::string_view> words =
+      absl::StrSplit(line, absl::ByAnyChar(" \t"), absl::SkipWhitespace());
+    if (words.empty()) continue;
+    const auto error = [line_number](std::string_view message) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Line ", line_number, ": ", message));
+    };
+
+    Limit *limit;
+    size_t next = 1;
+    if (words[0] == "total") {
+      limit = &config.total;
+    } else if (words[0] == "default") {
+      limit = &config.default_limit;
+    } else if (words[0] == "uid" || words[0] == "gid") {
+      uint32_t id;
+      if (words.size() < 2 || !absl::SimpleAtoi(words[1], &id)) {
+        return error(absl::StrCat("Expected a number after ", words[0]));
+      }
+      limit = &(words[0] == "uid" ? config.uids : config.gids)[id];
+      next = 2;
+    } else {
+      return error(absl::StrCat("Unknown tenant \"", words[0], "\""));
+    }
+
+    for (; next < words.size(); next++) {
+      std::string_view word = words[next];
+      std::pair<std::string_view, std::string_view> kv =
+        absl::StrSplit(word, absl::MaxSplits('=', 1));
+      double *value;
+      if (kv.first == "iops") {
+        value = &limit->iops;
+      } else if (kv.first == "bytes") {
+        value = &limit->bytes_per_sec;
+      } else if (kv.first == "weight") {
+        value = &limit->weight;
+      } else {
+        return error(absl::StrCat("Unknown limit \"", kv.first, "\""));
+      }
+      if (!ParseAmount(kv.second, *value)) {
+        return error(absl::StrCat("Bad amount \"", kv.second, "\""));
+      }
+    }
+    if (limit->weight <= 0) return error("Weight must be positive");
+  }
+  return config;
+}
+
+absl::StatusOr<std::unique_ptr<TenantThrottle>> TenantThrottle::Create(
+    std::string path) {
+  // Reloads happen after fuse_daemonize has changed directory.
+  std::error_code ec;
+  std::filesystem::path absolute = std::filesystem::absolute(path, ec);
+  if (ec) return ErrnoToStatus(ec.value(), absl::StrCat("absolute ", path));
+  ASSIGN_OR_RETURN(std::string text, ReadFile(absolute.string()));
+  absl::StatusOr<Config> config = ParseConfig(text);
+  if (!config.ok()) return Prepend(config.status(), absolute.string());
+  return std::unique_ptr<TenantThrottle>(
+      new TenantThrottle(absolute, *std::move(config), MonotonicNanos()));
+}
+
+std::unique_ptr<TenantThrottle> TenantThrottle::Create(
+    Config config, uint64_t now_ns) {
+  return std::unique_ptr<TenantThrottle>(
+      new TenantThrottle("", std::move(config), now_ns));
+}
+
+TenantThrottle::TenantThrottle(
+    std::string path, Config config, uint64_t now_ns)
+  : path_(std::move(path)) {
+  absl::MutexLock lock(&mu_);
+  Apply(std::move(config), now_ns);
+}
+
+TenantThrottle::~TenantThrottle() {
+  absl::MutexLock lock(&mu_);
+  for (Tenant *tenant : backlogged_) {
+    for (Deferred &deferred : tenant->deferred) std::free(deferred.buf.mem);
+  }
+}
+
+absl::Status TenantThrottle::ReloadOnSignal(int signo) {
+  struct sigaction act = {};
+  act.sa_handler = RequestReload;
+  act.sa_flags = SA_RESTART;
+  sigemptyset(&act.sa_mask);
+  return syscalls::sigaction(signo, &act);
+}
+
+void TenantThrottle::MaybeReload() {
+  if (path_.empty()) return;
+  if (!reload_pending.exchange(false, std::memory_order_relaxed)) return;
+  absl::StatusOr<std::string> text = ReadFile(path_);
+  if (!text.ok()) {
+    LOG(ERROR) << "Not reloading tenant limits: " << text.status();
+    return;
+  }
+  absl::StatusOr<Config> config = ParseConfig(*text);
+  if (!config.ok()) {
+    LOG(ERROR) << "Not reloading tenant limits from " << path_ << ": "
+      << config.status();
+    return;
+  }
+  LOG(INFO) << "Reloaded tenant limits from " << path_;
+  absl::MutexLock lock(&mu_);
+  Apply(*std::move(config), MonotonicNanos());
+}
+
+void TenantThrottle::Apply(Config config, uint64_t now_ns) {
+  config_ = std::move(config);
+  total_ops_.SetRate(config_.total.iops, now_ns);
+  total_bytes_.SetRate(config_.total.bytes_per_sec, now_ns);
+  for (auto &[key, tenant] : tenants_) {
+    tenant->limit = LimitFor(key);
+    tenant->ops.SetRate(tenant->limit.iops, now_ns);
+    tenant->bytes.SetRate(tenant->limit.bytes_per_sec, now_ns);
+  }
+  // Deferred requests may now be within their limits.
+  cv_.SignalAll();
+}
+
+TenantThrottle::Limit TenantThrottle::LimitFor(uint64_t key) const {
+  const auto &rules = (key & kGidKey) ? config_.gids : config_.uids;
+  auto iter = rules.find(static_cast<uint32_t>(key));
+  return iter == rules.end() ? config_.default_limit : iter->second;
+}
+
+TenantThrottle::Tenant &TenantThrottle::GetTenant(
+    uid_t uid, gid_t gid, uint64_t now_ns) {
+  uint64_t key = uid;
+  if (!config_.uids.contains(uid) && config_.gids.contains(gid)) {
+    key = kGidKey | gid;
+  }
+  std::unique_ptr<Tenant> &tenant = tenants_[key];
+  if (tenant == nullptr) {
+    tenant = std::make_unique<Tenant>();
+    tenant->name = (key & kGidKey) ? absl::StrCat("gid ", gid)
+                                   : absl::StrCat("uid ", uid);
+    tenant->limit = LimitFor(key);
+    tenant->ops.SetRate(tenant->limit.iops, now_ns);
+    tenant->bytes.SetRate(tenant->limit.bytes_per_sec, now_ns);
+  }
+  return *tenant;
+}
+
+bool TenantThrottle::Tenant::Ready(uint64_t now_ns) {
+  ops.Refill(now_ns);
+  bytes.Refill(now_ns);
+  return ops.Ready() && bytes.Ready();
+}
+
+void TenantThrottle::Charge(Tenant &tenant, uint64_t bytes, double finish) {
+  tenant.ops.Take(1);
+  tenant.bytes.Take(static_cast<double>(bytes));
+  total_ops_.Take(1);
+  total_bytes_.Take(static_cast<double>(bytes));
+  vtime_ = std::max(vtime_, finish);
+}
+
+TenantThrottle::Admission TenantThrottle::Admit(fuse_buf &buf) {
+  return Admit(buf, MonotonicNanos());
+}
+
+TenantThrottle::Admission TenantThrottle::Admit(
+    fuse_buf &buf, uint64_t now_ns) {
+  std::optional<Request> request = Classify(buf);
+  if (!request.has_value()) return Admission::kNow;
+  if (reload_pending.load(std::memory_order_relaxed)) MaybeReload();
+
+  absl::MutexLock lock(&mu_);
+  Tenant &tenant = GetTenant(request->uid, request->gid, now_ns);
+  tenant.requests++;
+  tenant.bytes_total += request->bytes;
+
+  // Its virtual finish time: the time, in seconds of the source's capacity,
+  // that it would finish if each backlogged tenant were served at a rate in
+  // proportion to its weight.
+  double cost = 0;
+  if (total_ops_.rate != 0) cost += 1 / total_ops_.rate;
+  if (total_bytes_.rate != 0) cost += request->bytes / total_bytes_.rate;
+  const double finish =
+    std::max(vtime_, tenant.finish) + cost / tenant.limit.weight;
+  tenant.finish = finish;
+
+  // Behind its tenant's own deferred requests, and, once the source is
+  // limited, behind any other tenant's that are ready to go.
+  const bool limited = total_ops_.rate != 0 || total_bytes_.rate != 0;
+  bool now = tenant.deferred.empty() && tenant.Ready(now_ns);
+  if (now && limited) {
+    total_ops_.Refill(now_ns);
+    total_bytes_.Refill(now_ns);
+    now = total_ops_.Ready() && total_bytes_.Ready() &&
+      FirstReady(now_ns) == nullptr;
+  }
+  if (now) {
+    Charge(tenant, request->bytes, finish);
+    return Admission::kNow;
+  }
+
+  void *mem = deferred_.load(std::memory_order_relaxed) < kMaxDeferred
+    ? std::malloc(buf.size) : nullptr;
+  if (mem == nullptr) {
+    over_limit_++;
+    Charge(tenant, request->bytes, finish);
+    return Admission::kNow;
+  }
+  std::memcpy(mem, buf.mem, buf.size);
+  fuse_buf copy = buf;
+  copy.mem = mem;
+  tenant.deferred.push_back({
+    .buf = copy,
+    .bytes = request->bytes,
+    .finish = finish,
+    .arrival = next_arrival_++,
+    .deferred_ns = now_ns,
+  });
+  tenant.throttled++;
+  backlogged_.insert(&tenant);
+  deferred_.fetch_add(1, std::memory_order_relaxed);
+  cv_.Signal();
+  return Admission::kDeferred;
+}
+
+TenantThrottle::Tenant *TenantThrottle::FirstReady(uint64_t now_ns) {
+  Tenant *first = nullptr;
+  for (Tenant *tenant : backlogged_) {
+    if (!tenant->Ready(now_ns)) continue;
+    const Deferred &head = tenant->deferred.front();
+    if (first == nullptr ||
+        std::tie(head.finish, head.arrival) <
+          std::tie(
+            first->deferred.front().finish, first->deferred.front().arrival)) {
+      first = tenant;
+    }
+  }
+  return first;
+}
+
+std::optional<fuse_buf> TenantThrottle::Next() {
+  return Next(MonotonicNanos());
+}
+
+std::optional<fuse_buf> TenantThrottle::Next(uint64_t now_ns) {
+  if (deferred_.load(std::memory_order_relaxed) == 0) return std::nullopt;
+  absl::MutexLock lock(&mu_);
+  return NextLocked(now_ns);
+}
+
+std::optional<fuse_buf> TenantThrottle::NextLocked(uint64_t now_ns) {
+  if (backlogged_.empty()) return std::nullopt;
+  total_ops_.Refill(now_ns);
+  total_bytes_.Refill(now_ns);
+  if (!total_ops_.Ready() || !total_bytes_.Ready()) return std::nullopt;
+  Tenant *tenant = FirstReady(now_ns);
+  if (tenant == nullptr) return std::nullopt;
+
+  Deferred deferred = tenant->deferred.front();
+  tenant->deferred.pop_front();
+  if (tenant->deferred.empty()) backlogged_.erase(tenant);
+  deferred_.fetch_sub(1, std::memory_order_relaxed);
+  tenant->wait_ns += now_ns - deferred.deferred_ns;
+  Charge(*tenant, deferred.bytes, deferred.finish);
+  return deferred.buf;
+}
+
+uint64_t TenantThrottle::WaitNanos(uint64_t now_ns) {
+  uint64_t wait = UINT64_MAX;
+  for (Tenant *tenant : backlogged_) {
+    tenant->Ready(now_ns);
+    wait = std::min(
+        wait, std::max(tenant->ops.WaitNanos(), tenant->bytes.WaitNanos()));
+  }
+  if (wait == UINT64_MAX) return wait;
+  total_ops_.Refill(now_ns);
+  total_bytes_.Refill(now_ns);
+  return std::max(
+      {wait, total_ops_.WaitNanos(), total_bytes_.WaitNanos()});
+}
+
+std::optional<fuse_buf> TenantThrottle::WaitForNext(absl::Duration timeout) {
+  const uint64_t deadline =
+    MonotonicNanos() + static_cast<uint64_t>(absl::ToInt64Nanoseconds(timeout));
+  absl::MutexLock lock(&mu_);
+  while (true) {
+    const uint64_t now = MonotonicNanos();
+    if (std::optional<fuse_buf> buf = NextLocked(now)) return buf;
+    if (now >= deadline) return std::nullopt;
+    // Woken early by a newly deferred request, or a reload.
+    cv_.WaitWithTimeout(
+        &mu_, absl::Nanoseconds(std::min(WaitNanos(now), deadline - now)));
+  }
+}
+
+std::string TenantThrottle::Format() const {
+  absl::MutexLock lock(&mu_);
+  std::string out = absl::StrFormat(
+      "total: %s iops, %s bytes/s, %d deferred, %d over the limit\n\n",
+      FormatRate(config_.total.iops), FormatRate(config_.total.bytes_per_sec),
+      deferred_.load(std::memory_order_relaxed), over_limit_);
+  absl::StrAppendFormat(
+      &out, "%-12s %6s %8s %12s %10s %14s %10s %8s %10s\n", "tenant",
+      "weight", "iops", "bytes/s", "requests", "bytes", "throttled",
+      "deferred", "wait ms");
+  std::vector<const Tenant *> sorted;
+  for (const auto &[key, tenant] : tenants_) sorted.push_back(tenant.get());
+  std::sort(
+      sorted.begin(), sorted.end(), [](const Tenant *a, const Tenant *b) {
+        return a->requests > b->requests;
+      });
+  for (const Tenant *tenant : sorted) {
+    absl::StrAppendFormat(
+        &out, "%-12s %6g %8s %12s %10d %14d %10d %8d %10.1f\n",
+        tenant->name, tenant->limit.weight, FormatRate(tenant->limit.iops),
+        FormatRate(tenant->limit.bytes_per_sec), tenant->requests,
+        tenant->bytes_total, tenant->throttled, tenant->deferred.size(),
+        static_cast<double>(tenant->wait_ns) / 1e6);
+  }
+  return out;
+}
+
+}  // namespace pafs
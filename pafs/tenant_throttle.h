@@ -0,0 +1,208 @@
+#ifndef PAFS_TENANT_THROTTLE_H_
+#define PAFS_TENANT_THROTTLE_H_
+
+#ifndef FUSE_USE_VERSION
+// Needed by fuse/fuse_lowlevel.h
+#define FUSE_USE_VERSION 312
+#elif FUSE_USE_VERSION != 312
+#error this file is written for fuse 3.12
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "fuse/fuse_lowlevel.h"
+
+namespace pafs {
+
+// Limits the data requests (reads, writes, fsyncs and the like) and bytes a
+// second of each tenant sharing the mount, where a tenant is the uid or gid
+// of the requesting process, and shares the source's capacity between
+// tenants by weight. Metadata requests are never throttled.
+//
+// Configured by a file of one rule per line:
+//
+//   # who        limits
+//   total        iops=5000 bytes=400M
+//   default      iops=500
+//   uid 1000     iops=2000 bytes=100M weight=4
+//   gid 100      bytes=20M
+//
+// A request belongs to the tenant of its uid's rule, else its gid's, else to
+// its uid, limited by the default rule. Limits left out, or 0, are unlimited.
+// Bytes are those read, written or copied; `bytes` takes a K, M or G suffix.
+// "total" is the source's capacity: once it's used up, tenants are served in
+// weighted fair order, each getting a share in proportion to its weight,
+// which defaults to 1.
+//
+// Like RequestScheduler, works on requests as read from /dev/fuse, before
+// libfuse dispatches them. A request over its limits is copied into its
+// tenant's queue, so that the thread that read it can go on to others, and
+// is handed out by Next once it's within them. Writes libfuse spliced from
+// /dev/fuse can't be read until they're handled, so go unthrottled.
+//
+// Thread-safe.
+class TenantThrottle {
+ public:
+  struct Limit {
+    double iops = 0;
+    double bytes_per_sec = 0;
+    double weight = 1;
+  };
+  struct Config {
+    Limit total;
+    Limit default_limit;
+    absl::flat_hash_map<uint32_t, Limit> uids;
+    absl::flat_hash_map<uint32_t, Limit> gids;
+  };
+
+  static absl::StatusOr<Config> ParseConfig(std::string_view text);
+
+  // Reads the config from `path`.
+  static absl::StatusOr<std::unique_ptr<TenantThrottle>> Create(
+      std::string path);
+  // Never reloaded. Times are as for Admit.
+  static std::unique_ptr<TenantThrottle> Create(
+      Config config, uint64_t now_ns);
+  // Frees any requests still deferred, unreplied.
+  ~TenantThrottle();
+
+  TenantThrottle(TenantThrottle &&) = delete;
+  TenantThrottle(const TenantThrottle &) = delete;
+  TenantThrottle &operator=(TenantThrottle &&) = delete;
+  TenantThrottle &operator=(const TenantThrottle &) = delete;
+
+  // Re-reads the config file whenever the process gets `signo`. A config that
+  // fails to parse is logged and ignored.
+  static absl::Status ReloadOnSignal(int signo);
+
+  enum class Admission {
+    // Handle it now.
+    kNow,
+    // A copy has been deferred, to be handed out by Next. `buf` is left to be
+    // read into again.
+    kDeferred,
+  };
+
+  // Called with a request just read into `buf` by fuse_session_receive_buf.
+  // `now_ns` is CLOCK_MONOTONIC, or any clock that never goes back.
+  Admission Admit(fuse_buf &buf);
+  Admission Admit(fuse_buf &buf, uint64_t now_ns);
+
+  // The deferred request with the earliest virtual finish time of those now
+  // within their limits, or nullopt if there's none. The caller owns the
+  // returned buffer's memory.
+  std::optional<fuse_buf> Next();
+  std::optional<fuse_buf> Next(uint64_t now_ns);
+  // Like Next, but waits up to `timeout` for a request to come within its
+  // limits.
+  std::optional<fuse_buf> WaitForNext(absl::Duration timeout);
+
+  // For ControlRegistry.
+  std::string Format() const;
+
+ private:
+  // Past this many deferred requests, further ones are handled at once, in
+  // debt to their buckets, rather than hold more memory.
+  static constexpr size_t kMaxDeferred = 4096;
+
+  // Tokens accrue at `rate` a second, up to a second's worth. Taking them may
+  // leave the bucket in debt, so that a request bigger than a second's worth
+  // still gets through once it's paid off the last one.
+  struct TokenBucket {
+    // 0 is unlimited.
+    double rate = 0;
+    double tokens = 0;
+    uint64_t updated_ns = 0;
+
+    void SetRate(double r, uint64_t now_ns);
+    void Refill(uint64_t now_ns);
+    bool Ready() const { return rate == 0 || tokens > 0; }
+    // Until Ready.
+    uint64_t WaitNanos() const;
+    void Take(double n) { if (rate != 0) tokens -= n; }
+  };
+
+  struct Deferred {
+    fuse_buf buf;
+    uint64_t bytes;
+    // Its virtual finish time, then its arrival, for fair queueing.
+    double finish;
+    uint64_t arrival;
+    uint64_t deferred_ns;
+  };
+
+  struct Tenant {
+    std::string name;
+    Limit limit;
+    TokenBucket ops;
+    TokenBucket bytes;
+    // The virtual finish time of its last request.
+    double finish = 0;
+    std::deque<Deferred> deferred;
+    uint64_t requests = 0;
+    uint64_t bytes_total = 0;
+    uint64_t throttled = 0;
+    uint64_t wait_ns = 0;
+
+    bool Ready(uint64_t now_ns);
+  };
+
+  TenantThrottle(std::string path, Config config, uint64_t now_ns);
+
+  void MaybeReload();
+  void Apply(Config config, uint64_t now_ns)
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  Limit LimitFor(uint64_t key) const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  Tenant &GetTenant(uid_t uid, gid_t gid, uint64_t now_ns)
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // Takes the request's tokens from its tenant's buckets and the source's.
+  void Charge(Tenant &tenant, uint64_t bytes, double finish)
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // The backlogged tenant whose first deferred request is within its limits
+  // and finishes first, or nullptr.
+  Tenant *FirstReady(uint64_t now_ns) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  std::optional<fuse_buf> NextLocked(uint64_t now_ns)
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  // How long until NextLocked might return a request, if any are deferred.
+  uint64_t WaitNanos(uint64_t now_ns) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  const std::string path_;
+
+  mutable absl::Mutex mu_;
+  absl::CondVar cv_;
+  Config config_ ABSL_GUARDED_BY(mu_);
+  TokenBucket total_ops_ ABSL_GUARDED_BY(mu_);
+  TokenBucket total_bytes_ ABSL_GUARDED_BY(mu_);
+  // The virtual time: the finish time of the last request let through.
+  double vtime_ ABSL_GUARDED_BY(mu_) = 0;
+  uint64_t next_arrival_ ABSL_GUARDED_BY(mu_) = 0;
+  // Keyed by whether it's a gid, in the top 32 bits, and the id.
+  absl::flat_hash_map<uint64_t, std::unique_ptr<Tenant>> tenants_
+    ABSL_GUARDED_BY(mu_);
+  // Those with deferred requests.
+  absl::flat_hash_set<Tenant *> backlogged_ ABSL_GUARDED_BY(mu_);
+  // Changed under mu_, but read without it, so that workers can check for
+  // deferred requests after each one they handle.
+  std::atomic<size_t> deferred_ = 0;
+  // Handled at once since kMaxDeferred were already deferred.
+  uint64_t over_limit_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_TENANT_THROTTLE_H_
@@ -0,0 +1,201 @@
+#include "pafs/tenant_throttle.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "fuse/fuse_kernel.h"
+#include "fuse/fuse_lowlevel.h"
+#include "gtest/gtest.h"
+
+namespace pafs {
+namespace {
+
+using Admission = TenantThrottle::Admission;
+
+constexpr uint64_t kSecond = 1'000'000'000;
+// Any time will do, as long as the test's clock only goes forward from it.
+constexpr uint64_t kStart = 100 * kSecond;
+
+// A request as read from /dev/fuse: a fuse_in_header, then for reads, a
+// fuse_read_in.
+class Request {
+ public:
+  Request(uint64_t unique, uint32_t opcode, uint32_t uid, uint32_t size = 0)
+    : storage_(
+        (sizeof(fuse_in_header) + sizeof(fuse_read_in)) / sizeof(uint64_t)) {
+    fuse_in_header in = {};
+    in.len = sizeof(fuse_in_header) + sizeof(fuse_read_in);
+    in.opcode = opcode;
+    in.unique = unique;
+    in.uid = uid;
+    in.gid = uid;
+    fuse_read_in read = {};
+    read.size = size;
+    char *mem = reinterpret_cast<char *>(storage_.data());
+    std::memcpy(mem, &in, sizeof(in));
+    std::memcpy(mem + sizeof(in), &read, sizeof(read));
+    buf_.size = in.len;
+    buf_.mem = mem;
+    buf_.fd = -1;
+  }
+
+  fuse_buf &buf() { return buf_; }
+
+ private:
+  // Of uint64_t for the alignment of a fuse_in_header.
+  std::vector<uint64_t> storage_;
+  fuse_buf buf_ = {};
+};
+
+Admission Admit(
+    TenantThrottle &throttle, uint64_t now_ns, uint64_t unique,
+    uint32_t opcode, uint32_t uid, uint32_t size = 0) {
+  Request request(unique, opcode, uid, size);
+  return throttle.Admit(request.buf(), now_ns);
+}
+
+// The unique of the request Next hands out, if any.
+std::optional<uint64_t> NextUnique(TenantThrottle &throttle, uint64_t now_ns) {
+  std::optional<fuse_buf> buf = throttle.Next(now_ns);
+  if (!buf.has_value()) return std::nullopt;
+  fuse_in_header in;
+  std::memcpy(&in, buf->mem, sizeof(in));
+  std::free(buf->mem);
+  return in.unique;
+}
+
+std::unique_ptr<TenantThrottle> Create(std::string_view config) {
+  absl::StatusOr<TenantThrottle::Config> parsed =
+    TenantThrottle::ParseConfig(config);
+  EXPECT_TRUE(parsed.ok()) << parsed.status();
+  return TenantThrottle::Create(*std::move(parsed), kStart);
+}
+
+TEST(TenantThrottleTest, ParsesRules) {
+  absl::StatusOr<TenantThrottle::Config> config = TenantThrottle::ParseConfig(
+      "# who        limits\n"
+      "total        iops=5000 bytes=400M\n"
+      "\n"
+      "default      iops=500   # everyone else\n"
+      "uid 1000     iops=2000 bytes=100K weight=4\n"
+      "gid 100\tbytes=2G\n");
+  ASSERT_TRUE(config.ok()) << config.status();
+  EXPECT_EQ(config->total.iops, 5000);
+  EXPECT_EQ(config->total.bytes_per_sec, 400 << 20);
+  EXPECT_EQ(config->default_limit.iops, 500);
+  EXPECT_EQ(config->default_limit.bytes_per_sec, 0);
+  ASSERT_TRUE(config->uids.contains(1000));
+  EXPECT_EQ(config->uids[1000].iops, 2000);
+  EXPECT_EQ(config->uids[1000].bytes_per_sec, 100 << 10);
+  EXPECT_EQ(config->uids[1000].weight, 4);
+  ASSERT_TRUE(config->gids.contains(100));
+  EXPECT_EQ(config->gids[100].bytes_per_sec, double{1 << 30} * 2);
+  EXPECT_EQ(config->gids[100].weight, 1);
+}
+
+TEST(TenantThrottleTest, RejectsBadRules) {
+  for (const char *text : {
+         "someone iops=1",
+         "uid iops=1",
+         "uid x iops=1",
+         "default speed=1",
+         "default iops=fast",
+         "default iops=-1",
+         "default weight=0",
+       }) {
+    absl::StatusOr<TenantThrottle::Config> config =
+      TenantThrottle::ParseConfig(std::string("total iops=1\n") + text);
+    EXPECT_EQ(config.status().code(), absl::StatusCode::kInvalidArgument)
+      << text;
+    EXPECT_TRUE(absl::StartsWith(config.status().message(), "Line 2: "))
+      << text;
+  }
+}
+
+TEST(TenantThrottleTest, NeverThrottlesMetadata) {
+  std::unique_ptr<TenantThrottle> throttle = Create("default iops=1");
+  for (uint64_t unique = 1; unique <= 100; unique++) {
+    EXPECT_EQ(
+        Admit(*throttle, kStart, unique, FUSE_GETATTR, 1000), Admission::kNow);
+  }
+}
+
+TEST(TenantThrottleTest, DefersRequestsOverTheTenantsIops) {
+  // Starts with a second's worth.
+  std::unique_ptr<TenantThrottle> throttle = Create("default iops=2");
+  EXPECT_EQ(Admit(*throttle, kStart, 1, FUSE_READ, 1000), Admission::kNow);
+  EXPECT_EQ(Admit(*throttle, kStart, 2, FUSE_READ, 1000), Admission::kNow);
+  EXPECT_EQ(Admit(*throttle, kStart, 3, FUSE_READ, 1000), Admission::kDeferred);
+  EXPECT_EQ(Admit(*throttle, kStart, 4, FUSE_FSYNC, 1000), Admission::kDeferred);
+  EXPECT_EQ(NextUnique(*throttle, kStart), std::nullopt);
+
+  // Half a second buys one more.
+  EXPECT_EQ(NextUnique(*throttle, kStart + kSecond / 2), 3);
+  EXPECT_EQ(NextUnique(*throttle, kStart + kSecond / 2), std::nullopt);
+  EXPECT_EQ(NextUnique(*throttle, kStart + kSecond), 4);
+  // With nothing deferred, and the bucket refilled, at once again.
+  EXPECT_EQ(
+      Admit(*throttle, kStart + 3 * kSecond, 5, FUSE_READ, 1000),
+      Admission::kNow);
+}
+
+TEST(TenantThrottleTest, LetsABigRequestThroughInDebt) {
+  std::unique_ptr<TenantThrottle> throttle = Create("default bytes=1M");
+  EXPECT_EQ(
+      Admit(*throttle, kStart, 1, FUSE_READ, 1000, 4 << 20), Admission::kNow);
+  EXPECT_EQ(
+      Admit(*throttle, kStart, 2, FUSE_READ, 1000, 4096),
+      Admission::kDeferred);
+  // Until the 3MiB of debt is paid off.
+  EXPECT_EQ(NextUnique(*throttle, kStart + 2 * kSecond), std::nullopt);
+  EXPECT_EQ(NextUnique(*throttle, kStart + 3 * kSecond + 1), 2);
+}
+
+TEST(TenantThrottleTest, DoesntHoldBackOtherTenants) {
+  std::unique_ptr<TenantThrottle> throttle = Create("uid 1 iops=1");
+  EXPECT_EQ(Admit(*throttle, kStart, 1, FUSE_READ, 1), Admission::kNow);
+  EXPECT_EQ(Admit(*throttle, kStart, 2, FUSE_READ, 1), Admission::kDeferred);
+  EXPECT_EQ(Admit(*throttle, kStart, 3, FUSE_WRITE, 2), Admission::kNow);
+  EXPECT_EQ(Admit(*throttle, kStart, 4, FUSE_READ, 3), Admission::kNow);
+  EXPECT_EQ(NextUnique(*throttle, kStart), std::nullopt);
+}
+
+TEST(TenantThrottleTest, SharesTheSourceByWeight) {
+  // Each request costs a second of the source's capacity: 1 virtual second
+  // for uid 1, and half of one for uid 2.
+  std::unique_ptr<TenantThrottle> throttle = Create(
+      "total iops=1\n"
+      "uid 2 weight=2\n");
+  // Finishes at 1, using up the source.
+  EXPECT_EQ(Admit(*throttle, kStart, 1, FUSE_READ, 1), Admission::kNow);
+  // Finish at 2, 3 and 4.
+  EXPECT_EQ(Admit(*throttle, kStart, 2, FUSE_READ, 1), Admission::kDeferred);
+  EXPECT_EQ(Admit(*throttle, kStart, 3, FUSE_READ, 1), Admission::kDeferred);
+  EXPECT_EQ(Admit(*throttle, kStart, 4, FUSE_READ, 1), Admission::kDeferred);
+  // Finish at 1.5, 2 and 2.5.
+  EXPECT_EQ(Admit(*throttle, kStart, 5, FUSE_READ, 2), Admission::kDeferred);
+  EXPECT_EQ(Admit(*throttle, kStart, 6, FUSE_READ, 2), Admission::kDeferred);
+  EXPECT_EQ(Admit(*throttle, kStart, 7, FUSE_READ, 2), Admission::kDeferred);
+
+  // One a second, in order of finish time, then arrival.
+  uint64_t now = kStart;
+  for (uint64_t unique : {5, 2, 6, 7, 3, 4}) {
+    EXPECT_EQ(NextUnique(*throttle, now), std::nullopt);
+    now += kSecond;
+    EXPECT_EQ(NextUnique(*throttle, now), unique);
+  }
+  EXPECT_EQ(NextUnique(*throttle, now + kSecond), std::nullopt);
+}
+
+}  // namespace
+}  // namespace pafs
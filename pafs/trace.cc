@@ -0,0 +1,374 @@
+#include "pafs/trace.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "absl/base/attributes.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+#include "pafs/util.h"
+
+namespace pafs {
+namespace {
+
+// Single-producer (the owning thread), single-consumer (the drainer).
+struct TraceRing {
+  static constexpr uint64_t kCapacity = 4096;
+  static_assert((kCapacity & (kCapacity - 1)) == 0);
+
+  explicit TraceRing(uint32_t tid) : tid(tid) {}
+
+  const uint32_t tid;
+  // Set when the owning thread exits. The drainer forgets the ring once it's
+  // empty.
+  std::atomic<bool> retired = false;
+  std::atomic<uint64_t> dropped = 0;
+
+  alignas(64) std::atomic<uint64_t> head = 0;
+  alignas(64) std::atomic<uint64_t> tail = 0;
+  std::array<TraceRecord, kCapacity> records;
+};
+
+// Rings outlive both their thread and any one Tracer, so request threads
+// never have to know whether a Tracer exists.
+ABSL_CONST_INIT absl::Mutex rings_mu(absl::kConstInit);
+std::vector<std::shared_ptr<TraceRing>> &Rings()
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(rings_mu) {
+  static auto *rings = new std::vector<std::shared_ptr<TraceRing>>();
+  return *rings;
+}
+
+// Kept lock-free, since ToggleOnSignal's handler writes them.
+std::atomic<TraceLevel> level = TraceLevel::kOff;
+std::atomic<TraceLevel> toggled_level = TraceLevel::kOff;
+std::atomic<bool> tracer_exists = false;
+std::atomic<uint32_t> sample_every = 1;
+
+static_assert(std::atomic<TraceLevel>::is_always_lock_free);
+static_assert(std::atomic<bool>::is_always_lock_free);
+
+// Not a TraceRecord flag: cleared before the record is written out.
+constexpr uint8_t kOnlyIfFailed = 1 << 7;
+
+struct ThreadRing {
+  ~ThreadRing() {
+    if (ring != nullptr) ring->retired.store(true, std::memory_order_release);
+  }
+
+  TraceRing &Get() {
+    if (ring == nullptr) {
+      ring = std::make_shared<TraceRing>(static_cast<uint32_t>(gettid()));
+      absl::MutexLock lock(&rings_mu);
+      Rings().push_back(ring);
+    }
+    return *ring;
+  }
+
+  std::shared_ptr<TraceRing> ring;
+  uint32_t sample_count = 0;
+};
+thread_local ThreadRing thread_ring;
+
+void Push(TraceRing &ring, const TraceRecord &record) {
+  uint64_t head = ring.head.load(std::memory_order_relaxed);
+  if (head - ring.tail.load(std::memory_order_acquire) >= TraceRing::kCapacity) {
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  ring.records[head & (TraceRing::kCapacity - 1)] = record;
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+void ToggleLevel(int) {
+  if (!tracer_exists.load(std::memory_order_relaxed)) return;
+  TraceLevel current = level.load(std::memory_order_relaxed);
+  if (current == TraceLevel::kOff) {
+    level.store(toggled_level.load(std::memory_order_relaxed));
+  } else {
+    toggled_level.store(current, std::memory_order_relaxed);
+    level.store(TraceLevel::kOff, std::memory_order_relaxed);
+  }
+}
+
+}  // namespace
+
+bool AbslParseFlag(
+    std::string_view text, TraceLevel *level, std::string *error) {
+  if (text == "off") {
+    *level = TraceLevel::kOff;
+  } else if (text == "failures") {
+    *level = TraceLevel::kFailures;
+  } else if (text == "all") {
+    *level = TraceLevel::kAll;
+  } else {
+    *error = "must be one of off, failures or all";
+    return false;
+  }
+  return true;
+}
+
+std::string AbslUnparseFlag(TraceLevel level) {
+  switch (level) {
+    case TraceLevel::kOff:
+      return "off";
+    case TraceLevel::kFailures:
+      return "failures";
+    case TraceLevel::kAll:
+      return "all";
+  }
+  return "off";
+}
+
+absl::StatusOr<TraceFile> ReadTraceFile(int fd) {
+  std::vector<char> data;
+  size_t size = 0;
+  for (;;) {
+    data.resize(size + (1 << 20));
+    ASSIGN_OR_RETURN(
+        size_t n, syscalls::read(fd, data.data() + size, data.size() - size));
+    if (n == 0) break;
+    size += n;
+  }
+  data.resize(size);
+
+  TraceFile file;
+  if (data.size() < sizeof(file.header)) {
+    return absl::InvalidArgumentError("Trace file is too short");
+  }
+  std::memcpy(&file.header, data.data(), sizeof(file.header));
+  if (std::memcmp(
+        file.header.magic, kTraceMagic, sizeof(file.header.magic)) != 0) {
+    return absl::InvalidArgumentError("Not a trace file");
+  }
+  if (file.header.version != kTraceVersion ||
+      file.header.record_size != sizeof(TraceRecord)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+          "Unsupported trace version ", file.header.version, " with ",
+          file.header.record_size, " byte records"));
+  }
+
+  size_t records = (data.size() - sizeof(file.header)) / sizeof(TraceRecord);
+  file.records.resize(records);
+  std::memcpy(
+      file.records.data(), data.data() + sizeof(file.header),
+      records * sizeof(TraceRecord));
+  file.trailing_bytes =
+    data.size() - sizeof(file.header) - records * sizeof(TraceRecord);
+  return file;
+}
+
+std::optional<TraceRecord> TraceBegin(const OpInfo &info) {
+  TraceLevel current = level.load(std::memory_order_relaxed);
+  if (current == TraceLevel::kOff) return std::nullopt;
+
+  TraceRecord record{
+    .start_ns = MonotonicNanos(),
+    .ino = info.ino,
+    .arg0 = info.arg0,
+    .arg1 = info.arg1,
+    .fh = info.fh,
+    .entry_ino = 0,
+    .duration_ns = 0,
+    .tid = 0,
+    .error = 0,
+    .op = info.op,
+    .flags = 0,
+    .name_len = static_cast<uint8_t>(
+        std::min<size_t>(info.name.size(), std::numeric_limits<uint8_t>::max())),
+    .name2_len = static_cast<uint8_t>(std::min<size_t>(
+          info.name2.size(), std::numeric_limits<uint8_t>::max())),
+    .name = {},
+  };
+  // Successes that aren't sampled are still timed, in case they fail.
+  uint32_t every = sample_every.load(std::memory_order_relaxed);
+  if (current != TraceLevel::kAll || ++thread_ring.sample_count < every) {
+    record.flags |= kOnlyIfFailed;
+  } else {
+    thread_ring.sample_count = 0;
+  }
+  size_t n = std::min(info.name.size(), sizeof(record.name));
+  std::memcpy(record.name, info.name.data(), n);
+  size_t n2 = std::min(info.name2.size(), sizeof(record.name) - n);
+  std::memcpy(record.name + n, info.name2.data(), n2);
+  if (n < info.name.size() || n2 < info.name2.size()) {
+    record.flags |= TraceRecord::kNameTruncated;
+  }
+  return record;
+}
+
+void TraceEnd(TraceRecord &record, int error) {
+  if ((record.flags & kOnlyIfFailed) && error == 0) return;
+  record.flags &= ~kOnlyIfFailed;
+  record.error = error;
+  record.duration_ns = static_cast<uint32_t>(std::min<uint64_t>(
+        MonotonicNanos() - record.start_ns,
+        std::numeric_limits<uint32_t>::max()));
+  TraceRing &ring = thread_ring.Get();
+  record.tid = ring.tid;
+  Push(ring, record);
+}
+
+absl::StatusOr<std::unique_ptr<Tracer>> Tracer::Create(
+    FileDescriptor out, Options opts) {
+  CHECK(!tracer_exists.exchange(true)) << "Only one Tracer may exist";
+  auto tracer = std::unique_ptr<Tracer>(
+      new Tracer(std::move(out), opts.flush_interval));
+
+  struct timespec realtime;
+  struct timespec monotonic;
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  clock_gettime(CLOCK_MONOTONIC, &monotonic);
+  TraceFileHeader header = {
+    .magic = {},
+    .version = kTraceVersion,
+    .record_size = sizeof(TraceRecord),
+    .realtime_ns =
+      static_cast<uint64_t>(realtime.tv_sec) * 1'000'000'000 + realtime.tv_nsec,
+    .monotonic_ns =
+      static_cast<uint64_t>(monotonic.tv_sec) * 1'000'000'000 +
+      monotonic.tv_nsec,
+  };
+  std::memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+  RETURN_IF_ERROR(tracer->Write(&header, sizeof(header)));
+
+  tracer->SetSampleEvery(opts.sample_every);
+  tracer->SetLevel(opts.level);
+  tracer->thread_ = std::thread([t = tracer.get()]() { t->Run(); });
+  return tracer;
+}
+
+Tracer::Tracer(FileDescriptor out, absl::Duration flush_interval)
+  : out_(std::move(out)), flush_interval_(flush_interval) {}
+
+Tracer::~Tracer() {
+  level.store(TraceLevel::kOff);
+  toggled_level.store(TraceLevel::kOff);
+  {
+    absl::MutexLock lock(&mu_);
+    stopping_ = true;
+  }
+  if (thread_.joinable()) thread_.join();
+  tracer_exists.store(false);
+}
+
+void Tracer::SetLevel(TraceLevel l) {
+  level.store(l, std::memory_order_relaxed);
+  toggled_level.store(l, std::memory_order_relaxed);
+}
+
+TraceLevel Tracer::GetLevel() const {
+  return level.load(std::memory_order_relaxed);
+}
+
+void Tracer::SetSampleEvery(uint32_t n) {
+  sample_every.store(std::max<uint32_t>(n, 1), std::memory_order_relaxed);
+}
+
+absl::Status Tracer::ToggleOnSignal(int signo) {
+  struct sigaction act = {};
+  act.sa_handler = ToggleLevel;
+  act.sa_flags = SA_RESTART;
+  sigemptyset(&act.sa_mask);
+  return syscalls::sigaction(signo, &act);
+}
+
+void Tracer::Run() {
+  for (;;) {
+    bool stopping;
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.AwaitWithTimeout(absl::Condition(&stopping_), flush_interval_);
+      stopping = stopping_;
+    }
+    // Once writing fails it will likely keep failing, so rather than logging
+    // every interval, stop tracing. The rings are still drained so that they
+    // don't report drops.
+    if (absl::Status st = Drain(); !st.ok() && GetLevel() != TraceLevel::kOff) {
+      LOG(ERROR) << "Turning tracing off: " << st;
+      SetLevel(TraceLevel::kOff);
+    }
+    if (stopping) return;
+  }
+}
+
+absl::Status Tracer::Drain() {
+  std::vector<std::shared_ptr<TraceRing>> rings;
+  {
+    absl::MutexLock lock(&rings_mu);
+    // A retired ring can't gain records, so if it's empty now it's done.
+    std::erase_if(Rings(), [](const std::shared_ptr<TraceRing> &ring) {
+      return ring->retired.load(std::memory_order_acquire) &&
+             ring->head.load(std::memory_order_acquire) ==
+               ring->tail.load(std::memory_order_relaxed) &&
+             ring->dropped.load(std::memory_order_relaxed) == 0;
+    });
+    rings = Rings();
+  }
+
+  buf_.clear();
+  for (const std::shared_ptr<TraceRing> &ring : rings) {
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    for (; tail != head; ++tail) {
+      buf_.push_back(ring->records[tail & (TraceRing::kCapacity - 1)]);
+    }
+    ring->tail.store(tail, std::memory_order_release);
+
+    if (uint64_t dropped =
+          ring->dropped.exchange(0, std::memory_order_relaxed);
+        dropped > 0) {
+      buf_.push_back(TraceRecord{
+        .start_ns = MonotonicNanos(),
+        .ino = 0,
+        .arg0 = dropped,
+        .arg1 = 0,
+        .fh = 0,
+        .entry_ino = 0,
+        .duration_ns = 0,
+        .tid = ring->tid,
+        .error = 0,
+        .op = Op::kUnknown,
+        .flags = TraceRecord::kDropped,
+        .name_len = 0,
+        .name2_len = 0,
+        .name = {},
+      });
+    }
+  }
+  if (buf_.empty()) return absl::OkStatus();
+  return Write(buf_.data(), buf_.size() * sizeof(TraceRecord));
+}
+
+absl::Status Tracer::Write(const void *buf, size_t size) {
+  const char *p = static_cast<const char *>(buf);
+  while (size > 0) {
+    ASSIGN_OR_RETURN(size_t n, syscalls::write(*out_, p, size));
+    p += n;
+    size -= n;
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace pafs
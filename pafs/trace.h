@@ -0,0 +1,181 @@
+#ifndef PAFS_TRACE_H_
+#define PAFS_TRACE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "pafs/fd.h"
+#include "pafs/op.h"
+
+namespace pafs {
+
+enum class TraceLevel : uint8_t {
+  kOff = 0,
+  // Only requests replied to with an error.
+  kFailures,
+  // Every request, subject to sampling. Failures are never sampled out.
+  kAll,
+};
+
+// "off", "failures" or "all". For absl flags.
+bool AbslParseFlag(std::string_view text, TraceLevel *level, std::string *error);
+std::string AbslUnparseFlag(TraceLevel level);
+
+// A trace file is a TraceFileHeader followed by TraceRecords, in host byte
+// order. Decode one with trace_decode.
+inline constexpr char kTraceMagic[8] = {'P', 'A', 'F', 'S', 'T', 'R', 'C', '\0'};
+inline constexpr uint32_t kTraceVersion = 2;
+
+struct TraceFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  // The same instant on both clocks, to turn TraceRecord::start_ns into wall
+  // time.
+  uint64_t realtime_ns;
+  uint64_t monotonic_ns;
+};
+static_assert(sizeof(TraceFileHeader) == 32);
+
+// One request. Fixed-size so that it can be written from a ring buffer as-is.
+//
+// Records hold what trace_replay needs to send the request again: inodes and
+// file handles are those of the traced process, and are mapped to the
+// replaying one's through `entry_ino` and `fh` of the replies that created
+// them.
+struct TraceRecord {
+  // Set on a record that only reports that `arg0` records from thread `tid`
+  // were dropped because its ring was full.
+  static constexpr uint8_t kDropped = 1 << 0;
+  // `name` was truncated; `name_len` and `name2_len` are the lengths of the
+  // full names, clamped to 255.
+  static constexpr uint8_t kNameTruncated = 1 << 1;
+
+  // CLOCK_MONOTONIC.
+  uint64_t start_ns;
+  uint64_t ino;
+  uint64_t arg0;
+  uint64_t arg1;
+  // The file handle the request was on, or for Open, OpenDir and Create the
+  // one replied with.
+  uint64_t fh;
+  // The inode replied with by ops that reply with an entry, e.g. Lookup.
+  uint64_t entry_ino;
+  // Saturates at UINT32_MAX (about 4s).
+  uint32_t duration_ns;
+  uint32_t tid;
+  // The errno replied with; 0 on success.
+  int32_t error;
+  Op op;
+  uint8_t flags;
+  uint8_t name_len;
+  uint8_t name2_len;
+  // The name, then the second name (see OpInfo), without NULs.
+  char name[64];
+
+  // What fit of each name.
+  std::string_view Name() const {
+    return {name, std::min<size_t>(name_len, sizeof(name))};
+  }
+  std::string_view Name2() const {
+    size_t start = Name().size();
+    return {
+      name + start, std::min<size_t>(name2_len, sizeof(name) - start)};
+  }
+};
+static_assert(sizeof(TraceRecord) == 128);
+
+// A trace file, read back.
+struct TraceFile {
+  TraceFileHeader header;
+  std::vector<TraceRecord> records;
+  // What followed the last whole record, e.g. if the trace was cut off
+  // mid-write by a crash.
+  size_t trailing_bytes = 0;
+};
+
+// Fails if `fd` isn't a trace file of this version.
+absl::StatusOr<TraceFile> ReadTraceFile(int fd);
+
+// Starts tracing a request, or returns nullopt if it won't be traced. Called
+// by FuseRequest, which fills in what it replied with and passes the record to
+// TraceEnd once it has replied.
+//
+// Cheap when tracing is off: a relaxed atomic load.
+std::optional<TraceRecord> TraceBegin(const OpInfo &info);
+void TraceEnd(TraceRecord &record, int error);
+
+// Drains the per-thread ring buffers TraceEnd writes to into a trace file,
+// on a dedicated thread.
+//
+// Request threads never block on the drainer. If a thread's ring fills up
+// its records are dropped, and the drop is itself recorded.
+//
+// Only one Tracer may exist at a time.
+class Tracer {
+ public:
+  struct Options {
+    TraceLevel level = TraceLevel::kAll;
+    // Record only every Nth successful request on each thread.
+    uint32_t sample_every = 1;
+    // How often the ring buffers are drained.
+    absl::Duration flush_interval = absl::Milliseconds(100);
+  };
+
+  // Writes the trace to `out`, starting immediately.
+  static absl::StatusOr<std::unique_ptr<Tracer>> Create(
+      FileDescriptor out, Options opts);
+
+  // Stops tracing and writes out whatever is left in the ring buffers.
+  ~Tracer();
+
+  Tracer(Tracer &&) = delete;
+  Tracer(const Tracer &) = delete;
+  Tracer &operator=(Tracer &&) = delete;
+  Tracer &operator=(const Tracer &) = delete;
+
+  // Both take effect immediately, from any thread.
+  void SetLevel(TraceLevel level);
+  TraceLevel GetLevel() const;
+  void SetSampleEvery(uint32_t n);
+
+  // Installs a handler for `signo` that switches tracing off, or back on to
+  // the level it had before. Lets tracing be left configured but off until
+  // needed.
+  static absl::Status ToggleOnSignal(int signo);
+
+ private:
+  Tracer(FileDescriptor out, absl::Duration flush_interval);
+
+  void Run();
+  absl::Status Drain();
+  absl::Status Write(const void *buf, size_t size);
+
+  FileDescriptor out_;
+  const absl::Duration flush_interval_;
+
+  absl::Mutex mu_;
+  bool stopping_ ABSL_GUARDED_BY(mu_) = false;
+
+  // Only touched by the drainer thread, then by the destructor once it has
+  // been joined.
+  std::vector<TraceRecord> buf_;
+
+  std::thread thread_;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_TRACE_H_
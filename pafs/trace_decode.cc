@@ -0,0 +1,96 @@
+// Prints a trace file written by Tracer (see --trace_file) as text, one
+// request per line.
+
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/log/initialize.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+#include "pafs/fd.h"
+#include "pafs/op.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+#include "pafs/trace.h"
+
+namespace pafs {
+namespace {
+
+std::string FormatRecord(
+    const TraceRecord &record, const TraceFileHeader &header) {
+  absl::Time start = absl::FromUnixNanos(
+      static_cast<int64_t>(header.realtime_ns) +
+      (static_cast<int64_t>(record.start_ns) -
+       static_cast<int64_t>(header.monotonic_ns)));
+  std::string line = absl::StrCat(
+      absl::FormatTime("%Y-%m-%d %H:%M:%E6S", start, absl::LocalTimeZone()),
+      " ", record.tid, " ");
+  if (record.flags & TraceRecord::kDropped) {
+    absl::StrAppend(&line, "dropped ", record.arg0, " records");
+    return line;
+  }
+
+  absl::StrAppendFormat(
+      &line, "%s ino:%#x", OpName(record.op), record.ino);
+  if (record.name_len > 0) {
+    absl::StrAppend(&line, ", name:", record.Name());
+    if (record.name2_len > 0) absl::StrAppend(&line, ",", record.Name2());
+    if (record.flags & TraceRecord::kNameTruncated) {
+      absl::StrAppend(&line, "...");
+    }
+  }
+  if (record.arg0 != 0 || record.arg1 != 0) {
+    absl::StrAppend(&line, ", args:", record.arg0, ",", record.arg1);
+  }
+  if (record.fh != 0) absl::StrAppendFormat(&line, ", fh:%#x", record.fh);
+  if (record.entry_ino != 0) {
+    absl::StrAppendFormat(&line, ", entry:%#x", record.entry_ino);
+  }
+  absl::StrAppend(
+      &line, " -> ", ErrnoToErrorName(record.error), " in ",
+      absl::FormatDuration(absl::Nanoseconds(record.duration_ns)));
+  return line;
+}
+
+absl::StatusOr<int> Main(int argc, char *argv[]) {
+  absl::SetProgramUsageMessage("trace_file");
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  absl::InitializeLog();
+  if (args.size() != 2) {
+    std::cerr << "usage: " << args[0] << " trace_file" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  ASSIGN_OR_RETURN(
+      FileDescriptor fd, syscalls::open(args[1], O_RDONLY | O_CLOEXEC));
+  ASSIGN_OR_RETURN(TraceFile trace, ReadTraceFile(*fd));
+  for (const TraceRecord &record : trace.records) {
+    std::cout << FormatRecord(record, trace.header) << "\n";
+  }
+  if (trace.trailing_bytes != 0) {
+    std::cerr << "Ignoring " << trace.trailing_bytes << " trailing bytes"
+              << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
+
+}  // namespace
+}  // namespace pafs
+
+int main(int argc, char *argv[]) {
+  absl::StatusOr<int> ret = pafs::Main(argc, argv);
+  if (!ret.ok()) {
+    std::cerr << ret.status() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return *ret;
+}
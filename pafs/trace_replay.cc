@@ -0,0 +1,406 @@
+// Replays a trace file written by Tracer (see --trace_file) against a fresh
+// PageAlignFS, through a FuseHarness, and reports how long it took.
+//
+// --source should hold the tree the traced mount started from, e.g. a copy
+// of it, since the trace is replayed against it. The trace must have been
+// recorded with --trace_level=all and --trace_sample_every=1, or requests on
+// inodes that weren't traced being looked up are skipped.
+//
+// By default requests are sent as fast as possible. With --open_loop each is
+// sent when it arrived in the trace, however far behind replay has fallen, and
+// its latency counts from then.
+
+#ifndef FUSE_USE_VERSION
+// Needed by fuse/fuse_lowlevel.h
+#define FUSE_USE_VERSION 312
+#elif FUSE_USE_VERSION != 312
+#error this file is written for fuse 3.12
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/log/initialize.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "fuse/fuse_kernel.h"
+#include "fuse/fuse_lowlevel.h"
+#include "pafs/fd.h"
+#include "pafs/fuse.h"
+#include "pafs/fuse_harness.h"
+#include "pafs/fuse_ops.h"
+#include "pafs/op.h"
+#include "pafs/page_align_fs.h"
+#include "pafs/stats.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+#include "pafs/trace.h"
+#include "pafs/util.h"
+
+ABSL_FLAG(std::string, source, "", "The directory to serve while replaying. Required.");
+ABSL_FLAG(bool, open_loop, false, "Send each request when it arrived in the trace, rather than as soon as the last was replied to.");
+ABSL_FLAG(double, speed, 1.0, "With --open_loop, replay this many times faster than the trace was recorded.");
+
+namespace pafs {
+namespace {
+
+void SleepUntil(uint64_t monotonic_ns) {
+  struct timespec ts = {
+    .tv_sec = static_cast<time_t>(monotonic_ns / 1'000'000'000),
+    .tv_nsec = static_cast<long>(monotonic_ns % 1'000'000'000),
+  };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) != 0) {
+  }
+}
+
+void Add(OpStats::Histogram &h, uint64_t ns) {
+  h.count++;
+  h.total_ns += ns;
+  h.max_ns = std::max(h.max_ns, ns);
+  h.buckets[OpStats::Bucket(ns)]++;
+}
+
+// Sends traced requests to a FuseHarness, translating the traced process's
+// inodes and file handles to the replaying one's as replies introduce them.
+class Replayer {
+ public:
+  enum class Result {
+    kReplayed,
+    // An op, or a use of one, that replay doesn't support.
+    kUnsupported,
+    // On an inode or file handle that replay hasn't seen created, e.g. because
+    // creating it failed or wasn't traced.
+    kUnknown,
+    kNameTruncated,
+  };
+
+  explicit Replayer(FuseHarness &harness) : harness_(harness) {
+    inodes_[FUSE_ROOT_ID] = FUSE_ROOT_ID;
+  }
+
+  // Replays `record`. `error` is set to what it was replied with.
+  absl::StatusOr<Result> Replay(const TraceRecord &record, int &error);
+
+ private:
+  absl::StatusOr<Result> Send(
+      const TraceRecord &record, FuseHarness::Reply &reply);
+
+  // Maps the inode and file handle replied with, if any.
+  void Learn(const TraceRecord &record, const FuseHarness::Reply &reply);
+
+  FuseHarness &harness_;
+  absl::flat_hash_map<uint64_t, uint64_t> inodes_;
+  absl::flat_hash_map<uint64_t, uint64_t> fhs_;
+  // Written by Write requests.
+  std::string zeros_;
+};
+
+absl::StatusOr<Replayer::Result> Replayer::Replay(
+    const TraceRecord &record, int &error) {
+  if (record.flags & TraceRecord::kNameTruncated) {
+    return Result::kNameTruncated;
+  }
+  FuseHarness::Reply reply;
+  ASSIGN_OR_RETURN(Result result, Send(record, reply));
+  if (result != Result::kReplayed) return result;
+  error = reply.error;
+  if (reply.error == 0) Learn(record, reply);
+  return result;
+}
+
+absl::StatusOr<Replayer::Result> Replayer::Send(
+    const TraceRecord &record, FuseHarness::Reply &reply) {
+  auto ino = inodes_.find(record.ino);
+  if (ino == inodes_.end()) return Result::kUnknown;
+  uint64_t nodeid = ino->second;
+  uint64_t fh = 0;
+  if (record.fh != 0 && record.op != Op::kOpen &&
+      record.op != Op::kOpenDir && record.op != Op::kCreate) {
+    auto it = fhs_.find(record.fh);
+    if (it == fhs_.end()) return Result::kUnknown;
+    fh = it->second;
+  }
+
+  switch (record.op) {
+    case Op::kLookup:
+      ASSIGN_OR_RETURN(reply, harness_.Lookup(nodeid, record.Name()));
+      break;
+    case Op::kForget:
+      RETURN_IF_ERROR(harness_.Forget(nodeid, record.arg0));
+      break;
+    case Op::kGetAttr:
+      ASSIGN_OR_RETURN(reply, harness_.GetAttr(nodeid));
+      break;
+    case Op::kSetAttr: {
+      // Only the size is traced, so set times to now instead of to what
+      // they were set to, and leave everything else.
+      fuse_setattr_in in = {};
+      if (record.arg0 & FUSE_SET_ATTR_SIZE) {
+        in.valid |= FATTR_SIZE;
+        in.size = record.arg1;
+      }
+      if (record.arg0 & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_ATIME_NOW)) {
+        in.valid |= FATTR_ATIME | FATTR_ATIME_NOW;
+      }
+      if (record.arg0 & (FUSE_SET_ATTR_MTIME | FUSE_SET_ATTR_MTIME_NOW)) {
+        in.valid |= FATTR_MTIME | FATTR_MTIME_NOW;
+      }
+      if (in.valid == 0) return Result::kUnsupported;
+      if (fh != 0) {
+        in.valid |= FATTR_FH;
+        in.fh = fh;
+      }
+      ASSIGN_OR_RETURN(reply, harness_.SetAttr(nodeid, in));
+      break;
+    }
+    case Op::kReadLink:
+      ASSIGN_OR_RETURN(reply, harness_.ReadLink(nodeid));
+      break;
+    case Op::kMknod:
+      ASSIGN_OR_RETURN(
+          reply,
+          harness_.Mknod(nodeid, record.Name(), record.arg0, record.arg1));
+      break;
+    case Op::kMkdir:
+      ASSIGN_OR_RETURN(
+          reply, harness_.Mkdir(nodeid, record.Name(), record.arg0));
+      break;
+    case Op::kUnlink:
+      ASSIGN_OR_RETURN(reply, harness_.Unlink(nodeid, record.Name()));
+      break;
+    case Op::kRmdir:
+      ASSIGN_OR_RETURN(reply, harness_.Rmdir(nodeid, record.Name()));
+      break;
+    case Op::kSymlink:
+      ASSIGN_OR_RETURN(
+          reply, harness_.Symlink(nodeid, record.Name(), record.Name2()));
+      break;
+    case Op::kRename: {
+      auto newparent = inodes_.find(record.arg0);
+      if (newparent == inodes_.end()) return Result::kUnknown;
+      ASSIGN_OR_RETURN(
+          reply,
+          harness_.Rename(
+            nodeid, record.Name(), newparent->second, record.Name2(),
+            record.arg1));
+      break;
+    }
+    case Op::kLink: {
+      auto newparent = inodes_.find(record.arg0);
+      if (newparent == inodes_.end()) return Result::kUnknown;
+      ASSIGN_OR_RETURN(
+          reply, harness_.Link(nodeid, newparent->second, record.Name()));
+      break;
+    }
+    case Op::kOpen:
+      ASSIGN_OR_RETURN(reply, harness_.Open(nodeid, record.arg0));
+      break;
+    case Op::kRead:
+      ASSIGN_OR_RETURN(
+          reply, harness_.Read(nodeid, fh, record.arg0, record.arg1));
+      break;
+    case Op::kWrite:
+    case Op::kWriteBuf:
+      if (zeros_.size() < record.arg1) zeros_.resize(record.arg1);
+      ASSIGN_OR_RETURN(
+          reply,
+          harness_.Write(
+            nodeid, fh, record.arg0,
+            std::span<const char>(zeros_).first(record.arg1)));
+      break;
+    case Op::kFlush:
+      ASSIGN_OR_RETURN(reply, harness_.Flush(nodeid, fh));
+      break;
+    case Op::kRelease:
+      ASSIGN_OR_RETURN(reply, harness_.Release(nodeid, fh));
+      fhs_.erase(record.fh);
+      break;
+    case Op::kFSync:
+      ASSIGN_OR_RETURN(reply, harness_.FSync(nodeid, fh, record.arg0 != 0));
+      break;
+    case Op::kOpenDir:
+      ASSIGN_OR_RETURN(reply, harness_.OpenDir(nodeid));
+      break;
+    case Op::kReadDir:
+    case Op::kReadDirPlus:
+      ASSIGN_OR_RETURN(
+          reply,
+          harness_.ReadDir(
+            nodeid, fh, record.arg0, record.arg1,
+            record.op == Op::kReadDirPlus));
+      break;
+    case Op::kReleaseDir:
+      ASSIGN_OR_RETURN(reply, harness_.ReleaseDir(nodeid, fh));
+      fhs_.erase(record.fh);
+      break;
+    case Op::kFSyncDir:
+      ASSIGN_OR_RETURN(
+          reply, harness_.FSyncDir(nodeid, fh, record.arg0 != 0));
+      break;
+    case Op::kStatFS:
+      ASSIGN_OR_RETURN(reply, harness_.StatFS(nodeid));
+      break;
+    case Op::kGetXAttr:
+      ASSIGN_OR_RETURN(
+          reply, harness_.GetXAttr(nodeid, record.Name(), record.arg0));
+      break;
+    case Op::kListXAttr:
+      ASSIGN_OR_RETURN(reply, harness_.ListXAttr(nodeid, record.arg0));
+      break;
+    case Op::kAccess:
+      ASSIGN_OR_RETURN(reply, harness_.Access(nodeid, record.arg0));
+      break;
+    case Op::kCreate:
+      ASSIGN_OR_RETURN(
+          reply,
+          harness_.CreateFile(
+            nodeid, record.Name(), record.arg1, record.arg0));
+      break;
+    default:
+      return Result::kUnsupported;
+  }
+  return Result::kReplayed;
+}
+
+void Replayer::Learn(
+    const TraceRecord &record, const FuseHarness::Reply &reply) {
+  if (record.entry_ino != 0) {
+    if (auto entry = reply.As<fuse_entry_out>(); entry.has_value()) {
+      inodes_[record.entry_ino] = entry->nodeid;
+    }
+  }
+  if (record.fh == 0) return;
+  std::optional<fuse_open_out> open;
+  switch (record.op) {
+    case Op::kOpen:
+    case Op::kOpenDir:
+      open = reply.As<fuse_open_out>();
+      break;
+    case Op::kCreate:
+      open = reply.As<fuse_open_out>(sizeof(fuse_entry_out));
+      break;
+    default:
+      return;
+  }
+  if (open.has_value()) fhs_[record.fh] = open->fh;
+}
+
+std::string FormatLatency(const OpStats::Histogram &h) {
+  if (h.count == 0) return "none";
+  auto us = [](uint64_t ns) { return ns / 1000.0; };
+  return absl::StrFormat(
+      "mean %.1fus, p50 %.1fus, p90 %.1fus, p99 %.1fus, max %.1fus",
+      us(h.total_ns / h.count), us(h.Quantile(0.5)), us(h.Quantile(0.9)),
+      us(h.Quantile(0.99)), us(h.max_ns));
+}
+
+absl::StatusOr<int> Main(int argc, char *argv[]) {
+  absl::SetProgramUsageMessage("--source=<dir> [flags] trace_file");
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  absl::InitializeLog();
+  std::string source = absl::GetFlag(FLAGS_source);
+  if (args.size() != 2 || source.empty()) {
+    std::cerr << "usage: " << args[0] << " --source=<dir> trace_file"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  const bool open_loop = absl::GetFlag(FLAGS_open_loop);
+  const double speed = absl::GetFlag(FLAGS_speed);
+  if (speed <= 0) return absl::InvalidArgumentError("--speed must be > 0");
+
+  ASSIGN_OR_RETURN(
+      FileDescriptor fd, syscalls::open(args[1], O_RDONLY | O_CLOEXEC));
+  ASSIGN_OR_RETURN(TraceFile trace, ReadTraceFile(*fd));
+  uint64_t dropped = 0;
+  std::erase_if(trace.records, [&dropped](const TraceRecord &record) {
+    if (!(record.flags & TraceRecord::kDropped)) return false;
+    dropped += record.arg0;
+    return true;
+  });
+  // Each thread's records are written out together, so interleave them back
+  // into the order they arrived in.
+  std::stable_sort(
+      trace.records.begin(), trace.records.end(),
+      [](const TraceRecord &a, const TraceRecord &b) {
+        return a.start_ns < b.start_ns;
+      });
+
+  // Timed by FuseRequest, as when mounted.
+  std::unique_ptr<OpStats> op_stats = OpStats::Create();
+  absl::StatusOr<PageAlignFS> fs = PageAlignFS::Create(source, {});
+  RETURN_IF_ERROR(fs.status());
+  ASSIGN_OR_RETURN(
+      std::unique_ptr<FuseHarness> harness,
+      FuseHarness::Create(AsFuseLowLevelOps<PageAlignFS>(), &*fs));
+  fs->SetSession(harness->GetSession());
+  RETURN_IF_ERROR(harness->Init().status());
+
+  Replayer replayer(*harness);
+  uint64_t counts[4] = {};
+  uint64_t mismatched = 0;
+  OpStats::Histogram latency;
+  const uint64_t trace_start =
+    trace.records.empty() ? 0 : trace.records.front().start_ns;
+  const uint64_t start = MonotonicNanos();
+  for (const TraceRecord &record : trace.records) {
+    uint64_t sent = MonotonicNanos();
+    if (open_loop) {
+      uint64_t due =
+        start + static_cast<uint64_t>((record.start_ns - trace_start) / speed);
+      if (due > sent) SleepUntil(due);
+      sent = due;
+    }
+    int error = 0;
+    ASSIGN_OR_RETURN(Replayer::Result result, replayer.Replay(record, error));
+    counts[static_cast<int>(result)]++;
+    if (result != Replayer::Result::kReplayed) continue;
+    Add(latency, MonotonicNanos() - sent);
+    if (error != record.error) mismatched++;
+  }
+  const uint64_t elapsed = MonotonicNanos() - start;
+
+  using Result = Replayer::Result;
+  uint64_t replayed = counts[static_cast<int>(Result::kReplayed)];
+  std::cout << absl::StrFormat(
+      "Replayed %d of %d requests in %.3fs (%.0f/s)%s\n",
+      replayed, trace.records.size(), elapsed / 1e9,
+      elapsed == 0 ? 0.0 : replayed / (elapsed / 1e9),
+      open_loop ? absl::StrFormat(", open loop at %gx", speed) : "");
+  std::cout << absl::StrFormat(
+      "Skipped: %d unsupported, %d on unknown inodes or handles, %d with "
+      "truncated names; %d dropped from the trace\n",
+      counts[static_cast<int>(Result::kUnsupported)],
+      counts[static_cast<int>(Result::kUnknown)],
+      counts[static_cast<int>(Result::kNameTruncated)], dropped);
+  std::cout << absl::StrFormat(
+      "%d replies differed in error from the trace\n", mismatched);
+  std::cout << "Latency: " << FormatLatency(latency) << "\n\n";
+  std::cout << op_stats->Format();
+  return EXIT_SUCCESS;
+}
+
+}  // namespace
+}  // namespace pafs
+
+int main(int argc, char *argv[]) {
+  absl::StatusOr<int> ret = pafs::Main(argc, argv);
+  if (!ret.ok()) {
+    std::cerr << ret.status() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return *ret;
+}
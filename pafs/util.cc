@@ -0,0 +1,38 @@
+#include "pafs/util.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "pafs/status.h"
+
+namespace pafs {
+
+uint64_t MonotonicNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+absl::StatusOr<std::string> ReadFile(CStringView path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return ErrnoToStatus(errno, absl::StrCat("open(", path.c_str(), ")"));
+  absl::Cleanup closer = [fd]() { close(fd); };
+  std::string contents;
+  char buf[4096];
+  while (true) {
+    const ssize_t nb = read(fd, buf, sizeof(buf));
+    if (nb < 0 && errno == EINTR) continue;
+    if (nb < 0) return ErrnoToStatus(errno, absl::StrCat("read(", path.c_str(), ")"));
+    if (nb == 0) return contents;
+    contents.append(buf, nb);
+  }
+}
+
+}  // namespace pafs
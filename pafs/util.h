@@ -0,0 +1,22 @@
+#ifndef PAFS_UTIL_H_
+#define PAFS_UTIL_H_
+
+#include <cstdint>
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "pafs/cstring_view.h"
+
+namespace pafs {
+
+// CLOCK_MONOTONIC, in nanoseconds.
+uint64_t MonotonicNanos();
+
+// All of `path`, e.g. a config file or one under /proc or /sys. Calls libc
+// directly rather than through syscalls, which depends on this, so its calls
+// aren't counted by SyscallStats.
+absl::StatusOr<std::string> ReadFile(CStringView path);
+
+}  // namespace pafs
+
+#endif  // PAFS_UTIL_H_
@@ -0,0 +1,247 @@
+#include "pafs/worker_loop.h"
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "pafs/numa.h"
+#include "pafs/request_scheduler.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+#include "pafs/tenant_throttle.h"
+#include "pafs/worker_stats.h"
+
+namespace pafs {
+namespace {
+
+// Interrupts a worker blocked reading /dev/fuse once the session has exited.
+// Signals exit the session through libfuse's handler, but only interrupt the
+// read of whichever thread they're delivered to.
+void IgnoreWakeup(int) {}
+
+absl::Status InstallWakeupHandler() {
+  struct sigaction act = {};
+  act.sa_handler = IgnoreWakeup;
+  // No SA_RESTART, so that the read fails with EINTR.
+  act.sa_flags = 0;
+  sigemptyset(&act.sa_mask);
+  return syscalls::sigaction(SIGRTMIN, &act);
+}
+
+// Handles a request once TenantThrottle has let it through.
+void Handle(fuse_session *se, RequestScheduler *scheduler, fuse_buf &buf) {
+  if (scheduler == nullptr) {
+    fuse_session_process_buf(se, &buf);
+    return;
+  }
+  switch (scheduler->Admit(buf)) {
+    case RequestScheduler::Admission::kMetadata:
+      fuse_session_process_buf(se, &buf);
+      break;
+    case RequestScheduler::Admission::kData:
+      fuse_session_process_buf(se, &buf);
+      // Queued data requests go ahead of reading more.
+      while (std::optional<fuse_buf> next = scheduler->Next()) {
+        absl::Cleanup free_next = [&next]() { std::free(next->mem); };
+        WorkerStats::Received();
+        fuse_session_process_buf(se, &*next);
+      }
+      break;
+    case RequestScheduler::Admission::kQueued:
+      break;
+  }
+}
+
+// Handles deferred requests as they come within their limits, so that they
+// don't wait for a worker to finish another request when all are idle.
+void RunThrottleDispatcher(
+    fuse_session *se, RequestScheduler *scheduler, TenantThrottle &throttle) {
+  while (!fuse_session_exited(se)) {
+    std::optional<fuse_buf> next =
+      throttle.WaitForNext(absl::Milliseconds(100));
+    if (!next.has_value()) continue;
+    absl::Cleanup free_next = [&next]() { std::free(next->mem); };
+    WorkerStats::Received();
+    Handle(se, scheduler, *next);
+  }
+}
+
+class Worker {
+ public:
+  // Placed on `node`, if set, else pinned to `cpu`, if set.
+  Worker(
+      fuse_session *se, std::optional<int> cpu, const NumaNode *node,
+      RequestScheduler *scheduler, TenantThrottle *throttle)
+    : se_(se), cpu_(cpu), node_(node), scheduler_(scheduler),
+      throttle_(throttle) {}
+
+  void Start() { thread_ = std::thread([this]() { Run(); }); }
+
+  bool Done() const { return done_.load(std::memory_order_acquire); }
+
+  // Until the thread has left its loop.
+  absl::Status Wake() {
+    if (Done()) return absl::OkStatus();
+    return syscalls::pthread_kill(thread_.native_handle(), SIGRTMIN);
+  }
+
+  void Join() { thread_.join(); }
+
+  // Why the worker stopped, if not because the session exited or was
+  // unmounted.
+  const absl::Status &GetStatus() const { return status_; }
+
+ private:
+  void Run() {
+    absl::Cleanup done = [this]() {
+      done_.store(true, std::memory_order_release);
+    };
+    if (node_ != nullptr) {
+      if (absl::Status st = PlaceThreadOnNode(*node_); !st.ok()) {
+        LOG(WARNING)
+          << "Not placing worker on NUMA node " << node_->id << ": " << st;
+      }
+    } else if (cpu_.has_value()) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(*cpu_, &cpus);
+      if (absl::Status st = syscalls::pthread_setaffinity_np(
+            pthread_self(), cpus);
+          !st.ok()) {
+        LOG(WARNING) << "Not pinning worker to CPU " << *cpu_ << ": " << st;
+      }
+    }
+
+    fuse_buf buf = {};
+    absl::Cleanup free_buf = [&buf]() { std::free(buf.mem); };
+    while (!fuse_session_exited(se_)) {
+      // Returns 0, having exited the session, once it's unmounted.
+      int res = fuse_session_receive_buf(se_, &buf);
+      if (res == -EINTR) continue;
+      if (res < 0) {
+        status_ = ErrnoToStatus(-res, "fuse_session_receive_buf");
+        fuse_session_exit(se_);
+      }
+      if (res <= 0) break;
+      WorkerStats::Received();
+      Process(buf);
+    }
+  }
+
+  void Process(fuse_buf &buf) {
+    if (throttle_ == nullptr) {
+      Handle(se_, scheduler_, buf);
+      return;
+    }
+    if (throttle_->Admit(buf) == TenantThrottle::Admission::kNow) {
+      Handle(se_, scheduler_, buf);
+    }
+    // Deferred requests that are now within their limits go ahead of reading
+    // more.
+    while (std::optional<fuse_buf> next = throttle_->Next()) {
+      absl::Cleanup free_next = [&next]() { std::free(next->mem); };
+      WorkerStats::Received();
+      Handle(se_, scheduler_, *next);
+    }
+  }
+
+  fuse_session *const se_;
+  const std::optional<int> cpu_;
+  const NumaNode *const node_;
+  RequestScheduler *const scheduler_;
+  TenantThrottle *const throttle_;
+  std::atomic<bool> done_ = false;
+  // Only touched by the thread, then by the caller once it's joined.
+  absl::Status status_;
+  std::thread thread_;
+};
+
+}  // namespace
+
+absl::Status RunWorkerLoop(fuse_session *se, const WorkerLoopOptions &opts) {
+  if (opts.threads == 0) {
+    return absl::InvalidArgumentError("RunWorkerLoop needs a thread");
+  }
+  std::vector<NumaNode> nodes;
+  if (opts.numa) {
+    ASSIGN_OR_RETURN(nodes, ReadNumaTopology());
+    if (!opts.cpus.empty()) {
+      // Only the given CPUs, and only nodes that have some of them.
+      absl::flat_hash_set<int> allowed(opts.cpus.begin(), opts.cpus.end());
+      for (NumaNode &node : nodes) {
+        std::erase_if(
+            node.cpus, [&allowed](int cpu) { return !allowed.contains(cpu); });
+      }
+      std::erase_if(
+          nodes, [](const NumaNode &node) { return node.cpus.empty(); });
+      if (nodes.empty()) {
+        return absl::InvalidArgumentError("No NUMA node has any of the CPUs");
+      }
+    }
+  }
+  RETURN_IF_ERROR(InstallWakeupHandler());
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (size_t i = 0; i < opts.threads; i++) {
+    std::optional<int> cpu;
+    if (!opts.cpus.empty()) cpu = opts.cpus[i % opts.cpus.size()];
+    const NumaNode *node = nodes.empty() ? nullptr : &nodes[i % nodes.size()];
+    workers.push_back(
+        std::make_unique<Worker>(
+          se, cpu, node, opts.scheduler, opts.throttle));
+    workers.back()->Start();
+  }
+  std::thread dispatcher;
+  if (opts.throttle != nullptr) {
+    dispatcher = std::thread(
+        RunThrottleDispatcher, se, opts.scheduler, std::ref(*opts.throttle));
+  }
+
+  // libfuse's signal handler exits the session without telling anyone, so
+  // poll for it.
+  while (!fuse_session_exited(se)) absl::SleepFor(absl::Milliseconds(100));
+
+  // A worker may check for exit just before its read, so keep waking the
+  // stragglers until they've all left.
+  while (true) {
+    bool all_done = true;
+    for (const std::unique_ptr<Worker> &worker : workers) {
+      if (worker->Done()) continue;
+      all_done = false;
+      if (absl::Status st = worker->Wake(); !st.ok()) {
+        LOG(ERROR) << "Failed to wake worker: " << st;
+      }
+    }
+    if (all_done) break;
+    absl::SleepFor(absl::Milliseconds(10));
+  }
+
+  // Leaves within 100ms of the session exiting.
+  if (dispatcher.joinable()) dispatcher.join();
+
+  absl::Status status;
+  for (const std::unique_ptr<Worker> &worker : workers) {
+    worker->Join();
+    if (status.ok()) status = worker->GetStatus();
+  }
+  return status;
+}
+
+}  // namespace pafs
@@ -0,0 +1,52 @@
+#ifndef PAFS_WORKER_LOOP_H_
+#define PAFS_WORKER_LOOP_H_
+
+#ifndef FUSE_USE_VERSION
+// Needed by fuse/fuse_lowlevel.h
+#define FUSE_USE_VERSION 312
+#elif FUSE_USE_VERSION != 312
+#error this file is written for fuse 3.12
+#endif
+
+#include <cstddef>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "fuse/fuse_lowlevel.h"
+#include "pafs/request_scheduler.h"
+#include "pafs/tenant_throttle.h"
+
+namespace pafs {
+
+struct WorkerLoopOptions {
+  // Started up front and kept until the session exits, unlike
+  // fuse_session_loop_mt's, which come and go with load. Thread-local state,
+  // like RequestArena, then stays warm.
+  size_t threads = 1;
+  // Thread i is pinned to cpus[i % cpus.size()]. Empty leaves threads
+  // unpinned.
+  std::vector<int> cpus;
+  // Spreads threads across NUMA nodes: each is pinned to one node's CPUs,
+  // those of them in `cpus` if it's set, and allocates from its memory.
+  bool numa = false;
+  // If set, limits how many threads handle data requests at once, see
+  // RequestScheduler. Must outlive the loop.
+  RequestScheduler *scheduler = nullptr;
+  // If set, defers requests over their tenants' limits, see TenantThrottle.
+  // Workers take those that come within their limits before reading more,
+  // and a thread of their own takes them while the workers are idle. Must
+  // outlive the loop.
+  TenantThrottle *throttle = nullptr;
+};
+
+// Serves `se` until it exits, like fuse_session_loop_mt, on a fixed pool of
+// threads. Each reads requests from the session's /dev/fuse descriptor and
+// handles them itself, and tells WorkerStats when it has read one.
+//
+// Must be called after fuse_set_signal_handlers, so that a signal exits the
+// session.
+absl::Status RunWorkerLoop(fuse_session *se, const WorkerLoopOptions &opts);
+
+}  // namespace pafs
+
+#endif  // PAFS_WORKER_LOOP_H_
@@ -0,0 +1,259 @@
+#include "pafs/worker_stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <fcntl.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+#include "pafs/util.h"
+
+namespace pafs {
+namespace {
+
+std::atomic<WorkerStats *> current = nullptr;
+
+// Undoes the octal escapes of spaces, tabs, newlines and backslashes in
+// /proc/self/mountinfo.
+std::string UnescapeMountPath(std::string_view path) {
+  std::string out;
+  for (size_t i = 0; i < path.size(); i++) {
+    unsigned c;
+    if (path[i] == '\\' && i + 3 < path.size() &&
+        std::from_chars(
+          path.data() + i + 1, path.data() + i + 4, c, 8).ptr ==
+        path.data() + i + 4) {
+      out.push_back(static_cast<char>(c));
+      i += 3;
+    } else {
+      out.push_back(path[i]);
+    }
+  }
+  return out;
+}
+
+}  // namespace
+
+struct WorkerStats::WorkerThread {
+  ~WorkerThread() {
+    if (!started) return;
+    if (WorkerStats *stats = current.load(std::memory_order_acquire)) {
+      stats->exited_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  bool started = false;
+  // When Received was last called, or 0.
+  uint64_t received_ns = 0;
+};
+
+thread_local WorkerStats::WorkerThread WorkerStats::worker_thread_;
+
+void WorkerStats::Sample::Add(int64_t value) {
+  count++;
+  last = value;
+  max = std::max(max, value);
+  total += value;
+}
+
+std::unique_ptr<WorkerStats> WorkerStats::Create(Options opts) {
+  std::optional<FileDescriptor> waiting_fd;
+  if (opts.waiting_file.has_value()) {
+    // e.g. fusectl isn't mounted. Not worth failing the mount over.
+    absl::StatusOr<FileDescriptor> fd =
+      syscalls::open(opts.waiting_file->c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd.ok()) {
+      waiting_fd = *std::move(fd);
+    } else {
+      LOG(WARNING) << "Not sampling the kernel's queue: " << fd.status();
+    }
+  }
+  auto stats = std::unique_ptr<WorkerStats>(
+      new WorkerStats(std::move(waiting_fd), opts.sample_interval));
+  WorkerStats *expected = nullptr;
+  CHECK(current.compare_exchange_strong(expected, stats.get()))
+    << "Only one WorkerStats may exist";
+  stats->thread_ = std::thread([s = stats.get()]() { s->Run(); });
+  return stats;
+}
+
+WorkerStats::WorkerStats(
+    std::optional<FileDescriptor> waiting_fd, absl::Duration interval)
+  : waiting_fd_(std::move(waiting_fd)), interval_(interval) {}
+
+WorkerStats::~WorkerStats() {
+  {
+    absl::MutexLock lock(&mu_);
+    stopping_ = true;
+  }
+  if (thread_.joinable()) thread_.join();
+  current.store(nullptr);
+}
+
+absl::StatusOr<std::string> WorkerStats::FindWaitingFile(
+    CStringView mountpoint) {
+  ASSIGN_OR_RETURN(std::string mountinfo, ReadFile("/proc/self/mountinfo"));
+  // Filesystems mounted over the same point are listed in the order they
+  // were mounted, so the last one is on top.
+  std::optional<std::string> waiting;
+  for (std::string_view line : absl::StrSplit(mountinfo, '\n')) {
+    // ID PARENT MAJOR:MINOR ROOT MOUNTPOINT OPTIONS [OPTIONAL...] - FSTYPE ...
+    std::vector<std::string_view> fields = absl::StrSplit(line, ' ');
+    if (fields.size() < 5 ||
+        UnescapeMountPath(fields[4]) != mountpoint.c_str()) {
+      continue;
+    }
+    auto sep = std::find(fields.begin() + 5, fields.end(), "-");
+    if (sep == fields.end() || sep + 1 == fields.end() ||
+        !absl::StartsWith(*(sep + 1), "fuse")) {
+      continue;
+    }
+    std::pair<std::string_view, std::string_view> dev =
+      absl::StrSplit(fields[2], ':');
+    unsigned major, minor;
+    if (!absl::SimpleAtoi(dev.first, &major) ||
+        !absl::SimpleAtoi(dev.second, &minor)) {
+      continue;
+    }
+    // Connections are named by the kernel's encoding of their device number.
+    waiting = absl::StrCat(
+        "/sys/fs/fuse/connections/", (major << 20) | minor, "/waiting");
+  }
+  if (!waiting.has_value()) {
+    return absl::NotFoundError(
+        absl::StrCat("No FUSE filesystem is mounted at ", mountpoint.c_str()));
+  }
+  return *std::move(waiting);
+}
+
+void WorkerStats::BeginRequest() {
+  WorkerStats *stats = current.load(std::memory_order_acquire);
+  if (stats == nullptr) return;
+  if (!worker_thread_.started) {
+    worker_thread_.started = true;
+    stats->started_.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (uint64_t received = std::exchange(worker_thread_.received_ns, 0);
+      received != 0) {
+    uint64_t delay = MonotonicNanos() - received;
+    stats->dispatched_.fetch_add(1, std::memory_order_relaxed);
+    stats->dispatch_total_ns_.fetch_add(delay, std::memory_order_relaxed);
+    uint64_t max = stats->dispatch_max_ns_.load(std::memory_order_relaxed);
+    while (delay > max &&
+           !stats->dispatch_max_ns_.compare_exchange_weak(
+             max, delay, std::memory_order_relaxed)) {}
+  }
+  int64_t busy = stats->busy_.fetch_add(1, std::memory_order_relaxed) + 1;
+  int64_t peak = stats->peak_busy_.load(std::memory_order_relaxed);
+  while (busy > peak &&
+         !stats->peak_busy_.compare_exchange_weak(
+           peak, busy, std::memory_order_relaxed)) {}
+}
+
+void WorkerStats::Received() {
+  if (current.load(std::memory_order_relaxed) == nullptr) return;
+  worker_thread_.received_ns = MonotonicNanos();
+}
+
+void WorkerStats::EndRequest() {
+  WorkerStats *stats = current.load(std::memory_order_acquire);
+  if (stats == nullptr) return;
+  stats->busy_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void WorkerStats::Run() {
+  absl::MutexLock lock(&mu_);
+  while (!mu_.AwaitWithTimeout(absl::Condition(&stopping_), interval_)) {
+    TakeSample();
+  }
+}
+
+void WorkerStats::TakeSample() {
+  int64_t started = started_.load(std::memory_order_relaxed);
+  int64_t exited = exited_.load(std::memory_order_relaxed);
+  int64_t busy = std::max<int64_t>(busy_.load(std::memory_order_relaxed), 0);
+  live_.Add(started - exited);
+  busy_sample_.Add(busy);
+
+  if (!waiting_fd_.has_value() || waiting_error_.has_value()) return;
+  char buf[32];
+  absl::StatusOr<size_t> nb =
+    syscalls::pread(**waiting_fd_, buf, sizeof(buf), 0);
+  int64_t waiting;
+  if (!nb.ok()) {
+    // The connection is gone, e.g. after an unmount; it won't come back.
+    waiting_error_ = std::string(nb.status().message());
+    return;
+  }
+  if (!absl::SimpleAtoi(std::string_view(buf, *nb), &waiting)) {
+    waiting_error_ = "Unparseable waiting count";
+    return;
+  }
+  waiting_.Add(waiting);
+  queued_.Add(std::max<int64_t>(waiting - busy, 0));
+}
+
+std::string WorkerStats::Format() const {
+  int64_t started = started_.load(std::memory_order_relaxed);
+  int64_t exited = exited_.load(std::memory_order_relaxed);
+  int64_t busy = std::max<int64_t>(busy_.load(std::memory_order_relaxed), 0);
+  int64_t live = started - exited;
+
+  std::string out = absl::StrFormat(
+      "threads: %d live, %d busy, %d idle, %d peak busy\n"
+      "churn: %d started, %d exited\n",
+      live, busy, std::max<int64_t>(live - busy, 0),
+      peak_busy_.load(std::memory_order_relaxed), started, exited);
+
+  if (uint64_t dispatched = dispatched_.load(std::memory_order_relaxed);
+      dispatched != 0) {
+    absl::StrAppendFormat(
+        &out, "dispatch: %d requests, %.1f us mean, %.1f us max\n", dispatched,
+        static_cast<double>(
+          dispatch_total_ns_.load(std::memory_order_relaxed)) / 1000 /
+        static_cast<double>(dispatched),
+        static_cast<double>(
+          dispatch_max_ns_.load(std::memory_order_relaxed)) / 1000);
+  }
+
+  absl::MutexLock lock(&mu_);
+  absl::StrAppendFormat(
+      &out, "\nsampled every %s:\n%-8s %8s %8s %8s\n",
+      absl::FormatDuration(interval_), "", "last", "mean", "max");
+  const auto row = [&out](const char *name, const Sample &s) {
+    double mean = s.count == 0 ? 0 : static_cast<double>(s.total) / s.count;
+    absl::StrAppendFormat(
+        &out, "%-8s %8d %8.1f %8d\n", name, s.last, mean, s.max);
+  };
+  row("live", live_);
+  row("busy", busy_sample_);
+  if (waiting_fd_.has_value()) {
+    row("waiting", waiting_);
+    row("queued", queued_);
+  }
+  if (waiting_error_.has_value()) {
+    absl::StrAppend(&out, "waiting: ", *waiting_error_, "\n");
+  }
+  return out;
+}
+
+}  // namespace pafs
@@ -0,0 +1,108 @@
+#ifndef PAFS_WORKER_STATS_H_
+#define PAFS_WORKER_STATS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "pafs/cstring_view.h"
+#include "pafs/fd.h"
+
+namespace pafs {
+
+// Watches the threads the session loop runs requests on: how many there are,
+// how many are busy with a request, and how often libfuse starts and stops
+// them. A dedicated thread samples these, along with the kernel's count of
+// requests waiting on the connection, so that a report can tell whether we're
+// short of threads (requests queue in the kernel while every thread is busy),
+// bound on the source (threads are busy but use little CPU) or neither.
+//
+// Only one WorkerStats may exist at a time.
+class WorkerStats {
+ public:
+  struct Options {
+    // The connection's "waiting" file, from FindWaitingFile. If unset, or it
+    // can't be opened, the kernel's queue isn't sampled.
+    std::optional<std::string> waiting_file;
+    absl::Duration sample_interval = absl::Seconds(1);
+  };
+
+  static std::unique_ptr<WorkerStats> Create(Options opts);
+  ~WorkerStats();
+
+  WorkerStats(WorkerStats &&) = delete;
+  WorkerStats(const WorkerStats &) = delete;
+  WorkerStats &operator=(WorkerStats &&) = delete;
+  WorkerStats &operator=(const WorkerStats &) = delete;
+
+  // The file under /sys/fs/fuse/connections that counts the requests of the
+  // FUSE filesystem mounted at `mountpoint`, found through
+  // /proc/self/mountinfo. Needs no request to the filesystem, so it can be
+  // called before the session loop runs.
+  static absl::StatusOr<std::string> FindWaitingFile(CStringView mountpoint);
+
+  // Called by FuseRequest as the calling thread starts and stops handling a
+  // request. Do nothing unless a WorkerStats exists.
+  static void BeginRequest();
+  static void EndRequest();
+  // Called by a session loop that reads /dev/fuse itself, like
+  // RunWorkerLoop, once it has read a request. The time from then until
+  // BeginRequest is recorded as the request's dispatch delay.
+  static void Received();
+
+  // For ControlRegistry.
+  std::string Format() const;
+
+ private:
+  struct Sample {
+    uint64_t count = 0;
+    int64_t last = 0;
+    int64_t max = 0;
+    int64_t total = 0;
+
+    void Add(int64_t value);
+  };
+
+  WorkerStats(std::optional<FileDescriptor> waiting_fd, absl::Duration interval);
+
+  void Run();
+  void TakeSample();
+
+  // Counts its thread as started on its first request, and as exited when
+  // the thread does.
+  struct WorkerThread;
+  static thread_local WorkerThread worker_thread_;
+
+  std::atomic<uint64_t> started_ = 0;
+  std::atomic<uint64_t> exited_ = 0;
+  std::atomic<int64_t> busy_ = 0;
+  std::atomic<int64_t> peak_busy_ = 0;
+  std::atomic<uint64_t> dispatched_ = 0;
+  std::atomic<uint64_t> dispatch_total_ns_ = 0;
+  std::atomic<uint64_t> dispatch_max_ns_ = 0;
+
+  const std::optional<FileDescriptor> waiting_fd_;
+  const absl::Duration interval_;
+
+  mutable absl::Mutex mu_;
+  bool stopping_ ABSL_GUARDED_BY(mu_) = false;
+  Sample live_ ABSL_GUARDED_BY(mu_);
+  Sample busy_sample_ ABSL_GUARDED_BY(mu_);
+  Sample waiting_ ABSL_GUARDED_BY(mu_);
+  // Requests the kernel has that no thread is working on: waiting less busy.
+  Sample queued_ ABSL_GUARDED_BY(mu_);
+  std::optional<std::string> waiting_error_ ABSL_GUARDED_BY(mu_);
+
+  std::thread thread_;
+};
+
+}  // namespace pafs
+
+#endif  // PAFS_WORKER_STATS_H_
@@ -0,0 +1,378 @@
+// Workload mixes run against a tmpfs directory directly, and again through
+// pafs mounted over it, reporting how many times slower each is through pafs.
+//
+// Mounting needs /dev/fuse, and either root or fusermount3.
+//
+// bazel run -c opt //pafs:workload_benchmark
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "benchmark/benchmark.h"
+#include "fuse/fuse_lowlevel.h"
+#include "pafs/benchmark_util.h"
+#include "pafs/cstring_view.h"
+#include "pafs/fd.h"
+#include "pafs/fuse.h"
+#include "pafs/fuse_ops.h"
+#include "pafs/page_align_fs.h"
+#include "pafs/status.h"
+#include "pafs/syscalls.h"
+
+namespace pafs {
+namespace {
+
+constexpr size_t kLargeFileSize = 64 << 20;
+constexpr size_t kLargeIOSize = 1 << 20;
+constexpr size_t kSmallIOSize = 4096;
+constexpr int kSmallFiles = 1024;
+constexpr int kTreeDepth = 16;
+
+// PageAlignFS mounted over a directory, serving requests on its own threads
+// until destroyed.
+struct MountedFS {
+  static absl::StatusOr<std::unique_ptr<MountedFS>> Create(
+      const std::string &path) {
+    auto m = std::unique_ptr<MountedFS>(new MountedFS{
+        .fs = PageAlignFS::Create(path, {}),
+    });
+    RETURN_IF_ERROR(m->fs.status());
+
+    char arg0[] = "workload_benchmark";
+    char *argv[] = {arg0, nullptr};
+    struct fuse_args args = FUSE_ARGS_INIT(1, argv);
+    struct fuse_lowlevel_ops ops = AsFuseLowLevelOps<PageAlignFS>();
+    m->session = fuse_session_new(&args, &ops, sizeof(ops), &*m->fs);
+    fuse_opt_free_args(&args);
+    if (m->session == nullptr) {
+      return absl::InternalError("fuse_session_new failed");
+    }
+    m->fs->SetSession(m->session);
+    if (fuse_session_mount(m->session, path.c_str()) != 0) {
+      return absl::InternalError(absl::StrCat("Mounting ", path, " failed"));
+    }
+    m->mounted = true;
+
+    m->loop = std::thread([session = m->session]() {
+      struct fuse_loop_config *config = fuse_loop_cfg_create();
+      fuse_session_loop_mt(session, config);
+      fuse_loop_cfg_destroy(config);
+    });
+    return m;
+  }
+
+  ~MountedFS() {
+    // Unmounting fails the loop's reads of /dev/fuse, ending it.
+    if (mounted) {
+      fuse_session_exit(session);
+      fuse_session_unmount(session);
+    }
+    if (loop.joinable()) loop.join();
+    if (session != nullptr) fuse_session_destroy(session);
+  }
+
+  absl::StatusOr<PageAlignFS> fs;
+  struct fuse_session *session = nullptr;
+  bool mounted = false;
+  std::thread loop;
+};
+
+// Makes `path` a regular file of `size` bytes, unless it already is one.
+absl::Status EnsureFile(int dirfd, CStringView path, size_t size) {
+  ASSIGN_OR_RETURN(
+      FileDescriptor fd,
+      syscalls::openat(dirfd, path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+  ASSIGN_OR_RETURN(
+      struct stat st, syscalls::fstatat(*fd, "", AT_EMPTY_PATH));
+  if (static_cast<size_t>(st.st_size) == size) return absl::OkStatus();
+  RETURN_IF_ERROR(syscalls::ftruncate(*fd, 0));
+  std::string buf(kLargeIOSize, 'x');
+  for (size_t off = 0; off < size; off += buf.size()) {
+    RETURN_IF_ERROR(syscalls::write(
+          *fd, buf.data(), std::min(buf.size(), size - off)).status());
+  }
+  return absl::OkStatus();
+}
+
+absl::Status EnsureDir(int dirfd, CStringView path) {
+  Errno err = syscalls::mkdirat(dirfd, path, 0755);
+  if (!err.ok() && err.value() != EEXIST) return err.ToStatus();
+  return absl::OkStatus();
+}
+
+// Each mix sets up what it needs under `dirfd` first, the same files whether
+// `dirfd` is the source or the mount, so only the first run pays for it.
+
+// Creating, stat-ing and removing a file, as a build or untar does.
+void CreateStatUnlink(benchmark::State &state, int dirfd) {
+  for (auto _ : state) {
+    ErrnoOr<FileDescriptor> fd = syscalls::openat(
+        dirfd, "storm", O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (!fd.ok()) {
+      state.SkipWithError("Creating the file failed");
+      break;
+    }
+    benchmark::DoNotOptimize(syscalls::close(*std::move(fd)));
+    benchmark::DoNotOptimize(syscalls::fstatat(dirfd, "storm"));
+    benchmark::DoNotOptimize(syscalls::unlinkat(dirfd, "storm"));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Stat-ing a file kTreeDepth directories down, a lookup per component.
+void DeepLookup(benchmark::State &state, int dirfd) {
+  std::string path = "deep";
+  if (!EnsureDir(dirfd, path).ok()) {
+    state.SkipWithError("Creating the tree failed");
+    return;
+  }
+  for (int i = 0; i < kTreeDepth; i++) {
+    absl::StrAppend(&path, "/d");
+    if (!EnsureDir(dirfd, path).ok()) {
+      state.SkipWithError("Creating the tree failed");
+      return;
+    }
+  }
+  absl::StrAppend(&path, "/f");
+  if (!EnsureFile(dirfd, path, 0).ok()) {
+    state.SkipWithError("Creating the file failed");
+    return;
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(syscalls::fstatat(dirfd, path.c_str()));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Writing a kLargeFileSize file from scratch in kLargeIOSize writes.
+void SequentialWrite(benchmark::State &state, int dirfd) {
+  std::string buf(kLargeIOSize, 'x');
+  for (auto _ : state) {
+    ErrnoOr<FileDescriptor> fd = syscalls::openat(
+        dirfd, "sequential-write", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+        0644);
+    if (!fd.ok()) {
+      state.SkipWithError("Opening the file failed");
+      break;
+    }
+    for (size_t off = 0; off < kLargeFileSize; off += buf.size()) {
+      benchmark::DoNotOptimize(syscalls::write(**fd, buf.data(), buf.size()));
+    }
+    benchmark::DoNotOptimize(syscalls::close(*std::move(fd)));
+  }
+  state.SetBytesProcessed(state.iterations() * kLargeFileSize);
+}
+
+// Reading a kLargeFileSize file through in kLargeIOSize reads.
+void SequentialRead(benchmark::State &state, int dirfd) {
+  if (!EnsureFile(dirfd, "sequential-read", kLargeFileSize).ok()) {
+    state.SkipWithError("Creating the file failed");
+    return;
+  }
+  std::string buf(kLargeIOSize, '\0');
+  for (auto _ : state) {
+    ErrnoOr<FileDescriptor> fd = syscalls::openat(
+        dirfd, "sequential-read", O_RDONLY | O_CLOEXEC);
+    if (!fd.ok()) {
+      state.SkipWithError("Opening the file failed");
+      break;
+    }
+    while (true) {
+      absl::StatusOr<size_t> nb =
+        syscalls::read(**fd, buf.data(), buf.size());
+      if (!nb.ok() || *nb == 0) break;
+    }
+    benchmark::DoNotOptimize(syscalls::close(*std::move(fd)));
+  }
+  state.SetBytesProcessed(state.iterations() * kLargeFileSize);
+}
+
+// kSmallIOSize reads or writes at random aligned offsets of an open
+// kLargeFileSize file, as a database does.
+template <bool kWrite>
+void RandomIO(benchmark::State &state, int dirfd) {
+  if (!EnsureFile(dirfd, "random", kLargeFileSize).ok()) {
+    state.SkipWithError("Creating the file failed");
+    return;
+  }
+  ErrnoOr<FileDescriptor> fd =
+    syscalls::openat(dirfd, "random", O_RDWR | O_CLOEXEC);
+  if (!fd.ok()) {
+    state.SkipWithError("Opening the file failed");
+    return;
+  }
+  // Seeded the same for both targets, so they see the same offsets.
+  std::mt19937_64 rng(0);
+  std::uniform_int_distribution<size_t> block(
+      0, kLargeFileSize / kSmallIOSize - 1);
+  std::string buf(kSmallIOSize, 'x');
+  for (auto _ : state) {
+    off_t off = block(rng) * kSmallIOSize;
+    if constexpr (kWrite) {
+      benchmark::DoNotOptimize(
+          syscalls::pwrite(**fd, buf.data(), buf.size(), off));
+    } else {
+      benchmark::DoNotOptimize(
+          syscalls::pread(**fd, buf.data(), buf.size(), off));
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * kSmallIOSize);
+}
+
+// Opening, reading and closing each of kSmallFiles small files in turn, as a
+// compiler reading headers does.
+void SmallFileRead(benchmark::State &state, int dirfd) {
+  std::vector<std::string> paths;
+  if (!EnsureDir(dirfd, "small").ok()) {
+    state.SkipWithError("Creating the directory failed");
+    return;
+  }
+  for (int i = 0; i < kSmallFiles; i++) {
+    paths.push_back(absl::StrCat("small/", i));
+    if (!EnsureFile(dirfd, paths.back(), kSmallIOSize).ok()) {
+      state.SkipWithError("Creating the files failed");
+      return;
+    }
+  }
+  std::string buf(kSmallIOSize, '\0');
+  size_t next = 0;
+  for (auto _ : state) {
+    ErrnoOr<FileDescriptor> fd = syscalls::openat(
+        dirfd, paths[next], O_RDONLY | O_CLOEXEC);
+    next = (next + 1) % paths.size();
+    if (!fd.ok()) {
+      state.SkipWithError("Opening the file failed");
+      break;
+    }
+    benchmark::DoNotOptimize(syscalls::read(**fd, buf.data(), buf.size()));
+    benchmark::DoNotOptimize(syscalls::close(*std::move(fd)));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+struct Mix {
+  const char *name;
+  void (*run)(benchmark::State &, int dirfd);
+};
+
+constexpr Mix kMixes[] = {
+  {"CreateStatUnlink", &CreateStatUnlink},
+  {"DeepLookup", &DeepLookup},
+  {"SequentialWrite", &SequentialWrite},
+  {"SequentialRead", &SequentialRead},
+  {"RandomRead4K", &RandomIO</*kWrite=*/false>},
+  {"RandomWrite4K", &RandomIO</*kWrite=*/true>},
+  {"SmallFileRead", &SmallFileRead},
+};
+
+// The usual console output, followed by each mix's time through pafs over
+// its time against the source.
+class OverheadReporter : public benchmark::ConsoleReporter {
+ public:
+  void ReportRuns(const std::vector<Run> &runs) override {
+    ConsoleReporter::ReportRuns(runs);
+    for (const Run &run : runs) {
+      if (run.run_type != Run::RT_Iteration || run.skipped) continue;
+      // Named <mix>/raw or <mix>/pafs.
+      std::string name = run.benchmark_name();
+      size_t slash = name.rfind('/');
+      if (slash == std::string::npos) continue;
+      Times &times = times_[name.substr(0, slash)];
+      if (name.substr(slash + 1) == "pafs") {
+        times.pafs += run.GetAdjustedRealTime();
+        times.pafs_runs++;
+      } else {
+        times.raw += run.GetAdjustedRealTime();
+        times.raw_runs++;
+      }
+    }
+  }
+
+  void Finalize() override {
+    ConsoleReporter::Finalize();
+    std::ostream &out = GetOutputStream();
+    out << "\n" << absl::StrFormat("%-20s %10s\n", "Mix", "Overhead");
+    for (const Mix &mix : kMixes) {
+      auto it = times_.find(mix.name);
+      if (it == times_.end()) continue;
+      const Times &times = it->second;
+      if (times.raw_runs == 0 || times.pafs_runs == 0) continue;
+      double ratio = (times.pafs / times.pafs_runs) /
+        (times.raw / times.raw_runs);
+      out << absl::StrFormat("%-20s %9.2fx\n", mix.name, ratio);
+    }
+  }
+
+ private:
+  struct Times {
+    double raw = 0;
+    double pafs = 0;
+    int raw_runs = 0;
+    int pafs_runs = 0;
+  };
+  std::map<std::string, Times> times_;
+};
+
+absl::StatusOr<int> Main(int argc, char *argv[]) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return EXIT_FAILURE;
+
+  ASSIGN_OR_RETURN(ScratchDir dir, ScratchDir::Create());
+  std::string path(dir.Path());
+  // Opened before the mount covers it, so still the source.
+  int raw_fd = dir.GetFD();
+  ASSIGN_OR_RETURN(std::unique_ptr<MountedFS> mounted, MountedFS::Create(path));
+  ASSIGN_OR_RETURN(
+      FileDescriptor pafs_fd,
+      syscalls::open(path, O_PATH | O_DIRECTORY | O_CLOEXEC));
+
+  // The work happens on the mount's threads, so only real time counts.
+  for (const Mix &mix : kMixes) {
+    benchmark::RegisterBenchmark(
+        absl::StrCat(mix.name, "/raw").c_str(),
+        [&mix, raw_fd](benchmark::State &state) { mix.run(state, raw_fd); })
+      ->UseRealTime();
+    benchmark::RegisterBenchmark(
+        absl::StrCat(mix.name, "/pafs").c_str(),
+        [&mix, fd = *pafs_fd](benchmark::State &state) { mix.run(state, fd); })
+      ->UseRealTime();
+  }
+
+  OverheadReporter reporter;
+  benchmark::RunSpecifiedBenchmarks(&reporter);
+  benchmark::Shutdown();
+
+  // Closed before unmounting, which fails while the mount is in use.
+  RETURN_IF_ERROR(syscalls::close(std::move(pafs_fd)));
+  mounted.reset();
+  return EXIT_SUCCESS;
+}
+
+}  // namespace
+}  // namespace pafs
+
+int main(int argc, char *argv[]) {
+  absl::StatusOr<int> ret = pafs::Main(argc, argv);
+  if (!ret.ok()) {
+    std::cerr << ret.status() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return *ret;
+}